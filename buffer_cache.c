@@ -0,0 +1,215 @@
+/**
+ * @file buffer_cache.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief The files open in the full editor
+ * Each keeps its contents, line offsets and render caches so switching between them doesn't reread anything,
+ * the least recently used are unloaded once they take up more than the memory budget
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#include "buffer_cache.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Gets the memory budget, CWORD_BUFFER_MB if set
+ *
+ * @return size_t The budget in bytes
+ */
+size_t bufferCacheBudget(){
+    char *setting = getenv(BUFFER_CACHE_BUDGET_VARIABLE);
+    long megabytes = setting != NULL ? strtol(setting, NULL, 10) : 0;
+    if (megabytes <= 0) megabytes = BUFFER_CACHE_DEFAULT_BUDGET_MB;
+    return (size_t)megabytes * 1024 * 1024;
+}
+
+/**
+ * @brief Empties the cache
+ *
+ * @param cache The cache to setup
+ * @param budget Bytes the buffers may use, the active buffer is kept whatever its size
+ */
+void initBufferCache(struct BufferCache *cache, size_t budget){
+    memset(cache, 0, sizeof(*cache));
+    cache->budget = budget;
+}
+
+/**
+ * @brief Frees the contents of a buffer, keeping where the user was in it
+ *
+ * @param buffer The buffer
+ */
+static void unloadBuffer(struct EditorBuffer *buffer){
+    if (buffer->loaded == 0) return;
+    buffer->language = buffer->syntax.language;
+    closeDocument(&buffer->document);
+    freeLineWidthCache(&buffer->widthCache);
+    freeSyntaxCache(&buffer->syntax);
+    buffer->loaded = 0;
+}
+
+/**
+ * @brief Reads a buffers file back in
+ *
+ * @param buffer The buffer
+ * @return int 1 if ok, 0 if the file couldn't be read
+ */
+static int loadBuffer(struct EditorBuffer *buffer){
+    if (buffer->loaded) return 1;
+    if (openDocument(&buffer->document, buffer->fileName) == 0) return 0;
+    initLineWidthCache(&buffer->widthCache);
+    initSyntaxCache(&buffer->syntax, buffer->language);
+    buffer->loaded = 1;
+    return 1;
+}
+
+/**
+ * @brief Frees every buffer
+ *
+ * @param cache The cache
+ */
+void freeBufferCache(struct BufferCache *cache){
+    while (cache->count > 0) closeBuffer(cache, cache->count - 1);
+}
+
+/**
+ * @brief Opens a file in a new buffer, or switches to it if it is already open
+ *
+ * @param cache The cache
+ * @param fileName The file
+ * @return int The buffers index, -1 if the file couldn't be read or too many are open
+ */
+int openBuffer(struct BufferCache *cache, char *fileName){
+    size_t i;
+    for (i = 0; i < cache->count; i++){
+        if (strcmp(cache->buffers[i]->fileName, fileName) == 0) return switchBuffer(cache, i) ? (int)i : -1;
+    }
+    if (cache->count == BUFFER_CACHE_MAX_BUFFERS) return -1;
+
+    struct EditorBuffer *buffer = calloc(1, sizeof(struct EditorBuffer));
+    buffer->fileName = strdup(fileName);
+    buffer->lineNumber = 1;
+    buffer->language = syntaxLanguageForFile(fileName);
+    if (loadBuffer(buffer) == 0){
+        free(buffer->fileName);
+        free(buffer);
+        return -1;
+    }
+
+    cache->buffers[cache->count] = buffer;
+    cache->active = cache->count++;
+    buffer->lastUsed = ++cache->clock;
+    enforceBufferBudget(cache);
+    return cache->active;
+}
+
+/**
+ * @brief Makes a buffer the active one, rereading its file if it was unloaded
+ *
+ * @param cache The cache
+ * @param index The buffer
+ * @return int 1 if ok, 0 if its file couldn't be read (the active buffer stays as it was)
+ */
+int switchBuffer(struct BufferCache *cache, size_t index){
+    if (index >= cache->count) return 0;
+    struct EditorBuffer *buffer = cache->buffers[index];
+    if (loadBuffer(buffer) == 0) return 0;
+
+    cache->active = index;
+    buffer->lastUsed = ++cache->clock;
+    enforceBufferBudget(cache);
+    return 1;
+}
+
+/**
+ * @brief Closes a buffer, the one before it becomes active if it was.
+ * Call switchBuffer on the new active buffer as it may be unloaded
+ *
+ * @param cache The cache
+ * @param index The buffer
+ */
+void closeBuffer(struct BufferCache *cache, size_t index){
+    if (index >= cache->count) return;
+    struct EditorBuffer *buffer = cache->buffers[index];
+    unloadBuffer(buffer);
+    free(buffer->fileName);
+    free(buffer);
+
+    memmove(&cache->buffers[index], &cache->buffers[index + 1], (cache->count - index - 1) * sizeof(struct EditorBuffer *));
+    cache->count--;
+    if (cache->active > index || (cache->active == index && index > 0)) cache->active--;
+}
+
+/**
+ * @brief Gets the buffer being edited
+ *
+ * @param cache The cache
+ * @return struct EditorBuffer* The buffer, NULL if none are open
+ */
+struct EditorBuffer * activeBuffer(struct BufferCache *cache){
+    return cache->count > 0 ? cache->buffers[cache->active] : NULL;
+}
+
+/**
+ * @brief Works out roughly how much memory a buffer holds on its own,
+ * its lines live in the shared line store
+ *
+ * @param buffer The buffer
+ * @return size_t Bytes
+ */
+size_t bufferMemory(struct EditorBuffer *buffer){
+    size_t total = sizeof(struct EditorBuffer);
+    if (buffer->loaded == 0) return total;
+
+    total += buffer->document.lineCapacity * sizeof(uint32_t);
+    if (buffer->document.windowCount > 0) total += buffer->document.windowStarts[buffer->document.windowCount] + (DOCUMENT_WINDOW_LINES + 1) * sizeof(size_t);
+    total += buffer->syntax.capacity;
+    size_t i;
+    for (i = 0; i < LINE_WIDTH_CACHE_SIZE; i++){
+        total += buffer->widthCache.entries[i].checkpointCount * 2 * sizeof(size_t);
+    }
+    for (i = 0; i < SYNTAX_LINE_CACHE_SIZE; i++){
+        if (buffer->syntax.lines[i].classes != NULL) total += buffer->syntax.lines[i].length;
+    }
+    return total;
+}
+
+/**
+ * @brief Works out roughly how much memory every buffer holds, including the lines they share
+ *
+ * @param cache The cache
+ * @return size_t Bytes
+ */
+size_t bufferCacheMemory(struct BufferCache *cache){
+    size_t total = lineStoreMemory(sharedLineStore()), i;
+    for (i = 0; i < cache->count; i++) total += bufferMemory(cache->buffers[i]);
+    return total;
+}
+
+/**
+ * @brief Unloads the least recently used buffers until the rest fit the budget
+ *
+ * @param cache The cache
+ */
+void enforceBufferBudget(struct BufferCache *cache){
+    size_t total = bufferCacheMemory(cache);
+    while (total > cache->budget){
+        struct EditorBuffer *oldest = NULL;
+        size_t i;
+        for (i = 0; i < cache->count; i++){
+            struct EditorBuffer *buffer = cache->buffers[i];
+            if (i == cache->active || buffer->loaded == 0) continue;
+            if (oldest == NULL || buffer->lastUsed < oldest->lastUsed) oldest = buffer;
+        }
+        if (oldest == NULL) break;
+
+        // Only lines no other buffer uses are freed, so everything is measured again
+        unloadBuffer(oldest);
+        total = bufferCacheMemory(cache);
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef BUFFER_CACHE_H
+#define BUFFER_CACHE_H
+
+#include "document.h"
+#include "line_view.h"
+#include "syntax.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Memory the files open in the editor may use before the least recently used are unloaded
+#define BUFFER_CACHE_DEFAULT_BUDGET_MB 64
+// Set to a number of MB to change the budget
+#define BUFFER_CACHE_BUDGET_VARIABLE "CWORD_BUFFER_MB"
+#define BUFFER_CACHE_MAX_BUFFERS 16
+
+// A file open in the editor. Edits are saved straight away so a buffer is never dirty
+// and can always be unloaded, only its place in the file and highlighting choice are kept
+struct EditorBuffer
+{
+    char *fileName;
+    int loaded;                         // 0 once unloaded, the file is reread when switched back to
+    uint64_t lastUsed;
+    int lineNumber;
+    size_t leftColumn;
+    struct SyntaxLanguage *language;    // May have been changed with CTRL + T
+    struct Document document;
+    struct LineWidthCache widthCache;
+    struct SyntaxCache syntax;
+};
+
+struct BufferCache
+{
+    struct EditorBuffer *buffers[BUFFER_CACHE_MAX_BUFFERS];
+    size_t count;
+    size_t active;
+    size_t budget;                      // Bytes
+    uint64_t clock;
+};
+
+size_t bufferCacheBudget();
+void initBufferCache(struct BufferCache *cache, size_t budget);
+void freeBufferCache(struct BufferCache *cache);
+
+int openBuffer(struct BufferCache *cache, char *fileName);
+int switchBuffer(struct BufferCache *cache, size_t index);
+void closeBuffer(struct BufferCache *cache, size_t index);
+struct EditorBuffer * activeBuffer(struct BufferCache *cache);
+
+size_t bufferMemory(struct EditorBuffer *buffer);
+size_t bufferCacheMemory(struct BufferCache *cache);
+void enforceBufferBudget(struct BufferCache *cache);
+
+#endif
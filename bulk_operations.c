@@ -0,0 +1,499 @@
+/**
+ * @file bulk_operations.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Copy, delete and restore every file matching a glob at once
+ * The file I/O runs on a bounded pool of threads, only the changelog records are written one at a time
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "bulk_operations.h"
+#include "change_log.h"
+#include "change_log_index.h"
+#include "compression.h"
+#include "file_operations.h"
+#include "interface.h"
+#include "utils.h"
+#include "version_control.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <glob.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+struct ThreadPoolWork
+{
+    pthread_mutex_t lock;
+    size_t next;
+    size_t count;
+    void (*work)(void *context, size_t job);
+    void *context;
+};
+
+// Shared by the workers of one bulk operation
+struct BulkJobs
+{
+    char **sources;
+    char **destinations;    // Only used by copy
+    char **hashes;          // Only used by restore
+    int *succeeded;
+};
+
+/**
+ * @brief Takes jobs until there are none left
+ *
+ * @param arg The ThreadPoolWork
+ * @return void* Always NULL
+ */
+static void *threadPoolWorker(void *arg){
+    struct ThreadPoolWork *pool = arg;
+    while (1 == 1){
+        pthread_mutex_lock(&pool->lock);
+        size_t job = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        if (job >= pool->count) return NULL;
+        uint64_t trace = TRACE_BEGIN();
+        pool->work(pool->context, job);
+        TRACE_END("bulkJob", trace, 0);
+    }
+}
+
+/**
+ * @brief Runs work for every job on a bounded pool of threads, returning once all are done
+ *
+ * @param jobCount How many jobs
+ * @param work Called once per job, from any thread
+ * @param context Passed to work
+ */
+void runInThreadPool(size_t jobCount, void (*work)(void *context, size_t job), void *context){
+    struct ThreadPoolWork pool;
+    pthread_mutex_init(&pool.lock, NULL);
+    pool.next = 0;
+    pool.count = jobCount;
+    pool.work = work;
+    pool.context = context;
+
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t threadCount = processors > 0 ? (size_t)processors * 2 : 4;
+    if (threadCount > BULK_MAX_THREADS) threadCount = BULK_MAX_THREADS;
+    if (threadCount > jobCount) threadCount = jobCount;
+
+    pthread_t threads[BULK_MAX_THREADS];
+    size_t started = 0;
+    for (; started < threadCount; started++){
+        if (pthread_create(&threads[started], NULL, threadPoolWorker, &pool) != 0) break;
+    }
+    // Always make progress, even if no thread could be started
+    if (started == 0) threadPoolWorker(&pool);
+
+    size_t i;
+    for (i = 0; i < started; i++) pthread_join(threads[i], NULL);
+    pthread_mutex_destroy(&pool.lock);
+}
+
+/**
+ * @brief Copies a file letting the kernel move the data, falling back to read/write
+ * Never overwrites an existing file
+ *
+ * @param source The file to copy
+ * @param destination The copy to create
+ * @return int 1 if ok, 0 if not
+ */
+int fastCopyFile(char *source, char *destination){
+    int in = open(source, O_RDONLY);
+    if (in == -1) return 0;
+    struct stat info;
+    if (fstat(in, &info) != 0 || !S_ISREG(info.st_mode)){
+        close(in);
+        return 0;
+    }
+    int out = open(destination, O_WRONLY | O_CREAT | O_EXCL, info.st_mode & 0777);
+    if (out == -1){
+        close(in);
+        return 0;
+    }
+
+    int ok = 1;
+    off_t remaining = info.st_size;
+    while (remaining > 0){
+        ssize_t copied = copy_file_range(in, NULL, out, NULL, remaining, 0);
+        if (copied <= 0) break;
+        remaining -= copied;
+    }
+
+    // Not supported between these files, copy what is left ourselves
+    if (remaining > 0){
+        char buffer[64 * 1024];
+        ssize_t read;
+        while ((read = pread(in, buffer, sizeof(buffer), info.st_size - remaining)) > 0){
+            if (write(out, buffer, read) != read){
+                ok = 0;
+                break;
+            }
+            remaining -= read;
+        }
+        if (read == -1) ok = 0;
+    }
+
+    close(in);
+    if (close(out) != 0) ok = 0;
+    if (ok == 0) remove(destination);
+    return ok;
+}
+
+/**
+ * @brief Creates a files history folder along with any parent folders it needs
+ *
+ * @param fileName The tracked file, may include directories
+ */
+static void ensureHistoryDir(char *fileName){
+    char *location = concat(".cword/", fileName);
+    char *slash;
+    for (slash = strchr(location + strlen(".cword/"), '/'); slash != NULL; slash = strchr(slash + 1, '/')){
+        *slash = '\0';
+        mkdir(location, 0770);
+        *slash = '/';
+    }
+    mkdir(location, 0770);
+    free(location);
+}
+
+/**
+ * @brief Expands a glob into the regular files it matches
+ *
+ * @param pattern The glob
+ * @param files Set to the matches, make sure to free each and the array after use!
+ * @return size_t The number of matches
+ */
+static size_t matchFiles(char *pattern, char ***files){
+    glob_t matches;
+    *files = NULL;
+    if (glob(pattern, 0, NULL, &matches) != 0) return 0;
+
+    size_t count = 0, i;
+    *files = malloc((matches.gl_pathc + 1) * sizeof(char *));
+    for (i = 0; i < matches.gl_pathc; i++){
+        char *path = matches.gl_pathv[i];
+        struct stat info;
+        // Never touch CWords own history
+        if (strncmp(path, ".cword", 6) == 0 || strncmp(path, "./.cword", 8) == 0) continue;
+        if (stat(path, &info) != 0 || !S_ISREG(info.st_mode)) continue;
+        (*files)[count++] = strdup(path);
+    }
+    globfree(&matches);
+    return count;
+}
+
+/**
+ * @brief Finds tracked files whose newest record is DELETED and match a glob
+ *
+ * @param pattern The glob
+ * @param files Set to the matches, make sure to free each and the array after use!
+ * @return size_t The number of matches
+ */
+static size_t matchDeletedFiles(char *pattern, char ***files){
+    char **tracked;
+    size_t trackedCount = listTrackedFiles(&tracked);
+    size_t count = 0, i;
+    *files = malloc((trackedCount + 1) * sizeof(char *));
+
+    for (i = 0; i < trackedCount; i++){
+        char *fileName = tracked[i];
+        if (fileExists(fileName) == 0 && fnmatch(pattern, fileName, FNM_PATHNAME) == 0){
+            char *last = lastChangeLogRecord(fileName);
+            if (last != NULL && strstr(last, "||DELETED||") != NULL){
+                (*files)[count++] = fileName;
+                fileName = NULL;
+            }
+            free(last);
+        }
+        free(fileName);
+    }
+    free(tracked);
+    return count;
+}
+
+/**
+ * @brief Gets the time since start in seconds
+ *
+ * @param start When the operation started
+ * @return double The seconds passed
+ */
+static double secondsSince(struct timespec *start){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Fills in the counts of a finished bulk operation
+ *
+ * @param jobs The jobs
+ * @param count How many jobs
+ * @param start When the operation started
+ * @param result The result to fill, may be NULL
+ */
+static void finishBulk(struct BulkJobs *jobs, size_t count, struct timespec *start, struct BulkResult *result){
+    struct BulkResult stats;
+    memset(&stats, 0, sizeof(stats));
+    stats.matched = count;
+
+    size_t i;
+    for (i = 0; i < count; i++){
+        if (jobs->succeeded[i]){
+            stats.done++;
+        } else {
+            stats.failed++;
+        }
+        free(jobs->sources[i]);
+        if (jobs->destinations != NULL) free(jobs->destinations[i]);
+        if (jobs->hashes != NULL) free(jobs->hashes[i]);
+    }
+    free(jobs->sources);
+    free(jobs->destinations);
+    free(jobs->hashes);
+    free(jobs->succeeded);
+
+    stats.seconds = secondsSince(start);
+    if (result != NULL) *result = stats;
+}
+
+/**
+ * @brief Copies one file and shares its history with the copy
+ *
+ * @param context The BulkJobs
+ * @param job The file
+ */
+static void copyJob(void *context, size_t job){
+    struct BulkJobs *jobs = context;
+    if (fastCopyFile(jobs->sources[job], jobs->destinations[job]) == 0) return;
+    ensureHistoryDir(jobs->destinations[job]);
+    copyChangeLog(jobs->sources[job], jobs->destinations[job]);
+    jobs->succeeded[job] = 1;
+}
+
+/**
+ * @brief Copies every file matching a glob into a folder, existing files are never overwritten
+ *
+ * @param pattern The glob
+ * @param destinationDir The folder to copy to, created if needed
+ * @param result Filled with what happened, may be NULL
+ * @return int 1 if ok, 0 if the folder couldn't be used
+ */
+int bulkCopyFiles(char *pattern, char *destinationDir, struct BulkResult *result){
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    mkdir(destinationDir, 0775);
+    struct stat info;
+    if (stat(destinationDir, &info) != 0 || !S_ISDIR(info.st_mode)) return 0;
+
+    struct BulkJobs jobs;
+    memset(&jobs, 0, sizeof(jobs));
+    size_t count = matchFiles(pattern, &jobs.sources);
+    jobs.destinations = malloc((count + 1) * sizeof(char *));
+    jobs.succeeded = calloc(count + 1, sizeof(int));
+
+    size_t i;
+    for (i = 0; i < count; i++){
+        char *name = strrchr(jobs.sources[i], '/');
+        name = name != NULL ? name + 1 : jobs.sources[i];
+        jobs.destinations[i] = concat3(destinationDir, destinationDir[strlen(destinationDir) - 1] == '/' ? "" : "/", name);
+    }
+
+    runInThreadPool(count, copyJob, &jobs);
+    finishBulk(&jobs, count, &start, result);
+    return 1;
+}
+
+/**
+ * @brief Snapshots and deletes one file, then records it
+ *
+ * @param context The BulkJobs
+ * @param job The file
+ */
+static void deleteJob(void *context, size_t job){
+    struct BulkJobs *jobs = context;
+    char *fileName = jobs->sources[job];
+
+    ensureHistoryDir(fileName);
+    // The snapshot is new enough that compaction leaves it alone until the record exists
+    char *hash = saveDeletedFileForVersionControl(fileName);
+    if (hash == NULL) return;
+
+    // An unused snapshot is left for compaction, an earlier delete may share it
+    if (remove(fileName) == 0){
+        addToChangeLog(fileName, "DELETED", hash);
+        jobs->succeeded[job] = 1;
+    }
+    free(hash);
+}
+
+/**
+ * @brief Deletes every file matching a glob, each one can be restored like a normal delete
+ *
+ * @param pattern The glob
+ * @param result Filled with what happened, may be NULL
+ * @return int Always 1
+ */
+int bulkDeleteFiles(char *pattern, struct BulkResult *result){
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct BulkJobs jobs;
+    memset(&jobs, 0, sizeof(jobs));
+    size_t count = matchFiles(pattern, &jobs.sources);
+    jobs.succeeded = calloc(count + 1, sizeof(int));
+
+    runInThreadPool(count, deleteJob, &jobs);
+    finishBulk(&jobs, count, &start, result);
+    return 1;
+}
+
+/**
+ * @brief Restores one deleted file from its snapshot and removes the DELETED record
+ *
+ * @param context The BulkJobs
+ * @param job The file
+ */
+static void restoreJob(void *context, size_t job){
+    struct BulkJobs *jobs = context;
+    char *fileName = jobs->sources[job];
+    if (jobs->hashes[job][0] == '\0') return;
+
+    char *snapshot = changeLogSnapshotPath(fileName, jobs->hashes[job]);
+    if (snapshot == NULL) return;
+    int ok = isCompressedFile(snapshot) ? decompressFile(snapshot, fileName) : fastCopyFile(snapshot, fileName);
+    free(snapshot);
+    if (ok == 0){
+        remove(fileName);
+        return;
+    }
+
+    // Only pop the record that was restored, in case another change got in first
+    lockChangeLogs();
+    char *last = lastChangeLogRecord(fileName);
+    char *deleted = last != NULL ? strstr(last, "||DELETED||") : NULL;
+    if (deleted != NULL && strncmp(deleted + strlen("||DELETED||"), jobs->hashes[job], strlen(jobs->hashes[job])) == 0){
+        popChangeLogRecord(fileName);
+        jobs->succeeded[job] = 1;
+    }
+    unlockChangeLogs();
+    free(last);
+}
+
+/**
+ * @brief Restores every deleted file whose name matches a glob
+ *
+ * @param pattern The glob, matched against the names of tracked files
+ * @param result Filled with what happened, may be NULL
+ * @return int Always 1
+ */
+int bulkRestoreFiles(char *pattern, struct BulkResult *result){
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    struct BulkJobs jobs;
+    memset(&jobs, 0, sizeof(jobs));
+    size_t count = matchDeletedFiles(pattern, &jobs.sources);
+    jobs.hashes = malloc((count + 1) * sizeof(char *));
+    jobs.succeeded = calloc(count + 1, sizeof(int));
+
+    size_t i;
+    for (i = 0; i < count; i++){
+        char *last = lastChangeLogRecord(jobs.sources[i]);
+        char *hash = last != NULL ? strstr(last, "||DELETED||") : NULL;
+        if (hash != NULL){
+            hash += strlen("||DELETED||");
+            hash[strcspn(hash, "\n")] = '\0';
+        }
+        jobs.hashes[i] = strdup(hash != NULL ? hash : "");
+        free(last);
+    }
+
+    runInThreadPool(count, restoreJob, &jobs);
+    finishBulk(&jobs, count, &start, result);
+    return 1;
+}
+
+/**
+ * @brief Tells the user how a bulk operation went
+ *
+ * @param verb What was done, e.g. Copied
+ * @param result The result
+ */
+static void showBulkResult(char *verb, struct BulkResult *result){
+    char message[256];
+    if (result->matched == 0){
+        infoScreen("No files matched that pattern!");
+        return;
+    }
+    sprintf(message, "%s %zu of %zu files in %.2fs", verb, result->done, result->matched, result->seconds);
+    if (result->failed > 0) sprintf(message + strlen(message), "\n%zu files couldn't be done", result->failed);
+    infoScreen(message);
+}
+
+/**
+ * @brief Shows the bulk operations menu
+ *
+ */
+void bulkOperations(){
+    struct QuestionOption bulkOptions[4];
+    bulkOptions[0] = (struct QuestionOption) {"Copy Matching Files to a Folder", 'c'};
+    bulkOptions[1] = (struct QuestionOption) {"Delete Matching Files", 'd'};
+    bulkOptions[2] = (struct QuestionOption) {"Restore Matching Deleted Files\n", 'r'};
+    bulkOptions[3] = (struct QuestionOption) {"Back", 'b'};
+
+    char input = getUserOption("Select a Bulk Operation", bulkOptions, 4);
+    struct BulkResult result;
+
+    switch (input){
+        case 'c':
+            {
+                char *pattern = getUserInput("Please provide the files to copy (e.g. src/*): ");
+                char *destination = getUserInput("Please provide the folder to copy them to: ");
+                waitScreen("Copying Files.\nPlease wait...\n");
+                if (bulkCopyFiles(pattern, destination, &result)){
+                    showBulkResult("Copied", &result);
+                } else {
+                    infoScreen("That folder couldn't be created or written to!");
+                }
+                free(pattern);
+                free(destination);
+                break;
+            }
+
+        case 'd':
+            {
+                char *pattern = getUserInput("Please provide the files to delete (e.g. *.log): ");
+                waitScreen("Deleting Files.\nPlease wait...\n");
+                bulkDeleteFiles(pattern, &result);
+                showBulkResult("Deleted", &result);
+                free(pattern);
+                break;
+            }
+
+        case 'r':
+            {
+                char *pattern = getUserInput("Please provide the deleted files to restore (e.g. *.log): ");
+                waitScreen("Restoring Files.\nPlease wait...\n");
+                bulkRestoreFiles(pattern, &result);
+                showBulkResult("Restored", &result);
+                free(pattern);
+                break;
+            }
+    }
+}
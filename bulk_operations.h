@@ -0,0 +1,25 @@
+#ifndef BULK_OPERATIONS_H
+#define BULK_OPERATIONS_H
+
+#include <stddef.h>
+
+// Most worker threads a bulk operation uses, the work is mostly waiting on I/O
+#define BULK_MAX_THREADS 16
+
+struct BulkResult
+{
+    size_t matched;
+    size_t done;
+    size_t failed;
+    double seconds;
+};
+
+void runInThreadPool(size_t jobCount, void (*work)(void *context, size_t job), void *context);
+int fastCopyFile(char *source, char *destination);
+
+int bulkCopyFiles(char *pattern, char *destinationDir, struct BulkResult *result);
+int bulkDeleteFiles(char *pattern, struct BulkResult *result);
+int bulkRestoreFiles(char *pattern, struct BulkResult *result);
+void bulkOperations();
+
+#endif
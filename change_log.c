@@ -9,19 +9,74 @@
  * 
  */
 
+#define _GNU_SOURCE
+
 #include "change_log.h"
 #include "file_operations.h"
 #include "line_operations.h"
 #include "interface.h"
 #include "utils.h"
+#include "change_log_index.h"
+#include "compression.h"
+#include "trace.h"
+#include "status.h"
+#include "pack.h"
+#include "compaction.h"
+#include "storage.h"
 
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <stdlib.h>
 #include <time.h>
 #include <stdio.h>
 #include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <unistd.h>
+
+static pthread_mutex_t changeLogMutex;
+static pthread_once_t changeLogMutexOnce = PTHREAD_ONCE_INIT;
+
+// A changelog read as one stream over its sealed segments followed by the active changelog.txt
+struct ChangeLogStream
+{
+    FILE *parent;               // The parents stream when this log is a copy, NULL if not
+    uint64_t parentBytes;       // How much of the parents log belongs to this log
+    struct CompressedFile *segments;
+    uint64_t *segmentStarts;    // Logical offset each segment starts at
+    size_t segmentCount;
+    struct StorageFile *active;
+    uint64_t activeStart;       // Logical offset changelog.txt starts at
+    uint64_t position;
+};
+
+static char * readChangeLogFile(char *location);
+static int addChangeLogChild(char *parent, char *child);
+static void sealedChangeLogSize(char *fileName, size_t *count, uint64_t *size);
+static void setSealedChangeLogSize(char *fileName, size_t count, uint64_t size);
+
+/**
+ * @brief Lists the copies of every file, once, for histories copied before each file kept its children.txt
+ */
+static void listExistingChangeLogChildren(){
+    if (fileExists(".cword/children.ready")) return;
+    char **tracked;
+    size_t count = listTrackedFiles(&tracked), i;
+    for (i = 0; i < count; i++){
+        char *parent;
+        uint64_t parentBytes;
+        if (changeLogParent(tracked[i], &parent, &parentBytes)){
+            addChangeLogChild(parent, tracked[i]);
+            free(parent);
+        }
+        free(tracked[i]);
+    }
+    free(tracked);
+    storageClose(storageOpen(".cword/children.ready", STORAGE_WRITE));
+}
 
 /**
  * @brief Initiates the change log making sure it can exits
@@ -38,6 +93,7 @@ int initiateChangeLog(){
         infoScreen("CWord can't access/create its settings folder\nMake sure you have permission to create files!\nMake sure you are the user that first ran CWord here!");
         return 0;
     } else {
+        listExistingChangeLogChildren();
         return 1;
     }
         
@@ -53,6 +109,7 @@ int initiateChangeLog(){
  */
 void addToChangeLog(char *fileName, char *operation, char *info){
 
+    uint64_t trace = TRACE_BEGIN();
     char *dirLocation = concat(".cword/", fileName);
     if (dirExists(dirLocation) == 0){
         infoScreen("CWord couldn't find this files changelog folder.\nThis change hasn't been recorded!");
@@ -60,27 +117,48 @@ void addToChangeLog(char *fileName, char *operation, char *info){
     }
     free(dirLocation);
 
-    char out[256];
-
-
-    time_t now;
-    time(&now);
-    struct tm *time = localtime(&now);
-    char stringTime[20];
-    sprintf(stringTime, "%02d:%02d:%02d %02d/%02d/%d", time->tm_hour, time->tm_min, time->tm_sec, time->tm_mday, time->tm_mon + 1, time->tm_year + 1900);
-
-    sprintf(out, "[%s]||%s||%s\n", stringTime, operation, info);
-       
+    lockChangeLogs();
+    uint64_t nanos = nextChangeLogNanos(fileName);
 
     char *location = concat3(".cword/", fileName, "/changelog.txt");
-
-    internalAppendLine(location, out);
+    struct StorageFile *append = storageOpen(location, STORAGE_APPEND);
+    if (append != NULL && storageSize(append) >= CHANGE_LOG_SEGMENT_BYTES){
+        storageClose(append);
+        sealChangeLog(fileName);
+        append = storageOpen(location, STORAGE_APPEND);
+    }
     free(location);
-    
+    if (append == NULL){
+        unlockChangeLogs();
+        infoScreen("CWord couldn't open this files changelog.\nThis change hasn't been recorded!");
+        return;
+    }
+
+    uint64_t logicalSize;
+    changeLogStoredSize(fileName, &logicalSize);
+    struct ChangeLogIndexEntry entry;
+    entry.offset = logicalSize;
+    entry.nanos = nanos;
+    char start[32];
+    int startLength = sprintf(start, "[%llu]||", (unsigned long long)nanos);
+    // The whole record goes to the backend in one write
+    storageWrite(append, start, startLength);
+    storageWriteString(append, operation);
+    storageWrite(append, "||", 2);
+    storageWriteString(append, info);
+    storageWrite(append, "\n", 1);
+    entry.length = startLength + strlen(operation) + 2 + strlen(info) + 1;
+    entry.operation = changeLogOperationFromName(operation);
+    storageClose(append);
+
+    indexChangeLogRecord(fileName, entry);
+    unlockChangeLogs();
+    TRACE_END("addToChangeLog", trace, entry.length);
 }
 
 /**
- * @brief Copies the change log file 
+ * @brief Gives a copy the history of the original without duplicating it,
+ * the copy points at the originals log as it is now and only stores its own records after that
  * 
  * @param from Name of the source file
  * @param to Name of the new file
@@ -100,26 +178,1087 @@ void copyChangeLog(char *from, char *to){
     dirExists(toDir);
     free(toDir);
 
-    
+    lockChangeLogs();
+    uint64_t size;
+    changeLogStoredSize(from, &size);
+
+    // Anything already sharing the old history under this name keeps its own copy of it
+    if (fileExists(toLocation)) detachChangeLogChildren(to, 0);
+    removeChangeLogSegments(to);
+    storageClose(storageOpen(toLocation, STORAGE_WRITE));
+    char *indexLocation = changeLogIndexPath(to);
+    remove(indexLocation);
+    free(indexLocation);
+    setChangeLogParent(to, from, size);
+    unlockChangeLogs();
 
-    internalCopyFile(fromLocation, toLocation);
     free(fromLocation);
     free(toLocation);
 }
+
+/**
+ * @brief Converts a date typed by the user to nanoseconds
+ * Accepts DD/MM/YYYY, DD/MM/YYYY HH:MM and DD/MM/YYYY HH:MM:SS
+ * 
+ * @param text The users input
+ * @param endOfRange 1 to round up to the end of the given minute/day
+ * @param nanos Set to the time
+ * @return int 1 if ok, 0 if the date couldn't be read
+ */
+static int parseUserTime(char *text, int endOfRange, uint64_t *nanos){
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    int read = sscanf(text, "%d/%d/%d %d:%d:%d", &tm.tm_mday, &tm.tm_mon, &tm.tm_year, &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (read < 3) return 0;
+
+    if (endOfRange){
+        if (read < 4) tm.tm_hour = 23;
+        if (read < 5) tm.tm_min = 59;
+        if (read < 6) tm.tm_sec = 59;
+    }
+    tm.tm_mon -= 1;
+    tm.tm_year -= 1900;
+    tm.tm_isdst = -1;
+
+    time_t seconds = mktime(&tm);
+    if (seconds < 0) return 0;
+    *nanos = (uint64_t)seconds * 1000000000ULL + (endOfRange ? 999999999ULL : 0);
+    return 1;
+}
+
+/**
+ * @brief Prints a single record in a readable form
+ * 
+ * @param number The records position, 1 being the newest
+ * @param record The raw record
+ */
+static void printChangeLogRecord(size_t number, char *record){
+    uint64_t nanos = changeLogStampToNanos(record);
+    time_t seconds = nanos / 1000000000ULL;
+    struct tm tm;
+    localtime_r(&seconds, &tm);
+
+    char *operation = strstr(record, "||");
+    char *info = operation != NULL ? strstr(operation + 2, "||") : NULL;
+    if (info == NULL){
+        printf("%6zu  %s", number, record);
+        return;
+    }
+    *info = '\0';
+    info += 2;
+    info[strcspn(info, "\n")] = '\0';
+
+    printf("%6zu  %02d:%02d:%02d.%03llu %02d/%02d/%d  %-8s %s\n", number, tm.tm_hour, tm.tm_min, tm.tm_sec,
+        (unsigned long long)(nanos % 1000000000ULL) / 1000000ULL, tm.tm_mday, tm.tm_mon + 1, tm.tm_year + 1900, operation + 2, info);
+}
+
  /**
-  * @brief Shows the change log to the user for viewing
+  * @brief Shows the change log to the user for viewing, newest first
+  * Only the records on screen are read, found through the changelog index
   * 
   * @param fileName The name of the file
   */
 void viewChangeLog(char *fileName){
+    int operation = OPERATION_ANY;
+    uint64_t from = 0, to = UINT64_MAX;
+    size_t pageEnd = SIZE_MAX;
+
+    while (1 == 1){
+        struct ChangeLogView view;
+        if (openChangeLogView(&view, fileName, operation) == 0){
+            infoScreen("That file doesn't have any changelog history!");
+            return;
+        }
+
+        size_t low = findChangeLogNanos(&view, from);
+        size_t high = to == UINT64_MAX ? view.count : findChangeLogNanos(&view, to + 1);
+        if (high < low) high = low;
+        if (pageEnd > high) pageEnd = high;
+        if (pageEnd < low) pageEnd = low;
+        size_t pageStart = (pageEnd - low) > CHANGE_LOG_PAGE_SIZE ? pageEnd - CHANGE_LOG_PAGE_SIZE : low;
+
+        clearScreen();
+        printHeader();
+        printf("%s changelog, showing %s records", fileName, operation == OPERATION_ANY ? "all" : changeLogOperationName(operation));
+        if (from != 0 || to != UINT64_MAX) printf(" in the chosen time range");
+        printf(":\n\n");
+
+        size_t i;
+        for (i = pageEnd; i > pageStart; i--){
+            struct ChangeLogIndexEntry entry;
+            if (readChangeLogViewEntry(&view, i - 1, &entry) == 0) break;
+            char *record = readChangeLogViewRecord(&view, &entry);
+            if (record == NULL) break;
+            printChangeLogRecord(high - i + 1, record);
+            free(record);
+        }
+        closeChangeLogView(&view);
+
+        if (high == low){
+            printLine("There are no records to show!\n");
+            printf("\n[0/0](f filter operation, t time range, r reset, c close)>");
+        } else {
+            printf("\n[%zu-%zu/%zu](ENTER/o older, n newer, f filter operation, t time range, r reset, c close)>", high - pageEnd + 1, high - pageStart, high - low);
+        }
+
+        char input = tolower(getchar());
+        if (input != '\n') clearInputBuffer();
+
+        switch (input){
+            case '\n':
+            case 'o':
+                if (pageStart > low) pageEnd = pageStart;
+                break;
+
+            case 'n':
+                pageEnd = (high - pageEnd) > CHANGE_LOG_PAGE_SIZE ? pageEnd + CHANGE_LOG_PAGE_SIZE : high;
+                break;
+
+            case 'f':
+                {
+                    char *input = getUserLine("Operation to show (APPEND, INSERT, DELETE, REPLACE, SUBSTITUTE, TRANSFORM, CREATED, DELETED, blank for all): ");
+                    if (strcmp(input, "") == 0){
+                        operation = OPERATION_ANY;
+                    } else if (changeLogOperationFromName(input) != OPERATION_UNKNOWN){
+                        operation = changeLogOperationFromName(input);
+                    } else {
+                        infoScreen("That isn't an operation CWord records!");
+                    }
+                    free(input);
+                    pageEnd = SIZE_MAX;
+                    break;
+                }
+
+            case 't':
+                {
+                    char *start = getUserLine("Show records from (DD/MM/YYYY [HH:MM[:SS]], blank for the beginning): ");
+                    char *end = getUserLine("Show records until (DD/MM/YYYY [HH:MM[:SS]], blank for now): ");
+                    uint64_t newFrom = 0, newTo = UINT64_MAX;
+                    if ((strcmp(start, "") != 0 && parseUserTime(start, 0, &newFrom) == 0) || (strcmp(end, "") != 0 && parseUserTime(end, 1, &newTo) == 0)){
+                        infoScreen("That date couldn't be understood!");
+                    } else {
+                        from = newFrom;
+                        to = newTo;
+                    }
+                    free(start);
+                    free(end);
+                    pageEnd = SIZE_MAX;
+                    break;
+                }
+
+            case 'r':
+                operation = OPERATION_ANY;
+                from = 0;
+                to = UINT64_MAX;
+                pageEnd = SIZE_MAX;
+                break;
+
+            case 'c':
+                return;
+        }
+    }
+}
+
+/**
+ * @brief Sets up the recursive changelog lock, only ever called once
+ * 
+ */
+static void initiateChangeLogMutex(){
+    pthread_mutexattr_t attributes;
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&changeLogMutex, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+}
+
+/**
+ * @brief Takes the lock guarding every changelog and snapshot,
+ * needed as compaction may be rewriting them in the background
+ * 
+ */
+void lockChangeLogs(){
+    pthread_once(&changeLogMutexOnce, initiateChangeLogMutex);
+    pthread_mutex_lock(&changeLogMutex);
+}
+
+/**
+ * @brief Releases the changelog lock
+ * 
+ */
+void unlockChangeLogs(){
+    pthread_mutex_unlock(&changeLogMutex);
+}
+
+/**
+ * @brief Gets the location of a sealed changelog segment
+ * Make sure to free after use!
+ *
+ * @param fileName The tracked file
+ * @param segment The segment, from 1 oldest first
+ * @return char* The location
+ */
+char * changeLogSegmentPath(char *fileName, size_t segment){
+    char name[48];
+    snprintf(name, sizeof(name), "/changelog.%06zu.cwz", segment);
+    return concat3(".cword/", fileName, name);
+}
+
+/**
+ * @brief Checks if a sealed segment exists, loose in the files folder or in the pack
+ *
+ * @param fileName The tracked file
+ * @param segment The segment, from 1
+ * @return int 1 if it exists
+ */
+static int changeLogSegmentExists(char *fileName, size_t segment){
+    char *location = changeLogSegmentPath(fileName, segment);
+    int exists = fileExists(location) || packedMemberExists(fileName, strrchr(location, '/') + 1);
+    free(location);
+    return exists;
+}
+
+/**
+ * @brief Counts the sealed segments of a changelog, they are always numbered 1 to n
+ *
+ * @param fileName The tracked file
+ * @return size_t The amount of segments
+ */
+size_t changeLogSegmentCount(char *fileName){
+    size_t count = 0;
+    while (changeLogSegmentExists(fileName, count + 1)) count++;
+    return count;
+}
+
+/**
+ * @brief Opens a sealed segment, loose in the files folder or in the pack
+ *
+ * @param compressed The handle to fill
+ * @param fileName The tracked file
+ * @param segment The segment, from 1
+ * @return int 1 if ok, 0 if it is missing or damaged
+ */
+static int openChangeLogSegment(struct CompressedFile *compressed, char *fileName, size_t segment){
+    char *location = changeLogSegmentPath(fileName, segment);
+    int ok = openCompressedFile(compressed, location);
+    if (ok == 0) ok = openPackedCompressedFile(compressed, fileName, strrchr(location, '/') + 1);
+    free(location);
+    return ok;
+}
+
+/**
+ * @brief Removes sealed segments wherever they are kept
+ *
+ * @param fileName The tracked file
+ * @param from The first segment to remove
+ * @param to The last segment to remove
+ */
+static void removeChangeLogSegmentRange(char *fileName, size_t from, size_t to){
+    if (to < from) return;
+    char *sealedLocation = concat3(".cword/", fileName, "/sealed.txt");
+    storageRemove(sealedLocation);
+    free(sealedLocation);
+    char **members = malloc((to - from + 1) * sizeof(char *));
+    size_t segment, count = 0;
+    for (segment = to; segment >= from && segment > 0; segment--){
+        char *location = changeLogSegmentPath(fileName, segment);
+        remove(location);
+        members[count++] = strdup(strrchr(location, '/') + 1);
+        free(location);
+    }
+    removePackedMembers(fileName, members, count);
+    for (segment = 0; segment < count; segment++) free(members[segment]);
+    free(members);
+}
+
+/**
+ * @brief Gets the size of a changelog as if it were never split into segments,
+ * this is the size the index offsets refer to
+ *
+ * @param fileName The tracked file
+ * @param size Set to the size
+ * @return int 1 if the changelog exists, 0 if not
+ */
+int changeLogStoredSize(char *fileName, uint64_t *size){
+    *size = 0;
+    char *location = concat3(".cword/", fileName, "/changelog.txt");
+    struct StorageStat info;
+    int exists = storageStat(location, &info);
+    free(location);
+    if (exists == 0) return 0;
+
+    lockChangeLogs();
+    char *parent;
+    if (changeLogParent(fileName, &parent, size)) free(parent);
+    size_t count;
+    uint64_t sealed;
+    sealedChangeLogSize(fileName, &count, &sealed);
+    unlockChangeLogs();
+
+    *size += sealed + info.size;
+    return 1;
+}
+
+/**
+ * @brief Gets how many sealed segments a changelog has and how much they hold uncompressed. This is kept
+ * in sealed.txt so the segments needn't be opened, it is only trusted while the last segment it counts
+ * is the last one there is and otherwise worked out again
+ *
+ * @param fileName The tracked file
+ * @param count Set to the amount of segments
+ * @param size Set to their size
+ */
+static void sealedChangeLogSize(char *fileName, size_t *count, uint64_t *size){
+    char *location = concat3(".cword/", fileName, "/sealed.txt");
+    char *contents = readChangeLogFile(location);
+    free(location);
+    unsigned long long bytes;
+    int current = contents != NULL && sscanf(contents, "%zu %llu", count, &bytes) == 2
+        && (*count == 0 || changeLogSegmentExists(fileName, *count)) && changeLogSegmentExists(fileName, *count + 1) == 0;
+    free(contents);
+    if (current){
+        *size = bytes;
+        return;
+    }
+
+    *count = changeLogSegmentCount(fileName);
+    *size = 0;
+    size_t segment;
+    for (segment = 1; segment <= *count; segment++){
+        struct CompressedFile compressed;
+        if (openChangeLogSegment(&compressed, fileName, segment)){
+            *size += compressed.rawSize;
+            closeCompressedFile(&compressed);
+        }
+    }
+    if (*count > 0) setSealedChangeLogSize(fileName, *count, *size);
+}
+
+/**
+ * @brief Writes sealed.txt, the amount of sealed segments then their size. If it can't be written it
+ * is removed so it is worked out again when next needed
+ *
+ * @param fileName The tracked file
+ * @param count The amount of segments
+ * @param size Their size
+ */
+static void setSealedChangeLogSize(char *fileName, size_t count, uint64_t size){
+    char *location = concat3(".cword/", fileName, "/sealed.txt");
+    char *tempLocation = concat(location, ".temp.cword.txt");
+    struct StorageFile *file = storageOpen(tempLocation, STORAGE_WRITE);
+    int ok = file != NULL;
+    if (ok){
+        char contents[48];
+        sprintf(contents, "%zu %llu\n", count, (unsigned long long)size);
+        storageWriteString(file, contents);
+        ok = storageClose(file) && storageReplace(tempLocation, location);
+    }
+    if (ok == 0){
+        storageRemove(tempLocation);
+        storageRemove(location);
+    }
+    free(location);
+    free(tempLocation);
+}
+
+/**
+ * @brief Cuts the active changelog down to a length
+ *
+ * @param location Where it is
+ * @param length How much to keep
+ * @return int 1 if ok, 0 if not
+ */
+static int truncateActiveChangeLog(char *location, uint64_t length){
+    struct StorageFile *active = storageOpen(location, STORAGE_UPDATE);
+    if (active == NULL) return 0;
+    int ok = storageTruncate(active, length);
+    return storageClose(active) && ok;
+}
+
+/**
+ * @brief Moves the active changelog into a new compressed segment and empties it
+ * Index offsets don't change as they are logical offsets over every segment
+ *
+ * @param fileName The tracked file
+ * @return int 1 if ok, 0 if the segment couldn't be written
+ */
+int sealChangeLog(char *fileName){
+    uint64_t trace = TRACE_BEGIN();
+    lockChangeLogs();
+    char *location = concat3(".cword/", fileName, "/changelog.txt");
+    size_t count;
+    uint64_t sealed;
+    sealedChangeLogSize(fileName, &count, &sealed);
+    char *segmentLocation = changeLogSegmentPath(fileName, count + 1);
+
+    struct StorageStat info;
+    int ok = storageStat(location, &info) && compressFile(location, segmentLocation) && verifyCompressedFile(segmentLocation);
+    if (ok){
+        truncateActiveChangeLog(location, 0);
+        setSealedChangeLogSize(fileName, count + 1, sealed + info.size);
+    } else {
+        remove(segmentLocation);
+    }
+
+    free(location);
+    free(segmentLocation);
+    unlockChangeLogs();
+    TRACE_END("sealChangeLog", trace, 0);
+    return ok;
+}
+
+/**
+ * @brief Removes every sealed segment of a changelog, used once the whole log has been rewritten into changelog.txt
+ *
+ * @param fileName The tracked file
+ */
+void removeChangeLogSegments(char *fileName){
+    lockChangeLogs();
+    removeChangeLogSegmentRange(fileName, 1, changeLogSegmentCount(fileName));
+    unlockChangeLogs();
+}
+
+/**
+ * @brief Cuts a changelog down to the given logical size
+ * A cut inside a sealed segment brings the kept part of that segment back into changelog.txt
+ *
+ * @param fileName The tracked file
+ * @param offset The logical size to keep
+ * @return int 1 if ok, 0 if the changelog couldn't be cut
+ */
+int truncateChangeLog(char *fileName, uint64_t offset){
+    lockChangeLogs();
+    detachChangeLogChildren(fileName, offset);
+
+    char *location = concat3(".cword/", fileName, "/changelog.txt");
+    size_t count = changeLogSegmentCount(fileName);
+
+    char *parent;
+    uint64_t start = 0;
+    if (changeLogParent(fileName, &parent, &start)){
+        if (offset < start){
+            // Cutting into the shared history only moves the parent pointer back
+            removeChangeLogSegments(fileName);
+            int ok = truncateActiveChangeLog(location, 0) && setChangeLogParent(fileName, parent, offset);
+            free(parent);
+            free(location);
+            unlockChangeLogs();
+            return ok;
+        }
+        free(parent);
+    }
+
+    size_t segment;
+    int ok = 1;
+    for (segment = 1; segment <= count && ok; segment++){
+        struct CompressedFile compressed;
+        if (openChangeLogSegment(&compressed, fileName, segment) == 0){
+            ok = 0;
+            break;
+        }
+
+        if (offset < start + compressed.rawSize){
+            // Keep the start of this segment as the new active log, drop it and every later segment
+            struct StorageFile *active = storageOpen(location, STORAGE_WRITE);
+            ok = active != NULL;
+            unsigned char *buffer = malloc(compressed.blockSize);
+            uint64_t position = 0, keep = offset - start;
+            while (ok && position < keep){
+                size_t want = keep - position < compressed.blockSize ? keep - position : compressed.blockSize;
+                size_t read = readCompressedFile(&compressed, position, buffer, want);
+                if (read != want) ok = 0;
+                if (ok) ok = storageWrite(active, buffer, read);
+                position += read;
+            }
+            free(buffer);
+            if (active != NULL && storageClose(active) == 0) ok = 0;
+            closeCompressedFile(&compressed);
+
+            if (ok) removeChangeLogSegmentRange(fileName, segment, count);
+            free(location);
+            unlockChangeLogs();
+            return ok;
+        }
+
+        start += compressed.rawSize;
+        closeCompressedFile(&compressed);
+    }
+
+    if (ok) ok = truncateActiveChangeLog(location, offset - start);
+    free(location);
+    unlockChangeLogs();
+    return ok;
+}
+
+/**
+ * @brief Reads from a changelog stream
+ *
+ * @param cookie The stream
+ * @param buffer Where to read to
+ * @param size The most to read
+ * @return ssize_t The bytes read, 0 at the end
+ */
+static ssize_t readChangeLogStream(void *cookie, char *buffer, size_t size){
+    struct ChangeLogStream *stream = cookie;
+    size_t done = 0;
+
+    if (stream->position < stream->parentBytes){
+        size_t want = stream->parentBytes - stream->position < size ? stream->parentBytes - stream->position : size;
+        if (fseeko(stream->parent, stream->position, SEEK_SET) != 0) return -1;
+        done = fread(buffer, 1, want, stream->parent);
+        stream->position += done;
+        if (done < want) return done > 0 ? (ssize_t)done : -1;
+    }
+
+    while (done < size && stream->position < stream->activeStart){
+        if (stream->segmentCount == 0) break;
+        size_t segment = stream->segmentCount - 1;
+        while (stream->segmentStarts[segment] > stream->position) segment--;
+        size_t read = readCompressedFile(&stream->segments[segment], stream->position - stream->segmentStarts[segment], buffer + done, size - done);
+        if (read == 0) return done > 0 ? (ssize_t)done : -1;
+        done += read;
+        stream->position += read;
+    }
+
+    if (done < size && stream->position >= stream->activeStart){
+        ssize_t read = storageRead(stream->active, buffer + done, size - done, stream->position - stream->activeStart);
+        if (read < 0) return done > 0 ? (ssize_t)done : -1;
+        done += read;
+        stream->position += read;
+    }
+    return done;
+}
+
+/**
+ * @brief Moves a changelog stream
+ *
+ * @param cookie The stream
+ * @param offset The offset, updated to the new position
+ * @param whence SEEK_SET, SEEK_CUR or SEEK_END
+ * @return int 0 if ok, -1 if not
+ */
+static int seekChangeLogStream(void *cookie, off64_t *offset, int whence){
+    struct ChangeLogStream *stream = cookie;
+    int64_t base = 0;
+    if (whence == SEEK_CUR){
+        base = stream->position;
+    } else if (whence == SEEK_END){
+        base = stream->activeStart + storageSize(stream->active);
+    }
+    if (base + *offset < 0) return -1;
+
+    stream->position = base + *offset;
+    *offset = stream->position;
+    return 0;
+}
+
+/**
+ * @brief Closes a changelog stream
+ *
+ * @param cookie The stream
+ * @return int Always 0
+ */
+static int closeChangeLogStream(void *cookie){
+    struct ChangeLogStream *stream = cookie;
+    size_t i;
+    if (stream->parent != NULL) fclose(stream->parent);
+    for (i = 0; i < stream->segmentCount; i++) closeCompressedFile(&stream->segments[i]);
+    free(stream->segments);
+    free(stream->segmentStarts);
+    if (stream->active != NULL) storageClose(stream->active);
+    free(stream);
+    return 0;
+}
+
+/**
+ * @brief Opens a changelog stream, following parent pointers no deeper than depth
+ *
+ * @param fileName The tracked file
+ * @param depth How many more parents may be followed, stops a broken chain looping forever
+ * @return FILE* The stream, NULL if the file has no changelog
+ */
+static FILE * openChangeLogStreamAt(char *fileName, int depth){
+    lockChangeLogs();
     char *location = concat3(".cword/", fileName, "/changelog.txt");
-    showFile(location);
+    struct StorageFile *active = storageOpen(location, STORAGE_READ);
     free(location);
+    if (active == NULL){
+        unlockChangeLogs();
+        return NULL;
+    }
+
+    struct ChangeLogStream *stream = calloc(1, sizeof(struct ChangeLogStream));
+    stream->active = active;
+    size_t count = changeLogSegmentCount(fileName);
+    stream->segments = malloc((count + 1) * sizeof(struct CompressedFile));
+    stream->segmentStarts = malloc((count + 1) * sizeof(uint64_t));
+
+    char *parent;
+    if (changeLogParent(fileName, &parent, &stream->parentBytes)){
+        stream->parent = depth > 0 ? openChangeLogStreamAt(parent, depth - 1) : NULL;
+        free(parent);
+        if (stream->parent == NULL){
+            closeChangeLogStream(stream);
+            unlockChangeLogs();
+            return NULL;
+        }
+        stream->activeStart = stream->parentBytes;
+    }
+
+    size_t segment;
+    for (segment = 1; segment <= count; segment++){
+        struct CompressedFile *compressed = &stream->segments[stream->segmentCount];
+        if (openChangeLogSegment(compressed, fileName, segment) == 0){
+            closeChangeLogStream(stream);
+            unlockChangeLogs();
+            return NULL;
+        }
+        stream->segmentStarts[stream->segmentCount++] = stream->activeStart;
+        stream->activeStart += compressed->rawSize;
+    }
+    unlockChangeLogs();
+
+    cookie_io_functions_t functions = {readChangeLogStream, NULL, seekChangeLogStream, closeChangeLogStream};
+    FILE *file = fopencookie(stream, "r", functions);
+    if (file == NULL) closeChangeLogStream(stream);
+    return file;
 }
 
+/**
+ * @brief Opens a changelog for reading as one seekable stream, hiding how it is split into segments
+ * and any history shared with the file it was copied from. Close with fclose
+ *
+ * @param fileName The tracked file
+ * @return FILE* The stream, NULL if the file has no changelog
+ */
+FILE * openChangeLogStream(char *fileName){
+    return openChangeLogStreamAt(fileName, CHANGE_LOG_MAX_PARENTS);
+}
 
+/**
+ * @brief Reads one of the small files kept beside a changelog
+ * Make sure to free after use!
+ *
+ * @param location Where it is
+ * @return char* Its contents, NULL if it can't be read
+ */
+static char * readChangeLogFile(char *location){
+    struct StorageFile *file = storageOpen(location, STORAGE_READ);
+    if (file == NULL) return NULL;
+    uint64_t size = storageSize(file);
+    char *contents = malloc(size + 1);
+    ssize_t got = contents != NULL ? storageRead(file, contents, size, 0) : -1;
+    storageClose(file);
+    if (got < 0){
+        free(contents);
+        return NULL;
+    }
+    contents[got] = '\0';
+    return contents;
+}
 
+/**
+ * @brief Adds a copy to the list of files sharing a parents history (children.txt, a name per line),
+ * so rewriting the parents log only has to look at them. Names no longer pointing at the parent are
+ * dropped when the list is next used
+ *
+ * @param parent The file whose history is shared
+ * @param child The copy
+ * @return int 1 if ok, 0 if the list couldn't be written
+ */
+static int addChangeLogChild(char *parent, char *child){
+    char *location = concat3(".cword/", parent, "/children.txt");
+    char *contents = readChangeLogFile(location);
+    int listed = 0;
+    char *name, *save = NULL;
+    for (name = contents != NULL ? strtok_r(contents, "\n", &save) : NULL; name != NULL && listed == 0; name = strtok_r(NULL, "\n", &save)){
+        listed = strcmp(name, child) == 0;
+    }
+    free(contents);
 
+    int ok = 1;
+    if (listed == 0){
+        struct StorageFile *file = storageOpen(location, STORAGE_APPEND);
+        ok = file != NULL;
+        if (ok){
+            storageWriteString(file, child);
+            storageWrite(file, "\n", 1);
+            ok = storageClose(file);
+        }
+    }
+    free(location);
+    return ok;
+}
 
+/**
+ * @brief Checks whether a files log is shared, because it is a copy or has copies
+ *
+ * @param fileName The tracked file
+ * @return int 1 if it has a parent or any children listed
+ */
+int changeLogShared(char *fileName){
+    char *parent;
+    uint64_t parentBytes;
+    if (changeLogParent(fileName, &parent, &parentBytes)){
+        free(parent);
+        return 1;
+    }
+    char *location = concat3(".cword/", fileName, "/children.txt");
+    struct StorageStat info;
+    int shared = storageStat(location, &info) && info.size > 0;
+    free(location);
+    return shared;
+}
 
+/**
+ * @brief Reads where a copied files history comes from
+ *
+ * @param fileName The tracked file
+ * @param parent Set to the file it was copied from, make sure to free after use!
+ * @param parentBytes Set to how much of the parents log is shared
+ * @return int 1 if the file has a parent, 0 if its history is all its own
+ */
+int changeLogParent(char *fileName, char **parent, uint64_t *parentBytes){
+    char *location = concat3(".cword/", fileName, "/parent.txt");
+    char *contents = readChangeLogFile(location);
+    free(location);
+    if (contents == NULL) return 0;
 
+    // The parents name then how much of its log is shared, a line each
+    char *newline = strchr(contents, '\n');
+    unsigned long long bytes;
+    int ok = newline != NULL && newline != contents && sscanf(newline + 1, "%llu", &bytes) == 1;
+    if (ok == 0){
+        free(contents);
+        return 0;
+    }
+    *newline = '\0';
+    *parent = contents;
+    *parentBytes = bytes;
+    return 1;
+}
+
+/**
+ * @brief Points a files history at the first parentBytes of another files log
+ *
+ * @param fileName The tracked file
+ * @param parent The file whose history is shared
+ * @param parentBytes How much of the parents log is shared
+ * @return int 1 if ok, 0 if the pointer couldn't be written
+ */
+int setChangeLogParent(char *fileName, char *parent, uint64_t parentBytes){
+    char *location = concat3(".cword/", fileName, "/parent.txt");
+    char *tempLocation = concat(location, ".temp.cword.txt");
+    struct StorageFile *file = storageOpen(tempLocation, STORAGE_WRITE);
+    int ok = file != NULL;
+    if (ok){
+        char bytes[24];
+        sprintf(bytes, "\n%llu\n", (unsigned long long)parentBytes);
+        storageWriteString(file, parent);
+        storageWriteString(file, bytes);
+        ok = storageClose(file) && storageReplace(tempLocation, location);
+    }
+    if (ok) ok = addChangeLogChild(parent, fileName);
+    free(location);
+    free(tempLocation);
+    return ok;
+}
+
+/**
+ * @brief Finds the snapshot a record refers to, DELETED records keep the deleted file,
+ * SUBSTITUTE records the lines they replaced and TRANSFORM records the whole file before
+ *
+ * @param record The record, its \n is removed
+ * @return char* The snapshots name within the record, NULL if it doesn't refer to one
+ */
+char * changeLogRecordSnapshot(char *record){
+    record[strcspn(record, "\n")] = '\0';
+    char *hash = strstr(record, "||DELETED||");
+    if (hash != NULL) return hash + strlen("||DELETED||");
+
+    hash = strstr(record, "||SUBSTITUTE||");
+    if (hash == NULL) hash = strstr(record, "||TRANSFORM||");
+    if (hash == NULL) return NULL;
+    hash = strstr(hash, "::");
+    return hash != NULL ? hash + 2 : NULL;
+}
+
+/**
+ * @brief Finds a deleted file snapshot, looking through the parents of a copied file
+ * A packed snapshot is copied back out next to where it was loose, the next repack takes it back in
+ * Make sure to free after use!
+ *
+ * @param fileName The tracked file
+ * @param hash The snapshots name
+ * @return char* The snapshots location, NULL if it can't be found
+ */
+char * changeLogSnapshotPath(char *fileName, char *hash){
+    char *current = strdup(fileName);
+    int depth;
+    for (depth = 0; depth <= CHANGE_LOG_MAX_PARENTS; depth++){
+        char *location = concat4(".cword/", current, "/", hash);
+        if (fileExists(location) || extractPackedMember(current, hash, location)){
+            free(current);
+            return location;
+        }
+        free(location);
+
+        char *parent;
+        uint64_t parentBytes;
+        if (changeLogParent(current, &parent, &parentBytes) == 0) break;
+        free(current);
+        current = parent;
+    }
+    free(current);
+    return NULL;
+}
+
+/**
+ * @brief Checks whether a snapshot holds exactly the contents of a file
+ *
+ * @param snapshot The snapshot, compressed or a plain copy
+ * @param source The file
+ * @return int 1 if they match
+ */
+static int snapshotMatches(char *snapshot, char *source){
+    struct StorageFile *file = storageOpen(source, STORAGE_READ);
+    if (file == NULL) return 0;
+
+    struct CompressedFile compressed;
+    struct StorageFile *plain = NULL;
+    int isCompressed = isCompressedFile(snapshot);
+    int same;
+    if (isCompressed){
+        same = openCompressedFile(&compressed, snapshot) && compressed.rawSize == storageSize(file);
+    } else {
+        plain = storageOpen(snapshot, STORAGE_READ);
+        same = plain != NULL && storageSize(plain) == storageSize(file);
+    }
+
+    char *expected = malloc(COMPRESSION_BLOCK_SIZE);
+    char *stored = malloc(COMPRESSION_BLOCK_SIZE);
+    uint64_t offset = 0;
+    while (same){
+        ssize_t got = storageRead(file, expected, COMPRESSION_BLOCK_SIZE, offset);
+        ssize_t have = isCompressed ? (ssize_t)readCompressedFile(&compressed, offset, stored, COMPRESSION_BLOCK_SIZE) : storageRead(plain, stored, COMPRESSION_BLOCK_SIZE, offset);
+        if (got < 0 || got != have || memcmp(expected, stored, got) != 0) same = 0;
+        if (got <= 0) break;
+        offset += got;
+    }
+    free(expected);
+    free(stored);
+
+    if (isCompressed) closeCompressedFile(&compressed);
+    storageClose(plain);
+    storageClose(file);
+    return same;
+}
+
+/**
+ * @brief Stores a copy of a file in the history of a tracked file, named by a hash
+ * of its contents so storing the same contents again reuses the snapshot already there
+ * Make sure to free after use!
+ *
+ * @param fileName The tracked file
+ * @param source The file to keep a copy of
+ * @return char* The snapshots name, NULL if it couldn't be stored
+ */
+char * storeSnapshot(char *fileName, char *source){
+    int ok;
+    uint64_t hash = hashFileContents(source, &ok);
+    if (ok == 0) return NULL;
+
+    char *folder = concat(".cword/", fileName);
+    dirExists(folder);
+
+    char name[24];
+    while (1 == 1){
+        // Digits only, like every snapshot, so orphan collection still recognises it
+        sprintf(name, "%llu", (unsigned long long)hash);
+        char *location = concat3(folder, "/", name);
+        // A packed snapshot of that name has to be compared like a loose one
+        if (fileExists(location) == 0) extractPackedMember(fileName, name, location);
+        if (fileExists(location) == 0){
+            // A plain copy keeps the user waiting the least, it is compressed in the background
+            internalCopyFile(source, location);
+            struct StorageStat sourceInfo, copyInfo;
+            ok = storageStat(source, &sourceInfo) && storageStat(location, &copyInfo) && sourceInfo.size == copyInfo.size;
+            if (ok){
+                scheduleSnapshotCompression(fileName);
+            } else {
+                storageRemove(location);
+            }
+            free(location);
+            break;
+        }
+        if (snapshotMatches(location, source)){
+            // Reset its age so compaction doesn't collect it before the record referencing it exists
+            utimensat(AT_FDCWD, location, NULL, 0);
+            free(location);
+            break;
+        }
+        // Same hash, different contents
+        free(location);
+        hash++;
+    }
+    free(folder);
+    return ok ? strdup(name) : NULL;
+}
+
+/**
+ * @brief Gives a copied file its own full history so it no longer depends on its parent,
+ * the logical log is unchanged so its index stays valid
+ *
+ * @param fileName The tracked file
+ * @return int 1 if ok, 0 if the history couldn't be written
+ */
+int materializeChangeLog(char *fileName){
+    lockChangeLogs();
+    char *parent;
+    uint64_t parentBytes;
+    if (changeLogParent(fileName, &parent, &parentBytes) == 0){
+        unlockChangeLogs();
+        return 1;
+    }
+    free(parent);
+
+    FILE *source = openChangeLogStream(fileName);
+    char *location = concat3(".cword/", fileName, "/changelog.txt");
+    char *tempLocation = concat(location, ".materialize.cword.txt");
+    struct StorageFile *temp = source != NULL ? storageOpen(tempLocation, STORAGE_WRITE) : NULL;
+    int ok = temp != NULL;
+
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t l;
+    while (ok && (l = getline(&line, &len, source)) != -1){
+        storageWrite(temp, line, l);
+
+        // Snapshots of the shared history move with it
+        char *hash = changeLogRecordSnapshot(line);
+        if (hash == NULL) continue;
+        char *own = concat4(".cword/", fileName, "/", hash);
+        char *found = fileExists(own) ? NULL : changeLogSnapshotPath(fileName, hash);
+        if (found != NULL) internalCopyFile(found, own);
+        free(found);
+        free(own);
+    }
+    free(line);
+    if (source != NULL) fclose(source);
+    if (temp != NULL && storageClose(temp) == 0) ok = 0;
+
+    if (ok && storageReplace(tempLocation, location)){
+        removeChangeLogSegments(fileName);
+        char *parentLocation = concat3(".cword/", fileName, "/parent.txt");
+        storageRemove(parentLocation);
+        free(parentLocation);
+    } else {
+        storageRemove(tempLocation);
+        ok = 0;
+    }
+
+    free(location);
+    free(tempLocation);
+    unlockChangeLogs();
+    return ok;
+}
+
+/**
+ * @brief Materializes every copy sharing more than keepBytes of a files log,
+ * call before that part of the log is rewritten or removed. Only the copies on its children.txt are looked at
+ *
+ * @param fileName The tracked file
+ * @param keepBytes How much of the log will stay as it is
+ */
+void detachChangeLogChildren(char *fileName, uint64_t keepBytes){
+    lockChangeLogs();
+    char *location = concat3(".cword/", fileName, "/children.txt");
+    char *contents = readChangeLogFile(location);
+    if (contents == NULL){
+        free(location);
+        unlockChangeLogs();
+        return;
+    }
+
+    // Only the copies still sharing the history stay on the list
+    char *tempLocation = concat(location, ".temp.cword.txt");
+    struct StorageFile *kept = storageOpen(tempLocation, STORAGE_WRITE);
+    size_t remaining = 0;
+    char *child, *save = NULL;
+    for (child = strtok_r(contents, "\n", &save); child != NULL; child = strtok_r(NULL, "\n", &save)){
+        char *parent;
+        uint64_t parentBytes;
+        if (changeLogParent(child, &parent, &parentBytes) == 0) continue;
+        int shared = strcmp(parent, fileName) == 0;
+        free(parent);
+        if (shared && parentBytes > keepBytes && materializeChangeLog(child)) shared = 0;
+        if (shared && kept != NULL){
+            storageWriteString(kept, child);
+            storageWrite(kept, "\n", 1);
+            remaining++;
+        }
+    }
+    free(contents);
+
+    if (kept != NULL && storageClose(kept) && remaining > 0){
+        storageReplace(tempLocation, location);
+    } else {
+        storageRemove(tempLocation);
+        if (kept != NULL && remaining == 0) storageRemove(location);
+    }
+    free(tempLocation);
+    free(location);
+    unlockChangeLogs();
+}
+
+/**
+ * @brief Adds every tracked file under a history folder to a list
+ *
+ * @param dirLocation The folder to search, under .cword
+ * @param files The list so far
+ * @param count Files in the list
+ * @param capacity Space in the list
+ */
+static void findTrackedFiles(char *dirLocation, char ***files, size_t *count, size_t *capacity){
+    DIR *dir = opendir(dirLocation);
+    if (dir == NULL) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL){
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+
+        char *location = concat3(dirLocation, "/", entry->d_name);
+        struct stat info;
+        if (stat(location, &info) != 0 || !S_ISDIR(info.st_mode)){
+            free(location);
+            continue;
+        }
+
+        char *logLocation = concat(location, "/changelog.txt");
+        if (fileExists(logLocation)){
+            if (*count == *capacity){
+                *capacity *= 2;
+                *files = realloc(*files, *capacity * sizeof(char *));
+            }
+            (*files)[(*count)++] = strdup(location + strlen(".cword/"));
+        }
+        free(logLocation);
+
+        // Files in folders are tracked as .cword/<folder>/<file>
+        findTrackedFiles(location, files, count, capacity);
+        free(location);
+    }
+    closedir(dir);
+}
+
+/**
+ * @brief Lists every file with a history under .cword, including deleted ones
+ *
+ * @param files Set to the names, make sure to free each and the array after use!
+ * @return size_t The number of files
+ */
+size_t listTrackedFiles(char ***files){
+    size_t count = 0, capacity = 16;
+    *files = malloc(capacity * sizeof(char *));
+    findTrackedFiles(".cword", files, &count, &capacity);
+    return count;
+}
@@ -1,11 +1,42 @@
 #ifndef CHANGE_LOG_H
 #define CHANGE_LOG_H
 
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CHANGE_LOG_PAGE_SIZE 15
+// Once changelog.txt grows past this it is sealed into a compressed segment
+#define CHANGE_LOG_SEGMENT_BYTES (256 * 1024)
+// Longest chain of copies whose history is followed
+#define CHANGE_LOG_MAX_PARENTS 32
+
 
 int initiateChangeLog();
 void addToChangeLog(char *fileName, char *operation, char *info);
 void copyChangeLog(char *from, char *to);
 void viewChangeLog(char *fileName);
 
+char * changeLogSegmentPath(char *fileName, size_t segment);
+size_t changeLogSegmentCount(char *fileName);
+int changeLogStoredSize(char *fileName, uint64_t *size);
+int sealChangeLog(char *fileName);
+void removeChangeLogSegments(char *fileName);
+int truncateChangeLog(char *fileName, uint64_t offset);
+FILE * openChangeLogStream(char *fileName);
+
+int changeLogParent(char *fileName, char **parent, uint64_t *parentBytes);
+int setChangeLogParent(char *fileName, char *parent, uint64_t parentBytes);
+int changeLogShared(char *fileName);
+char * changeLogSnapshotPath(char *fileName, char *hash);
+char * storeSnapshot(char *fileName, char *source);
+char * changeLogRecordSnapshot(char *record);
+int materializeChangeLog(char *fileName);
+void detachChangeLogChildren(char *fileName, uint64_t keepBytes);
+size_t listTrackedFiles(char ***files);
+
+void lockChangeLogs();
+void unlockChangeLogs();
+
 
 #endif
\ No newline at end of file
@@ -0,0 +1,528 @@
+/**
+ * @file change_log_index.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief The binary time/operation index kept next to every changelog
+ * Lets the viewer and rollback jump straight to any record instead of reading the whole log
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#include "change_log_index.h"
+#include "change_log.h"
+#include "utils.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+static const char *operationNames[OPERATION_COUNT] = {
+    "ANY", "CREATED", "DELETED", "APPEND", "INSERT", "DELETE", "REPLACE", "SUBSTITUTE", "TRANSFORM", "UNKNOWN"
+};
+
+/**
+ * @brief Gets the name of an operation as written in the changelog
+ *
+ * @param operation The operation
+ * @return const char* The name
+ */
+const char * changeLogOperationName(int operation){
+    if (operation < 0 || operation >= OPERATION_COUNT) return operationNames[OPERATION_UNKNOWN];
+    return operationNames[operation];
+}
+
+/**
+ * @brief Gets the operation for a name written in the changelog
+ *
+ * @param name The name, case insensitive
+ * @return int The operation, OPERATION_UNKNOWN if it isn't one
+ */
+int changeLogOperationFromName(const char *name){
+    int i;
+    for (i = OPERATION_CREATED; i < OPERATION_UNKNOWN; i++){
+        if (strcasecmp(name, operationNames[i]) == 0) return i;
+    }
+    return OPERATION_UNKNOWN;
+}
+
+/**
+ * @brief Converts a records stamp to nanoseconds since the epoch
+ * Accepts both [nanoseconds] and the older [HH:MM:SS DD/MM/YYYY] stamps
+ *
+ * @param stamp The stamp including its brackets
+ * @return uint64_t The time, 0 if it couldn't be read
+ */
+uint64_t changeLogStampToNanos(const char *stamp){
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    if (sscanf(stamp, "[%d:%d:%d %d/%d/%d", &tm.tm_hour, &tm.tm_min, &tm.tm_sec, &tm.tm_mday, &tm.tm_mon, &tm.tm_year) == 6){
+        tm.tm_mon -= 1;
+        tm.tm_year -= 1900;
+        tm.tm_isdst = -1;
+        time_t seconds = mktime(&tm);
+        return seconds < 0 ? 0 : (uint64_t)seconds * 1000000000ULL;
+    }
+    if (stamp[0] != '[') return 0;
+    return strtoull(stamp + 1, NULL, 10);
+}
+
+/**
+ * @brief The wall clock in nanoseconds
+ *
+ * @return uint64_t Nanoseconds since the epoch
+ */
+uint64_t currentNanos(){
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @brief Gets the location of a changelogs index
+ * Make sure to free after use!
+ *
+ * @param fileName The tracked file
+ * @return char* The location
+ */
+char * changeLogIndexPath(char *fileName){
+    return concat3(".cword/", fileName, "/changelog.idx");
+}
+
+/**
+ * @brief Reads the header of an index file
+ *
+ * @param index The open index
+ * @param header The header to fill
+ * @return int 1 if it is a valid header, 0 if not
+ */
+static int readHeader(FILE *index, struct ChangeLogIndexHeader *header){
+    fseeko(index, 0, SEEK_SET);
+    if (fread(header, sizeof(*header), 1, index) != 1) return 0;
+    return memcmp(header->magic, "CWIX", 4) == 0 && header->version == CHANGE_LOG_INDEX_VERSION;
+}
+
+/**
+ * @brief Writes the header of an index file
+ *
+ * @param index The open index
+ * @param header The header to write
+ */
+static void writeHeader(FILE *index, struct ChangeLogIndexHeader *header){
+    memcpy(header->magic, "CWIX", 4);
+    header->version = CHANGE_LOG_INDEX_VERSION;
+    fseeko(index, 0, SEEK_SET);
+    fwrite(header, sizeof(*header), 1, index);
+}
+
+/**
+ * @brief Checks whether the main index still describes the changelog
+ *
+ * @param fileName The tracked file
+ * @param logBytes The current size of the changelog
+ * @param header Filled with the header when current, may be NULL
+ * @return int 1 if current, 0 if it must be rebuilt
+ */
+static int indexIsCurrent(char *fileName, uint64_t logBytes, struct ChangeLogIndexHeader *header){
+    char *location = changeLogIndexPath(fileName);
+    FILE *index = fopen(location, "rb");
+    free(location);
+    if (index == NULL) return 0;
+
+    struct ChangeLogIndexHeader read;
+    int current = readHeader(index, &read) && read.logBytes == logBytes;
+    fclose(index);
+    if (current && header != NULL) *header = read;
+    return current;
+}
+
+/**
+ * @brief Rebuilds the index of a changelog by reading it once
+ * Stamps that go backwards are nudged forward so the index stays sorted
+ *
+ * @param fileName The tracked file
+ * @return int 1 if ok, 0 if the changelog couldn't be read
+ */
+int rebuildChangeLogIndex(char *fileName){
+    lockChangeLogs();
+    FILE *log = openChangeLogStream(fileName);
+    if (log == NULL){
+        unlockChangeLogs();
+        return 0;
+    }
+
+    struct ChangeLogIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    char *indexLocation = changeLogIndexPath(fileName);
+    FILE *index = fopen(indexLocation, "w+b");
+    free(indexLocation);
+    // Invalid until the real header is written at the end
+    if (index != NULL) fwrite(&header, sizeof(header), 1, index);
+
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t l;
+    uint64_t offset = 0;
+
+    while ((l = getline(&line, &len, log)) != -1){
+        struct ChangeLogIndexEntry entry;
+        entry.offset = offset;
+        entry.length = l;
+        entry.nanos = changeLogStampToNanos(line);
+        if (entry.nanos <= header.lastNanos) entry.nanos = header.lastNanos + 1;
+        header.lastNanos = entry.nanos;
+
+        entry.operation = OPERATION_UNKNOWN;
+        char *first = strstr(line, "||");
+        if (first != NULL){
+            char *second = strstr(first + 2, "||");
+            if (second != NULL){
+                *second = '\0';
+                entry.operation = changeLogOperationFromName(first + 2);
+            }
+        }
+
+        if (index != NULL) fwrite(&entry, sizeof(entry), 1, index);
+        header.count++;
+        header.operationCounts[entry.operation]++;
+
+        offset += l;
+    }
+    free(line);
+    fclose(log);
+
+    header.logBytes = offset;
+    header.operationCounts[OPERATION_ANY] = header.count;
+    if (index != NULL){
+        writeHeader(index, &header);
+        fclose(index);
+    }
+
+    // Older versions kept a changelog.<OPERATION>.idx for each operation too
+    int operation;
+    for (operation = OPERATION_CREATED; operation < OPERATION_COUNT; operation++){
+        char *directory = concat3(".cword/", fileName, "/changelog.");
+        char *legacyLocation = concat3(directory, changeLogOperationName(operation), ".idx");
+        remove(legacyLocation);
+        free(legacyLocation);
+        free(directory);
+    }
+    unlockChangeLogs();
+    return 1;
+}
+
+/**
+ * @brief Makes sure the indexes match the changelog, rebuilding them if not
+ *
+ * @param fileName The tracked file
+ * @return int 1 if there is a usable index, 0 if the file has no changelog
+ */
+int ensureChangeLogIndex(char *fileName){
+    uint64_t logBytes;
+    if (changeLogStoredSize(fileName, &logBytes) == 0) return 0;
+    if (indexIsCurrent(fileName, logBytes, NULL)) return 1;
+    return rebuildChangeLogIndex(fileName);
+}
+
+/**
+ * @brief Gets the stamp for a new record, always later than every existing record
+ *
+ * @param fileName The tracked file
+ * @return uint64_t The stamp in nanoseconds
+ */
+uint64_t nextChangeLogNanos(char *fileName){
+    uint64_t now = currentNanos();
+    if (ensureChangeLogIndex(fileName) == 0) return now;
+
+    char *location = changeLogIndexPath(fileName);
+    FILE *index = fopen(location, "rb");
+    free(location);
+    if (index == NULL) return now;
+
+    struct ChangeLogIndexHeader header;
+    uint64_t last = readHeader(index, &header) ? header.lastNanos : 0;
+    fclose(index);
+    return now > last ? now : last + 1;
+}
+
+/**
+ * @brief Writes an entry at the given position of the index
+ *
+ * @param fileName The tracked file
+ * @param position The byte position
+ * @param entry The entry to write
+ * @return int 1 if ok, 0 if it couldn't be written
+ */
+static int writeEntry(char *fileName, off_t position, struct ChangeLogIndexEntry *entry){
+    char *location = changeLogIndexPath(fileName);
+    FILE *index = fopen(location, "r+b");
+    free(location);
+    if (index == NULL) return 0;
+
+    fseeko(index, position, SEEK_SET);
+    int ok = fwrite(entry, sizeof(*entry), 1, index) == 1;
+    fclose(index);
+    return ok;
+}
+
+/**
+ * @brief Records a newly appended changelog record in the index
+ * The entry is written before the header so a crash only ever loses the new entry
+ *
+ * @param fileName The tracked file
+ * @param entry The entry describing the record
+ */
+void indexChangeLogRecord(char *fileName, struct ChangeLogIndexEntry entry){
+    lockChangeLogs();
+    struct ChangeLogIndexHeader header;
+    int ok = indexIsCurrent(fileName, entry.offset, &header);
+    if (ok){
+        ok = writeEntry(fileName, sizeof(header) + header.count * sizeof(entry), &entry);
+    }
+    if (ok){
+        char *location = changeLogIndexPath(fileName);
+        FILE *index = fopen(location, "r+b");
+        free(location);
+        ok = index != NULL;
+        if (ok){
+            header.count++;
+            header.operationCounts[OPERATION_ANY]++;
+            header.operationCounts[entry.operation]++;
+            header.logBytes = entry.offset + entry.length;
+            header.lastNanos = entry.nanos;
+            writeHeader(index, &header);
+            fclose(index);
+        }
+    }
+    if (ok == 0) rebuildChangeLogIndex(fileName);
+    unlockChangeLogs();
+}
+
+/**
+ * @brief Picks the entries of one operation out of the index
+ *
+ * @param view The view, its index is read from the start of the entries
+ * @param operation The operation
+ * @param total How many entries the index has
+ * @return int 1 if ok, 0 if the index couldn't be read
+ */
+static int loadOperationEntries(struct ChangeLogView *view, int operation, uint64_t total){
+    view->entries = malloc((view->count + 1) * sizeof(struct ChangeLogIndexEntry));
+    struct ChangeLogIndexEntry *block = malloc(CHANGE_LOG_INDEX_READ_ENTRIES * sizeof(struct ChangeLogIndexEntry));
+    if (view->entries == NULL || block == NULL || fseeko(view->index, view->base, SEEK_SET) != 0){
+        free(block);
+        return 0;
+    }
+
+    size_t found = 0;
+    uint64_t read = 0;
+    while (read < total && found < view->count){
+        size_t want = total - read < CHANGE_LOG_INDEX_READ_ENTRIES ? total - read : CHANGE_LOG_INDEX_READ_ENTRIES;
+        size_t got = fread(block, sizeof(struct ChangeLogIndexEntry), want, view->index);
+        size_t i;
+        for (i = 0; i < got && found < view->count; i++){
+            if (block[i].operation == (uint32_t)operation) view->entries[found++] = block[i];
+        }
+        if (got < want) break;
+        read += got;
+    }
+    free(block);
+    view->count = found;
+    return 1;
+}
+
+/**
+ * @brief Opens a view over an index for random access reads
+ *
+ * @param view The view to open
+ * @param fileName The tracked file
+ * @param operation OPERATION_ANY for every record, otherwise only that operation
+ * @return int 1 if ok, 0 if the file has no changelog
+ */
+int openChangeLogView(struct ChangeLogView *view, char *fileName, int operation){
+    memset(view, 0, sizeof(*view));
+    if (operation < 0 || operation >= OPERATION_COUNT) return 0;
+
+    lockChangeLogs();
+    uint64_t logBytes;
+    struct ChangeLogIndexHeader header;
+    if (changeLogStoredSize(fileName, &logBytes) == 0){
+        unlockChangeLogs();
+        return 0;
+    }
+    if (indexIsCurrent(fileName, logBytes, &header) == 0){
+        rebuildChangeLogIndex(fileName);
+        if (indexIsCurrent(fileName, logBytes, &header) == 0){
+            unlockChangeLogs();
+            return 0;
+        }
+    }
+
+    char *indexLocation = changeLogIndexPath(fileName);
+    view->index = fopen(indexLocation, "rb");
+    view->log = openChangeLogStream(fileName);
+    free(indexLocation);
+    unlockChangeLogs();
+
+    if (view->index == NULL || view->log == NULL){
+        closeChangeLogView(view);
+        return 0;
+    }
+    view->count = header.operationCounts[operation];
+    view->base = sizeof(header);
+    if (operation != OPERATION_ANY && loadOperationEntries(view, operation, header.count) == 0){
+        closeChangeLogView(view);
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Reads the ith entry of a view
+ *
+ * @param view The view
+ * @param i The entry, 0 is the oldest
+ * @param entry The entry to fill
+ * @return int 1 if ok, 0 if out of range
+ */
+int readChangeLogViewEntry(struct ChangeLogView *view, size_t i, struct ChangeLogIndexEntry *entry){
+    if (i >= view->count) return 0;
+    if (view->entries != NULL){
+        *entry = view->entries[i];
+        return 1;
+    }
+    fseeko(view->index, view->base + i * sizeof(*entry), SEEK_SET);
+    return fread(entry, sizeof(*entry), 1, view->index) == 1;
+}
+
+/**
+ * @brief Reads the record an entry points to
+ * Make sure to free after use!
+ *
+ * @param view The view
+ * @param entry The entry
+ * @return char* The record including its \n, NULL if it couldn't be read
+ */
+char * readChangeLogViewRecord(struct ChangeLogView *view, struct ChangeLogIndexEntry *entry){
+    char *record = malloc(entry->length + 1);
+    fseeko(view->log, entry->offset, SEEK_SET);
+    if (fread(record, 1, entry->length, view->log) != entry->length){
+        free(record);
+        return NULL;
+    }
+    record[entry->length] = '\0';
+    return record;
+}
+
+/**
+ * @brief Finds the first entry at or after the given time
+ *
+ * @param view The view to search
+ * @param nanos The time in nanoseconds
+ * @return size_t The entry, view->count if every entry is earlier
+ */
+size_t findChangeLogNanos(struct ChangeLogView *view, uint64_t nanos){
+    size_t low = 0, high = view->count;
+    while (low < high){
+        size_t middle = low + (high - low) / 2;
+        struct ChangeLogIndexEntry entry;
+        if (readChangeLogViewEntry(view, middle, &entry) == 0) break;
+        if (entry.nanos < nanos){
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/**
+ * @brief Closes a view
+ *
+ * @param view The view to close
+ */
+void closeChangeLogView(struct ChangeLogView *view){
+    if (view->index != NULL) fclose(view->index);
+    if (view->log != NULL) fclose(view->log);
+    free(view->entries);
+    view->entries = NULL;
+    view->index = NULL;
+    view->log = NULL;
+    view->count = 0;
+}
+
+/**
+ * @brief Gets the newest record of a changelog
+ * Make sure to free after use!
+ *
+ * @param fileName The tracked file
+ * @return char* The record including its \n, NULL if there are none
+ */
+char * lastChangeLogRecord(char *fileName){
+    struct ChangeLogView view;
+    if (openChangeLogView(&view, fileName, OPERATION_ANY) == 0) return NULL;
+
+    char *record = NULL;
+    struct ChangeLogIndexEntry entry;
+    if (view.count > 0 && readChangeLogViewEntry(&view, view.count - 1, &entry)){
+        record = readChangeLogViewRecord(&view, &entry);
+    }
+    closeChangeLogView(&view);
+    return record;
+}
+
+/**
+ * @brief Removes the newest record of a changelog without rereading it
+ *
+ * @param fileName The tracked file
+ * @return int 1 if a record was removed, 0 if there was nothing to remove
+ */
+int popChangeLogRecord(char *fileName){
+    lockChangeLogs();
+    struct ChangeLogView view;
+    if (openChangeLogView(&view, fileName, OPERATION_ANY) == 0){
+        unlockChangeLogs();
+        return 0;
+    }
+
+    struct ChangeLogIndexEntry entry;
+    int ok = view.count > 0 && readChangeLogViewEntry(&view, view.count - 1, &entry);
+    closeChangeLogView(&view);
+
+    uint64_t logBytes;
+    struct ChangeLogIndexHeader header;
+    if (ok == 0 || changeLogStoredSize(fileName, &logBytes) == 0 || indexIsCurrent(fileName, logBytes, &header) == 0){
+        unlockChangeLogs();
+        return 0;
+    }
+
+    if (truncateChangeLog(fileName, entry.offset) == 0){
+        rebuildChangeLogIndex(fileName);
+        unlockChangeLogs();
+        return 0;
+    }
+
+    header.count--;
+    header.operationCounts[OPERATION_ANY]--;
+    header.operationCounts[entry.operation]--;
+    header.logBytes = entry.offset;
+
+    char *indexLocation = changeLogIndexPath(fileName);
+    FILE *index = fopen(indexLocation, "r+b");
+    if (index != NULL){
+        writeHeader(index, &header);
+        fclose(index);
+        truncate(indexLocation, sizeof(header) + header.count * sizeof(entry));
+    } else {
+        rebuildChangeLogIndex(fileName);
+    }
+    free(indexLocation);
+
+    unlockChangeLogs();
+    return 1;
+}
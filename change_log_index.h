@@ -0,0 +1,78 @@
+#ifndef CHANGE_LOG_INDEX_H
+#define CHANGE_LOG_INDEX_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Bump whenever an operation is added (the header size depends on it) or the layout changes
+#define CHANGE_LOG_INDEX_VERSION 5
+// How many index entries are read at once when picking out one operation
+#define CHANGE_LOG_INDEX_READ_ENTRIES 4096
+
+enum ChangeLogOperation
+{
+    OPERATION_ANY = 0,
+    OPERATION_CREATED,
+    OPERATION_DELETED,
+    OPERATION_APPEND,
+    OPERATION_INSERT,
+    OPERATION_DELETE,
+    OPERATION_REPLACE,
+    OPERATION_SUBSTITUTE,
+    OPERATION_TRANSFORM,
+    OPERATION_UNKNOWN,
+    OPERATION_COUNT
+};
+
+// changelog.idx is this header then an entry per record, oldest first. Views of one operation
+// pick their entries out of it when opened, the counts here say how many there will be
+struct ChangeLogIndexHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t logBytes;   // Size of changelog.txt this index describes
+    uint64_t count;
+    uint64_t lastNanos;
+    uint64_t operationCounts[OPERATION_COUNT];
+};
+
+struct ChangeLogIndexEntry
+{
+    uint64_t offset;
+    uint64_t nanos;
+    uint32_t length;     // Including the \n
+    uint32_t operation;
+};
+
+struct ChangeLogView
+{
+    FILE *index;
+    FILE *log;
+    size_t count;
+    off_t base;          // Where the entries start in the index file
+    struct ChangeLogIndexEntry *entries;    // A single operations entries, NULL when viewing every record
+};
+
+const char * changeLogOperationName(int operation);
+int changeLogOperationFromName(const char *name);
+uint64_t changeLogStampToNanos(const char *stamp);
+uint64_t currentNanos();
+
+char * changeLogIndexPath(char *fileName);
+int rebuildChangeLogIndex(char *fileName);
+int ensureChangeLogIndex(char *fileName);
+uint64_t nextChangeLogNanos(char *fileName);
+void indexChangeLogRecord(char *fileName, struct ChangeLogIndexEntry entry);
+
+int openChangeLogView(struct ChangeLogView *view, char *fileName, int operation);
+int readChangeLogViewEntry(struct ChangeLogView *view, size_t i, struct ChangeLogIndexEntry *entry);
+char * readChangeLogViewRecord(struct ChangeLogView *view, struct ChangeLogIndexEntry *entry);
+size_t findChangeLogNanos(struct ChangeLogView *view, uint64_t nanos);
+void closeChangeLogView(struct ChangeLogView *view);
+
+char * lastChangeLogRecord(char *fileName);
+int popChangeLogRecord(char *fileName);
+
+#endif
@@ -0,0 +1,605 @@
+/**
+ * @file compaction.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Keeps changelogs and deleted file snapshots from growing forever
+ * Squashes redundant records, applies the retention policy and removes orphaned snapshots
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#include "compaction.h"
+#include "change_log.h"
+#include "change_log_index.h"
+#include "file_operations.h"
+#include "interface.h"
+#include "utils.h"
+#include "pack.h"
+#include "compression.h"
+#include "scheduler.h"
+#include "storage.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+struct CompactionRecord
+{
+    char *stamp;      // The [..] part, kept as written
+    char *operation;
+    char *info;
+    time_t time;
+};
+
+/**
+ * @brief The policy used when the user compacts history
+ *
+ * @return struct RetentionPolicy The default policy
+ */
+struct RetentionPolicy defaultRetentionPolicy(){
+    struct RetentionPolicy policy;
+    policy.maxAge = (time_t)RETENTION_MAX_AGE_DAYS * 24 * 60 * 60;
+    policy.maxBytes = RETENTION_MAX_BYTES;
+    policy.maxRecords = RETENTION_MAX_RECORDS;
+    return policy;
+}
+
+/**
+ * @brief The policy used by background maintenance, records are only folded and nothing is dropped
+ *
+ * @return struct RetentionPolicy A policy without any limits
+ */
+struct RetentionPolicy keepAllRetentionPolicy(){
+    struct RetentionPolicy policy;
+    memset(&policy, 0, sizeof(policy));
+    return policy;
+}
+
+/**
+ * @brief Splits a changelog line into a record
+ *
+ * @param line The line, without its \n
+ * @param record The record to fill
+ * @return int 1 if ok, 0 if the line isn't a record
+ */
+static int parseRecord(char *line, struct CompactionRecord *record){
+    char *first = strstr(line, "||");
+    if (first == NULL) return 0;
+    char *second = strstr(first + 2, "||");
+    if (second == NULL) return 0;
+
+    *first = '\0';
+    *second = '\0';
+    record->stamp = strdup(line);
+    record->operation = strdup(first + 2);
+    record->info = strdup(second + 2);
+    record->time = changeLogStampToNanos(record->stamp) / 1000000000ULL;
+    return 1;
+}
+
+/**
+ * @brief Frees the strings owned by a record
+ *
+ * @param record The record to free
+ */
+static void freeRecord(struct CompactionRecord *record){
+    free(record->stamp);
+    free(record->operation);
+    free(record->info);
+}
+
+/**
+ * @brief The length of the record once written back to the changelog
+ *
+ * @param record The record
+ * @return size_t The amount of bytes including the \n
+ */
+static size_t recordLength(struct CompactionRecord *record){
+    return strlen(record->stamp) + strlen(record->operation) + strlen(record->info) + 5;
+}
+
+/**
+ * @brief Gets the line number stored at the start of an INSERT or DELETE info
+ *
+ * @param info The info to read
+ * @return long The line number
+ */
+static long recordLineNumber(char *info){
+    return strtol(info, NULL, 10);
+}
+
+/**
+ * @brief Gets how many lines an INSERT added, a block stores it after the line number as n::count
+ *
+ * @param info The info to read
+ * @return long The number of lines
+ */
+static long recordLineCount(char *info){
+    char *separator = strstr(info, "::");
+    return separator != NULL ? strtol(separator + 2, NULL, 10) : 1;
+}
+
+/**
+ * @brief Pushes the next record onto the compacted stack, folding it into the top record when possible:
+ * APPEND a, APPEND b -> APPEND a+b (unless b was joined onto a last line without a \n, a keeps its own ::joined)
+ * INSERT n, DELETE n -> nothing (only for a single line, not a block)
+ * INSERT n, REPLACE n -> INSERT n
+ * REPLACE n, REPLACE n -> the first REPLACE, which holds the original content
+ * APPEND 0 -> nothing
+ *
+ * @param stack The compacted records
+ * @param top Pointer to the number of records on the stack
+ * @param record The record to push, owned by the stack afterwards
+ */
+static void pushRecord(struct CompactionRecord *stack, size_t *top, struct CompactionRecord record){
+    if (strcmp(record.operation, "APPEND") == 0){
+        long count = strtol(record.info, NULL, 10);
+        if (count <= 0){
+            freeRecord(&record);
+            return;
+        }
+
+        if (*top > 0 && strcmp(stack[*top - 1].operation, "APPEND") == 0 && strstr(record.info, "::joined") == NULL){
+            struct CompactionRecord *previous = &stack[*top - 1];
+            char number[32];
+            sprintf(number, strstr(previous->info, "::joined") != NULL ? "%ld::joined" : "%ld", strtol(previous->info, NULL, 10) + count);
+
+            // Keep the newest stamp so retention treats the squashed record as recent
+            free(previous->stamp);
+            free(previous->info);
+            previous->stamp = record.stamp;
+            previous->info = strdup(number);
+            previous->time = record.time;
+            free(record.operation);
+            free(record.info);
+            return;
+        }
+    } else if (strcmp(record.operation, "DELETE") == 0){
+        if (*top > 0 && strcmp(stack[*top - 1].operation, "INSERT") == 0 && recordLineCount(stack[*top - 1].info) == 1
+            && recordLineNumber(stack[*top - 1].info) == recordLineNumber(record.info)){
+            (*top)--;
+            freeRecord(&stack[*top]);
+            freeRecord(&record);
+            return;
+        }
+    } else if (strcmp(record.operation, "REPLACE") == 0){
+        if (*top > 0 && recordLineNumber(stack[*top - 1].info) == recordLineNumber(record.info)
+            && (strcmp(stack[*top - 1].operation, "INSERT") == 0 || strcmp(stack[*top - 1].operation, "REPLACE") == 0)){
+            struct CompactionRecord *previous = &stack[*top - 1];
+            free(previous->stamp);
+            previous->stamp = record.stamp;
+            previous->time = record.time;
+            free(record.operation);
+            free(record.info);
+            return;
+        }
+    }
+
+    stack[(*top)++] = record;
+}
+
+/**
+ * @brief Checks if a name looks like a snapshot made by saveDeletedFileForVersionControl
+ *
+ * @param name The entry name
+ * @return int 1 if it is a snapshot name, 0 if not
+ */
+static int isSnapshotName(char *name){
+    if (*name == '\0') return 0;
+    for (; *name; name++){
+        if (!isdigit((unsigned char)*name)) return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Checks if a snapshot name is in a list of referenced ones
+ *
+ * @param referenced The referenced names
+ * @param count How many there are
+ * @param name The snapshot
+ * @return int 1 if it is referenced
+ */
+static int isReferenced(char **referenced, size_t count, const char *name){
+    size_t i;
+    for (i = 0; i < count; i++){
+        if (strcmp(referenced[i], name) == 0) return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks that a changelog hasn't been written to since it was first looked at
+ *
+ * @param fileName The tracked file
+ * @param before Its changelog.txt as it was
+ * @param segments How many sealed segments it had
+ * @return int 1 if it is unchanged
+ */
+static int changeLogUnchanged(char *fileName, struct StorageStat *before, size_t segments){
+    char *location = concat3(".cword/", fileName, "/changelog.txt");
+    struct StorageStat now;
+    int same = storageStat(location, &now) && now.size == before->size && now.mtimeNanos == before->mtimeNanos
+        && now.inode == before->inode && changeLogSegmentCount(fileName) == segments;
+    free(location);
+    return same;
+}
+
+/**
+ * @brief Compacts the changelog of a file and enforces the retention policy. When the user asks for it
+ * the changelog lock is held throughout. In the background the log is read and the compacted one
+ * written without it, it is only taken to open the log and to swap the new one in, and if the log was
+ * written to in between nothing is changed
+ *
+ * @param fileName The file whose changelog to compact
+ * @param policy The retention policy to apply
+ * @param result Filled with before/after statistics, may be NULL
+ * @param task The task doing it so it can stop early, may be NULL
+ * @return int 1 if ok, 0 if the changelog couldn't be compacted
+ */
+int compactChangeLog(char *fileName, struct RetentionPolicy policy, struct CompactionResult *result, struct ScheduledTask *task){
+    struct CompactionResult stats;
+    memset(&stats, 0, sizeof(stats));
+    if (result != NULL) *result = stats;
+
+    char *location = concat3(".cword/", fileName, "/changelog.txt");
+
+    if (task == NULL) lockChangeLogs();
+    lockChangeLogs();
+    struct StorageStat before;
+    size_t segments = changeLogSegmentCount(fileName);
+    FILE *source = storageStat(location, &before) ? openChangeLogStream(fileName) : NULL;
+    unlockChangeLogs();
+    if (source == NULL){
+        if (task == NULL) unlockChangeLogs();
+        free(location);
+        return 0;
+    }
+
+    size_t capacity = 64;
+    size_t top = 0;
+    struct CompactionRecord *records = malloc(capacity * sizeof(struct CompactionRecord));
+
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t l;
+
+    while ((l = getline(&line, &len, source)) != -1){
+        stats.recordsBefore++;
+        stats.bytesBefore += l;
+        if (l > 0 && line[l - 1] == '\n') line[l - 1] = '\0';
+
+        struct CompactionRecord record;
+        if (parseRecord(line, &record) == 0) continue;
+
+        if (top == capacity){
+            capacity *= 2;
+            records = realloc(records, capacity * sizeof(struct CompactionRecord));
+        }
+        pushRecord(records, &top, record);
+    }
+    free(line);
+    fclose(source);
+
+    // Retention, always drop from the oldest end so rollback keeps working from the newest
+    size_t totalBytes = 0;
+    size_t i;
+    for (i = 0; i < top; i++) totalBytes += recordLength(&records[i]);
+
+    time_t now = time(NULL);
+    size_t start = 0;
+    while (start < top){
+        int tooMany = policy.maxRecords != 0 && (top - start) > policy.maxRecords;
+        int tooBig = policy.maxBytes != 0 && totalBytes > policy.maxBytes;
+        int tooOld = policy.maxAge != 0 && records[start].time != 0 && (now - records[start].time) > policy.maxAge;
+        if (!tooMany && !tooBig && !tooOld) break;
+
+        totalBytes -= recordLength(&records[start]);
+        start++;
+    }
+
+    stats.recordsAfter = top - start;
+    stats.bytesAfter = totalBytes;
+
+    // Nothing to fold or drop, leave the log alone so copies can keep sharing it
+    int ok = 1;
+    int changed = stats.recordsAfter != stats.recordsBefore || stats.bytesAfter != stats.bytesBefore;
+    if (changed && task != NULL && taskCancelled(task)) ok = 0;
+
+    // Background maintenance and the user may both compact a file, they write different temporary logs
+    char *tempName = concat(location, task != NULL ? ".maintain.cword.txt" : ".compact.cword.txt");
+    struct StorageFile *temp = changed && ok ? storageOpen(tempName, STORAGE_WRITE) : NULL;
+    if (changed && temp == NULL) ok = 0;
+    for (i = start; i < top && temp != NULL && ok; i++){
+        ok = storageWriteString(temp, records[i].stamp) && storageWrite(temp, "||", 2) && storageWriteString(temp, records[i].operation)
+            && storageWrite(temp, "||", 2) && storageWriteString(temp, records[i].info) && storageWrite(temp, "\n", 1);
+    }
+    if (temp != NULL && storageClose(temp) == 0) ok = 0;
+
+    if (changed && ok){
+        lockChangeLogs();
+        // Records added or rolled back since it was read would be lost
+        ok = changeLogUnchanged(fileName, &before, segments);
+        // Every offset is about to change
+        if (ok) detachChangeLogChildren(fileName, 0);
+        // The compacted log replaces every sealed segment and any shared history too, only once it is all written
+        if (ok && storageReplace(tempName, location)){
+            removeChangeLogSegments(fileName);
+            char *parentLocation = concat3(".cword/", fileName, "/parent.txt");
+            storageRemove(parentLocation);
+            free(parentLocation);
+            rebuildChangeLogIndex(fileName);
+        } else {
+            ok = 0;
+        }
+        unlockChangeLogs();
+    }
+    if (changed && ok == 0) storageRemove(tempName);
+    free(tempName);
+
+    for (i = 0; i < top; i++) freeRecord(&records[i]);
+    free(records);
+    free(location);
+    if (ok) stats.snapshotsRemoved = collectOrphanedSnapshots(fileName);
+    if (task == NULL) unlockChangeLogs();
+    if (ok == 0) return 0;
+
+    if (result != NULL) *result = stats;
+    return 1;
+}
+
+/**
+ * @brief Removes snapshots in the files history folder that no record refers to anymore
+ *
+ * @param fileName The file whose snapshots to check
+ * @return size_t The amount of snapshots removed
+ */
+size_t collectOrphanedSnapshots(char *fileName){
+    char *dirLocation = concat(".cword/", fileName);
+
+    DIR *dir = opendir(dirLocation);
+    if (dir == NULL){
+        free(dirLocation);
+        return 0;
+    }
+
+    lockChangeLogs();
+
+    // Gather the referenced hashes first, there are only ever a few DELETED, SUBSTITUTE and TRANSFORM records
+    size_t referencedCount = 0, referencedCapacity = 8;
+    char **referenced = malloc(referencedCapacity * sizeof(char *));
+
+    FILE *log = openChangeLogStream(fileName);
+    if (log != NULL){
+        char *line = NULL;
+        size_t len = 0;
+        ssize_t l;
+        while ((l = getline(&line, &len, log)) != -1){
+            char *hash = changeLogRecordSnapshot(line);
+            if (hash == NULL) continue;
+            if (referencedCount == referencedCapacity){
+                referencedCapacity *= 2;
+                referenced = realloc(referenced, referencedCapacity * sizeof(char *));
+            }
+            referenced[referencedCount++] = strdup(hash);
+        }
+        free(line);
+        fclose(log);
+    }
+
+    size_t removed = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL){
+        if (isSnapshotName(entry->d_name) == 0) continue;
+        if (isReferenced(referenced, referencedCount, entry->d_name)) continue;
+
+        // A snapshot this new may belong to a record that is still being written
+        char *snapshot = concat3(dirLocation, "/", entry->d_name);
+        struct stat info;
+        if (stat(snapshot, &info) == 0 && time(NULL) - info.st_mtime < SNAPSHOT_GRACE_SECONDS){
+            free(snapshot);
+            continue;
+        }
+        if (remove(snapshot) == 0) removed++;
+        free(snapshot);
+    }
+    closedir(dir);
+
+    // The same again for snapshots already moved into the pack
+    struct PackMember *packed;
+    size_t packedCount = listPackedMembers(fileName, &packed), i;
+    char **unused = malloc((packedCount + 1) * sizeof(char *));
+    size_t unusedCount = 0;
+    for (i = 0; i < packedCount; i++){
+        if (isSnapshotName(packed[i].name) == 0 || isReferenced(referenced, referencedCount, packed[i].name)) continue;
+        if (time(NULL) - packed[i].modified < SNAPSHOT_GRACE_SECONDS) continue;
+        unused[unusedCount++] = packed[i].name;
+    }
+    if (unusedCount > 0 && removePackedMembers(fileName, unused, unusedCount)) removed += unusedCount;
+    free(unused);
+    freePackMembers(packed, packedCount);
+
+    unlockChangeLogs();
+
+    for (i = 0; i < referencedCount; i++) free(referenced[i]);
+    free(referenced);
+    free(dirLocation);
+    return removed;
+}
+
+/**
+ * @brief Compacts every changelog under .cword
+ *
+ * @param policy The retention policy to apply
+ * @param total Filled with the combined statistics, may be NULL
+ */
+void compactAllChangeLogs(struct RetentionPolicy policy, struct CompactionResult *total){
+    struct CompactionResult sum;
+    memset(&sum, 0, sizeof(sum));
+
+    // Files in folders are tracked as .cword/<folder>/<file>, so the whole tree is walked
+    char **files;
+    size_t count = listTrackedFiles(&files), i;
+    for (i = 0; i < count; i++){
+        struct CompactionResult result;
+        if (compactChangeLog(files[i], policy, &result, NULL)){
+            sum.recordsBefore += result.recordsBefore;
+            sum.recordsAfter += result.recordsAfter;
+            sum.bytesBefore += result.bytesBefore;
+            sum.bytesAfter += result.bytesAfter;
+            sum.snapshotsRemoved += result.snapshotsRemoved;
+        }
+        free(files[i]);
+    }
+    free(files);
+
+    if (total != NULL) *total = sum;
+}
+
+/**
+ * @brief Compacts a files history on request and shows what was removed
+ *
+ * @param fileName The file to compact, * for every tracked file
+ */
+void compactHistory(char *fileName){
+    struct CompactionResult result;
+
+    struct RepackResult repacked;
+    memset(&repacked, 0, sizeof(repacked));
+    if (strcmp(fileName, "*") == 0){
+        waitScreen("Compacting all changelogs.\nPlease wait...\n");
+        compactAllChangeLogs(defaultRetentionPolicy(), &result);
+        repackHistory(&repacked, NULL);
+    } else {
+        char *location = concat3(".cword/", fileName, "/changelog.txt");
+        int exists = fileExists(location);
+        free(location);
+        if (exists == 0){
+            infoScreen("That file doesn't have any changelog history!");
+            return;
+        }
+        waitScreen("Compacting changelog.\nPlease wait...\n");
+        compactChangeLog(fileName, defaultRetentionPolicy(), &result, NULL);
+    }
+
+    char message[256];
+    sprintf(message, "History compacted!\n\nRecords: %zu -> %zu\nBytes: %zu -> %zu\nSnapshots removed: %zu\nSegments and snapshots packed: %zu",
+        result.recordsBefore, result.recordsAfter, result.bytesBefore, result.bytesAfter, result.snapshotsRemoved, repacked.membersPacked);
+    infoScreen(message);
+}
+
+/**
+ * @brief Compresses the snapshots of a file that were stored as plain copies, so deleting a file
+ * only costs a copy while the user waits. Each is checked after compressing and only then swapped in
+ *
+ * @param fileName The tracked file
+ * @param task The task doing it so it can stop early, may be NULL
+ * @return size_t The amount of snapshots compressed
+ */
+size_t compressLooseSnapshots(char *fileName, struct ScheduledTask *task){
+    char *dirLocation = concat(".cword/", fileName);
+    DIR *dir = opendir(dirLocation);
+    if (dir == NULL){
+        free(dirLocation);
+        return 0;
+    }
+
+    size_t compressed = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && (task == NULL || taskCancelled(task) == 0)){
+        if (isSnapshotName(entry->d_name) == 0) continue;
+        char *location = concat3(dirLocation, "/", entry->d_name);
+        if (isCompressedFile(location)){
+            free(location);
+            continue;
+        }
+
+        char *tempLocation = concat(location, ".compress.cword.txt");
+        int ok = compressFile(location, tempLocation) && verifyCompressedFile(tempLocation);
+        // Repacking or collection may have moved or removed it in the meantime
+        lockChangeLogs();
+        if (ok && fileExists(location) && isCompressedFile(location) == 0 && rename(tempLocation, location) == 0){
+            compressed++;
+        } else {
+            remove(tempLocation);
+        }
+        unlockChangeLogs();
+        free(tempLocation);
+        free(location);
+    }
+    closedir(dir);
+    free(dirLocation);
+    return compressed;
+}
+
+/**
+ * @brief The body of a snapshot compression task
+ *
+ * @param task The task, its subject is the tracked file
+ * @param context Unused
+ */
+static void compressSnapshotsTask(struct ScheduledTask *task, void *context){
+    compressLooseSnapshots(task->subject, task);
+}
+
+/**
+ * @brief Compresses a files plain snapshots in the background
+ *
+ * @param fileName The tracked file
+ */
+void scheduleSnapshotCompression(char *fileName){
+    scheduleTask(TASK_PRIORITY_NORMAL, "compressSnapshots", fileName, compressSnapshotsTask, NULL, NULL);
+}
+
+/**
+ * @brief The body of a maintenance task, one per tracked file so stopping only ever waits for one
+ *
+ * @param task The task, its subject is the tracked file
+ * @param context Unused
+ */
+static void maintainHistoryTask(struct ScheduledTask *task, void *context){
+    // History is only ever dropped when the user compacts it, maintenance just folds records. Shared logs
+    // are left alone, folding them would give every copy (or the copy itself) a full history of its own
+    if (changeLogShared(task->subject) == 0) compactChangeLog(task->subject, keepAllRetentionPolicy(), NULL, task);
+    if (taskCancelled(task)) return;
+    // Picks up snapshots left plain when CWord last exited
+    compressLooseSnapshots(task->subject, task);
+    if (taskCancelled(task)) return;
+    // A stale index is rebuilt now rather than when the changelog is next shown
+    lockChangeLogs();
+    ensureChangeLogIndex(task->subject);
+    unlockChangeLogs();
+}
+
+/**
+ * @brief The body of the repacking task
+ *
+ * @param task The task
+ * @param context Unused
+ */
+static void repackHistoryTask(struct ScheduledTask *task, void *context){
+    // Keeps the number of files under .cword down without repacking on every start
+    if (countLooseMembers() >= PACK_LOOSE_THRESHOLD) repackHistory(NULL, task);
+}
+
+/**
+ * @brief Queues compacting, compressing, indexing and (when needed) repacking every changelog for when
+ * the user is idle. Changelog writers hold the changelog lock so they never race with it
+ *
+ */
+void scheduleMaintenance(){
+    char **files;
+    size_t count = listTrackedFiles(&files), i;
+    for (i = 0; i < count; i++){
+        scheduleTask(TASK_PRIORITY_IDLE, "maintainHistory", files[i], maintainHistoryTask, NULL, NULL);
+        free(files[i]);
+    }
+    free(files);
+    scheduleTask(TASK_PRIORITY_IDLE, "repackHistory", "*", repackHistoryTask, NULL, NULL);
+}
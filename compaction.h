@@ -0,0 +1,44 @@
+#ifndef COMPACTION_H
+#define COMPACTION_H
+
+#include <stddef.h>
+#include <time.h>
+
+#include "scheduler.h"
+
+// Limits applied when the user compacts history, background maintenance never drops records
+#define RETENTION_MAX_AGE_DAYS 90
+#define RETENTION_MAX_BYTES (1024 * 1024)
+#define RETENTION_MAX_RECORDS 10000
+// Snapshots younger than this are never collected
+#define SNAPSHOT_GRACE_SECONDS (10 * 60)
+
+struct RetentionPolicy
+{
+    time_t maxAge;       // Seconds, 0 = keep forever
+    size_t maxBytes;     // 0 = no size limit
+    size_t maxRecords;   // 0 = no record limit
+};
+
+struct CompactionResult
+{
+    size_t recordsBefore;
+    size_t recordsAfter;
+    size_t bytesBefore;
+    size_t bytesAfter;
+    size_t snapshotsRemoved;
+};
+
+struct RetentionPolicy defaultRetentionPolicy();
+struct RetentionPolicy keepAllRetentionPolicy();
+
+int compactChangeLog(char *fileName, struct RetentionPolicy policy, struct CompactionResult *result, struct ScheduledTask *task);
+size_t collectOrphanedSnapshots(char *fileName);
+void compactAllChangeLogs(struct RetentionPolicy policy, struct CompactionResult *total);
+
+void compactHistory(char *fileName);
+size_t compressLooseSnapshots(char *fileName, struct ScheduledTask *task);
+void scheduleSnapshotCompression(char *fileName);
+void scheduleMaintenance();
+
+#endif
@@ -0,0 +1,505 @@
+/**
+ * @file compression.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief A small LZ77 block codec and the block file format used for history storage
+ * Every block carries its own header so any part of a file can be read by decompressing just its block
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#include "compression.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#define MIN_MATCH 4
+#define LAST_LITERALS 5
+#define MAX_OFFSET 65535
+#define HASH_BITS 12
+
+/**
+ * @brief Reads 4 unaligned bytes
+ *
+ * @param p Where to read
+ * @return uint32_t The bytes
+ */
+static uint32_t read32(const unsigned char *p){
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Hashes 4 bytes into the match table
+ *
+ * @param sequence The bytes
+ * @return uint32_t The table slot
+ */
+static uint32_t hashSequence(uint32_t sequence){
+    return (sequence * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/**
+ * @brief The most a block can grow by when it doesn't compress
+ *
+ * @param length The raw length
+ * @return size_t The worst case compressed length
+ */
+size_t compressedBlockBound(size_t length){
+    return length + length / 255 + 16;
+}
+
+/**
+ * @brief Writes a length that didn't fit in its token nibble
+ *
+ * @param out Where to write, advanced past the written bytes
+ * @param length The length left over
+ */
+static void writeExtraLength(unsigned char **out, size_t length){
+    while (length >= 255){
+        *(*out)++ = 255;
+        length -= 255;
+    }
+    *(*out)++ = (unsigned char)length;
+}
+
+/**
+ * @brief Writes a sequence of literals followed by a match (or no match for the last sequence)
+ *
+ * @param out Where to write, advanced past the sequence
+ * @param literals The literal bytes
+ * @param literalLength How many literals
+ * @param offset How far back the match is
+ * @param matchLength The match length, 0 for the last sequence
+ */
+static void writeSequence(unsigned char **out, const unsigned char *literals, size_t literalLength, size_t offset, size_t matchLength){
+    unsigned char *token = (*out)++;
+    *token = (unsigned char)((literalLength >= 15 ? 15 : literalLength) << 4);
+    if (literalLength >= 15) writeExtraLength(out, literalLength - 15);
+    memcpy(*out, literals, literalLength);
+    *out += literalLength;
+
+    if (matchLength == 0) return;
+
+    *(*out)++ = offset & 0xFF;
+    *(*out)++ = (offset >> 8) & 0xFF;
+    size_t code = matchLength - MIN_MATCH;
+    *token |= code >= 15 ? 15 : code;
+    if (code >= 15) writeExtraLength(out, code - 15);
+}
+
+/**
+ * @brief Compresses a block with a greedy single probe hash match finder
+ *
+ * @param source The raw data
+ * @param length The raw length
+ * @param destination Where to write
+ * @param capacity Space at destination, should be compressedBlockBound(length)
+ * @return size_t The compressed length, 0 if it didn't fit
+ */
+size_t compressBlock(const unsigned char *source, size_t length, unsigned char *destination, size_t capacity){
+    if (capacity < compressedBlockBound(length)) return 0;
+
+    uint32_t table[1 << HASH_BITS];
+    memset(table, 0, sizeof(table));
+
+    unsigned char *out = destination;
+    size_t position = 0, anchor = 0;
+    size_t limit = length > LAST_LITERALS + MIN_MATCH ? length - LAST_LITERALS - MIN_MATCH : 0;
+
+    while (position < limit){
+        uint32_t sequence = read32(source + position);
+        uint32_t slot = hashSequence(sequence);
+        // Positions are stored +1 so 0 means empty
+        size_t candidate = table[slot];
+        table[slot] = position + 1;
+
+        if (candidate == 0 || position - (candidate - 1) > MAX_OFFSET || read32(source + candidate - 1) != sequence){
+            position++;
+            continue;
+        }
+        candidate--;
+
+        size_t matchLength = MIN_MATCH;
+        while (position + matchLength < length - LAST_LITERALS && source[candidate + matchLength] == source[position + matchLength]){
+            matchLength++;
+        }
+
+        writeSequence(&out, source + anchor, position - anchor, position - candidate, matchLength);
+        position += matchLength;
+        anchor = position;
+    }
+
+    writeSequence(&out, source + anchor, length - anchor, 0, 0);
+    return out - destination;
+}
+
+/**
+ * @brief Reads a length that didn't fit in its token nibble
+ *
+ * @param in Where to read, advanced past the bytes
+ * @param end The end of the input
+ * @param length Added to
+ * @return int 1 if ok, 0 if the input ran out
+ */
+static int readExtraLength(const unsigned char **in, const unsigned char *end, size_t *length){
+    unsigned char byte;
+    do {
+        if (*in >= end) return 0;
+        byte = *(*in)++;
+        *length += byte;
+    } while (byte == 255);
+    return 1;
+}
+
+/**
+ * @brief Decompresses a block, checking every length against the buffers
+ *
+ * @param source The compressed data
+ * @param length The compressed length
+ * @param destination Where to write
+ * @param capacity Space at destination
+ * @return long The raw length, -1 if the block is corrupt
+ */
+long decompressBlock(const unsigned char *source, size_t length, unsigned char *destination, size_t capacity){
+    const unsigned char *in = source, *end = source + length;
+    unsigned char *out = destination, *outEnd = destination + capacity;
+
+    while (in < end){
+        unsigned char token = *in++;
+
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && readExtraLength(&in, end, &literalLength) == 0) return -1;
+        if (literalLength > (size_t)(end - in) || literalLength > (size_t)(outEnd - out)) return -1;
+        memcpy(out, in, literalLength);
+        in += literalLength;
+        out += literalLength;
+
+        // The last sequence has no match
+        if (in >= end) break;
+
+        if (end - in < 2) return -1;
+        size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+        if (offset == 0 || offset > (size_t)(out - destination)) return -1;
+
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && readExtraLength(&in, end, &matchLength) == 0) return -1;
+        matchLength += MIN_MATCH;
+        if (matchLength > (size_t)(outEnd - out)) return -1;
+
+        unsigned char *match = out - offset;
+        if (offset >= matchLength){
+            memcpy(out, match, matchLength);
+            out += matchLength;
+        } else {
+            // Overlapping copy repeats the pattern
+            while (matchLength--) *out++ = *match++;
+        }
+    }
+    return out - destination;
+}
+
+/**
+ * @brief A cheap checksum of a blocks raw data (FNV-1a)
+ *
+ * @param data The data
+ * @param length Its length
+ * @return uint32_t The checksum
+ */
+uint32_t blockChecksum(const unsigned char *data, size_t length){
+    uint32_t hash = 2166136261U;
+    size_t i;
+    for (i = 0; i < length; i++){
+        hash ^= data[i];
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+/**
+ * @brief Compresses a file into the block file format
+ *
+ * @param source The file to compress
+ * @param destination The compressed file to create
+ * @return int 1 if ok, 0 if either file couldn't be opened
+ */
+int compressFile(char *source, char *destination){
+    uint64_t trace = TRACE_BEGIN();
+    FILE *in = fopen(source, "rb");
+    if (in == NULL) return 0;
+    FILE *out = fopen(destination, "wb");
+    if (out == NULL){
+        fclose(in);
+        return 0;
+    }
+
+    struct CompressedFileHeader header;
+    memcpy(header.magic, COMPRESSION_MAGIC, 4);
+    header.blockSize = COMPRESSION_BLOCK_SIZE;
+    header.rawSize = 0;
+    fwrite(&header, sizeof(header), 1, out);
+
+    unsigned char *raw = malloc(COMPRESSION_BLOCK_SIZE);
+    unsigned char *packed = malloc(compressedBlockBound(COMPRESSION_BLOCK_SIZE));
+    size_t blockCount = 0, blockCapacity = 16;
+    uint64_t *offsets = malloc(blockCapacity * sizeof(uint64_t));
+
+    size_t read;
+    while ((read = fread(raw, 1, COMPRESSION_BLOCK_SIZE, in)) > 0){
+        if (blockCount == blockCapacity){
+            blockCapacity *= 2;
+            offsets = realloc(offsets, blockCapacity * sizeof(uint64_t));
+        }
+        offsets[blockCount++] = ftello(out);
+
+        struct CompressedBlockHeader block;
+        block.rawLength = read;
+        block.checksum = blockChecksum(raw, read);
+        size_t packedLength = compressBlock(raw, read, packed, compressedBlockBound(COMPRESSION_BLOCK_SIZE));
+
+        if (packedLength == 0 || packedLength >= read){
+            block.storedLength = read;
+            fwrite(&block, sizeof(block), 1, out);
+            fwrite(raw, 1, read, out);
+        } else {
+            block.storedLength = packedLength;
+            fwrite(&block, sizeof(block), 1, out);
+            fwrite(packed, 1, packedLength, out);
+        }
+        header.rawSize += read;
+    }
+
+    // Footer: block offsets, block count then the footer magic
+    uint32_t count = blockCount;
+    fwrite(offsets, sizeof(uint64_t), blockCount, out);
+    fwrite(&count, sizeof(count), 1, out);
+    fwrite(COMPRESSION_FOOTER_MAGIC, 1, 4, out);
+
+    fseeko(out, 0, SEEK_SET);
+    fwrite(&header, sizeof(header), 1, out);
+
+    int ok = ferror(out) == 0 && ferror(in) == 0;
+    fclose(in);
+    fclose(out);
+    free(raw);
+    free(packed);
+    free(offsets);
+    TRACE_END("compressFile", trace, header.rawSize);
+    return ok;
+}
+
+/**
+ * @brief Checks if a file is in the block file format
+ *
+ * @param fileName The file to check
+ * @return int 1 if it is, 0 if not
+ */
+int isCompressedFile(char *fileName){
+    FILE *file = fopen(fileName, "rb");
+    if (file == NULL) return 0;
+    char magic[4];
+    int compressed = fread(magic, 1, 4, file) == 4 && memcmp(magic, COMPRESSION_MAGIC, 4) == 0;
+    fclose(file);
+    return compressed;
+}
+
+/**
+ * @brief Opens a compressed file for random access reads
+ *
+ * @param compressed The handle to fill
+ * @param fileName The compressed file
+ * @return int 1 if ok, 0 if it isn't a valid compressed file
+ */
+int openCompressedFile(struct CompressedFile *compressed, char *fileName){
+    return openCompressedRegion(compressed, fileName, 0, 0);
+}
+
+/**
+ * @brief Opens compressed data stored inside a bigger file, such as a history pack
+ *
+ * @param compressed The handle to fill
+ * @param fileName The file holding it
+ * @param base Where the compressed data starts
+ * @param length How long it is, 0 for the rest of the file
+ * @return int 1 if ok, 0 if it isn't valid compressed data
+ */
+int openCompressedRegion(struct CompressedFile *compressed, char *fileName, uint64_t base, uint64_t length){
+    memset(compressed, 0, sizeof(*compressed));
+    compressed->cachedBlock = -1;
+    compressed->base = base;
+
+    compressed->file = fopen(fileName, "rb");
+    if (compressed->file == NULL) return 0;
+    if (length == 0){
+        struct stat info;
+        if (fstat(fileno(compressed->file), &info) != 0 || (uint64_t)info.st_size < base){
+            closeCompressedFile(compressed);
+            return 0;
+        }
+        length = info.st_size - base;
+    }
+    off_t end = base + length;
+
+    struct CompressedFileHeader header;
+    uint32_t count;
+    char magic[4];
+    if (length < sizeof(header) + 8 || fseeko(compressed->file, base, SEEK_SET) != 0
+        || fread(&header, sizeof(header), 1, compressed->file) != 1 || memcmp(header.magic, COMPRESSION_MAGIC, 4) != 0
+        || header.blockSize == 0
+        || fseeko(compressed->file, end - 8, SEEK_SET) != 0 || fread(&count, sizeof(count), 1, compressed->file) != 1
+        || fread(magic, 1, 4, compressed->file) != 4 || memcmp(magic, COMPRESSION_FOOTER_MAGIC, 4) != 0){
+        closeCompressedFile(compressed);
+        return 0;
+    }
+
+    compressed->rawSize = header.rawSize;
+    compressed->blockSize = header.blockSize;
+    compressed->blockCount = count;
+    compressed->blockOffsets = malloc((count + 1) * sizeof(uint64_t));
+    if (fseeko(compressed->file, end - 8 - (off_t)(count * sizeof(uint64_t)), SEEK_SET) != 0
+        || fread(compressed->blockOffsets, sizeof(uint64_t), count, compressed->file) != count){
+        closeCompressedFile(compressed);
+        return 0;
+    }
+    compressed->cache = malloc(compressed->blockSize);
+    return 1;
+}
+
+/**
+ * @brief Loads a block into the handles cache
+ *
+ * @param compressed The handle
+ * @param block The block to load
+ * @return int 1 if ok, 0 if the block is corrupt
+ */
+static int loadBlock(struct CompressedFile *compressed, size_t block){
+    if ((long)block == compressed->cachedBlock) return 1;
+    if (block >= compressed->blockCount) return 0;
+
+    struct CompressedBlockHeader header;
+    fseeko(compressed->file, compressed->base + compressed->blockOffsets[block], SEEK_SET);
+    if (fread(&header, sizeof(header), 1, compressed->file) != 1 || header.rawLength > compressed->blockSize) return 0;
+
+    if (header.storedLength == header.rawLength){
+        if (fread(compressed->cache, 1, header.rawLength, compressed->file) != header.rawLength) return 0;
+    } else {
+        unsigned char *packed = malloc(header.storedLength);
+        long raw = -1;
+        if (fread(packed, 1, header.storedLength, compressed->file) == header.storedLength){
+            raw = decompressBlock(packed, header.storedLength, compressed->cache, compressed->blockSize);
+        }
+        free(packed);
+        if (raw != header.rawLength) return 0;
+    }
+
+    compressed->cachedBlock = block;
+    compressed->cachedLength = header.rawLength;
+    return 1;
+}
+
+/**
+ * @brief Reads raw bytes from a compressed file, only the blocks covering them are decompressed
+ *
+ * @param compressed The handle
+ * @param offset The raw offset to read from
+ * @param buffer Where to read to
+ * @param length How many bytes to read
+ * @return size_t The bytes read, less than length at the end or on corruption
+ */
+size_t readCompressedFile(struct CompressedFile *compressed, uint64_t offset, void *buffer, size_t length){
+    size_t done = 0;
+    while (done < length && offset < compressed->rawSize){
+        size_t block = offset / compressed->blockSize;
+        if (loadBlock(compressed, block) == 0) break;
+
+        size_t within = offset % compressed->blockSize;
+        if (within >= compressed->cachedLength) break;
+        size_t take = compressed->cachedLength - within;
+        if (take > length - done) take = length - done;
+
+        memcpy((unsigned char *)buffer + done, compressed->cache + within, take);
+        done += take;
+        offset += take;
+    }
+    return done;
+}
+
+/**
+ * @brief Decompresses every block of a file and checks its checksum
+ *
+ * @param fileName The compressed file
+ * @return int 1 if every block is intact, 0 if not
+ */
+int verifyCompressedFile(char *fileName){
+    struct CompressedFile compressed;
+    if (openCompressedFile(&compressed, fileName) == 0) return 0;
+
+    int ok = 1;
+    uint64_t total = 0;
+    size_t i;
+    for (i = 0; i < compressed.blockCount && ok; i++){
+        struct CompressedBlockHeader header;
+        fseeko(compressed.file, compressed.base + compressed.blockOffsets[i], SEEK_SET);
+        ok = fread(&header, sizeof(header), 1, compressed.file) == 1 && loadBlock(&compressed, i)
+            && blockChecksum(compressed.cache, compressed.cachedLength) == header.checksum;
+        total += compressed.cachedLength;
+    }
+    if (total != compressed.rawSize) ok = 0;
+
+    closeCompressedFile(&compressed);
+    return ok;
+}
+
+/**
+ * @brief Decompresses a whole file
+ *
+ * @param source The compressed file
+ * @param destination The file to write
+ * @return int 1 if ok, 0 if the source was corrupt or a file couldn't be opened
+ */
+int decompressFile(char *source, char *destination){
+    struct CompressedFile compressed;
+    if (openCompressedFile(&compressed, source) == 0) return 0;
+
+    FILE *out = fopen(destination, "wb");
+    if (out == NULL){
+        closeCompressedFile(&compressed);
+        return 0;
+    }
+
+    int ok = 1;
+    uint64_t written = 0;
+    size_t i;
+    for (i = 0; i < compressed.blockCount && ok; i++){
+        ok = loadBlock(&compressed, i);
+        if (ok){
+            fwrite(compressed.cache, 1, compressed.cachedLength, out);
+            written += compressed.cachedLength;
+        }
+    }
+    if (written != compressed.rawSize) ok = 0;
+
+    fclose(out);
+    closeCompressedFile(&compressed);
+    return ok;
+}
+
+/**
+ * @brief Closes a compressed file
+ *
+ * @param compressed The handle
+ */
+void closeCompressedFile(struct CompressedFile *compressed){
+    if (compressed->file != NULL) fclose(compressed->file);
+    free(compressed->blockOffsets);
+    free(compressed->cache);
+    memset(compressed, 0, sizeof(*compressed));
+    compressed->cachedBlock = -1;
+}
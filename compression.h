@@ -0,0 +1,55 @@
+#ifndef COMPRESSION_H
+#define COMPRESSION_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define COMPRESSION_BLOCK_SIZE (64 * 1024)
+#define COMPRESSION_MAGIC "CWZ1"
+#define COMPRESSION_FOOTER_MAGIC "CWZE"
+
+struct CompressedFileHeader
+{
+    char magic[4];
+    uint32_t blockSize;
+    uint64_t rawSize;
+};
+
+// Written before every block, a block with storedLength == rawLength isn't compressed
+struct CompressedBlockHeader
+{
+    uint32_t rawLength;
+    uint32_t storedLength;
+    uint32_t checksum;      // Of the raw data
+};
+
+struct CompressedFile
+{
+    FILE *file;
+    uint64_t base;          // Where the compressed data starts in the file, non zero inside a pack
+    uint64_t rawSize;
+    uint32_t blockSize;
+    size_t blockCount;
+    uint64_t *blockOffsets;
+    long cachedBlock;       // -1 when nothing is cached
+    unsigned char *cache;
+    size_t cachedLength;
+};
+
+size_t compressedBlockBound(size_t length);
+size_t compressBlock(const unsigned char *source, size_t length, unsigned char *destination, size_t capacity);
+long decompressBlock(const unsigned char *source, size_t length, unsigned char *destination, size_t capacity);
+uint32_t blockChecksum(const unsigned char *data, size_t length);
+
+int compressFile(char *source, char *destination);
+int decompressFile(char *source, char *destination);
+int isCompressedFile(char *fileName);
+
+int openCompressedFile(struct CompressedFile *compressed, char *fileName);
+int openCompressedRegion(struct CompressedFile *compressed, char *fileName, uint64_t base, uint64_t length);
+size_t readCompressedFile(struct CompressedFile *compressed, uint64_t offset, void *buffer, size_t length);
+int verifyCompressedFile(char *fileName);
+void closeCompressedFile(struct CompressedFile *compressed);
+
+#endif
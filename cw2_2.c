@@ -15,10 +15,23 @@
 #include "change_log.h"
 #include "version_control.h"
 #include "full_editor.h"
+#include "compaction.h"
+#include "diff.h"
+#include "bulk_operations.h"
+#include "status.h"
+#include "find_replace.h"
+#include "transform.h"
+#include "trace.h"
+#include "output.h"
+#include "scheduler.h"
+#include "utils.h"
+#include "key_script.h"
+#include "storage_benchmark.h"
 
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <ncurses.h>
 
@@ -27,8 +40,11 @@ void mainMenu();
 void fileMenu();
 void lineMenu();
 void generalMenu();
+int dumpCommand(int argc, char *argv[]);
+int insertCommand(int argc, char *argv[]);
+int replayCommand(int argc, char *argv[]);
 
-struct QuestionOption options[4], fileOptions[5], lineOptions[5], generalOptions[5];
+struct QuestionOption options[4], fileOptions[7], lineOptions[8], generalOptions[8];
 
 /**
  * @brief Program start point, initiates values and makes method calls to ensure that everything is
@@ -40,12 +56,46 @@ struct QuestionOption options[4], fileOptions[5], lineOptions[5], generalOptions
  */
 int main(int argc, char *argv[]){
 
+    // Records a Chrome trace when CWORD_TRACE names a file to write it to
+    initTracing();
+    // Records the keys pressed in the Full Editor when CWORD_RECORD names a file to write them to
+    initKeyRecording();
+
+    // CWord --dump [-n] file writes the file out without paging or menus, for piping
+    if (argc >= 3 && (strcmp(argv[1], "--dump") == 0 || strcmp(argv[1], "--dump-log") == 0)){
+        return dumpCommand(argc, argv);
+    }
+
+    // CWord --insert file [line] inserts everything piped in as one block, appending without a line
+    if (argc >= 3 && strcmp(argv[1], "--insert") == 0){
+        return insertCommand(argc, argv);
+    }
+
+    // CWord --benchmark-storage [lines] times the file and line operations on every storage backend
+    if (argc >= 2 && strcmp(argv[1], "--benchmark-storage") == 0){
+        size_t lines = argc >= 3 ? (size_t)stringToInt(argv[2]) : STORAGE_BENCHMARK_LINES;
+        if (benchmarkStorage(lines > 0 ? lines : STORAGE_BENCHMARK_LINES, stdout) == 0){
+            fprintf(stderr, "The benchmark file couldn't be written!\n");
+            return 1;
+        }
+        return 0;
+    }
+
+    // CWord --replay script file [--realtime] plays recorded keys into the Full Editor and reports how long each took
+    if (argc >= 4 && strcmp(argv[1], "--replay") == 0){
+        return replayCommand(argc, argv);
+    }
+
     // Make sure changelog can be made, also checks if script can create folders/files in dir
     if (initiateChangeLog() == 0) {
         clearScreen();
         return 0;
     }
 
+    // Keep histories bounded, compressed and indexed without making the user wait for it
+    startScheduler();
+    scheduleMaintenance();
+
 
     // Set defaults that wont be changed
     struct QuestionOption back = {"Back", 'b'};
@@ -53,20 +103,28 @@ int main(int argc, char *argv[]){
     fileOptions[0] = (struct QuestionOption) {"Create File", 'c'};
     fileOptions[1] = (struct QuestionOption) {"Copy File", 'p'};
     fileOptions[2] = (struct QuestionOption) {"Delete File", 'd'};
-    fileOptions[3] = (struct QuestionOption) {"Show File\n", 's'};
-    fileOptions[4] = back;
+    fileOptions[3] = (struct QuestionOption) {"Show File", 's'};
+    fileOptions[4] = (struct QuestionOption) {"Follow File (Show Lines as They're Added)", 'f'};
+    fileOptions[5] = (struct QuestionOption) {"Bulk Copy/Delete/Restore\n", 'm'};
+    fileOptions[6] = back;
 
     lineOptions[0] = (struct QuestionOption) {"Append Line", 'a'};
     lineOptions[1] = (struct QuestionOption) {"Delete Line", 'd'};
     lineOptions[2] = (struct QuestionOption) {"Insert Line", 'i'};
-    lineOptions[3] = (struct QuestionOption) {"Show Line\n", 's'};
-    lineOptions[4] = back;
+    lineOptions[3] = (struct QuestionOption) {"Insert Block of Lines", 'k'};
+    lineOptions[4] = (struct QuestionOption) {"Show Line", 's'};
+    lineOptions[5] = (struct QuestionOption) {"Find and Replace", 'r'};
+    lineOptions[6] = (struct QuestionOption) {"Sort/Unique/Reverse Lines\n", 't'};
+    lineOptions[7] = back;
 
     generalOptions[0] = (struct QuestionOption) {"Show Change Log", 's'};
     generalOptions[1] = (struct QuestionOption) {"Rollback file", 'r'};
-    generalOptions[2] = (struct QuestionOption) {"Show # Lines in File\n", 'l'};
-    generalOptions[3] = (struct QuestionOption) {"Full Editor\n", 'f'};
-    generalOptions[4] = back;
+    generalOptions[2] = (struct QuestionOption) {"Compact History", 'c'};
+    generalOptions[3] = (struct QuestionOption) {"Diff File Against History", 'd'};
+    generalOptions[4] = (struct QuestionOption) {"Status (Changes Made Outside CWord)", 'u'};
+    generalOptions[5] = (struct QuestionOption) {"Show # Lines in File\n", 'l'};
+    generalOptions[6] = (struct QuestionOption) {"Full Editor\n", 'f'};
+    generalOptions[7] = back;
 
     options[0] = (struct QuestionOption) {"File Operations", 'f'};
     options[1] = (struct QuestionOption) {"Line Operations", 'l'};
@@ -74,6 +132,9 @@ int main(int argc, char *argv[]){
     options[3] = (struct QuestionOption) {"Exit", 'e'};
 
     mainProgramRun();
+
+    // Anything unfinished is picked up again next time
+    stopScheduler();
     
     clearScreen();
     printHeader();
@@ -127,7 +188,7 @@ void mainMenu(){
  * 
  */
 void fileMenu(){
-    char input = getUserOption("Select an Option", fileOptions, 5);
+    char input = getUserOption("Select an Option", fileOptions, 7);
     switch (input){
         case 'c':
             {
@@ -162,6 +223,18 @@ void fileMenu(){
                 break;
             }
 
+        case 'f':
+            {
+                char *input = getUserInput("Please provide the name of the file to follow: ");
+                followFile(input);
+                free(input);
+                break;
+            }
+
+        case 'm':
+            bulkOperations();
+            break;
+
         case 'b':
             return;
     }
@@ -169,12 +242,100 @@ void fileMenu(){
     fileMenu();
 }
 
+/**
+ * @brief Dumps a file or its changelog to stdout, numbering the lines when given -n
+ * 
+ * @param argc 
+ * @param argv --dump or --dump-log, optionally -n, then the file
+ * @return int The exit status
+ */
+int dumpCommand(int argc, char *argv[]){
+    int numberLines = argc >= 4 && strcmp(argv[2], "-n") == 0;
+    char *fileName = argv[argc - 1];
+    int ok = strcmp(argv[1], "--dump-log") == 0
+        ? dumpChangeLog(fileName, STDOUT_FILENO, numberLines)
+        : dumpFile(fileName, STDOUT_FILENO, numberLines);
+    if (ok == 0){
+        fprintf(stderr, "%s couldn't be dumped!\n", fileName);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Inserts stdin into a file as one block, recorded as a single changelog entry
+ * 
+ * @param argc 
+ * @param argv --insert, the file, then optionally the line to insert before
+ * @return int The exit status
+ */
+int insertCommand(int argc, char *argv[]){
+    char *fileName = argv[2];
+    int lineNumber = argc >= 4 ? stringToInt(argv[3]) : 0;
+    if (fileExists(fileName) == 0 || canWrite(fileName) == 0){
+        fprintf(stderr, "%s can't be written to!\n", fileName);
+        return 1;
+    }
+    if (dirExists(".cword") == 0){
+        fprintf(stderr, "CWord can't access/create its settings folder!\n");
+        return 1;
+    }
+    // Without a line number the block goes after the last line
+    if (lineNumber < 1) lineNumber = fileLines(fileName) + lastLineUnterminated(fileName) + 1;
+
+    size_t inserted = insertBlockFromStream(fileName, lineNumber, stdin);
+    fprintf(stderr, "%zu lines inserted into %s\n", inserted, fileName);
+    return 0;
+}
+
+/**
+ * @brief Plays a key script into the Full Editor editing a file, then writes out the per key latency,
+ * the final screen and the state of the file so runs can be compared
+ * 
+ * @param argc 
+ * @param argv --replay, the script, the file, then optionally --realtime to keep the recorded pace
+ * @return int The exit status
+ */
+int replayCommand(int argc, char *argv[]){
+    char *scriptName = argv[2];
+    char *fileName = argv[3];
+    struct KeyReplay replay;
+    if (loadKeyScript(scriptName, &replay) == 0){
+        fprintf(stderr, "%s isn't a key script!\n", scriptName);
+        return 1;
+    }
+    replay.realTime = argc >= 5 && strcmp(argv[4], "--realtime") == 0;
+    if (fileExists(fileName) == 0 || canRead(fileName) == 0 || canWrite(fileName) == 0){
+        fprintf(stderr, "%s can't be edited!\n", fileName);
+        freeKeyReplay(&replay);
+        return 1;
+    }
+    if (dirExists(".cword") == 0){
+        fprintf(stderr, "CWord can't access/create its settings folder!\n");
+        freeKeyReplay(&replay);
+        return 1;
+    }
+
+    if (replayEditor(fileName, &replay) == 0){
+        fprintf(stderr, "%s couldn't be opened in the editor!\n", fileName);
+        freeKeyReplay(&replay);
+        return 1;
+    }
+    reportKeyReplay(&replay, stdout);
+
+    int hashed;
+    uint64_t hash = hashFileContents(fileName, &hashed);
+    printf("\nFinal file: %s, %zu lines, hash %016llx\n", fileName, fileLines(fileName), hashed ? (unsigned long long)hash : 0ULL);
+    freeKeyReplay(&replay);
+    return 0;
+}
+
 /**
  * @brief Shows the line operations option list
  * 
  */
 void lineMenu(){
-    char input = getUserOption("Select an Option", lineOptions, 5);
+    char input = getUserOption("Select an Option", lineOptions, 8);
     switch (input){
         case 'a':
             {
@@ -201,6 +362,14 @@ void lineMenu(){
             free(file);
             break;
         }
+        case 'k':
+        {
+            char* file = getUserInput("Please provide the name of the file to insert to: ");
+            int line = getIntegerInput("Please provide the line number to insert the block at: ");
+            insertBlock(file, line);
+            free(file);
+            break;
+        }
         case 's':
         {
             char* file = getUserInput("Please provide the name of the file to show: ");
@@ -210,6 +379,22 @@ void lineMenu(){
             break;
         }
 
+        case 'r':
+        {
+            char* file = getUserInput("Please provide the name of the file to find and replace in: ");
+            findAndReplace(file);
+            free(file);
+            break;
+        }
+
+        case 't':
+        {
+            char* file = getUserInput("Please provide the name of the file to sort, unique or reverse: ");
+            transformLines(file);
+            free(file);
+            break;
+        }
+
         case 'b':
             return;
     }
@@ -223,7 +408,7 @@ void lineMenu(){
  * 
  */
 void generalMenu(){
-    char input = getUserOption("Select an Option", generalOptions, 5);
+    char input = getUserOption("Select an Option", generalOptions, 8);
     switch (input){
         case 's':
             {
@@ -240,7 +425,27 @@ void generalMenu(){
                 free(input);
                 break;  
             } 
+
+        case 'c':
+            {
+                char *input = getUserInput("Please provide the name of the file to compact the history of (* for all): ");
+                compactHistory(input);
+                free(input);
+                break;
+            }
         
+        case 'd':
+            {
+                char *input = getUserInput("Please provide the name of the file to diff: ");
+                showDiff(input);
+                free(input);
+                break;
+            }
+
+        case 'u':
+            showStatus();
+            break;
+
         case 'l':
             {
                 char *input = getUserInput("Please provide the name of the file to count the lines for: ");
@@ -0,0 +1,678 @@
+/**
+ * @file diff.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Line diffs between a file and its history, using Myers' O(ND) algorithm with the linear space refinement
+ * Lines are hashed to integers up front so only an int and a flag per line are ever held in memory
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#include "diff.h"
+#include "file_operations.h"
+#include "interface.h"
+#include "utils.h"
+#include "version_control.h"
+#include "compression.h"
+#include "change_log.h"
+#include "change_log_index.h"
+#include "trace.h"
+
+#include <ctype.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// One side of a diff, every line reduced to an id shared by equal lines
+struct DiffSide
+{
+    int *ids;
+    char *changed;      // 1 if the line isn't in the longest common subsequence
+    size_t count;
+    int missingNewline; // The last line has no \n
+};
+
+// Maps line hashes to ids so equal lines compare as equal integers
+struct DiffHashTable
+{
+    uint64_t *hashes;
+    int *ids;
+    size_t capacity;
+    size_t count;
+};
+
+struct DiffContext
+{
+    const int *a;
+    const int *b;
+    char *changedA;
+    char *changedB;
+    int *forward;       // Furthest x reached on each diagonal, indexed by x - y
+    int *backward;
+};
+
+/**
+ * @brief Hashes a line (FNV-1a 64 bit)
+ *
+ * @param line The line without its \n
+ * @param length The lines length
+ * @param newline 1 if the line ended with a \n, a missing \n is a change too
+ * @return uint64_t The hash
+ */
+static uint64_t hashLine(const char *line, size_t length, int newline){
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+    for (i = 0; i < length; i++){
+        hash ^= (unsigned char)line[i];
+        hash *= 1099511628211ULL;
+    }
+    hash ^= newline ? 0x100 : 0x200;
+    hash *= 1099511628211ULL;
+    return hash;
+}
+
+/**
+ * @brief Gets the id of a hash, giving it a new one the first time it is seen
+ *
+ * @param table The table
+ * @param hash The lines hash
+ * @return int The id
+ */
+static int lineId(struct DiffHashTable *table, uint64_t hash){
+    if ((table->count + 1) * 2 > table->capacity){
+        size_t oldCapacity = table->capacity;
+        uint64_t *oldHashes = table->hashes;
+        int *oldIds = table->ids;
+
+        table->capacity = oldCapacity == 0 ? 1024 : oldCapacity * 2;
+        table->hashes = malloc(table->capacity * sizeof(uint64_t));
+        table->ids = malloc(table->capacity * sizeof(int));
+        memset(table->ids, -1, table->capacity * sizeof(int));
+
+        size_t i;
+        for (i = 0; i < oldCapacity; i++){
+            if (oldIds[i] == -1) continue;
+            size_t slot = oldHashes[i] & (table->capacity - 1);
+            while (table->ids[slot] != -1) slot = (slot + 1) & (table->capacity - 1);
+            table->hashes[slot] = oldHashes[i];
+            table->ids[slot] = oldIds[i];
+        }
+        free(oldHashes);
+        free(oldIds);
+    }
+
+    size_t slot = hash & (table->capacity - 1);
+    while (table->ids[slot] != -1){
+        if (table->hashes[slot] == hash) return table->ids[slot];
+        slot = (slot + 1) & (table->capacity - 1);
+    }
+    table->hashes[slot] = hash;
+    table->ids[slot] = table->count;
+    return table->count++;
+}
+
+/**
+ * @brief Reads a file into line ids
+ *
+ * @param side The side to fill
+ * @param fileName The file, a missing file counts as empty
+ * @param table The shared hash table
+ * @return int 1 if ok, 0 if the file has too many lines
+ */
+static int readDiffSide(struct DiffSide *side, char *fileName, struct DiffHashTable *table){
+    memset(side, 0, sizeof(*side));
+    size_t capacity = 1024;
+    side->ids = malloc(capacity * sizeof(int));
+
+    FILE *file = fopen(fileName, "r");
+    if (file == NULL){
+        side->changed = calloc(1, 1);
+        return 1;
+    }
+
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t l;
+    while ((l = getline(&line, &len, file)) != -1){
+        if (side->count == INT_MAX / 2){
+            free(line);
+            fclose(file);
+            return 0;
+        }
+        int newline = l > 0 && line[l - 1] == '\n';
+        if (side->count == capacity){
+            capacity *= 2;
+            side->ids = realloc(side->ids, capacity * sizeof(int));
+        }
+        side->ids[side->count++] = lineId(table, hashLine(line, newline ? l - 1 : l, newline));
+        side->missingNewline = !newline;
+    }
+    free(line);
+    fclose(file);
+
+    side->changed = calloc(side->count + 1, 1);
+    return 1;
+}
+
+/**
+ * @brief Finds the middle snake of the shortest edit script between a[xLow, xHigh) and b[yLow, yHigh),
+ * running the forward and backward searches until they overlap
+ *
+ * @param context The diff
+ * @param xLow Start of the range in a
+ * @param xHigh End of the range in a
+ * @param yLow Start of the range in b
+ * @param yHigh End of the range in b
+ * @param xMiddle Set to where a is split
+ * @param yMiddle Set to where b is split
+ */
+static void middleSnake(struct DiffContext *context, int xLow, int xHigh, int yLow, int yHigh, int *xMiddle, int *yMiddle){
+    const int *a = context->a, *b = context->b;
+    int *forward = context->forward, *backward = context->backward;
+
+    int minDiagonal = xLow - yHigh, maxDiagonal = xHigh - yLow;
+    int forwardMiddle = xLow - yLow, backwardMiddle = xHigh - yHigh;
+    int forwardMin = forwardMiddle, forwardMax = forwardMiddle;
+    int backwardMin = backwardMiddle, backwardMax = backwardMiddle;
+    int odd = (forwardMiddle - backwardMiddle) & 1;
+
+    forward[forwardMiddle] = xLow;
+    backward[backwardMiddle] = xHigh;
+
+    while (1 == 1){
+        int diagonal;
+
+        // Extend the forward search one edit further
+        if (forwardMin > minDiagonal){
+            forward[--forwardMin - 1] = -1;
+        } else {
+            ++forwardMin;
+        }
+        if (forwardMax < maxDiagonal){
+            forward[++forwardMax + 1] = -1;
+        } else {
+            --forwardMax;
+        }
+        for (diagonal = forwardMax; diagonal >= forwardMin; diagonal -= 2){
+            int low = forward[diagonal - 1], high = forward[diagonal + 1];
+            int x = low >= high ? low + 1 : high;
+            int y = x - diagonal;
+            while (x < xHigh && y < yHigh && a[x] == b[y]){
+                x++;
+                y++;
+            }
+            forward[diagonal] = x;
+            if (odd && backwardMin <= diagonal && diagonal <= backwardMax && backward[diagonal] <= x){
+                *xMiddle = x;
+                *yMiddle = y;
+                return;
+            }
+        }
+
+        // Extend the backward search one edit further
+        if (backwardMin > minDiagonal){
+            backward[--backwardMin - 1] = INT_MAX;
+        } else {
+            ++backwardMin;
+        }
+        if (backwardMax < maxDiagonal){
+            backward[++backwardMax + 1] = INT_MAX;
+        } else {
+            --backwardMax;
+        }
+        for (diagonal = backwardMin; diagonal <= backwardMax; diagonal += 2){
+            int low = backward[diagonal - 1], high = backward[diagonal + 1];
+            int x = low < high ? low : high - 1;
+            int y = x - diagonal;
+            while (x > xLow && y > yLow && a[x - 1] == b[y - 1]){
+                x--;
+                y--;
+            }
+            backward[diagonal] = x;
+            if (!odd && forwardMin <= diagonal && diagonal <= forwardMax && x <= forward[diagonal]){
+                *xMiddle = x;
+                *yMiddle = y;
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * @brief Marks the lines of a[xLow, xHigh) and b[yLow, yHigh) outside their longest common subsequence
+ * Splits on the middle snake so only the two diagonal arrays are ever needed
+ *
+ * @param context The diff
+ * @param xLow Start of the range in a
+ * @param xHigh End of the range in a
+ * @param yLow Start of the range in b
+ * @param yHigh End of the range in b
+ */
+static void compareSequences(struct DiffContext *context, int xLow, int xHigh, int yLow, int yHigh){
+    // Common prefix and suffix never need searching
+    while (xLow < xHigh && yLow < yHigh && context->a[xLow] == context->b[yLow]){
+        xLow++;
+        yLow++;
+    }
+    while (xLow < xHigh && yLow < yHigh && context->a[xHigh - 1] == context->b[yHigh - 1]){
+        xHigh--;
+        yHigh--;
+    }
+
+    if (xLow == xHigh){
+        while (yLow < yHigh) context->changedB[yLow++] = 1;
+    } else if (yLow == yHigh){
+        while (xLow < xHigh) context->changedA[xLow++] = 1;
+    } else {
+        int xMiddle, yMiddle;
+        middleSnake(context, xLow, xHigh, yLow, yHigh, &xMiddle, &yMiddle);
+        compareSequences(context, xLow, xMiddle, yLow, yMiddle);
+        compareSequences(context, xMiddle, xHigh, yMiddle, yHigh);
+    }
+}
+
+/**
+ * @brief Reads lines from a file up to the given line
+ *
+ * @param file The file
+ * @param current The line the file is at, updated
+ * @param target The line to stop at
+ * @param line The getline buffer
+ * @param len The getline buffer size
+ */
+static void skipLines(FILE *file, size_t *current, size_t target, char **line, size_t *len){
+    while (*current < target && file != NULL && getline(line, len, file) != -1) (*current)++;
+}
+
+/**
+ * @brief Copies the next line of a file into the diff with a prefix
+ *
+ * @param output The diff
+ * @param prefix ' ', '-' or '+'
+ * @param file The file
+ * @param current The line the file is at, updated
+ * @param line The getline buffer
+ * @param len The getline buffer size
+ */
+static void printDiffLine(FILE *output, char prefix, FILE *file, size_t *current, char **line, size_t *len){
+    ssize_t l = file != NULL ? getline(line, len, file) : -1;
+    if (l == -1) return;
+    (*current)++;
+    fputc(prefix, output);
+    fwrite(*line, 1, l, output);
+    if ((*line)[l - 1] != '\n') fputs("\n\\ No newline at end of file\n", output);
+}
+
+/**
+ * @brief Writes one hunk, both files are read forward only so hunks must come in order
+ *
+ * @param output The diff
+ * @param old The old side
+ * @param new The new side
+ * @param oldStart First old line of the hunk
+ * @param oldEnd End of the hunks old lines
+ * @param newStart First new line of the hunk
+ * @param newEnd End of the hunks new lines
+ * @param oldFile The old file
+ * @param newFile The new file
+ * @param oldCurrent The line oldFile is at
+ * @param newCurrent The line newFile is at
+ */
+static void printHunk(FILE *output, struct DiffSide *old, struct DiffSide *new, size_t oldStart, size_t oldEnd, size_t newStart, size_t newEnd,
+    FILE *oldFile, FILE *newFile, size_t *oldCurrent, size_t *newCurrent){
+    size_t oldLength = oldEnd - oldStart, newLength = newEnd - newStart;
+    fprintf(output, "@@ -%zu,%zu +%zu,%zu @@\n", oldLength == 0 ? oldStart : oldStart + 1, oldLength, newLength == 0 ? newStart : newStart + 1, newLength);
+
+    char *line = NULL;
+    size_t len = 0;
+    skipLines(oldFile, oldCurrent, oldStart, &line, &len);
+    skipLines(newFile, newCurrent, newStart, &line, &len);
+
+    size_t i = oldStart, j = newStart;
+    while (i < oldEnd || j < newEnd){
+        if (i < oldEnd && j < newEnd && old->changed[i] == 0 && new->changed[j] == 0){
+            printDiffLine(output, ' ', oldFile, oldCurrent, &line, &len);
+            skipLines(newFile, newCurrent, *newCurrent + 1, &line, &len);
+            i++;
+            j++;
+            continue;
+        }
+        while (i < oldEnd && old->changed[i]){
+            printDiffLine(output, '-', oldFile, oldCurrent, &line, &len);
+            i++;
+        }
+        while (j < newEnd && new->changed[j]){
+            printDiffLine(output, '+', newFile, newCurrent, &line, &len);
+            j++;
+        }
+    }
+    free(line);
+}
+
+/**
+ * @brief Finds the next run of changed lines
+ *
+ * @param old The old side
+ * @param new The new side
+ * @param i The old line to search from, set to the start of the run
+ * @param j The new line to search from, set to the start of the run
+ * @param oldEnd Set to the end of the runs old lines
+ * @param newEnd Set to the end of the runs new lines
+ * @return int 1 if a run was found, 0 if there are no more changes
+ */
+static int nextChange(struct DiffSide *old, struct DiffSide *new, size_t *i, size_t *j, size_t *oldEnd, size_t *newEnd){
+    while (*i < old->count && *j < new->count && old->changed[*i] == 0 && new->changed[*j] == 0){
+        (*i)++;
+        (*j)++;
+    }
+    if (*i >= old->count && *j >= new->count) return 0;
+
+    *oldEnd = *i;
+    *newEnd = *j;
+    while (*oldEnd < old->count && old->changed[*oldEnd]) (*oldEnd)++;
+    while (*newEnd < new->count && new->changed[*newEnd]) (*newEnd)++;
+    return 1;
+}
+
+/**
+ * @brief Writes a unified diff of two files
+ *
+ * @param oldName The old file, a missing file counts as empty
+ * @param newName The new file, a missing file counts as empty
+ * @param oldLabel The name shown for the old file
+ * @param newLabel The name shown for the new file
+ * @param output Where to write the diff
+ * @param result Filled with statistics, may be NULL
+ * @return int 1 if ok, 0 if a file was too large to compare
+ */
+int diffFiles(char *oldName, char *newName, char *oldLabel, char *newLabel, FILE *output, struct DiffResult *result){
+    uint64_t trace = TRACE_BEGIN();
+    struct DiffResult stats;
+    memset(&stats, 0, sizeof(stats));
+
+    struct DiffHashTable table;
+    memset(&table, 0, sizeof(table));
+    struct DiffSide old, new;
+    int ok = readDiffSide(&old, oldName, &table) && readDiffSide(&new, newName, &table);
+    free(table.hashes);
+    free(table.ids);
+    if (ok == 0){
+        free(old.ids);
+        free(old.changed);
+        free(new.ids);
+        free(new.changed);
+        return 0;
+    }
+
+    struct DiffContext context;
+    context.a = old.ids;
+    context.b = new.ids;
+    context.changedA = old.changed;
+    context.changedB = new.changed;
+    // Diagonals run from -newCount - 1 to oldCount + 1
+    size_t diagonals = old.count + new.count + 3;
+    context.forward = malloc(diagonals * 2 * sizeof(int));
+    context.backward = context.forward + diagonals;
+    context.forward += new.count + 1;
+    context.backward += new.count + 1;
+
+    compareSequences(&context, 0, old.count, 0, new.count);
+    free(context.forward - (new.count + 1));
+
+    stats.oldLines = old.count;
+    stats.newLines = new.count;
+
+    FILE *oldFile = fopen(oldName, "r");
+    FILE *newFile = fopen(newName, "r");
+    size_t oldCurrent = 0, newCurrent = 0;
+
+    size_t i = 0, j = 0, oldEnd, newEnd;
+    int printedHeader = 0;
+    size_t hunkOldStart = 0, hunkNewStart = 0, hunkOldEnd = 0, hunkNewEnd = 0;
+    int open = 0;
+
+    while (nextChange(&old, &new, &i, &j, &oldEnd, &newEnd)){
+        stats.removed += oldEnd - i;
+        stats.added += newEnd - j;
+
+        size_t before = i < DIFF_CONTEXT ? i : DIFF_CONTEXT;
+        if (j < before) before = j;
+
+        if (open && i - before > hunkOldEnd + DIFF_CONTEXT){
+            size_t after = DIFF_CONTEXT;
+            printHunk(output, &old, &new, hunkOldStart, hunkOldEnd + after, hunkNewStart, hunkNewEnd + after, oldFile, newFile, &oldCurrent, &newCurrent);
+            stats.hunks++;
+            open = 0;
+        }
+        if (printedHeader == 0){
+            fprintf(output, "--- %s\n+++ %s\n", oldLabel, newLabel);
+            printedHeader = 1;
+        }
+        if (open == 0){
+            hunkOldStart = i - before;
+            hunkNewStart = j - before;
+            open = 1;
+        }
+        hunkOldEnd = oldEnd;
+        hunkNewEnd = newEnd;
+        i = oldEnd;
+        j = newEnd;
+    }
+    if (open){
+        size_t after = DIFF_CONTEXT;
+        if (old.count - hunkOldEnd < after) after = old.count - hunkOldEnd;
+        if (new.count - hunkNewEnd < after) after = new.count - hunkNewEnd;
+        printHunk(output, &old, &new, hunkOldStart, hunkOldEnd + after, hunkNewStart, hunkNewEnd + after, oldFile, newFile, &oldCurrent, &newCurrent);
+        stats.hunks++;
+    }
+
+    if (oldFile != NULL) fclose(oldFile);
+    if (newFile != NULL) fclose(newFile);
+    free(old.ids);
+    free(old.changed);
+    free(new.ids);
+    free(new.changed);
+
+    if (result != NULL) *result = stats;
+    TRACE_END("diffFiles", trace, 0);
+    return 1;
+}
+
+/**
+ * @brief Shows a diff a page at a time
+ *
+ * @param diff The diff, read from the start
+ * @param title Shown above the diff
+ */
+void pageDiff(FILE *diff, char *title){
+    rewind(diff);
+    char *line = NULL;
+    size_t len = 0;
+    size_t lineCount = 0, totalLineCount = 0;
+
+    clearScreen();
+    printHeader();
+    printf("%s\n\n", title);
+
+    while (getline(&line, &len, diff) != -1){
+        printLine(line);
+        lineCount++;
+        totalLineCount++;
+        if (lineCount >= DIFF_PAGE_SIZE){
+            printf("[%zu-%zu](ENTER to continue, c/C to close)>", totalLineCount - lineCount + 1, totalLineCount);
+            char input = tolower(getchar());
+            if (input != '\n') clearInputBuffer();
+            if (input == 'c'){
+                free(line);
+                return;
+            }
+            lineCount = 0;
+            clearScreen();
+            printHeader();
+            printf("%s\n\n", title);
+        }
+    }
+    free(line);
+    printf("\n(END)");
+    waitForKey();
+}
+
+/**
+ * @brief Lets the user pick one of the files deleted file snapshots
+ * Make sure to free after use!
+ *
+ * @param fileName The tracked file
+ * @return char* The snapshots hash, NULL if none was picked
+ */
+static char * pickSnapshot(char *fileName){
+    struct ChangeLogView view;
+    if (openChangeLogView(&view, fileName, OPERATION_DELETED) == 0 || view.count == 0){
+        closeChangeLogView(&view);
+        infoScreen("That file doesn't have any deleted file snapshots!");
+        return NULL;
+    }
+
+    clearScreen();
+    printHeader();
+    printf("%s snapshots, newest first:\n\n", fileName);
+    size_t i, shown = view.count < CHANGE_LOG_PAGE_SIZE ? view.count : CHANGE_LOG_PAGE_SIZE;
+    for (i = 0; i < shown; i++){
+        struct ChangeLogIndexEntry entry;
+        if (readChangeLogViewEntry(&view, view.count - 1 - i, &entry) == 0) break;
+        time_t seconds = entry.nanos / 1000000000ULL;
+        struct tm tm;
+        localtime_r(&seconds, &tm);
+        printf("%6zu  Deleted at %02d:%02d:%02d %02d/%02d/%d\n", i + 1, tm.tm_hour, tm.tm_min, tm.tm_sec, tm.tm_mday, tm.tm_mon + 1, tm.tm_year + 1900);
+    }
+    printf("\n");
+
+    printf("Which snapshot to compare against: ");
+    int choice = 0;
+    scanf("%d", &choice);
+    clearInputBuffer();
+    char *hash = NULL;
+    struct ChangeLogIndexEntry entry;
+    if (choice >= 1 && (size_t)choice <= shown && readChangeLogViewEntry(&view, view.count - choice, &entry)){
+        char *record = readChangeLogViewRecord(&view, &entry);
+        char *deleted = record != NULL ? strstr(record, "||DELETED||") : NULL;
+        if (deleted != NULL){
+            deleted += strlen("||DELETED||");
+            deleted[strcspn(deleted, "\n")] = '\0';
+            hash = strdup(deleted);
+        }
+        free(record);
+    } else {
+        infoScreen("That isn't one of the snapshots!");
+    }
+    closeChangeLogView(&view);
+    return hash;
+}
+
+/**
+ * @brief Shows the user a diff between a file and a snapshot, an earlier version or another file
+ *
+ * @param fileName The file to compare
+ */
+void showDiff(char *fileName){
+    struct QuestionOption diffOptions[4];
+    diffOptions[0] = (struct QuestionOption) {"Deleted File Snapshot", 's'};
+    diffOptions[1] = (struct QuestionOption) {"Rollback Target", 'r'};
+    diffOptions[2] = (struct QuestionOption) {"Another File (e.g. a Copy)\n", 'c'};
+    diffOptions[3] = (struct QuestionOption) {"Back", 'b'};
+
+    char input = getUserOption("Compare against", diffOptions, 4);
+    char *oldName = NULL, *oldLabel = NULL;
+    int temporary = 0;
+
+    switch (input){
+        case 's':
+            {
+                char *hash = pickSnapshot(fileName);
+                if (hash == NULL) return;
+                char *snapshot = changeLogSnapshotPath(fileName, hash);
+                oldLabel = concat3(fileName, " snapshot ", hash);
+                free(hash);
+                if (snapshot == NULL){
+                    free(oldLabel);
+                    infoScreen("The snapshot of that file couldn't be found!");
+                    return;
+                }
+                if (isCompressedFile(snapshot)){
+                    oldName = concat3(".cword/", fileName, "/diff.base.cword.txt");
+                    temporary = 1;
+                    if (decompressFile(snapshot, oldName) == 0){
+                        remove(oldName);
+                        free(oldName);
+                        free(oldLabel);
+                        free(snapshot);
+                        infoScreen("The snapshot of that file is damaged!");
+                        return;
+                    }
+                    free(snapshot);
+                } else {
+                    oldName = snapshot;
+                }
+                break;
+            }
+
+        case 'r':
+            {
+                int steps = getIntegerInput("How many changes back to compare against: ");
+                if (steps < 1){
+                    infoScreen("That needs to be at least 1 change!");
+                    return;
+                }
+                oldName = concat3(".cword/", fileName, "/diff.base.cword.txt");
+                temporary = 1;
+                if (reconstructVersion(fileName, steps, oldName) == 0){
+                    remove(oldName);
+                    free(oldName);
+                    infoScreen("That file doesn't have that many changes to roll back!");
+                    return;
+                }
+                char *number = intToString(steps);
+                oldLabel = concat4(fileName, " (", number, " changes back)");
+                free(number);
+                break;
+            }
+
+        case 'c':
+            {
+                oldName = getUserInput("Please provide the name of the file to compare against: ");
+                if (fileExists(oldName) == 0){
+                    char *m = concat(oldName, " doesn't exist!");
+                    infoScreen(m);
+                    free(m);
+                    free(oldName);
+                    return;
+                }
+                oldLabel = strdup(oldName);
+                break;
+            }
+
+        default:
+            return;
+    }
+
+    waitScreen("Comparing.\nPlease wait...\n");
+    FILE *output = tmpfile();
+    struct DiffResult result;
+    if (output == NULL || diffFiles(oldName, fileName, oldLabel, fileName, output, &result) == 0){
+        infoScreen("Those files couldn't be compared!");
+    } else if (result.hunks == 0){
+        infoScreen("There are no differences!");
+    } else {
+        char title[128];
+        sprintf(title, "%zu lines removed, %zu lines added in %zu hunks:", result.removed, result.added, result.hunks);
+        pageDiff(output, title);
+    }
+
+    if (output != NULL) fclose(output);
+    if (temporary) remove(oldName);
+    free(oldName);
+    free(oldLabel);
+}
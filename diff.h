@@ -0,0 +1,25 @@
+#ifndef DIFF_H
+#define DIFF_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Unchanged lines shown around every change
+#define DIFF_CONTEXT 3
+// Lines shown per page of the diff pager
+#define DIFF_PAGE_SIZE 20
+
+struct DiffResult
+{
+    size_t oldLines;
+    size_t newLines;
+    size_t removed;
+    size_t added;
+    size_t hunks;
+};
+
+int diffFiles(char *oldName, char *newName, char *oldLabel, char *newLabel, FILE *output, struct DiffResult *result);
+void pageDiff(FILE *diff, char *title);
+void showDiff(char *fileName);
+
+#endif
@@ -0,0 +1,654 @@
+/**
+ * @file document.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief The full editors copy of its file
+ * Kept in memory as ids of interned lines and reloaded only when another program writes the file. Files of
+ * DOCUMENT_PAGED_BYTES or more are never read whole, a window of lines is read from where the line index
+ * says they start and edits are made to the file itself by the line operations
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "document.h"
+#include "line_operations.h"
+#include "utils.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Reads a whole file
+ *
+ * @param fileName The file
+ * @param length Set to the files length
+ * @return char* The contents, NULL if it couldn't be read. Make sure to free after use!
+ */
+static char * readWholeFile(char *fileName, size_t *length){
+    int file = open(fileName, O_RDONLY);
+    if (file == -1) return NULL;
+
+    struct stat info;
+    size_t capacity = fstat(file, &info) == 0 && info.st_size > 0 ? info.st_size + 1 : 4096;
+    char *data = malloc(capacity);
+    size_t filled = 0;
+    ssize_t read;
+    // The file may grow while it is read
+    while ((read = pread(file, data + filled, capacity - filled, filled)) > 0){
+        filled += read;
+        if (filled == capacity){
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+    }
+    close(file);
+    if (read == -1){
+        free(data);
+        return NULL;
+    }
+    *length = filled;
+    return data;
+}
+
+/**
+ * @brief Remembers the files stat data so our own writes aren't mistaken for someone elses
+ *
+ * @param document The document
+ */
+static void rememberStat(struct Document *document){
+    struct stat info;
+    if (stat(document->fileName, &info) != 0) return;
+    document->knownSize = info.st_size;
+    document->knownMtimeNanos = (int64_t)info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+    document->knownInode = info.st_ino;
+}
+
+/**
+ * @brief Throws away every queued inotify event
+ *
+ * @param document The document
+ * @return int 1 if an event was about the documents file
+ */
+static int drainEvents(struct Document *document){
+    if (document->watch == -1) return 0;
+
+    int matched = 0;
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t got;
+    while ((got = read(document->watch, buffer, sizeof(buffer))) > 0){
+        char *p;
+        for (p = buffer; p < buffer + got; p += sizeof(struct inotify_event) + ((struct inotify_event *)p)->len){
+            struct inotify_event *event = (struct inotify_event *)p;
+            if (event->len > 0 && strcmp(event->name, document->watchName) == 0) matched = 1;
+            // Events were lost, the file may have changed
+            if (event->mask & IN_Q_OVERFLOW) matched = 1;
+        }
+    }
+    return matched;
+}
+
+/**
+ * @brief Finds where the line starting at position ends
+ *
+ * @param data The text
+ * @param position Where the line starts
+ * @param length Where the text ends
+ * @return size_t The offset just past the lines \n, or length for a last line without one
+ */
+static size_t lineEnd(const char *data, size_t position, size_t length){
+    const char *newline = memchr(data + position, '\n', length - position);
+    return newline != NULL ? (size_t)(newline - data) + 1 : length;
+}
+
+/**
+ * @brief Interns every line of some text, adding their ids to the end of a list
+ *
+ * @param store The store
+ * @param text The text
+ * @param length Its length
+ * @param ids The list, grown as needed
+ * @param count How many ids are in the list
+ * @param capacity How many ids the list has room for
+ */
+static void internLines(struct LineStore *store, const char *text, size_t length, uint32_t **ids, size_t *count, size_t *capacity){
+    size_t position = 0;
+    while (position < length){
+        size_t end = lineEnd(text, position, length);
+        if (*count == *capacity){
+            *capacity = *capacity == 0 ? 256 : *capacity * 2;
+            *ids = realloc(*ids, *capacity * sizeof(uint32_t));
+        }
+        (*ids)[(*count)++] = internLine(store, text + position, end - position);
+        position = end;
+    }
+}
+
+/**
+ * @brief Checks whether a line ends in a \n, only the last line ever doesn't
+ *
+ * @param document The document
+ * @param lineNumber The line, from 1
+ * @return int 1 if it does
+ */
+static int endsWithNewline(struct Document *document, size_t lineNumber){
+    size_t length;
+    const char *text = storedLine(document->store, document->lines[lineNumber - 1], &length);
+    return length > 0 && text[length - 1] == '\n';
+}
+
+/**
+ * @brief Replaces some lines with the lines of content, joining the ends the same way
+ * editing the bytes of the file would
+ *
+ * @param document The document
+ * @param first The first line to replace, from 1
+ * @param count How many lines to replace, 0 to insert before first
+ * @param content The new text
+ * @param length Its length
+ */
+static void spliceLines(struct Document *document, size_t first, size_t count, const char *content, size_t length){
+    if (first < 1) first = 1;
+    if (first > document->lineCount + 1) first = document->lineCount + 1;
+    if (count > document->lineCount - (first - 1)) count = document->lineCount - (first - 1);
+
+    // Text added after a last line without a \n carries on that line
+    size_t before = 0, after = 0, joinedLength = length;
+    const char *beforeText = NULL, *afterText = NULL;
+    if (length > 0 && first > 1 && first - 1 == document->lineCount && endsWithNewline(document, first - 1) == 0){
+        first--;
+        count++;
+        beforeText = storedLine(document->store, document->lines[first - 1], &before);
+        joinedLength += before;
+    }
+    // And text without a \n runs into the line after it
+    if (length > 0 && content[length - 1] != '\n' && first + count <= document->lineCount){
+        afterText = storedLine(document->store, document->lines[first + count - 1], &after);
+        count++;
+        joinedLength += after;
+    }
+
+    const char *joined = content;
+    char *buffer = NULL;
+    if (joinedLength != length){
+        buffer = malloc(joinedLength);
+        if (before > 0) memcpy(buffer, beforeText, before);
+        memcpy(buffer + before, content, length);
+        if (after > 0) memcpy(buffer + before + length, afterText, after);
+        joined = buffer;
+    }
+
+    // Interned before the old lines are released so lines in both are never freed
+    uint32_t *ids = NULL;
+    size_t added = 0, capacity = 0, i;
+    internLines(document->store, joined, joinedLength, &ids, &added, &capacity);
+    free(buffer);
+
+    for (i = first - 1; i < first - 1 + count; i++){
+        size_t oldLength;
+        storedLine(document->store, document->lines[i], &oldLength);
+        document->length -= oldLength;
+        releaseLine(document->store, document->lines[i]);
+    }
+    document->length += joinedLength;
+
+    size_t lineCount = document->lineCount - count + added;
+    if (lineCount > document->lineCapacity){
+        document->lineCapacity = lineCount * 2 > 256 ? lineCount * 2 : 256;
+        document->lines = realloc(document->lines, document->lineCapacity * sizeof(uint32_t));
+    }
+    memmove(document->lines + first - 1 + added, document->lines + first - 1 + count, (document->lineCount - (first - 1) - count) * sizeof(uint32_t));
+    if (added > 0) memcpy(document->lines + first - 1, ids, added * sizeof(uint32_t));
+    document->lineCount = lineCount;
+    free(ids);
+}
+
+/**
+ * @brief Forgets a paged documents window
+ *
+ * @param document The document
+ */
+static void dropWindow(struct Document *document){
+    free(document->window);
+    free(document->windowStarts);
+    document->window = NULL;
+    document->windowStarts = NULL;
+    document->windowFirst = 0;
+    document->windowCount = 0;
+}
+
+/**
+ * @brief Makes a paged documents line count exact once the file has been indexed
+ *
+ * @param document The document
+ * @param wait 1 to index the file now if it hasn't been, 0 to only use an index already built
+ */
+static void settlePagedLines(struct Document *document, int wait){
+    size_t lines;
+    if (indexedLineCount(document->fileName, &lines) == 0){
+        if (wait == 0) return;
+        lines = indexFileLines(document->fileName);
+    }
+    document->lineCount = lines + document->partialLastLine;
+    document->linesExact = 1;
+}
+
+/**
+ * @brief Starts (or restarts after the file changed) paging a document, without reading the file.
+ * The line count is estimated until the file has been indexed in the background
+ *
+ * @param document The document, its file name set
+ * @return int 1 if ok, 0 if the file couldn't be read
+ */
+static int pageDocument(struct Document *document){
+    dropWindow(document);
+    int file = open(document->fileName, O_RDONLY);
+    if (file == -1) return 0;
+    struct stat info;
+    char last = '\n';
+    int ok = fstat(file, &info) == 0 && (info.st_size == 0 || pread(file, &last, 1, info.st_size - 1) == 1);
+    close(file);
+    struct LineEstimate estimate;
+    if (ok == 0 || estimateFileLines(document->fileName, &estimate) == 0) return 0;
+
+    document->paged = 1;
+    document->length = info.st_size;
+    document->partialLastLine = last != '\n';
+    document->lineCount = estimate.lines + document->partialLastLine;
+    document->linesExact = estimate.exact;
+    return 1;
+}
+
+/**
+ * @brief Reads the window of lines around a line of a paged document. Moving on from the window
+ * already read carries on from where it is, anything else is found with the files line index
+ *
+ * @param document The document
+ * @param lineNumber The line wanted, from 1
+ * @return int 1 if ok (the line may still be past the end), 0 if the file couldn't be read
+ */
+static int loadWindow(struct Document *document, size_t lineNumber){
+    size_t first = lineNumber > DOCUMENT_WINDOW_LINES / 4 ? lineNumber - DOCUMENT_WINDOW_LINES / 4 : 1;
+    uint64_t offset = 0;
+    if (document->windowCount > 0 && first >= document->windowFirst && first <= document->windowFirst + document->windowCount){
+        offset = document->windowOffset + document->windowStarts[first - document->windowFirst];
+    } else if (indexedLineStart(document->fileName, first, &offset) == 0){
+        // Jumping before the background index is ready waits for it
+        settlePagedLines(document, 1);
+        if (indexedLineStart(document->fileName, first, &offset) == 0) return 0;
+    }
+
+    int file = open(document->fileName, O_RDONLY);
+    if (file == -1) return 0;
+    uint64_t trace = TRACE_BEGIN();
+    size_t wanted = lineNumber - first + 1, count = 0, filled = 0, scanned = 0, capacity = DOCUMENT_WINDOW_BYTES;
+    char *data = malloc(capacity);
+    size_t *starts = malloc((DOCUMENT_WINDOW_LINES + 1) * sizeof(size_t));
+    starts[0] = 0;
+    ssize_t got = 1;
+    while (count < DOCUMENT_WINDOW_LINES){
+        if (scanned == filled){
+            if (filled == capacity){
+                // The window stops when full, unless the line wanted is longer than it
+                if (count >= wanted) break;
+                capacity *= 2;
+                data = realloc(data, capacity);
+            }
+            got = pread(file, data + filled, capacity - filled, offset + filled);
+            if (got <= 0) break;
+            filled += got;
+        }
+        char *newline = memchr(data + scanned, '\n', filled - scanned);
+        scanned = newline != NULL ? (size_t)(newline - data) + 1 : filled;
+        if (newline != NULL) starts[++count] = scanned;
+    }
+    close(file);
+    if (got == -1){
+        free(data);
+        free(starts);
+        return 0;
+    }
+    // Reached the end, so the line count is known
+    if (got == 0){
+        if (filled > starts[count]) starts[++count] = filled;
+        document->lineCount = first - 1 + count;
+        document->linesExact = 1;
+    } else if (document->linesExact == 0 && first + count > document->lineCount){
+        document->lineCount = first + count;
+    }
+
+    dropWindow(document);
+    document->window = data;
+    document->windowStarts = starts;
+    document->windowFirst = first;
+    document->windowCount = count;
+    document->windowOffset = offset;
+    TRACE_END("loadWindow", trace, filled);
+    return 1;
+}
+
+/**
+ * @brief Reads a file into memory (or starts paging a huge one) and starts watching it
+ *
+ * @param document The document to fill
+ * @param fileName The file
+ * @return int 1 if ok, 0 if the file couldn't be read
+ */
+int openDocument(struct Document *document, char *fileName){
+    memset(document, 0, sizeof(*document));
+    document->watch = -1;
+
+    struct stat info;
+    if (stat(fileName, &info) == 0 && info.st_size >= DOCUMENT_PAGED_BYTES){
+        document->fileName = strdup(fileName);
+        if (pageDocument(document) == 0){
+            free(document->fileName);
+            document->fileName = NULL;
+            return 0;
+        }
+    } else {
+        size_t length;
+        char *data = readWholeFile(fileName, &length);
+        if (data == NULL) return 0;
+        document->fileName = strdup(fileName);
+        document->length = length;
+        internLines(sharedLineStore(), data, length, &document->lines, &document->lineCount, &document->lineCapacity);
+        free(data);
+    }
+    document->store = sharedLineStore();
+
+    // Watch the folder rather than the file as every save replaces the file
+    char *slash = strrchr(fileName, '/');
+    char *folder = slash != NULL ? strndup(fileName, slash - fileName + 1) : strdup(".");
+    document->watchName = strdup(slash != NULL ? slash + 1 : fileName);
+    document->watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (document->watch != -1 && inotify_add_watch(document->watch, folder, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE | IN_DELETE) == -1){
+        close(document->watch);
+        document->watch = -1;
+    }
+    free(folder);
+
+    rememberStat(document);
+    return 1;
+}
+
+/**
+ * @brief Frees a document and stops watching its file
+ *
+ * @param document The document
+ */
+void closeDocument(struct Document *document){
+    if (document->watch != -1) close(document->watch);
+    size_t i;
+    for (i = 0; i < document->lineCount && document->paged == 0; i++) releaseLine(document->store, document->lines[i]);
+    dropWindow(document);
+    free(document->fileName);
+    free(document->lines);
+    free(document->watchName);
+    memset(document, 0, sizeof(*document));
+    document->watch = -1;
+}
+
+/**
+ * @brief Counts the lines ending in a \n, the same as fileLines
+ *
+ * @param document The document
+ * @return size_t The number of lines
+ */
+size_t documentLines(struct Document *document){
+    if (document->paged){
+        if (document->linesExact == 0) settlePagedLines(document, 0);
+        return document->lineCount - (document->lineCount > 0 ? document->partialLastLine : 0);
+    }
+    if (document->lineCount > 0 && endsWithNewline(document, document->lineCount) == 0) return document->lineCount - 1;
+    return document->lineCount;
+}
+
+/**
+ * @brief Counts the lines like documentLines, waiting for a huge file to be indexed if its count is still estimated
+ *
+ * @param document The document
+ * @return size_t The number of lines
+ */
+size_t exactDocumentLines(struct Document *document){
+    if (document->paged && document->linesExact == 0) settlePagedLines(document, 1);
+    return documentLines(document);
+}
+
+/**
+ * @brief Gets a line without copying it
+ *
+ * @param document The document
+ * @param lineNumber The line, from 1
+ * @param length Set to the lines length without its \n
+ * @return const char* The line, valid until the document next changes (or for a paged document, until
+ * another line outside its window is asked for). NULL if there is no such line
+ */
+const char * documentLine(struct Document *document, size_t lineNumber, size_t *length){
+    if (lineNumber < 1 || (lineNumber > document->lineCount && (document->paged == 0 || document->linesExact))) return NULL;
+    const char *text;
+    if (document->paged){
+        if (lineNumber < document->windowFirst || lineNumber >= document->windowFirst + document->windowCount){
+            if (loadWindow(document, lineNumber) == 0 || lineNumber >= document->windowFirst + document->windowCount) return NULL;
+        }
+        size_t start = document->windowStarts[lineNumber - document->windowFirst];
+        text = document->window + start;
+        *length = document->windowStarts[lineNumber - document->windowFirst + 1] - start;
+    } else {
+        text = storedLine(document->store, document->lines[lineNumber - 1], length);
+    }
+    if (*length > 0 && text[*length - 1] == '\n') (*length)--;
+    return text;
+}
+
+/**
+ * @brief Copies a line, like getLineNOfFile without reading the file
+ * Make sure to free after use!
+ *
+ * @param document The document
+ * @param lineNumber The line, from 1
+ * @return char* The line without its \n, empty if there is no such line
+ */
+char * documentLineCopy(struct Document *document, size_t lineNumber){
+    size_t length = 0;
+    const char *line = documentLine(document, lineNumber, &length);
+    char *copy = malloc(length + 1);
+    if (line != NULL) memcpy(copy, line, length);
+    copy[length] = '\0';
+    return copy;
+}
+
+/**
+ * @brief Inserts a line before the given line, like internalInsertLine
+ *
+ * @param document The document
+ * @param lineNumber The line to insert before, past the end appends
+ * @param content The line including its \n
+ */
+void documentInsertLine(struct Document *document, size_t lineNumber, const char *content){
+    if (document->paged){
+        internalInsertLine(document->fileName, lineNumber, (char *)content);
+        pageDocument(document);
+        return;
+    }
+    spliceLines(document, lineNumber, 0, content, strlen(content));
+}
+
+/**
+ * @brief Appends to the end of the document, like internalAppendLine
+ *
+ * @param document The document
+ * @param content The line including its \n
+ */
+void documentAppendLine(struct Document *document, const char *content){
+    if (document->paged){
+        internalAppendLine(document->fileName, (char *)content);
+        pageDocument(document);
+        return;
+    }
+    spliceLines(document, document->lineCount + 1, 0, content, strlen(content));
+}
+
+/**
+ * @brief Removes a line, like internalDeleteLine
+ *
+ * @param document The document
+ * @param lineNumber The line, from 1
+ */
+void documentDeleteLine(struct Document *document, size_t lineNumber){
+    if (lineNumber < 1 || lineNumber > document->lineCount) return;
+    if (document->paged){
+        internalDeleteLine(document->fileName, lineNumber);
+        pageDocument(document);
+        return;
+    }
+    spliceLines(document, lineNumber, 1, "", 0);
+}
+
+/**
+ * @brief Replaces a line, like internalReplaceLine
+ *
+ * @param document The document
+ * @param lineNumber The line, from 1
+ * @param content The new line including its \n
+ */
+void documentReplaceLine(struct Document *document, size_t lineNumber, const char *content){
+    if (lineNumber < 1 || lineNumber > document->lineCount) return;
+    if (document->paged){
+        internalReplaceLine(document->fileName, lineNumber, (char *)content);
+        pageDocument(document);
+        return;
+    }
+    spliceLines(document, lineNumber, 1, content, strlen(content));
+}
+
+/**
+ * @brief Writes the document over its file, the same way the line operations do. A paged documents
+ * edits have already been written
+ *
+ * @param document The document
+ * @return int 1 if ok, 0 if the file couldn't be written
+ */
+int saveDocument(struct Document *document){
+    if (document->paged){
+        drainEvents(document);
+        rememberStat(document);
+        return 1;
+    }
+    uint64_t trace = TRACE_BEGIN();
+    char *tempName = concat(document->fileName, ".document.cword.txt");
+    FILE *temp = fopen(tempName, "w");
+    int ok = temp != NULL;
+    if (ok){
+        size_t i;
+        for (i = 0; i < document->lineCount && ok; i++){
+            size_t length;
+            const char *text = storedLine(document->store, document->lines[i], &length);
+            ok = fwrite(text, 1, length, temp) == length;
+        }
+        if (fclose(temp) != 0) ok = 0;
+    }
+    if (ok) ok = rename(tempName, document->fileName) == 0;
+    if (ok == 0) remove(tempName);
+    free(tempName);
+
+    // Our own save isn't a change to reload
+    drainEvents(document);
+    rememberStat(document);
+    TRACE_END("saveDocument", trace, document->length);
+    return ok;
+}
+
+/**
+ * @brief Checks without blocking whether another program has written the file
+ *
+ * @param document The document
+ * @return int 1 if the file on disk no longer matches the document
+ */
+int documentChangedOnDisk(struct Document *document){
+    // Without inotify every check is a stat, still never a read
+    if (document->watch != -1 && drainEvents(document) == 0) return 0;
+
+    struct stat info;
+    if (stat(document->fileName, &info) != 0) return 0;
+    int64_t mtimeNanos = (int64_t)info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+    return info.st_size != document->knownSize || mtimeNanos != document->knownMtimeNanos || info.st_ino != document->knownInode;
+}
+
+/**
+ * @brief Rereads the file after another program wrote it. Lines matching the start and end of
+ * the document keep their ids, only the lines between them are hashed and interned. A paged document
+ * is paged again from the start with every line counted as changed
+ *
+ * @param document The document
+ * @param change Set to the lines that differ
+ * @return int 1 if ok, 0 if the file couldn't be read (the document is left as it was)
+ */
+int reloadDocument(struct Document *document, struct DocumentChange *change){
+    if (document->paged){
+        size_t oldLineCount = document->lineCount;
+        if (pageDocument(document) == 0) return 0;
+        rememberStat(document);
+        change->firstLine = 1;
+        change->oldLines = oldLineCount;
+        change->newLines = document->lineCount;
+        return 1;
+    }
+    uint64_t trace = TRACE_BEGIN();
+    size_t newLength;
+    char *data = readWholeFile(document->fileName, &newLength);
+    if (data == NULL) return 0;
+    rememberStat(document);
+
+    size_t oldLineCount = document->lineCount;
+    size_t prefix = 0, position = 0;
+    while (prefix < oldLineCount && position < newLength){
+        size_t end = lineEnd(data, position, newLength);
+        if (storedLineEquals(document->store, document->lines[prefix], data + position, end - position) == 0) break;
+        prefix++;
+        position = end;
+    }
+
+    // Lines are matched from the end back to where the matching start stopped
+    size_t suffix = 0, middleEnd = newLength;
+    while (suffix < oldLineCount - prefix && middleEnd > position){
+        const char *newline = middleEnd - 1 > position ? memrchr(data + position, '\n', middleEnd - 1 - position) : NULL;
+        size_t start = newline != NULL ? (size_t)(newline - data) + 1 : position;
+        if (storedLineEquals(document->store, document->lines[oldLineCount - 1 - suffix], data + start, middleEnd - start) == 0) break;
+        suffix++;
+        middleEnd = start;
+    }
+
+    uint32_t *middle = NULL;
+    size_t added = 0, capacity = 0, i;
+    internLines(document->store, data + position, middleEnd - position, &middle, &added, &capacity);
+    free(data);
+
+    for (i = prefix; i < oldLineCount - suffix; i++) releaseLine(document->store, document->lines[i]);
+    size_t lineCount = prefix + added + suffix;
+    if (lineCount > document->lineCapacity){
+        document->lineCapacity = lineCount * 2 > 256 ? lineCount * 2 : 256;
+        document->lines = realloc(document->lines, document->lineCapacity * sizeof(uint32_t));
+    }
+    memmove(document->lines + prefix + added, document->lines + oldLineCount - suffix, suffix * sizeof(uint32_t));
+    if (added > 0) memcpy(document->lines + prefix, middle, added * sizeof(uint32_t));
+    free(middle);
+    document->lineCount = lineCount;
+    document->length = newLength;
+
+    change->firstLine = prefix + 1;
+    change->oldLines = oldLineCount - prefix - suffix;
+    change->newLines = added;
+    TRACE_END("reloadDocument", trace, newLength);
+    return 1;
+}
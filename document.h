@@ -0,0 +1,67 @@
+#ifndef DOCUMENT_H
+#define DOCUMENT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "line_store.h"
+#include "line_index.h"
+
+// Files this big are paged, anything smaller is read whole
+#define DOCUMENT_PAGED_BYTES LINE_INDEX_INSTANT_BYTES
+// Lines read into a paged documents window at a time, the line asked for is a quarter of the way in
+#define DOCUMENT_WINDOW_LINES 1024
+#define DOCUMENT_WINDOW_BYTES (256 * 1024)
+
+// An open file held in memory as ids of interned lines, watched for changes by other programs.
+// Huge files are paged instead, only a window of lines is read and edits go straight to the file
+struct Document
+{
+    char *fileName;
+    struct LineStore *store;
+    uint32_t *lines;        // lines[n - 1] is the id of line n, including its \n
+    size_t lineCount;       // Including a last line without a \n
+    size_t lineCapacity;
+    size_t length;          // Bytes in the file
+    int paged;              // 1 if only the window is held, lines is unused
+    int linesExact;         // 0 while a paged documents lineCount is estimated
+    int partialLastLine;    // 1 if a paged documents last line has no \n
+    char *window;           // The text of lines windowFirst onwards
+    size_t *windowStarts;   // Where each line of the window starts in it, windowCount + 1 entries
+    size_t windowFirst;
+    size_t windowCount;
+    uint64_t windowOffset;  // Where the window starts in the file
+    int watch;              // inotify descriptor, -1 if the file is only polled
+    char *watchName;        // The files name within its folder
+    off_t knownSize;        // Stat data of the file as last read or written by us
+    int64_t knownMtimeNanos;
+    ino_t knownInode;
+};
+
+// The lines that differ after a reload
+struct DocumentChange
+{
+    size_t firstLine;       // First line that differs, from 1
+    size_t oldLines;        // Lines from firstLine replaced
+    size_t newLines;        // Lines now in their place
+};
+
+int openDocument(struct Document *document, char *fileName);
+void closeDocument(struct Document *document);
+
+size_t documentLines(struct Document *document);
+size_t exactDocumentLines(struct Document *document);
+const char * documentLine(struct Document *document, size_t lineNumber, size_t *length);
+char * documentLineCopy(struct Document *document, size_t lineNumber);
+
+void documentInsertLine(struct Document *document, size_t lineNumber, const char *content);
+void documentAppendLine(struct Document *document, const char *content);
+void documentDeleteLine(struct Document *document, size_t lineNumber);
+void documentReplaceLine(struct Document *document, size_t lineNumber, const char *content);
+int saveDocument(struct Document *document);
+
+int documentChangedOnDisk(struct Document *document);
+int reloadDocument(struct Document *document, struct DocumentChange *change);
+
+#endif
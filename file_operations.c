@@ -16,12 +16,25 @@
 #include "line_operations.h"
 #include "change_log.h"
 #include "version_control.h"
+#include "trace.h"
+#include "output.h"
+#include "scheduler.h"
+#include "storage.h"
+#include "line_index.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
 #include <ctype.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+// Following a file starts by showing this many of its last lines
+#define FOLLOW_LINES 20
+// How often a followed file is checked without inotify, or for being replaced
+#define FOLLOW_POLL_MILLISECONDS 1000
 
 
 
@@ -47,9 +60,10 @@ void createFile(char *fileName){
 
 
 
-    FILE *file;
-    file = fopen(fileName, "w");
-    fclose(file);
+    if (storageClose(storageOpen(fileName, STORAGE_WRITE)) == 0){
+        infoScreen("The file couldn't be created!");
+        return;
+    }
 
     addToChangeLog(fileName, "CREATED", "");
 
@@ -114,13 +128,22 @@ void deleteFile(char *fileName){
         return;
     }
 
+    // Held until the record exists so compaction can't collect the snapshot as an orphan
+    lockChangeLogs();
     char *deletedHash = saveDeletedFileForVersionControl(fileName);
+    if (deletedHash == NULL){
+        unlockChangeLogs();
+        infoScreen("A copy of the file couldn't be saved for rolling back!\nIt hasn't been deleted.");
+        return;
+    }
 
-    if (remove(fileName) == 0){
+    if (storageRemove(fileName)){
         addToChangeLog(fileName, "DELETED", deletedHash);
+        unlockChangeLogs();
         free(deletedHash);
         infoScreen("File deleted!");
     } else {
+        unlockChangeLogs();
         infoScreen("You don't have permission to delete this file!");
     }
 }
@@ -143,12 +166,21 @@ void showFile(char *fileName){
     }
 
 
-    FILE *read;
+    // Nothing to page through when piped, so stream it straight out
+    if (isatty(STDOUT_FILENO) == 0){
+        if (dumpFile(fileName, STDOUT_FILENO, 0) == 0) infoScreen("The file couldn't be read!");
+        return;
+    }
 
-    read = fopen(fileName, "r");
+    struct StorageFile *read = storageOpen(fileName, STORAGE_READ);
+    if (read == NULL){
+        infoScreen("The file couldn't be read!");
+        return;
+    }
 
-    char *line;
-    size_t len = 0;
+    struct StorageLineReader reader;
+    openLineReader(&reader, read, 0);
+    const char *line;
     ssize_t line_length;
 
     clearScreen();
@@ -156,44 +188,147 @@ void showFile(char *fileName){
     char *m = concat(fileName, ":\n\n");
     printLine(m);
     free(m);
+
+    // Each page is written out in one go rather than a write per line
+    struct OutputBuffer output;
+    openOutput(&output, STDOUT_FILENO);
     
-    size_t lines = fileLines(fileName);
-    if (lines < 15){
-        while ((line_length = getline(&line, &len, read)) != -1) {
-            printLine(line);
+    // A huge file is shown straight away with an estimated count, which becomes exact once it has been indexed
+    struct LineEstimate estimate;
+    if (estimateFileLines(fileName, &estimate) == 0){
+        estimate.lines = 0;
+        estimate.exact = 1;
+    }
+    size_t lines = estimate.lines;
+    if (estimate.exact && lines < 15){
+        while ((line_length = storageReadLine(&reader, &line)) != -1) {
+            outputBytes(&output, line, line_length);
         }
     } else {
         size_t lineCount = 0, totalLineCount = 0;
         
-        while ((line_length = getline(&line, &len, read)) != -1) {
-            printLine(line);
+        while ((line_length = storageReadLine(&reader, &line)) != -1) {
+            outputBytes(&output, line, line_length);
             lineCount++;
             totalLineCount++;
             if (lineCount > 19){
-                printf("[%ld-%ld/%ld](ENTER to continue, c/C to close)>", totalLineCount-19, totalLineCount, lines);
+                flushOutput(&output);
+                if (estimate.exact == 0) estimate.exact = indexedLineCount(fileName, &lines);
+                printf("[%ld-%ld/%s%ld](ENTER to continue, c/C to close)>", totalLineCount-19, totalLineCount, estimate.exact ? "" : "~", lines);
                 
                 
                 char c = getchar();
                 
                 if (tolower(c) == 'c'){
+                    closeOutput(&output);
+                    closeLineReader(&reader);
+                    storageClose(read);
                     return;
                 }
                  // option TWO to clean stdin
 
                 clearScreen();
                 printHeader();
+                fflush(stdout);
                 lineCount = 0;
             }
         }
     }
-    
-
-    fclose(read);
+    closeOutput(&output);
+    closeLineReader(&reader);
+    storageClose(read);
     printLine("\n\n----------------------------------------");
     waitForKey();
     return;
 }
 
+/**
+ * @brief Shows the end of a file, then anything added to it as it grows (like tail -f).
+ * Only the bytes added since the last look are read, so following a huge log costs just the new data
+ * 
+ * @param fileName The file to follow
+ */
+void followFile(char *fileName){
+    if (fileExists(fileName) == 0){
+        char *m = concat(fileName, " doesn't exist!");
+        infoScreen(m);
+        free(m);
+        return;
+    }
+    if (canRead(fileName) == 0){
+        infoScreen("You don't have permission to read this file!");
+        return;
+    }
+
+    // The file grows while it is followed, so it is read with plain POSIX calls rather than a snapshot of it
+    struct stat info;
+    struct StorageFile *file = storageOpenWith(&posixStorage, fileName, STORAGE_READ);
+    if (file == NULL || stat(fileName, &info) != 0){
+        storageClose(file);
+        infoScreen("The file couldn't be read!");
+        return;
+    }
+
+    clearScreen();
+    printHeader();
+    char *m = concat3("Following ", fileName, " (ENTER to stop):\n\n");
+    printLine(m);
+    free(m);
+
+    off_t offset = dumpFrom(file, tailOffset(file, storageSize(file), FOLLOW_LINES), STDOUT_FILENO);
+
+    // Without inotify the file is only checked every second
+    int watch = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (watch != -1 && inotify_add_watch(watch, fileName, IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF) == -1){
+        close(watch);
+        watch = -1;
+    }
+
+    while (offset != -1){
+        struct pollfd watched[2];
+        watched[0].fd = STDIN_FILENO;
+        watched[0].events = POLLIN;
+        watched[0].revents = 0;
+        watched[1].fd = watch;
+        watched[1].events = POLLIN;
+        watched[1].revents = 0;
+
+        setUserWaiting(1);
+        int ready = poll(watched, watch != -1 ? 2 : 1, FOLLOW_POLL_MILLISECONDS);
+        setUserWaiting(0);
+        if (ready > 0 && (watched[0].revents & (POLLIN | POLLHUP))) break;
+
+        if (watched[1].revents & POLLIN){
+            char events[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+            while (read(watch, events, sizeof(events)) > 0);
+        }
+
+        // CWord and most editors replace a file rather than writing to it, so the name is followed
+        struct stat current;
+        if (stat(fileName, &current) == 0 && (current.st_ino != info.st_ino || current.st_dev != info.st_dev)){
+            struct StorageFile *replacement = storageOpenWith(&posixStorage, fileName, STORAGE_READ);
+            if (replacement != NULL){
+                storageClose(file);
+                file = replacement;
+                info = current;
+                printf("\n--- %s was replaced ---\n", fileName);
+                offset = tailOffset(file, storageSize(file), FOLLOW_LINES);
+                if (watch != -1) inotify_add_watch(watch, fileName, IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF);
+            }
+        }
+
+        off_t size = storageSize(file);
+        if (size < offset){
+            printf("\n--- %s was truncated ---\n", fileName);
+            offset = tailOffset(file, size, FOLLOW_LINES);
+        }
+        if (size > offset) offset = dumpFrom(file, offset, STDOUT_FILENO);
+    }
+
+    if (watch != -1) close(watch);
+    storageClose(file);
+}
+
 /**
  * @brief Determines if a file exits
  * 
@@ -201,7 +336,7 @@ void showFile(char *fileName){
  * @return int 1 if exists, 0 if it doesn't
  */
 int fileExists(char *fileName){
-    return access(fileName, F_OK) == 0 ? 1 : 0;
+    return storageExists(fileName);
 }
 
 /**
@@ -211,7 +346,7 @@ int fileExists(char *fileName){
  * @return int 1 if you can write, 0 if not
  */
 int canWrite(char *fileName){
-    return access(fileName, W_OK) == 0 ? 1 : 0;
+    return storageAccess(fileName, 1);
 }
 
 /**
@@ -221,7 +356,7 @@ int canWrite(char *fileName){
  * @return int  1 if you can read it, 0 if not
  */
 int canRead(char *fileName){
-    return access(fileName, R_OK) == 0 ? 1 : 0;
+    return storageAccess(fileName, 0);
 }
 
 /**
@@ -235,19 +370,8 @@ size_t fileLines(char *fileName){
 
     if (fileExists(fileName) == 0 || canRead(fileName) == 0) return 0;
 
-    size_t lines = 0;
-    char currentChar;
-
-    FILE *file = fopen(fileName, "r");
-
-    for (currentChar = getc(file); currentChar != EOF; currentChar = getc(file)){
-        if (currentChar == '\n') {
-            lines++;
-        }
-    }
-
-    fclose(file);
-    return lines;
+    // Counting also indexes the file, so asking again is instant until it changes
+    return indexFileLines(fileName);
 }
 
 
@@ -258,16 +382,25 @@ size_t fileLines(char *fileName){
  * @param copyName Copy file
  */
 void internalCopyFile(char *fileName, char* copyName){
-    FILE *source, *copy;
-    source = fopen(fileName, "r");
-    copy = fopen(copyName, "w");
+    uint64_t trace = TRACE_BEGIN();
+    struct StorageFile *source = storageOpen(fileName, STORAGE_READ);
+    if (source == NULL) return;
+    struct StorageFile *copy = storageOpen(copyName, STORAGE_WRITE);
+    if (copy == NULL){
+        storageClose(source);
+        return;
+    }
 
-    char charToCopy;
+    char buffer[64 * 1024];
+    uint64_t offset = 0;
+    ssize_t read;
 
-    while ((charToCopy = fgetc(source)) != EOF){
-        fputc(charToCopy, copy);
+    while ((read = storageRead(source, buffer, sizeof(buffer), offset)) > 0){
+        storageWrite(copy, buffer, read);
+        offset += read;
     }
-    fclose(source);
-    fclose(copy);
+    TRACE_END("internalCopyFile", trace, offset);
+    storageClose(source);
+    storageClose(copy);
 }
 
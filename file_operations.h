@@ -7,6 +7,7 @@ void createFile(char *fileName);
 void copyFile(char *fileName, char* copyName);
 void deleteFile(char *fileName);
 void showFile(char *fileName);
+void followFile(char *fileName);
 int fileExists(char *fileName);
 int canWrite(char *fileName);
 int canRead(char *fileName);
@@ -0,0 +1,471 @@
+/**
+ * @file find_replace.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Find and replace across a whole file
+ * The file is streamed through in large blocks and rewritten in a single pass. The lines changed are kept
+ * in a compressed snapshot so the whole replace is one SUBSTITUTE record that can be rolled back
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "find_replace.h"
+#include "file_operations.h"
+#include "interface.h"
+#include "utils.h"
+#include "change_log.h"
+#include "change_log_index.h"
+#include "compression.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <regex.h>
+
+struct Matcher
+{
+    int regex;
+    regex_t compiled;
+    const char *pattern;
+    size_t patternLength;
+    const char *replacement;
+    size_t replacementLength;
+};
+
+// A growing output buffer for a single rewritten line
+struct LineBuffer
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+/**
+ * @brief Adds bytes to the end of a line buffer
+ *
+ * @param buffer The buffer
+ * @param bytes The bytes to add
+ * @param length How many
+ */
+static void appendBytes(struct LineBuffer *buffer, const char *bytes, size_t length){
+    if (buffer->length + length > buffer->capacity){
+        buffer->capacity = (buffer->length + length) * 2;
+        buffer->data = realloc(buffer->data, buffer->capacity);
+    }
+    memcpy(buffer->data + buffer->length, bytes, length);
+    buffer->length += length;
+}
+
+/**
+ * @brief Finds the first match in text[from, to). Literal text is found with memmem, which compares
+ * many bytes per instruction, regexes with a single regexec over the whole range
+ *
+ * @param matcher The pattern
+ * @param text The text, usually a whole block of lines
+ * @param from Where to start, must be a line start unless notBol is set
+ * @param to Where to stop
+ * @param notBol 1 if from isn't the start of a line
+ * @param groups Filled with the regex groups, groups[0] is the match
+ * @return int 1 if found, 0 if not
+ */
+static int findMatch(struct Matcher *matcher, const char *text, size_t from, size_t to, int notBol, regmatch_t groups[10]){
+    if (matcher->regex == 0){
+        const char *found = memmem(text + from, to - from, matcher->pattern, matcher->patternLength);
+        if (found == NULL) return 0;
+        groups[0].rm_so = found - text;
+        groups[0].rm_eo = groups[0].rm_so + matcher->patternLength;
+        return 1;
+    }
+
+    // REG_STARTEND lets the block be searched in place, without a \0 after it
+    groups[0].rm_so = from;
+    groups[0].rm_eo = to;
+    return regexec(&matcher->compiled, text, 10, groups, REG_STARTEND | (notBol ? REG_NOTBOL : 0)) == 0;
+}
+
+/**
+ * @brief Adds the replacement for a match, filling in \0 to \9 for regexes
+ *
+ * @param matcher The pattern
+ * @param line The matched text
+ * @param groups The groups of the match
+ * @param output Where the new line is built
+ */
+static void appendReplacement(struct Matcher *matcher, const char *line, regmatch_t groups[10], struct LineBuffer *output){
+    if (matcher->regex == 0){
+        appendBytes(output, matcher->replacement, matcher->replacementLength);
+        return;
+    }
+
+    size_t i;
+    for (i = 0; i < matcher->replacementLength; i++){
+        char c = matcher->replacement[i];
+        if (c == '\\' && i + 1 < matcher->replacementLength){
+            char next = matcher->replacement[i + 1];
+            if (next >= '0' && next <= '9'){
+                regmatch_t group = groups[next - '0'];
+                if (group.rm_so != -1) appendBytes(output, line + group.rm_so, group.rm_eo - group.rm_so);
+                i++;
+                continue;
+            } else if (next == '\\'){
+                i++;
+            }
+        }
+        appendBytes(output, &c, 1);
+    }
+}
+
+/**
+ * @brief Replaces every match within a single line
+ *
+ * @param matcher The pattern
+ * @param line The lines content, without its \n
+ * @param length The lines length
+ * @param output Emptied and filled with the new line
+ * @return size_t The number of replacements made
+ */
+static size_t substituteLine(struct Matcher *matcher, const char *line, size_t length, struct LineBuffer *output){
+    output->length = 0;
+    size_t position = 0, count = 0;
+    regmatch_t groups[10];
+
+    while (position <= length && findMatch(matcher, line, position, length, position > 0, groups)){
+        size_t start = groups[0].rm_so, end = groups[0].rm_eo;
+        appendBytes(output, line + position, start - position);
+        appendReplacement(matcher, line, groups, output);
+        count++;
+
+        if (end == start){
+            // An empty match, step over a byte so it can't match again in the same place
+            if (start < length) appendBytes(output, line + start, 1);
+            position = start + 1;
+        } else {
+            position = end;
+        }
+    }
+    if (position < length) appendBytes(output, line + position, length - position);
+    return count;
+}
+
+/**
+ * @brief Counts the \n in a range with memchr
+ *
+ * @param text The text
+ * @param from Start of the range
+ * @param to End of the range
+ * @return size_t The number of lines ended in the range
+ */
+static size_t countNewlines(const char *text, size_t from, size_t to){
+    size_t count = 0;
+    const char *p = text + from, *end = text + to;
+    while (p < end && (p = memchr(p, '\n', end - p)) != NULL){
+        count++;
+        p++;
+    }
+    return count;
+}
+
+/**
+ * @brief Replaces every match of a pattern in a file, in a single pass over it.
+ * The original content of each changed line is kept so the replace can be rolled back,
+ * patterns never match across lines so the number of lines stays the same. The one exception is
+ * a last line without a \n emptied by the replace, which leaves the file, undoSubstitute puts it back
+ *
+ * @param fileName The file
+ * @param options What to replace
+ * @param result Filled with what was changed, may be NULL
+ * @return int 1 if ok, 0 if the file couldn't be read or written, -1 if the pattern isn't valid
+ */
+int findReplace(char *fileName, struct FindReplaceOptions *options, struct FindReplaceResult *result){
+    uint64_t trace = TRACE_BEGIN();
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    if (result != NULL) memset(result, 0, sizeof(*result));
+
+    if (options->pattern[0] == '\0' || strchr(options->pattern, '\n') != NULL || strchr(options->replacement, '\n') != NULL) return -1;
+
+    struct Matcher matcher;
+    memset(&matcher, 0, sizeof(matcher));
+    matcher.regex = options->regex;
+    matcher.pattern = options->pattern;
+    matcher.patternLength = strlen(options->pattern);
+    matcher.replacement = options->replacement;
+    matcher.replacementLength = strlen(options->replacement);
+    // REG_NEWLINE keeps a regex from matching across lines, so whole blocks can be searched at once
+    if (matcher.regex && regcomp(&matcher.compiled, options->pattern, REG_EXTENDED | REG_NEWLINE) != 0) return -1;
+
+    FILE *source = fopen(fileName, "r");
+    char *outputName = concat(fileName, ".replace.cword.txt");
+    FILE *output = source != NULL ? fopen(outputName, "w") : NULL;
+
+    char *dirLocation = concat(".cword/", fileName);
+    dirExists(dirLocation);
+    char *undoName = concat(dirLocation, "/substitute.cword.txt");
+    FILE *undo = output != NULL ? fopen(undoName, "w") : NULL;
+
+    int ok = undo != NULL;
+    size_t capacity = FIND_REPLACE_BLOCK_SIZE;
+    char *buffer = malloc(capacity);
+    if (ok) setvbuf(output, NULL, _IOFBF, FIND_REPLACE_BLOCK_SIZE);
+
+    struct LineBuffer line;
+    memset(&line, 0, sizeof(line));
+    size_t filled = 0, lineNumber = 1, linesChanged = 0, replacements = 0;
+    uint64_t totalRead = 0;
+    int endOfFile = 0;
+
+    while (ok){
+        if (endOfFile == 0){
+            size_t read = fread(buffer + filled, 1, capacity - filled, source);
+            filled += read;
+            totalRead += read;
+            if (filled < capacity) endOfFile = 1;
+        }
+        if (filled == 0) break;
+
+        // Only whole lines are searched, the tail is kept for the next block
+        char *lastNewline = memrchr(buffer, '\n', filled);
+        size_t end = lastNewline != NULL ? (size_t)(lastNewline - buffer) + 1 : 0;
+        if (endOfFile) end = filled;
+        if (end == 0){
+            capacity *= 2;
+            buffer = realloc(buffer, capacity);
+            continue;
+        }
+
+        size_t position = 0, written = 0;
+        while (position < end){
+            // Step over the lines before the range a line at a time
+            if (lineNumber < options->firstLine){
+                char *newline = memchr(buffer + position, '\n', end - position);
+                position = newline != NULL ? (size_t)(newline - buffer) + 1 : end;
+                if (newline != NULL) lineNumber++;
+                continue;
+            }
+            if (options->lastLine != 0 && lineNumber > options->lastLine){
+                lineNumber += countNewlines(buffer, position, end);
+                break;
+            }
+
+            regmatch_t groups[10];
+            if (findMatch(&matcher, buffer, position, end, 0, groups) == 0){
+                lineNumber += countNewlines(buffer, position, end);
+                break;
+            }
+
+            // Widen the match out to its whole line
+            size_t matchStart = groups[0].rm_so;
+            char *previous = matchStart > position ? memrchr(buffer + position, '\n', matchStart - position) : NULL;
+            size_t lineStart = previous != NULL ? (size_t)(previous - buffer) + 1 : position;
+            lineNumber += countNewlines(buffer, position, lineStart);
+            if (options->lastLine != 0 && lineNumber > options->lastLine){
+                lineNumber += countNewlines(buffer, lineStart, end);
+                break;
+            }
+            char *next = memchr(buffer + lineStart, '\n', end - lineStart);
+            size_t lineEnd = next != NULL ? (size_t)(next - buffer) : end;
+
+            size_t count = substituteLine(&matcher, buffer + lineStart, lineEnd - lineStart, &line);
+            if (count > 0 && (line.length != lineEnd - lineStart || memcmp(line.data, buffer + lineStart, line.length) != 0)){
+                fwrite(buffer + written, 1, lineStart - written, output);
+                fwrite(line.data, 1, line.length, output);
+                written = lineEnd;
+
+                fprintf(undo, "%zu::", lineNumber);
+                fwrite(buffer + lineStart, 1, lineEnd - lineStart, undo);
+                fputc('\n', undo);
+                linesChanged++;
+                replacements += count;
+            }
+
+            position = next != NULL ? lineEnd + 1 : end;
+            if (next != NULL) lineNumber++;
+        }
+
+        fwrite(buffer + written, 1, end - written, output);
+        memmove(buffer, buffer + end, filled - end);
+        filled -= end;
+        if (endOfFile && filled == 0) break;
+    }
+
+    if (source != NULL && ferror(source)) ok = 0;
+    if (source != NULL) fclose(source);
+    if (output != NULL && fclose(output) != 0) ok = 0;
+    if (undo != NULL && fclose(undo) != 0) ok = 0;
+    if (matcher.regex) regfree(&matcher.compiled);
+    free(buffer);
+    free(line.data);
+
+    if (ok && linesChanged > 0){
+        // Stored like a snapshot so lookups through copies and orphan collection already handle it,
+        // an unused one is left for compaction as another change may share it
+        char *hash = storeSnapshot(fileName, undoName);
+        ok = hash != NULL && rename(outputName, fileName) == 0;
+        if (ok){
+            char *count = intToString(linesChanged);
+            char *info = concat3(count, "::", hash);
+            addToChangeLog(fileName, "SUBSTITUTE", info);
+            free(info);
+            free(count);
+        }
+        free(hash);
+    }
+
+    remove(outputName);
+    remove(undoName);
+    free(outputName);
+    free(undoName);
+    free(dirLocation);
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    if (result != NULL && ok){
+        result->linesChanged = linesChanged;
+        result->replacements = replacements;
+        result->seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+    }
+    TRACE_END("findReplace", trace, totalRead);
+    return ok;
+}
+
+/**
+ * @brief Puts back the lines a SUBSTITUTE record replaced, in a single pass over the file
+ *
+ * @param fileName The tracked file, its history holds the snapshot
+ * @param hash The snapshot named in the record
+ * @param target The file to restore the lines in, the tracked file or a copy of it
+ * @return int 1 if ok, 0 if the snapshot or file couldn't be read
+ */
+int undoSubstitute(char *fileName, char *hash, char *target){
+    char *snapshot = changeLogSnapshotPath(fileName, hash);
+    if (snapshot == NULL) return 0;
+
+    char *undoName = concat3(".cword/", fileName, "/substitute.undo.cword.txt");
+    int ok = 1;
+    if (isCompressedFile(snapshot)){
+        ok = decompressFile(snapshot, undoName);
+    } else {
+        internalCopyFile(snapshot, undoName);
+    }
+    free(snapshot);
+
+    FILE *undo = ok ? fopen(undoName, "r") : NULL;
+    FILE *source = undo != NULL ? fopen(target, "r") : NULL;
+    char *outputName = concat(target, ".replace.cword.txt");
+    FILE *output = source != NULL ? fopen(outputName, "w") : NULL;
+    ok = output != NULL;
+
+    char *line = NULL, *original = NULL;
+    size_t len = 0, originalLen = 0, lineNumber = 0, nextLine = 0;
+    ssize_t l, o = -1;
+    char *content = NULL;
+
+    if (ok) setvbuf(output, NULL, _IOFBF, FIND_REPLACE_BLOCK_SIZE);
+    while (ok && (l = getline(&line, &len, source)) != -1){
+        lineNumber++;
+        while (nextLine < lineNumber){
+            o = getline(&original, &originalLen, undo);
+            if (o == -1){
+                nextLine = (size_t)-1;
+                break;
+            }
+            if (o > 0 && original[o - 1] == '\n') original[--o] = '\0';
+            content = strstr(original, "::");
+            nextLine = strtoul(original, NULL, 10);
+            if (content == NULL) nextLine = 0;
+        }
+
+        if (o != -1 && nextLine == lineNumber){
+            content += 2;
+            fwrite(content, 1, o - (content - original), output);
+            if (line[l - 1] == '\n') fputc('\n', output);
+        } else {
+            fwrite(line, 1, l, output);
+        }
+    }
+
+    // A last line without a \n that was emptied is no longer in the file, it goes back on the end
+    int putBack = 0;
+    while (ok && nextLine != (size_t)-1){
+        if (o != -1 && content != NULL && nextLine > lineNumber){
+            if (putBack) fputc('\n', output);
+            content += 2;
+            fwrite(content, 1, o - (content - original), output);
+            putBack = 1;
+        }
+        o = getline(&original, &originalLen, undo);
+        if (o == -1) break;
+        if (o > 0 && original[o - 1] == '\n') original[--o] = '\0';
+        content = strstr(original, "::");
+        nextLine = content != NULL ? strtoul(original, NULL, 10) : 0;
+    }
+    free(line);
+    free(original);
+
+    if (undo != NULL) fclose(undo);
+    if (source != NULL) fclose(source);
+    if (output != NULL && fclose(output) != 0) ok = 0;
+    if (ok) ok = rename(outputName, target) == 0;
+    remove(outputName);
+    remove(undoName);
+    free(outputName);
+    free(undoName);
+    return ok;
+}
+
+/**
+ * @brief Asks what to replace in a file and does it
+ *
+ * @param fileName The file
+ */
+void findAndReplace(char *fileName){
+    if (fileExists(fileName) == 0){
+        char *m = concat(fileName, " doesn't exist!");
+        infoScreen(m);
+        free(m);
+        return;
+    }
+    if (canRead(fileName) == 0 || canWrite(fileName) == 0){
+        infoScreen("You don't have permission to edit this file!");
+        return;
+    }
+
+    struct FindReplaceOptions options;
+    options.pattern = getUserLine("Please provide the text to find: ");
+    options.replacement = getUserLine("Please provide the text to replace it with (\\1 to \\9 for regex groups): ");
+    char *mode = getUserLine("Is that a regular expression? (y/N): ");
+    options.regex = mode[0] == 'y' || mode[0] == 'Y';
+    free(mode);
+    char *range = getUserLine("Lines to replace in, e.g. 10-200 (blank for the whole file): ");
+    options.firstLine = 1;
+    options.lastLine = 0;
+    if (range[0] != '\0'){
+        char *dash = strchr(range, '-');
+        options.firstLine = strtoul(range, NULL, 10);
+        options.lastLine = dash != NULL ? strtoul(dash + 1, NULL, 10) : options.firstLine;
+        if (options.firstLine < 1) options.firstLine = 1;
+    }
+    free(range);
+
+    waitScreen("Replacing.\nPlease wait...\n");
+    struct FindReplaceResult result;
+    int ok = findReplace(fileName, &options, &result);
+    if (ok == -1){
+        infoScreen("That isn't a valid pattern!\nPatterns can't be empty and neither can span lines.");
+    } else if (ok == 0){
+        infoScreen("The file couldn't be rewritten!\nNothing has been changed.");
+    } else if (result.linesChanged == 0){
+        infoScreen("No matches were found.");
+    } else {
+        char message[160];
+        sprintf(message, "Made %zu replacements on %zu lines in %.2f seconds.\nThey can be undone with a single rollback.", result.replacements, result.linesChanged, result.seconds);
+        infoScreen(message);
+    }
+    free(options.pattern);
+    free(options.replacement);
+}
@@ -0,0 +1,29 @@
+#ifndef FIND_REPLACE_H
+#define FIND_REPLACE_H
+
+#include <stddef.h>
+
+// Bytes read from the file at a time, grown only for a line longer than this
+#define FIND_REPLACE_BLOCK_SIZE (1024 * 1024)
+
+struct FindReplaceOptions
+{
+    char *pattern;
+    char *replacement;   // \0 to \9 insert the regex groups
+    int regex;           // 1 for a POSIX extended regex, 0 for literal text
+    size_t firstLine;    // From 1
+    size_t lastLine;     // 0 = to the end of the file
+};
+
+struct FindReplaceResult
+{
+    size_t linesChanged;
+    size_t replacements;
+    double seconds;
+};
+
+int findReplace(char *fileName, struct FindReplaceOptions *options, struct FindReplaceResult *result);
+int undoSubstitute(char *fileName, char *hash, char *target);
+void findAndReplace(char *fileName);
+
+#endif
@@ -16,11 +16,21 @@
 #include "interface.h"
 #include "utils.h"
 #include "change_log.h"
+#include "gap_buffer.h"
+#include "document.h"
+#include "buffer_cache.h"
+#include "trace.h"
+#include "scheduler.h"
+#include "key_script.h"
 
 #include <stddef.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <locale.h>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include <ncurses.h>
 
@@ -28,32 +38,182 @@
 #define CTRL(c) ((c) & 037)
 #endif
 
+#define KEY_ESCAPE 27
+// Returned by waitForEditorKey when another program has written the file
+#define KEY_FILE_CHANGED (KEY_MAX + 1)
+// Sent by the terminal around pasted text once bracketed paste is turned on
+#define KEY_PASTE_START (KEY_MAX + 2)
+#define KEY_PASTE_END (KEY_MAX + 3)
+// How long a paste may stall before the block is taken as finished
+#define PASTE_TIMEOUT_MILLISECONDS 500
+// How often the file is checked when inotify isn't available
+#define FILE_POLL_MILLISECONDS 1000
+
+static void runEditor(struct BufferCache *buffers, int linesToShow);
+static int nextKey();
+static int readInputLine(struct GapBuffer *input, char *label);
+static int waitForEditorKey(struct Document *document);
+static void reloadEditor(struct EditorBuffer *buffer);
+static void setBracketedPaste(int enabled);
+static char * readPastedBlock(size_t *lines);
+
 /**
- * @brief Initiates the editor
+ * @brief Checks a file can be opened in the editor, telling the user why not
  * 
- * @param fileName The file to edit
+ * @param fileName The file
+ * @return int 1 if it can be edited
  */
-void editor(char *fileName){
-    
+static int canEdit(char *fileName){
     if (fileExists(fileName) == 0){
         char *m = concat(fileName, " doesn't exist!");
         infoScreen(m);
         free(m);
-        return;
+        return 0;
     }
     if (canRead(fileName) == 0){
         infoScreen("You don't have permission to read this file!");
-        return;
+        return 0;
     }
     if (canWrite(fileName) == 0){
         infoScreen("You don't have permission to write to this file!");
+        return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Shows a message over the editor, returning to it after a key press
+ * 
+ * @param message The message
+ */
+static void editorMessage(char *message){
+    setBracketedPaste(0);
+    endwin();
+    infoScreen(message);
+    refresh();
+    setBracketedPaste(1);
+}
+
+/**
+ * @brief Switches buffer, checking the file hasn't been written by another program whilst in the background
+ * 
+ * @param buffers The open files
+ * @param index The buffer to switch to
+ */
+static void switchEditorBuffer(struct BufferCache *buffers, size_t index){
+    if (switchBuffer(buffers, index) == 0){
+        editorMessage("That file couldn't be read!");
+        return;
+    }
+    struct EditorBuffer *buffer = activeBuffer(buffers);
+    if (documentChangedOnDisk(&buffer->document)) reloadEditor(buffer);
+}
+
+/**
+ * @brief Asks for a line number and moves straight to it, lines past the end go to the last line
+ *
+ * @param buffer The open file
+ * @param totalLines How many lines it has
+ */
+static void goToLine(struct EditorBuffer *buffer, size_t totalLines){
+    struct GapBuffer input;
+    initGapBuffer(&input, "", 0);
+    char label[48];
+    sprintf(label, "[Go to line 1-%zu]> ", totalLines);
+    if (readInputLine(&input, label) == 1){
+        char *typed = gapBufferContents(&input);
+        char *end;
+        long target = strtol(typed, &end, 10);
+        if (end != typed && *end == '\0'){
+            if (target < 1) target = 1;
+            if ((size_t)target > totalLines) target = totalLines;
+            buffer->lineNumber = target;
+        }
+        free(typed);
+    }
+    freeGapBuffer(&input);
+}
+
+/**
+ * @brief Initiates the editor
+ * 
+ * @param fileName The file to edit, more can be opened with CTRL + O
+ */
+void editor(char *fileName){
+    
+    if (canEdit(fileName) == 0) return;
+
+    struct BufferCache buffers;
+    initBufferCache(&buffers, bufferCacheBudget());
+    if (openBuffer(&buffers, fileName) == -1){
+        infoScreen("Couldn't read the file!");
         return;
     }
     
 
     int linesToShow = getIntegerInput("How many lines would you like to view at a time (odd number only): ");
     infoScreen("Please note that changes saved immediately, accidentally closing will only loose\n a line that hasn't been entered!");
+    recordEditorSize(linesToShow);
+    
+    clearScreen();
+
+    // Initiate Ncurse's, the locale lets ncursesw draw UTF-8
+    setlocale(LC_ALL, "");
+    initscr();
+    runEditor(&buffers, linesToShow);
+}
+
+/**
+ * @brief Plays a key script into the editor as fast as it takes them (or at the pace they were recorded),
+ * drawing into a screen that is never shown. Message screens are sent to /dev/null and read nothing
+ * 
+ * @param fileName The file to edit
+ * @param replay The loaded script, its latencies and final screen are filled in
+ * @return int 1 if it was played, 0 if the file or screen couldn't be opened
+ */
+int replayEditor(char *fileName, struct KeyReplay *replay){
+    struct BufferCache buffers;
+    initBufferCache(&buffers, bufferCacheBudget());
+    if (openBuffer(&buffers, fileName) == -1){
+        freeBufferCache(&buffers);
+        return 0;
+    }
+
+    fflush(stdout);
+    int savedInput = dup(STDIN_FILENO), savedOutput = dup(STDOUT_FILENO);
+    int nothing = open("/dev/null", O_RDWR);
+    dup2(nothing, STDIN_FILENO);
+    dup2(nothing, STDOUT_FILENO);
+    close(nothing);
 
+    // Always the same terminal so a script draws the same screen wherever it is played, LINES and COLUMNS resize it
+    setlocale(LC_ALL, "");
+    SCREEN *screen = newterm("xterm", stdout, stdin);
+    if (screen != NULL){
+        startKeyReplay(replay);
+        runEditor(&buffers, replay->linesToShow);
+        endKeyReplay();
+        delscreen(screen);
+    } else {
+        freeBufferCache(&buffers);
+    }
+
+    fflush(stdout);
+    clearerr(stdin);
+    dup2(savedInput, STDIN_FILENO);
+    dup2(savedOutput, STDOUT_FILENO);
+    close(savedInput);
+    close(savedOutput);
+    return screen != NULL;
+}
+
+/**
+ * @brief Runs the editor on an ncurses screen already set up, until it is left
+ * 
+ * @param buffers The open files, freed when the editor is left
+ * @param linesToShow How many lines the user asked to see
+ */
+static void runEditor(struct BufferCache *buffers, int linesToShow){
     // Calc deviation
     if (linesToShow % 2 == 1){
         linesToShow--;
@@ -65,105 +225,193 @@ void editor(char *fileName){
 
     linesToShow = linesToShow / 2;
 
-
-    int lineNumber = 1;
-
-    
-    clearScreen();
-
-    // Initiate Ncurse's
-    initscr();
-    //noecho();
+    // The input line is drawn by readInputLine, not echoed
+    noecho();
+    set_escdelay(25);
     cbreak();
     keypad(stdscr, TRUE);
+    // Pastes arrive wrapped in markers so the whole block can be inserted at once
+    define_key("\033[200~", KEY_PASTE_START);
+    define_key("\033[201~", KEY_PASTE_END);
+    setBracketedPaste(1);
+    initSyntaxColours();
     clear();
-    char line[1000];
-
-    
 
+    // A keystroke is traced from the key arriving until the screen has been redrawn
+    uint64_t keyTrace = 0;
     while (1 == 1){
         
-        size_t totalLines = fileLines(fileName);
-        size_t min, max;
-        calculateMinMax(&min, &max, &lineNumber, totalLines, linesToShow);
-        printLinesNCurse(fileName, min, max, lineNumber);
-
-        int i;
-        for (i = 0; i < 1000; i++){
-            line[i] = '\0';
+        struct EditorBuffer *buffer = activeBuffer(buffers);
+        // Files that can't be read anymore are closed
+        while (buffer != NULL && buffer->loaded == 0 && switchBuffer(buffers, buffers->active) == 0){
+            closeBuffer(buffers, buffers->active);
+            buffer = activeBuffer(buffers);
         }
-        
-        int lineCounter = 0;
-        
+        if (buffer == NULL){
+            setBracketedPaste(0);
+            endwin();
+            infoScreen("None of the open files can be read anymore!");
+            break;
+        }
+        struct Document *document = &buffer->document;
+        // A huge files line count starts out estimated, reading the cursor line finds out if it is past the end
+        size_t length;
+        if (document->paged) documentLine(document, buffer->lineNumber, &length);
+        size_t totalLines = documentLines(document);
+        size_t min, max;
+        calculateMinMax(&min, &max, &buffer->lineNumber, totalLines, linesToShow);
+        printLinesNCurse(buffers, min, max);
+        TRACE_END("keystroke", keyTrace, 0);
 
-        int key = getch();
+        int key = waitForEditorKey(document);
+        keyTrace = TRACE_BEGIN();
 
-        if (key == KEY_UP){
-            lineNumber--;
+        if (key == KEY_FILE_CHANGED){
+            reloadEditor(buffer);
+        } else if (key == KEY_UP){
+            buffer->lineNumber--;
         } else if (key == KEY_DOWN){
-            lineNumber++;
+            buffer->lineNumber++;
+        } else if (key == KEY_PPAGE){
+            buffer->lineNumber -= linesToShow * 2 + 1;
+        } else if (key == KEY_NPAGE){
+            buffer->lineNumber += linesToShow * 2 + 1;
+        } else if (key == KEY_HOME){
+            buffer->lineNumber = 1;
+        } else if (key == KEY_END){
+            buffer->lineNumber = exactDocumentLines(document);
+        } else if (key == CTRL('g')){
+            goToLine(buffer, exactDocumentLines(document));
+        } else if (key == KEY_LEFT){
+            size_t step = COLS / 2;
+            buffer->leftColumn = buffer->leftColumn > step ? buffer->leftColumn - step : 0;
+        } else if (key == KEY_RIGHT){
+            buffer->leftColumn += COLS / 2;
+        } else if (key == CTRL('t')){
+            setSyntaxLanguage(&buffer->syntax, nextSyntaxLanguage(buffer->syntax.language));
+        } else if (key == CTRL('n') || key == CTRL('p')){
+            if (buffers->count > 1){
+                size_t step = key == CTRL('n') ? 1 : buffers->count - 1;
+                switchEditorBuffer(buffers, (buffers->active + step) % buffers->count);
+            }
+        } else if (key == CTRL('o')){
+            struct GapBuffer input;
+            initGapBuffer(&input, "", 0);
+            if (readInputLine(&input, "[Open file]> ") == 1){
+                char *name = gapBufferContents(&input);
+                setBracketedPaste(0);
+                endwin();
+                if (name[0] != '\0' && canEdit(name)){
+                    if (openBuffer(buffers, name) == -1){
+                        infoScreen(buffers->count == BUFFER_CACHE_MAX_BUFFERS ? "Too many files are open, close one with CTRL + W first!" : "Couldn't read the file!");
+                    } else {
+                        buffer = activeBuffer(buffers);
+                        if (documentChangedOnDisk(&buffer->document)) reloadEditor(buffer);
+                    }
+                }
+                refresh();
+                setBracketedPaste(1);
+                free(name);
+            }
+            freeGapBuffer(&input);
+        } else if (key == CTRL('w') && buffers->count > 1){
+            closeBuffer(buffers, buffers->active);
+            switchEditorBuffer(buffers, buffers->active);
         } else if (key == '\n'){
-           
-            attemptToAddLine(fileName, lineNumber, totalLines, "\n");
-            lineNumber++;
+            totalLines = exactDocumentLines(document);
+            attemptToAddLine(document, buffer->lineNumber, totalLines, "\n");
+            invalidateLineWidths(&buffer->widthCache, buffer->lineNumber);
+            syntaxLinesInserted(&buffer->syntax, buffer->lineNumber == totalLines ? totalLines + 1 : buffer->lineNumber, 1);
+            buffer->lineNumber++;
             
         } else if (key == CTRL('d') && totalLines != 0) {
-            char *dLine = getLineNOfFile(fileName, lineNumber);
-            int i;
-            for (i = 0; i < strlen(dLine); i++){
-                if (dLine[i] == '\n') dLine[i] = '\0';
-            }
-            internalDeleteLine(fileName, lineNumber);
-            char *ln = intToString(lineNumber);
+            char *dLine = documentLineCopy(document, buffer->lineNumber);
+            documentDeleteLine(document, buffer->lineNumber);
+            saveDocument(document);
+            char *ln = intToString(buffer->lineNumber);
 
             char *info = concat3(ln, "::", dLine);
             free(ln);
+            free(dLine);
     
-            addToChangeLog(fileName, "DELETE", info);
+            addToChangeLog(buffer->fileName, "DELETE", info);
           free(info);
-        } else if (key == CTRL('e')) {
+            invalidateLineWidths(&buffer->widthCache, buffer->lineNumber);
+            syntaxLinesDeleted(&buffer->syntax, buffer->lineNumber, 1);
+        } else if (key == CTRL('e') || key == CTRL('w')) {
             erase();
             refresh();
+            setBracketedPaste(0);
             endwin();
+            freeBufferCache(buffers);
             break;
-        } else {
-            line[0] = key;
-            while((key = getch()) != '\n'){
-                if (key == KEY_BACKSPACE){
-                    if (lineCounter >= 0){
-                        printw(" \b");
-                        line[lineCounter] = '\0';
-                        lineCounter--;
-                    } else
-                    {
-                        printw(" ");
-                    }
-                } else {
-                    if (lineCounter > 999){
-                        printw("\b \b");
-                        line[lineCounter] = '\0';
-                    } else {
-                        lineCounter++;
-                        line[lineCounter] = key;
-                    }
+        } else if (key == CTRL('r') && totalLines != 0) {
+            char *current = documentLineCopy(document, buffer->lineNumber);
+
+            struct GapBuffer input;
+            initGapBuffer(&input, current, strlen(current));
+            char label[48];
+            sprintf(label, "[Editing line %d]> ", buffer->lineNumber);
+
+            if (readInputLine(&input, label) == 1){
+                char *edited = gapBufferContents(&input);
+                char *clean = sanitise(edited);
+                if (strcmp(clean, current) != 0){
+                    attemptToReplaceLine(document, buffer->lineNumber, current, clean);
+                    invalidateLineWidths(&buffer->widthCache, buffer->lineNumber);
+                    syntaxLineChanged(&buffer->syntax, buffer->lineNumber);
                 }
+                free(clean);
+                free(edited);
             }
-            line[lineCounter+1] = '\n';
+            freeGapBuffer(&input);
+            free(current);
+        } else if (key == KEY_PASTE_START){
+            size_t lines;
+            char *block = readPastedBlock(&lines);
+            if (lines != 0){
+                totalLines = exactDocumentLines(document);
+                attemptToAddBlock(document, buffer->lineNumber, totalLines, block, lines);
+                invalidateLineWidths(&buffer->widthCache, buffer->lineNumber);
+                syntaxLinesInserted(&buffer->syntax, buffer->lineNumber == totalLines ? totalLines + 1 : buffer->lineNumber, lines);
+                buffer->lineNumber += lines;
+            }
+            free(block);
+        } else if (key < KEY_MIN && (key >= ' ' || key == '\t')) {
+            char first = key;
+            struct GapBuffer input;
+            initGapBuffer(&input, &first, 1);
 
-            if (line[0] == '!' && (line[1] == 'h' || line[1] == 'H') && strlen(line) == 3){
-                endwin();
-                infoScreen("The following are available:\n\n!h - This screen\nCTRL + D - Deletes current line\nCTRL + E - Exit editor\n");
-                refresh();
+            if (readInputLine(&input, "[!h - Help]> ") == 0){
+                freeGapBuffer(&input);
+                continue;
+            }
+            char *typed = gapBufferContents(&input);
+            freeGapBuffer(&input);
+
+            if (typed[0] == '!' && (typed[1] == 'h' || typed[1] == 'H') && strlen(typed) == 2){
+                free(typed);
+                editorMessage("The following are available:\n\n!h - This screen\nPAGE UP/PAGE DOWN - Move a screen at a time\nHOME/END - Go to the first/last line\nCTRL + G - Go to a line\nLEFT/RIGHT - Scroll sideways through long lines\nCTRL + T - Change syntax highlighting\nCTRL + R - Edit the current line\nCTRL + D - Deletes current line\nCTRL + O - Open another file\nCTRL + N/CTRL + P - Switch to the next/previous file\nCTRL + W - Close the current file\nCTRL + E - Exit editor\n\nPasted lines are inserted together as one change\n\nWhilst typing a line:\nLEFT/RIGHT/HOME/END - Move the cursor\nBACKSPACE/DELETE - Remove a character\nESC - Cancel the line\n");
                 continue;
             }
 
-            attemptToAddLine(fileName, lineNumber, totalLines, line);
-            lineNumber++;
+            char *clean = sanitise(typed);
+            char *line = concat(clean, "\n");
+            totalLines = exactDocumentLines(document);
+            attemptToAddLine(document, buffer->lineNumber, totalLines, line);
+            invalidateLineWidths(&buffer->widthCache, buffer->lineNumber);
+            syntaxLinesInserted(&buffer->syntax, buffer->lineNumber == totalLines ? totalLines + 1 : buffer->lineNumber, 1);
+            buffer->lineNumber++;
+            free(line);
+            free(clean);
+            free(typed);
         }
 
-        totalLines = fileLines(fileName);
-        if (lineNumber > totalLines) lineNumber = totalLines;
-        if (lineNumber < 1) lineNumber = 1;
+        // Opening, closing or switching files changes the active buffer
+        buffer = activeBuffer(buffers);
+        totalLines = documentLines(&buffer->document);
+        if (buffer->lineNumber > totalLines) buffer->lineNumber = totalLines;
+        if (buffer->lineNumber < 1) buffer->lineNumber = 1;
 
         
         
@@ -173,53 +421,403 @@ void editor(char *fileName){
 /**
  * @brief Adds the inputted line to the file by insertion or appendage
  * 
- * @param fileName File to insert to
+ * @param document The open file to insert to
  * @param lineNumber Line number to insert at
  * @param maxLines Total file lines
  * @param line The line to add
  */
-void attemptToAddLine(char *fileName, int lineNumber, int maxLines, char *line){
-    if (lineNumber == maxLines){
-        internalAppendLine(fileName, line);
-        addToChangeLog(fileName, "APPEND", "1");
+void attemptToAddLine(struct Document *document, int lineNumber, int maxLines, char *line){
+    // An empty file has no line to insert before
+    if (lineNumber >= maxLines){
+        documentAppendLine(document, line);
+        saveDocument(document);
+        addToChangeLog(document->fileName, "APPEND", "1");
         
     } else {
-        internalInsertLine(fileName, lineNumber, line);
+        documentInsertLine(document, lineNumber, line);
+        saveDocument(document);
         char *ln = intToString(lineNumber);
-        addToChangeLog(fileName, "INSERT", ln);
+        addToChangeLog(document->fileName, "INSERT", ln);
         free(ln);
     }
 }
 
 /**
- * @brief Prints files lines between x and y highlighting z using NCurse's methods
+ * @brief Adds a block of lines in one go by insertion or appendage, recorded as a single
+ * APPEND count or INSERT n::count so one rollback removes it all
+ * 
+ * @param document The open file to insert to
+ * @param lineNumber Line number to insert at
+ * @param maxLines Total file lines
+ * @param block The lines to add, each ending with \n
+ * @param lines How many lines are in the block
+ */
+void attemptToAddBlock(struct Document *document, int lineNumber, int maxLines, char *block, size_t lines){
+    if (lines == 1){
+        attemptToAddLine(document, lineNumber, maxLines, block);
+        return;
+    }
+
+    char info[48];
+    if (lineNumber >= maxLines){
+        documentAppendLine(document, block);
+        saveDocument(document);
+        sprintf(info, "%zu", lines);
+        addToChangeLog(document->fileName, "APPEND", info);
+    } else {
+        documentInsertLine(document, lineNumber, block);
+        saveDocument(document);
+        sprintf(info, "%d::%zu", lineNumber, lines);
+        addToChangeLog(document->fileName, "INSERT", info);
+    }
+}
+
+/**
+ * @brief Replaces a line with its edited version, recorded as a single REPLACE holding the old content
+ * 
+ * @param document The open file to edit
+ * @param lineNumber Line number being replaced
+ * @param oldLine The lines content before editing, without its \n
+ * @param newLine The lines new content, without its \n
+ */
+void attemptToReplaceLine(struct Document *document, int lineNumber, char *oldLine, char *newLine){
+    char *line = concat(newLine, "\n");
+    documentReplaceLine(document, lineNumber, line);
+    saveDocument(document);
+    free(line);
+
+    char *ln = intToString(lineNumber);
+    char *info = concat3(ln, "::", oldLine);
+    free(ln);
+    addToChangeLog(document->fileName, "REPLACE", info);
+    free(info);
+}
+
+/**
+ * @brief Turns the terminals bracketed paste mode on or off, it has to be off outside the editor
+ * 
+ * @param enabled 1 to turn it on
+ */
+static void setBracketedPaste(int enabled){
+    printf(enabled ? "\033[?2004h" : "\033[?2004l");
+    fflush(stdout);
+}
+
+/**
+ * @brief Reads a paste up to its end marker, the lines are sanitised and the last given a \n
+ * 
+ * @param lines Set to how many lines were pasted
+ * @return char* The pasted lines, make sure to free after use!
+ */
+static char * readPastedBlock(size_t *lines){
+    size_t length = 0, capacity = 256;
+    char *pasted = malloc(capacity);
+
+    // A terminal that never sends the end marker mustn't leave the editor stuck
+    timeout(PASTE_TIMEOUT_MILLISECONDS);
+    int key, previous = 0;
+    while ((key = nextKey()) != ERR && key != KEY_PASTE_END){
+        if (key >= KEY_MIN) continue;
+        // Terminals paste new lines as \r, a \r\n only counts once
+        int joined = key == '\n' && previous == '\r';
+        previous = key;
+        if (joined) continue;
+        if (length + 2 > capacity){
+            capacity *= 2;
+            pasted = realloc(pasted, capacity);
+        }
+        pasted[length++] = key == '\r' ? '\n' : key;
+    }
+    timeout(-1);
+
+    if (length != 0 && pasted[length - 1] != '\n') pasted[length++] = '\n';
+    pasted[length] = '\0';
+
+    char *block = sanitise(pasted);
+    free(pasted);
+    *lines = 0;
+    for (char *c = block; *c != '\0'; c++){
+        if (*c == '\n') (*lines)++;
+    }
+    return block;
+}
+
+/**
+ * @brief Reads a key, every key the editor reads comes through here so sessions can be recorded and played back
+ * 
+ * @return int The key, ERR if there wasn't one (or a script being played has run out)
+ */
+static int nextKey(){
+    if (keyReplay != NULL) return nextScriptedKey();
+    int key = getch();
+    if (recordingKeys && key != ERR) recordKey(key);
+    return key;
+}
+
+/**
+ * @brief Waits for a key, or for another program to write the file
+ * 
+ * @param document The open file
+ * @return int The key, KEY_FILE_CHANGED if the file needs reloading
+ */
+static int waitForEditorKey(struct Document *document){
+    // The editor is left once a script being played runs out
+    if (keyReplay != NULL){
+        int key = nextKey();
+        return key == ERR ? CTRL('e') : key;
+    }
+    while (1 == 1){
+        nodelay(stdscr, TRUE);
+        int key = nextKey();
+        nodelay(stdscr, FALSE);
+        if (key != ERR){
+            setUserWaiting(0);
+            return key;
+        }
+        // Nothing typed yet, background maintenance may run
+        setUserWaiting(1);
+
+        struct pollfd watched[2];
+        watched[0].fd = STDIN_FILENO;
+        watched[0].events = POLLIN;
+        watched[1].fd = document->watch;
+        watched[1].events = POLLIN;
+        watched[1].revents = 0;
+
+        int ready = document->watch != -1 ? poll(watched, 2, -1) : poll(watched, 1, FILE_POLL_MILLISECONDS);
+        if ((ready == 0 || (watched[1].revents & POLLIN)) && documentChangedOnDisk(document)){
+            setUserWaiting(0);
+            return KEY_FILE_CHANGED;
+        }
+    }
+}
+
+/**
+ * @brief Reloads a file written by another program, only forgetting cached lines from the first change.
+ * The cursor stays on the same line, found by its content if the change surrounds it
+ * 
+ * @param buffer The open file
+ */
+static void reloadEditor(struct EditorBuffer *buffer){
+    struct Document *document = &buffer->document;
+    int *lineNumber = &buffer->lineNumber;
+    struct LineWidthCache *widthCache = &buffer->widthCache;
+    struct SyntaxCache *syntax = &buffer->syntax;
+    char *cursorLine = documentLineCopy(document, *lineNumber);
+    struct DocumentChange change;
+    if (reloadDocument(document, &change) == 0 || (change.oldLines == 0 && change.newLines == 0)){
+        free(cursorLine);
+        return;
+    }
+
+    invalidateLineWidths(widthCache, change.firstLine);
+    if (change.oldLines == change.newLines){
+        size_t i;
+        for (i = 0; i < change.newLines; i++) syntaxLineChanged(syntax, change.firstLine + i);
+    } else {
+        syntaxLinesDeleted(syntax, change.firstLine, change.oldLines);
+        syntaxLinesInserted(syntax, change.firstLine, change.newLines);
+    }
+
+    long shift = (long)change.newLines - (long)change.oldLines;
+    if (*lineNumber >= change.firstLine + change.oldLines){
+        *lineNumber += shift;
+    } else if (*lineNumber >= change.firstLine && change.newLines > 0){
+        // Look outwards from where the line would have moved to for the nearest line still holding its content
+        long first = change.firstLine, last = change.firstLine + change.newLines - 1;
+        long expected = *lineNumber + shift;
+        if (expected < first) expected = first;
+        if (expected > last) expected = last;
+        *lineNumber = expected;
+        // A huge file is paged so only its lines near the cursor are looked through
+        if (document->paged && expected - first > DOCUMENT_WINDOW_LINES / 4) first = expected - DOCUMENT_WINDOW_LINES / 4;
+        if (document->paged && last - expected > DOCUMENT_WINDOW_LINES / 2) last = expected + DOCUMENT_WINDOW_LINES / 2;
+
+        size_t cursorLength = strlen(cursorLine);
+        long distance;
+        for (distance = 0; expected - distance >= first || expected + distance <= last; distance++){
+            long candidates[2] = {expected - distance, expected + distance};
+            int i, found = 0;
+            for (i = 0; i < 2 && found == 0; i++){
+                size_t length;
+                const char *line = documentLine(document, candidates[i], &length);
+                if (candidates[i] < first || candidates[i] > last || line == NULL) continue;
+                if (length == cursorLength && memcmp(line, cursorLine, length) == 0){
+                    *lineNumber = candidates[i];
+                    found = 1;
+                }
+            }
+            if (found == 1) break;
+        }
+    }
+    free(cursorLine);
+}
+
+/**
+ * @brief Draws the line being typed on the prompt row, scrolled so the cursor is always visible.
+ * Only the bytes around the cursor are copied out of the gap buffer
  * 
- * @param fileName The file to print lines for
+ * @param input The line being typed
+ * @param label The prompt shown before it
+ * @param row The prompt row
+ * @param inputLeft The first byte shown, kept between calls so the line doesn't jump around
+ */
+static void printInputLine(struct GapBuffer *input, char *label, int row, size_t *inputLeft){
+    move(row, 0);
+    clrtoeol();
+    printw("%s", label);
+    int start = getcurx(stdscr);
+    size_t available = COLS - start > 1 ? COLS - start - 1 : 1;
+
+    size_t cursor = gapBufferCursor(input);
+    // A column is never more than 4 bytes of UTF-8
+    size_t maxBytes = available * 4;
+
+    if (cursor < *inputLeft) *inputLeft = cursor;
+    if (cursor - *inputLeft > maxBytes) *inputLeft = cursor - maxBytes;
+    while (*inputLeft < cursor && (gapBufferByteAt(input, *inputLeft) & 0xC0) == 0x80) (*inputLeft)++;
+
+    char *slice = malloc(maxBytes * 2 + 1);
+    size_t sliceLength = gapBufferCopy(input, *inputLeft, *inputLeft + maxBytes * 2, slice);
+    struct LineWidths widths;
+    memset(&widths, 0, sizeof(widths));
+    measureLineWidths(&widths, slice, sliceLength);
+
+    size_t cursorColumn = columnAtByte(&widths, slice, cursor - *inputLeft);
+    if (cursorColumn >= available){
+        // Slide right just far enough to fit the cursor
+        size_t firstColumn;
+        size_t skip = byteAtColumn(&widths, slice, cursorColumn - available + 1, &firstColumn);
+        if (firstColumn < cursorColumn - available + 1){
+            size_t bytes;
+            characterWidth(slice + skip, sliceLength - skip, firstColumn, &bytes);
+            skip += bytes;
+        }
+        *inputLeft += skip;
+
+        freeLineWidths(&widths);
+        sliceLength = gapBufferCopy(input, *inputLeft, *inputLeft + maxBytes * 2, slice);
+        measureLineWidths(&widths, slice, sliceLength);
+        cursorColumn = columnAtByte(&widths, slice, cursor - *inputLeft);
+    }
+
+    renderLineSlice(&widths, slice, 0, available, NULL);
+    move(row, start + cursorColumn);
+    refresh();
+
+    freeLineWidths(&widths);
+    free(slice);
+}
+
+/**
+ * @brief Lets the user type/edit a line on the prompt row
+ * 
+ * @param input The line to edit, may already hold text
+ * @param label The prompt shown before it
+ * @return int 1 if ENTER was pressed, 0 if ESC cancelled it
+ */
+static int readInputLine(struct GapBuffer *input, char *label){
+    int row = getcury(stdscr);
+    size_t inputLeft = 0;
+
+    while (1 == 1){
+        printInputLine(input, label, row, &inputLeft);
+        int key = nextKey();
+
+        if (key == '\n' || key == KEY_ENTER){
+            return 1;
+        } else if (key == KEY_ESCAPE || (key == ERR && keyReplay != NULL)){
+            return 0;
+        } else if (key == KEY_BACKSPACE || key == 127 || key == '\b'){
+            gapBufferBackspace(input);
+        } else if (key == KEY_DC){
+            gapBufferDelete(input);
+        } else if (key == KEY_LEFT){
+            gapBufferLeft(input);
+        } else if (key == KEY_RIGHT){
+            gapBufferRight(input);
+        } else if (key == KEY_HOME){
+            gapBufferHome(input);
+        } else if (key == KEY_END){
+            gapBufferEnd(input);
+        } else if (key < KEY_MIN && (key >= ' ' || key == '\t')){
+            char byte = key;
+            gapBufferInsert(input, &byte, 1);
+        }
+    }
+}
+
+/**
+ * @brief Lexes the lines whose syntax state isn't known yet, up to a line about to be drawn.
+ * States are kept once worked out, so only the first jump past them pays for the lines in between
+ * 
+ * @param syntax The files highlighting
+ * @param document The open file
+ * @param lineNumber The first line that will be drawn
+ */
+static void feedSyntaxUpTo(struct SyntaxCache *syntax, struct Document *document, size_t lineNumber){
+    const char *line;
+    size_t l;
+    while (syntax->language != NULL && syntax->dirty < lineNumber && (line = documentLine(document, syntax->dirty, &l)) != NULL){
+        size_t fed = syntax->dirty;
+        syntaxFeedLine(syntax, fed, line, l);
+        if (syntax->dirty == fed) break;
+    }
+}
+
+/**
+ * @brief Prints the active files lines between x and y highlighting the cursor line using NCurse's methods.
+ * Only the columns from the buffers left column that fit on screen are drawn, with a tab for every open file above
+ * 
+ * @param buffers The open files
  * @param x The minimum line
  * @param y The maximum line
- * @param z Line the highlight
  */
-void printLinesNCurse(char *fileName, int x, int y, int z){
-    int totalLines = fileLines(fileName);
+void printLinesNCurse(struct BufferCache *buffers, int x, int y){
+    uint64_t trace = TRACE_BEGIN();
+    struct EditorBuffer *buffer = activeBuffer(buffers);
+    struct Document *document = &buffer->document;
+    struct LineWidthCache *widthCache = &buffer->widthCache;
+    struct SyntaxCache *syntax = &buffer->syntax;
+    int z = buffer->lineNumber;
+    size_t leftColumn = buffer->leftColumn;
+
     erase();
     printw("######################################## CWord ########################################\n");
 
+    size_t i;
+    for (i = 0; i < buffers->count; i++){
+        char *name = buffers->buffers[i]->fileName;
+        if (getcurx(stdscr) + (int)strlen(name) + 3 > COLS){
+            printw("...");
+            break;
+        }
+        if (i == buffers->active) attron(A_REVERSE);
+        printw(" %s ", name);
+        if (i == buffers->active) attroff(A_REVERSE);
+        printw(" ");
+    }
+    printw("\n");
 
-    FILE *file;
-    file = fopen(fileName, "r");
+    const char *line;
+    size_t l;
+    size_t lineCount = x;
 
-    char *line;
-    size_t len = 0;
-    size_t lineCount = 0;    
+    feedSyntaxUpTo(syntax, document, x);
+    while (lineCount <= y && (line = documentLine(document, lineCount, &l)) != NULL) {
+        syntaxFeedLine(syntax, lineCount, line, l);
+        lineCount == z ? printw("%ld > ", lineCount) : printw("%ld  ", lineCount);
 
-    while (getline(&line, &len, file) != -1) {
+        int row = getcury(stdscr);
+        int available = COLS - getcurx(stdscr);
+        struct LineWidths *widths = lineWidthsFor(widthCache, lineCount, line, l);
+        renderLineSlice(widths, line, leftColumn, available > 0 ? available : 0, syntaxHighlightLine(syntax, lineCount, line, l));
+        move(row + 1, 0);
         lineCount++;
-        if (lineCount <= y && lineCount >= x){
-            lineCount == z ? printw("%ld > %s", lineCount, line) : printw("%ld  %s", lineCount, line);
-        }
     }
-    fclose(file);
+    if (syntax->language != NULL) printw("[%s] ", syntax->language->name);
+    if (leftColumn > 0) printw("[Col %zu] ", leftColumn + 1);
     printw("[!h - Help]> ");
     refresh();
+    TRACE_END("printLinesNCurse", trace, 0);
 }
-
@@ -1,12 +1,24 @@
 #ifndef FULL_EDITOR_H
 #define FULL_EDITOR_H
 
+#include "line_view.h"
+#include "syntax.h"
+#include "document.h"
+#include "buffer_cache.h"
+#include "key_script.h"
+
 
 void editor(char *fileName);
 
-void printLinesNCurse(char *fileName, int x, int y, int z);
+int replayEditor(char *fileName, struct KeyReplay *replay);
+
+void printLinesNCurse(struct BufferCache *buffers, int x, int y);
+
+void attemptToAddLine(struct Document *document, int lineNumber, int maxLines, char *line);
+
+void attemptToAddBlock(struct Document *document, int lineNumber, int maxLines, char *block, size_t lines);
 
-void attemptToAddLine(char *fileName, int lineNumber, int maxLines, char *line);
+void attemptToReplaceLine(struct Document *document, int lineNumber, char *oldLine, char *newLine);
 
 
 
@@ -0,0 +1,257 @@
+/**
+ * @file gap_buffer.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief A gap buffer holding the line being typed in the full editor
+ * Inserting and deleting at the cursor is O(1), moving the cursor is O(distance moved)
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#include "gap_buffer.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Checks if a byte continues a UTF-8 character rather than starting one
+ *
+ * @param byte The byte to check
+ * @return int 1 if it is a continuation byte, 0 if not
+ */
+static int isContinuationByte(char byte){
+    return ((unsigned char)byte & 0xC0) == 0x80;
+}
+
+/**
+ * @brief Sets up a gap buffer holding the given text, with the cursor at the end
+ *
+ * @param gapBuffer The gap buffer to setup
+ * @param text The starting text, may be NULL
+ * @param length The length of the text
+ */
+void initGapBuffer(struct GapBuffer *gapBuffer, const char *text, size_t length){
+    gapBuffer->capacity = length + GAP_BUFFER_MIN_GAP;
+    gapBuffer->buffer = malloc(gapBuffer->capacity);
+    if (length > 0) memcpy(gapBuffer->buffer, text, length);
+    gapBuffer->gapStart = length;
+    gapBuffer->gapEnd = gapBuffer->capacity;
+}
+
+/**
+ * @brief Frees the gap buffers memory
+ *
+ * @param gapBuffer The gap buffer to free
+ */
+void freeGapBuffer(struct GapBuffer *gapBuffer){
+    free(gapBuffer->buffer);
+    gapBuffer->buffer = NULL;
+    gapBuffer->capacity = gapBuffer->gapStart = gapBuffer->gapEnd = 0;
+}
+
+/**
+ * @brief Gets the amount of text in the buffer
+ *
+ * @param gapBuffer The gap buffer
+ * @return size_t The length in bytes
+ */
+size_t gapBufferLength(struct GapBuffer *gapBuffer){
+    return gapBuffer->capacity - (gapBuffer->gapEnd - gapBuffer->gapStart);
+}
+
+/**
+ * @brief Gets the cursor position
+ *
+ * @param gapBuffer The gap buffer
+ * @return size_t The byte offset of the cursor
+ */
+size_t gapBufferCursor(struct GapBuffer *gapBuffer){
+    return gapBuffer->gapStart;
+}
+
+/**
+ * @brief Gets a byte of the text, skipping over the gap
+ *
+ * @param gapBuffer The gap buffer
+ * @param position The byte offset in the text
+ * @return char The byte
+ */
+char gapBufferByteAt(struct GapBuffer *gapBuffer, size_t position){
+    if (position < gapBuffer->gapStart) return gapBuffer->buffer[position];
+    return gapBuffer->buffer[position + (gapBuffer->gapEnd - gapBuffer->gapStart)];
+}
+
+/**
+ * @brief Copies part of the text out of the buffer
+ *
+ * @param gapBuffer The gap buffer
+ * @param from The first byte to copy
+ * @param to One past the last byte to copy
+ * @param out Where to copy to, must fit to - from bytes
+ * @return size_t The amount of bytes copied
+ */
+size_t gapBufferCopy(struct GapBuffer *gapBuffer, size_t from, size_t to, char *out){
+    size_t length = gapBufferLength(gapBuffer);
+    if (to > length) to = length;
+    if (from >= to) return 0;
+
+    size_t copied = 0;
+    if (from < gapBuffer->gapStart){
+        size_t end = to < gapBuffer->gapStart ? to : gapBuffer->gapStart;
+        memcpy(out, gapBuffer->buffer + from, end - from);
+        copied = end - from;
+        from = end;
+    }
+    if (from < to){
+        size_t gap = gapBuffer->gapEnd - gapBuffer->gapStart;
+        memcpy(out + copied, gapBuffer->buffer + from + gap, to - from);
+        copied += to - from;
+    }
+    return copied;
+}
+
+/**
+ * @brief Gets the whole text
+ * Make sure to free after use!
+ *
+ * @param gapBuffer The gap buffer
+ * @return char* The text, NULL terminated
+ */
+char * gapBufferContents(struct GapBuffer *gapBuffer){
+    size_t length = gapBufferLength(gapBuffer);
+    char *contents = malloc(length + 1);
+    gapBufferCopy(gapBuffer, 0, length, contents);
+    contents[length] = '\0';
+    return contents;
+}
+
+/**
+ * @brief Makes sure the gap can fit the given amount of bytes, doubling the buffer when it can't
+ *
+ * @param gapBuffer The gap buffer
+ * @param needed The bytes about to be inserted
+ */
+static void ensureGap(struct GapBuffer *gapBuffer, size_t needed){
+    size_t gap = gapBuffer->gapEnd - gapBuffer->gapStart;
+    if (gap >= needed) return;
+
+    size_t after = gapBuffer->capacity - gapBuffer->gapEnd;
+    size_t capacity = gapBuffer->capacity * 2;
+    if (capacity < gapBufferLength(gapBuffer) + needed + GAP_BUFFER_MIN_GAP){
+        capacity = gapBufferLength(gapBuffer) + needed + GAP_BUFFER_MIN_GAP;
+    }
+
+    gapBuffer->buffer = realloc(gapBuffer->buffer, capacity);
+    memmove(gapBuffer->buffer + capacity - after, gapBuffer->buffer + gapBuffer->gapEnd, after);
+    gapBuffer->gapEnd = capacity - after;
+    gapBuffer->capacity = capacity;
+}
+
+/**
+ * @brief Inserts text at the cursor, leaving the cursor after it
+ *
+ * @param gapBuffer The gap buffer
+ * @param text The text to insert
+ * @param length The length of the text
+ */
+void gapBufferInsert(struct GapBuffer *gapBuffer, const char *text, size_t length){
+    ensureGap(gapBuffer, length);
+    memcpy(gapBuffer->buffer + gapBuffer->gapStart, text, length);
+    gapBuffer->gapStart += length;
+}
+
+/**
+ * @brief Deletes the character before the cursor
+ *
+ * @param gapBuffer The gap buffer
+ */
+void gapBufferBackspace(struct GapBuffer *gapBuffer){
+    while (gapBuffer->gapStart > 0){
+        gapBuffer->gapStart--;
+        if (isContinuationByte(gapBuffer->buffer[gapBuffer->gapStart]) == 0) break;
+    }
+}
+
+/**
+ * @brief Deletes the character after the cursor
+ *
+ * @param gapBuffer The gap buffer
+ */
+void gapBufferDelete(struct GapBuffer *gapBuffer){
+    if (gapBuffer->gapEnd == gapBuffer->capacity) return;
+    gapBuffer->gapEnd++;
+    while (gapBuffer->gapEnd < gapBuffer->capacity && isContinuationByte(gapBuffer->buffer[gapBuffer->gapEnd])){
+        gapBuffer->gapEnd++;
+    }
+}
+
+/**
+ * @brief Moves the cursor to a byte offset by sliding the gap
+ *
+ * @param gapBuffer The gap buffer
+ * @param position The new cursor position
+ */
+void gapBufferMoveTo(struct GapBuffer *gapBuffer, size_t position){
+    size_t length = gapBufferLength(gapBuffer);
+    if (position > length) position = length;
+
+    if (position < gapBuffer->gapStart){
+        size_t move = gapBuffer->gapStart - position;
+        memmove(gapBuffer->buffer + gapBuffer->gapEnd - move, gapBuffer->buffer + position, move);
+        gapBuffer->gapStart -= move;
+        gapBuffer->gapEnd -= move;
+    } else if (position > gapBuffer->gapStart){
+        size_t move = position - gapBuffer->gapStart;
+        memmove(gapBuffer->buffer + gapBuffer->gapStart, gapBuffer->buffer + gapBuffer->gapEnd, move);
+        gapBuffer->gapStart += move;
+        gapBuffer->gapEnd += move;
+    }
+}
+
+/**
+ * @brief Moves the cursor one character left
+ *
+ * @param gapBuffer The gap buffer
+ */
+void gapBufferLeft(struct GapBuffer *gapBuffer){
+    size_t position = gapBuffer->gapStart;
+    while (position > 0){
+        position--;
+        if (isContinuationByte(gapBuffer->buffer[position]) == 0) break;
+    }
+    gapBufferMoveTo(gapBuffer, position);
+}
+
+/**
+ * @brief Moves the cursor one character right
+ *
+ * @param gapBuffer The gap buffer
+ */
+void gapBufferRight(struct GapBuffer *gapBuffer){
+    size_t length = gapBufferLength(gapBuffer);
+    size_t position = gapBuffer->gapStart;
+    if (position >= length) return;
+    position++;
+    while (position < length && isContinuationByte(gapBufferByteAt(gapBuffer, position))) position++;
+    gapBufferMoveTo(gapBuffer, position);
+}
+
+/**
+ * @brief Moves the cursor to the start of the line
+ *
+ * @param gapBuffer The gap buffer
+ */
+void gapBufferHome(struct GapBuffer *gapBuffer){
+    gapBufferMoveTo(gapBuffer, 0);
+}
+
+/**
+ * @brief Moves the cursor to the end of the line
+ *
+ * @param gapBuffer The gap buffer
+ */
+void gapBufferEnd(struct GapBuffer *gapBuffer){
+    gapBufferMoveTo(gapBuffer, gapBufferLength(gapBuffer));
+}
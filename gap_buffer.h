@@ -0,0 +1,34 @@
+#ifndef GAP_BUFFER_H
+#define GAP_BUFFER_H
+
+#include <stddef.h>
+
+#define GAP_BUFFER_MIN_GAP 64
+
+struct GapBuffer
+{
+    char *buffer;
+    size_t capacity;
+    size_t gapStart;    // Also the cursor
+    size_t gapEnd;
+};
+
+void initGapBuffer(struct GapBuffer *gapBuffer, const char *text, size_t length);
+void freeGapBuffer(struct GapBuffer *gapBuffer);
+
+size_t gapBufferLength(struct GapBuffer *gapBuffer);
+size_t gapBufferCursor(struct GapBuffer *gapBuffer);
+char gapBufferByteAt(struct GapBuffer *gapBuffer, size_t position);
+size_t gapBufferCopy(struct GapBuffer *gapBuffer, size_t from, size_t to, char *out);
+char * gapBufferContents(struct GapBuffer *gapBuffer);
+
+void gapBufferInsert(struct GapBuffer *gapBuffer, const char *text, size_t length);
+void gapBufferBackspace(struct GapBuffer *gapBuffer);
+void gapBufferDelete(struct GapBuffer *gapBuffer);
+void gapBufferMoveTo(struct GapBuffer *gapBuffer, size_t position);
+void gapBufferLeft(struct GapBuffer *gapBuffer);
+void gapBufferRight(struct GapBuffer *gapBuffer);
+void gapBufferHome(struct GapBuffer *gapBuffer);
+void gapBufferEnd(struct GapBuffer *gapBuffer);
+
+#endif
@@ -11,6 +11,7 @@
 
 #include "interface.h"
 #include "utils.h"
+#include "scheduler.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -72,7 +73,7 @@ void infoScreen(char *info){
  */
 void clearInputBuffer(){
     int ch = 0;
-    while ((ch = getchar()) != '\n' && ch != '\r');
+    while ((ch = getchar()) != '\n' && ch != '\r' && ch != EOF);
 }
 
 /**
@@ -92,7 +93,11 @@ void waitScreen(char *message){
  */
 void waitForKey(){
     printLine("\n\nPress ENTER to continue");
-    while(getchar()!='\n');
+    setUserWaiting(1);
+    // Piped input may run out, e.g. for --insert
+    int ch;
+    while((ch = getchar()) != '\n' && ch != EOF);
+    setUserWaiting(0);
 }
 
 /**
@@ -121,7 +126,10 @@ char getUserOption(char *question, struct QuestionOption options[], int length){
             printLine("\nPlease type the option to perform: ");
         }
 
+        // Background maintenance runs while the menu is up
+        setUserWaiting(1);
         char input = tolower(getchar());
+        setUserWaiting(0);
         clearInputBuffer();
 
         // Check if char was a valid option
@@ -149,7 +157,9 @@ char* getUserInput(char *question){
         printf("%s", question);
         
         char *input = malloc(256*sizeof(char));
+        setUserWaiting(1);
         scanf("%s", input);
+        setUserWaiting(0);
         clearInputBuffer();
         
         if (strcmp(input, "\0") != 0){
@@ -159,6 +169,32 @@ char* getUserInput(char *question){
     }
 }
 
+/**
+ * @brief Get a whole line from the user, unlike getUserInput it may be blank or contain spaces
+ * Make sure to free after use!
+ * 
+ * @param question The question to ask
+ * @return char* The users input without its \n
+ */
+char* getUserLine(char *question){
+    clearScreen();
+    printHeader();
+    printf("%s", question);
+
+    char *input = NULL;
+    size_t len = 0;
+    setUserWaiting(1);
+    ssize_t read = getline(&input, &len, stdin);
+    setUserWaiting(0);
+    if (read == -1){
+        free(input);
+        input = malloc(1);
+        input[0] = '\0';
+    }
+    input[strcspn(input, "\r\n")] = '\0';
+    return input;
+}
+
 /**
  * @brief Get the users input as an integer
  * 
@@ -173,7 +209,9 @@ int getIntegerInput(char *question){
         printf("%s", question);
         
         int input;
+        setUserWaiting(1);
         scanf("%d", &input);
+        setUserWaiting(0);
         clearInputBuffer();
         
         return input;
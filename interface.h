@@ -20,6 +20,7 @@ void waitScreen(char *message);
 void waitForKey();
 char getUserOption(char *question, struct QuestionOption options[], int length);
 char* getUserInput(char *question);
+char* getUserLine(char *question);
 
 // Part of line op
 int getIntegerInput(char *question);
@@ -0,0 +1,308 @@
+/**
+ * @file key_script.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Recording the keys pressed in the Full Editor and playing them back
+ * A script is a line per key of the milliseconds since the key before it and the key code, after an
+ * optional "lines N" giving the editor size. Played back, the time from each key being handed to the
+ * editor until it asks for the next one (so including the redraw) is measured
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "key_script.h"
+#include "trace.h"
+#include "scheduler.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+
+#include <ncurses.h>
+
+int recordingKeys = 0;
+struct KeyReplay *keyReplay = NULL;
+
+static FILE *recording = NULL;
+static uint64_t lastRecorded = 0;
+
+/**
+ * @brief Turns recording on if CWORD_RECORD is set, the script is written as the keys are pressed
+ *
+ * @return int 1 if recording, 0 if not
+ */
+int initKeyRecording(){
+    char *fileName = getenv(KEY_SCRIPT_ENVIRONMENT_VARIABLE);
+    if (fileName == NULL || fileName[0] == '\0') return 0;
+
+    recording = fopen(fileName, "w");
+    if (recording == NULL){
+        fprintf(stderr, "Couldn't open %s to record keys to!\n", fileName);
+        return 0;
+    }
+    fprintf(recording, "# CWord key script: milliseconds since the last key, then the key code\n");
+    fflush(recording);
+    recordingKeys = 1;
+    return 1;
+}
+
+/**
+ * @brief Notes the size the editor was opened with, the first keys delay is timed from here
+ *
+ * @param linesToShow The number the user gave
+ */
+void recordEditorSize(int linesToShow){
+    if (recordingKeys == 0) return;
+    fprintf(recording, "lines %d\n", linesToShow);
+    fflush(recording);
+    lastRecorded = traceClock();
+}
+
+/**
+ * @brief Writes a key to the script, flushed straight away so a crash still leaves the keys that caused it
+ *
+ * @param key The key
+ */
+void recordKey(int key){
+    if (recordingKeys == 0) return;
+    uint64_t now = traceClock();
+    uint64_t delay = lastRecorded != 0 ? (now - lastRecorded) / 1000000 : 0;
+    lastRecorded = now;
+    fprintf(recording, "%lu %d\n", (unsigned long)delay, key);
+    fflush(recording);
+}
+
+/**
+ * @brief Reads a script
+ *
+ * @param scriptName The script
+ * @param replay Filled in, free with freeKeyReplay
+ * @return int 1 if ok, 0 if it couldn't be read or has a line that isn't a key
+ */
+int loadKeyScript(char *scriptName, struct KeyReplay *replay){
+    memset(replay, 0, sizeof(*replay));
+    replay->linesToShow = KEY_SCRIPT_DEFAULT_LINES;
+
+    FILE *script = fopen(scriptName, "r");
+    if (script == NULL) return 0;
+
+    size_t capacity = 256;
+    replay->keys = malloc(capacity * sizeof(struct ScriptedKey));
+    char *line = NULL;
+    size_t length = 0;
+    int ok = 1;
+    while (getline(&line, &length, script) != -1){
+        if (line[0] == '#' || line[0] == '\n') continue;
+        unsigned long delay;
+        int key;
+        if (sscanf(line, "lines %d", &replay->linesToShow) == 1) continue;
+        if (sscanf(line, "%lu %d", &delay, &key) != 2){
+            ok = 0;
+            break;
+        }
+        if (replay->count == capacity){
+            capacity *= 2;
+            replay->keys = realloc(replay->keys, capacity * sizeof(struct ScriptedKey));
+        }
+        replay->keys[replay->count].key = key;
+        replay->keys[replay->count].delayMillis = delay;
+        replay->count++;
+    }
+    free(line);
+    fclose(script);
+
+    replay->latencies = malloc((replay->count + 1) * sizeof(uint64_t));
+    if (ok == 0) freeKeyReplay(replay);
+    return ok;
+}
+
+/**
+ * @brief Makes the editor read its keys from a script rather than the keyboard
+ *
+ * @param replay The loaded script
+ */
+void startKeyReplay(struct KeyReplay *replay){
+    replay->next = 0;
+    replay->measured = 0;
+    replay->delivered = 0;
+    replay->ranOut = 0;
+    keyReplay = replay;
+}
+
+/**
+ * @brief Keeps the text on screen, replacing any kept before
+ *
+ * @param replay The script being played
+ */
+static void captureScreen(struct KeyReplay *replay){
+    int row;
+    for (row = 0; row < replay->screenRows; row++) free(replay->screen[row]);
+    free(replay->screen);
+    replay->screen = NULL;
+    replay->screenRows = 0;
+
+    // No screen to keep, curses reports -1 when it isn't running
+    int rows = getmaxy(stdscr), columns = getmaxx(stdscr);
+    if (rows <= 0 || columns <= 0) return;
+    int y, x;
+    getyx(stdscr, y, x);
+
+    replay->screen = malloc(rows * sizeof(char *));
+    replay->screenRows = rows;
+    wchar_t *wide = malloc((columns + 1) * sizeof(wchar_t));
+    for (row = 0; row < rows; row++){
+        if (mvwinnwstr(stdscr, row, 0, wide, columns) == ERR) wide[0] = L'\0';
+        size_t size = columns * MB_CUR_MAX + 1;
+        char *text = malloc(size);
+        if (wcstombs(text, wide, size) == (size_t)-1) text[0] = '\0';
+        // Rows are padded with blanks to the screen width
+        size_t length = strlen(text);
+        while (length > 0 && text[length - 1] == ' ') length--;
+        text[length] = '\0';
+        replay->screen[row] = text;
+    }
+    free(wide);
+    wmove(stdscr, y, x);
+}
+
+/**
+ * @brief Finishes measuring the last key handed over, the editor has either asked for another or closed
+ *
+ * @param replay The script being played
+ */
+static void keyHandled(struct KeyReplay *replay){
+    if (replay->delivered == 0) return;
+    replay->latencies[replay->measured++] = traceClock() - replay->delivered;
+    replay->delivered = 0;
+}
+
+/**
+ * @brief Gives the editor its next key, finishing the measurement of the key before it.
+ * Played in real time the keys delay is waited out first, counting as time at a prompt
+ *
+ * @return int The key, ERR once the script has run out
+ */
+int nextScriptedKey(){
+    struct KeyReplay *replay = keyReplay;
+    keyHandled(replay);
+    // Recorded sessions end by leaving the editor, so the screen is also kept before the last key
+    if (replay->next + 1 == replay->count || (replay->next == replay->count && replay->ranOut == 0)) captureScreen(replay);
+    if (replay->next == replay->count){
+        replay->ranOut = 1;
+        return ERR;
+    }
+
+    struct ScriptedKey *key = &replay->keys[replay->next++];
+    if (replay->realTime && key->delayMillis > 0){
+        struct timespec wait = {key->delayMillis / 1000, (key->delayMillis % 1000) * 1000000L};
+        setUserWaiting(1);
+        nanosleep(&wait, NULL);
+        setUserWaiting(0);
+    }
+    replay->delivered = traceClock();
+    return key->key;
+}
+
+/**
+ * @brief Stops playing a script once the editor has closed
+ */
+void endKeyReplay(){
+    if (keyReplay == NULL) return;
+    keyHandled(keyReplay);
+    keyReplay = NULL;
+}
+
+/**
+ * @brief Orders latencies for qsort
+ */
+static int compareLatencies(const void *a, const void *b){
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * @brief Gets a percentile by nearest rank
+ *
+ * @param sorted The latencies, in order
+ * @param count How many there are, at least 1
+ * @param percent The percentile
+ * @return double It in milliseconds
+ */
+static double percentile(uint64_t *sorted, size_t count, size_t percent){
+    size_t rank = (count * percent + 99) / 100;
+    return sorted[rank > 0 ? rank - 1 : 0] / 1000000.0;
+}
+
+/**
+ * @brief Writes out how long keys took, a histogram of it and the screen the script finished on
+ *
+ * @param replay A played script
+ * @param out Where to write it
+ */
+void reportKeyReplay(struct KeyReplay *replay, FILE *out){
+    size_t count = replay->measured, i;
+    fprintf(out, "Replayed %zu of %zu keys (%s)\n", replay->next, replay->count, replay->realTime ? "real time" : "full speed");
+
+    if (count > 0){
+        uint64_t *sorted = malloc(count * sizeof(uint64_t));
+        memcpy(sorted, replay->latencies, count * sizeof(uint64_t));
+        qsort(sorted, count, sizeof(uint64_t), compareLatencies);
+        uint64_t total = 0;
+        size_t buckets[KEY_SCRIPT_BUCKETS] = {0}, first = KEY_SCRIPT_BUCKETS, last = 0, most = 0;
+        for (i = 0; i < count; i++){
+            total += sorted[i];
+            uint64_t micros = sorted[i] / 1000;
+            size_t bucket = 0;
+            while (micros >= 2 && bucket < KEY_SCRIPT_BUCKETS - 1){
+                micros >>= 1;
+                bucket++;
+            }
+            buckets[bucket]++;
+            if (bucket < first) first = bucket;
+            if (bucket > last) last = bucket;
+            if (buckets[bucket] > most) most = buckets[bucket];
+        }
+
+        fprintf(out, "Latency per key (ms): p50 %.3f  p99 %.3f  max %.3f  mean %.3f\n\n",
+            percentile(sorted, count, 50), percentile(sorted, count, 99), sorted[count - 1] / 1000000.0, total / (double)count / 1000000.0);
+        for (i = first; i <= last; i++){
+            char bar[41];
+            size_t width = buckets[i] * 40 / most;
+            if (buckets[i] > 0 && width == 0) width = 1;
+            memset(bar, '#', width);
+            bar[width] = '\0';
+            if (i == KEY_SCRIPT_BUCKETS - 1){
+                fprintf(out, " >= %9luus | %-40s %zu\n", 1UL << i, bar, buckets[i]);
+            } else {
+                fprintf(out, "  < %9luus | %-40s %zu\n", 2UL << i, bar, buckets[i]);
+            }
+        }
+        free(sorted);
+    }
+
+    if (replay->screen != NULL){
+        fprintf(out, "\nFinal screen:\n");
+        int row;
+        for (row = 0; row < replay->screenRows; row++) fprintf(out, "|%s\n", replay->screen[row]);
+    }
+}
+
+/**
+ * @brief Frees a script
+ *
+ * @param replay The script
+ */
+void freeKeyReplay(struct KeyReplay *replay){
+    if (keyReplay == replay) keyReplay = NULL;
+    free(replay->keys);
+    free(replay->latencies);
+    int row;
+    for (row = 0; row < replay->screenRows; row++) free(replay->screen[row]);
+    free(replay->screen);
+    memset(replay, 0, sizeof(*replay));
+}
@@ -0,0 +1,49 @@
+#ifndef KEY_SCRIPT_H
+#define KEY_SCRIPT_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+// Set to a file name to record every key read by the Full Editor, play it back with --replay
+#define KEY_SCRIPT_ENVIRONMENT_VARIABLE "CWORD_RECORD"
+// Editor size for scripts that don't give one
+#define KEY_SCRIPT_DEFAULT_LINES 21
+// Latencies are counted in buckets of powers of two microseconds, the last takes everything slower
+#define KEY_SCRIPT_BUCKETS 24
+
+struct ScriptedKey
+{
+    int key;                // As returned by getch
+    uint32_t delayMillis;   // Since the key before it was read
+};
+
+struct KeyReplay
+{
+    struct ScriptedKey *keys;
+    size_t count;
+    size_t next;
+    int linesToShow;
+    int realTime;           // 1 to wait out each keys delay, 0 to send them as fast as the editor takes them
+    uint64_t delivered;     // When the last key was handed to the editor, 0 once its latency is known
+    uint64_t *latencies;    // Nanoseconds from each key being handed over until the editor asked for another
+    size_t measured;
+    int ranOut;             // Set once the editor asked for a key after the last
+    char **screen;          // What was on screen when the script ran out
+    int screenRows;
+};
+
+extern int recordingKeys;
+extern struct KeyReplay *keyReplay;
+
+int initKeyRecording();
+void recordEditorSize(int linesToShow);
+void recordKey(int key);
+int loadKeyScript(char *scriptName, struct KeyReplay *replay);
+void startKeyReplay(struct KeyReplay *replay);
+int nextScriptedKey();
+void endKeyReplay();
+void reportKeyReplay(struct KeyReplay *replay, FILE *out);
+void freeKeyReplay(struct KeyReplay *replay);
+
+#endif
@@ -0,0 +1,392 @@
+/**
+ * @file line_index.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Counting lines without making the user wait for it
+ * Counting a file remembers where every LINE_INDEX_STEP lines start, so the count is known straight away
+ * next time and any line can be found by reading only a little of the file. Huge files are shown first
+ * with an estimate from a few sampled blocks while the exact index is built in the background
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#include "line_index.h"
+#include "storage.h"
+#include "scheduler.h"
+#include "trace.h"
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct LineIndex
+{
+    char *fileName;
+    struct StorageStat stat;    // The file as it was indexed, the index is stale once this changes
+    uint64_t *checkpoints;      // checkpoints[k] is where line k * LINE_INDEX_STEP + 1 starts
+    size_t checkpointCount;
+    size_t lines;
+    uint64_t used;              // When it was last looked at, the oldest is dropped first
+};
+
+static struct
+{
+    pthread_mutex_t lock;
+    struct LineIndex indexes[LINE_INDEX_CACHE];
+    size_t count;
+    uint64_t clock;
+} lineIndexes = {PTHREAD_MUTEX_INITIALIZER};
+
+/**
+ * @brief Finds the index of a file if it still matches the file, the lock must be held
+ *
+ * @param fileName The file
+ * @param current The files stat data now
+ * @return struct LineIndex* The index, NULL if there isn't a current one
+ */
+static struct LineIndex * findLineIndex(char *fileName, struct StorageStat *current){
+    size_t i;
+    for (i = 0; i < lineIndexes.count; i++){
+        struct LineIndex *index = &lineIndexes.indexes[i];
+        if (strcmp(index->fileName, fileName) != 0) continue;
+        if (index->stat.size != current->size || index->stat.mtimeNanos != current->mtimeNanos || index->stat.inode != current->inode) return NULL;
+        index->used = ++lineIndexes.clock;
+        return index;
+    }
+    return NULL;
+}
+
+/**
+ * @brief Keeps a newly built index, replacing an older one of the same file or the one looked at longest ago
+ *
+ * @param built The index, owned by the cache from now on
+ */
+static void keepLineIndex(struct LineIndex *built){
+    pthread_mutex_lock(&lineIndexes.lock);
+    size_t i, slot = lineIndexes.count;
+    for (i = 0; i < lineIndexes.count; i++){
+        if (strcmp(lineIndexes.indexes[i].fileName, built->fileName) == 0){
+            slot = i;
+            break;
+        }
+    }
+    if (slot == LINE_INDEX_CACHE){
+        slot = 0;
+        for (i = 1; i < lineIndexes.count; i++){
+            if (lineIndexes.indexes[i].used < lineIndexes.indexes[slot].used) slot = i;
+        }
+    }
+    if (slot < lineIndexes.count){
+        free(lineIndexes.indexes[slot].fileName);
+        free(lineIndexes.indexes[slot].checkpoints);
+    } else {
+        lineIndexes.count++;
+    }
+    built->used = ++lineIndexes.clock;
+    lineIndexes.indexes[slot] = *built;
+    pthread_mutex_unlock(&lineIndexes.lock);
+}
+
+/**
+ * @brief Reads a whole file counting its lines and noting where every LINE_INDEX_STEP lines start
+ *
+ * @param fileName The file
+ * @param task The background task doing it, NULL in the foreground
+ * @param index Filled in, free its name and checkpoints after use
+ * @param stable Set to 1 if the file didn't change while it was read, so the index can be kept
+ * @return int 1 if the whole file was read, 0 if it couldn't be or the task was cancelled
+ */
+static int scanLineIndex(char *fileName, struct ScheduledTask *task, struct LineIndex *index, int *stable){
+    memset(index, 0, sizeof(*index));
+    *stable = 0;
+    struct StorageStat before, after;
+    if (storageStat(fileName, &before) == 0) return 0;
+    struct StorageFile *file = storageOpen(fileName, STORAGE_READ);
+    if (file == NULL) return 0;
+
+    uint64_t trace = TRACE_BEGIN();
+    char *block = malloc(STORAGE_BUFFER_SIZE);
+    size_t capacity = 64;
+    index->checkpoints = malloc(capacity * sizeof(uint64_t));
+    index->checkpoints[index->checkpointCount++] = 0;
+
+    uint64_t offset = 0;
+    size_t untilCheckpoint = LINE_INDEX_STEP;
+    ssize_t got;
+    int complete = 1;
+    while ((got = storageRead(file, block, STORAGE_BUFFER_SIZE, offset)) > 0){
+        char *position = block, *end = block + got;
+        while ((position = memchr(position, '\n', end - position)) != NULL){
+            position++;
+            index->lines++;
+            if (--untilCheckpoint > 0) continue;
+            untilCheckpoint = LINE_INDEX_STEP;
+            if (index->checkpointCount == capacity){
+                capacity *= 2;
+                index->checkpoints = realloc(index->checkpoints, capacity * sizeof(uint64_t));
+            }
+            index->checkpoints[index->checkpointCount++] = offset + (position - block);
+        }
+        offset += got;
+        if (task != NULL && taskCancelled(task)){
+            complete = 0;
+            break;
+        }
+    }
+    if (got < 0) complete = 0;
+    free(block);
+    storageClose(file);
+    TRACE_END("scanLineIndex", trace, offset);
+
+    index->fileName = strdup(fileName);
+    index->stat = before;
+    *stable = complete && storageStat(fileName, &after) && after.size == before.size && after.mtimeNanos == before.mtimeNanos && after.inode == before.inode;
+    return complete;
+}
+
+/**
+ * @brief Counts the lines of a file, the same as fileLines. A current index answers straight away,
+ * otherwise the file is read once and indexed for next time
+ *
+ * @param fileName The file
+ * @return size_t The lines ending in a \n, 0 if it can't be read
+ */
+size_t indexFileLines(char *fileName){
+    size_t lines;
+    if (indexedLineCount(fileName, &lines)) return lines;
+
+    struct LineIndex index;
+    int stable;
+    scanLineIndex(fileName, NULL, &index, &stable);
+    lines = index.lines;
+    if (stable){
+        keepLineIndex(&index);
+    } else {
+        free(index.fileName);
+        free(index.checkpoints);
+    }
+    return lines;
+}
+
+/**
+ * @brief Gets the line count from a current index without reading the file
+ *
+ * @param fileName The file
+ * @param lines Set to the count
+ * @return int 1 if the file has a current index, 0 if not
+ */
+int indexedLineCount(char *fileName, size_t *lines){
+    struct StorageStat current;
+    if (storageStat(fileName, &current) == 0) return 0;
+    pthread_mutex_lock(&lineIndexes.lock);
+    struct LineIndex *index = findLineIndex(fileName, &current);
+    if (index != NULL) *lines = index->lines;
+    pthread_mutex_unlock(&lineIndexes.lock);
+    return index != NULL;
+}
+
+/**
+ * @brief The body of a background index build
+ *
+ * @param task The task, its subject is the file
+ * @param context Unused
+ */
+static void indexLinesTask(struct ScheduledTask *task, void *context){
+    size_t lines;
+    // Asked for twice while it was being built
+    if (indexedLineCount(task->subject, &lines)) return;
+
+    struct LineIndex index;
+    int stable;
+    if (scanLineIndex(task->subject, task, &index, &stable) && stable){
+        keepLineIndex(&index);
+        return;
+    }
+    free(index.fileName);
+    free(index.checkpoints);
+}
+
+/**
+ * @brief Builds the index of a file in the background, straight away if the scheduler isn't running
+ *
+ * @param fileName The file
+ */
+void requestLineIndex(char *fileName){
+    scheduleTask(TASK_PRIORITY_HIGH, "indexLines", fileName, indexLinesTask, NULL, NULL);
+}
+
+/**
+ * @brief Works out how many lines a file has without waiting to read it all. Small or indexed files
+ * are exact, huge ones are estimated from LINE_INDEX_SAMPLES blocks spread through them and
+ * indexed in the background so the exact count can take over
+ *
+ * @param fileName The file
+ * @param estimate Filled in
+ * @return int 1 if ok, 0 if the file can't be read
+ */
+int estimateFileLines(char *fileName, struct LineEstimate *estimate){
+    struct StorageStat info;
+    if (storageStat(fileName, &info) == 0) return 0;
+
+    estimate->exact = 1;
+    if (indexedLineCount(fileName, &estimate->lines) == 0){
+        if (info.size < LINE_INDEX_INSTANT_BYTES){
+            estimate->lines = indexFileLines(fileName);
+        } else {
+            estimate->exact = 0;
+        }
+    }
+    if (estimate->exact){
+        estimate->averageLength = estimate->lines > 0 ? (double)info.size / estimate->lines : info.size;
+        return 1;
+    }
+
+    struct StorageFile *file = storageOpen(fileName, STORAGE_READ);
+    if (file == NULL) return 0;
+    uint64_t trace = TRACE_BEGIN();
+    char *block = malloc(LINE_INDEX_SAMPLE_BYTES);
+    uint64_t sampled = 0, newlines = 0;
+    size_t sample;
+    for (sample = 0; sample < LINE_INDEX_SAMPLES; sample++){
+        uint64_t offset = (info.size - LINE_INDEX_SAMPLE_BYTES) / (LINE_INDEX_SAMPLES - 1) * sample;
+        ssize_t got = storageRead(file, block, LINE_INDEX_SAMPLE_BYTES, offset);
+        if (got <= 0) continue;
+        sampled += got;
+        char *position = block, *end = block + got;
+        while ((position = memchr(position, '\n', end - position)) != NULL){
+            position++;
+            newlines++;
+        }
+    }
+    free(block);
+    storageClose(file);
+    TRACE_END("estimateFileLines", trace, sampled);
+
+    // Nothing sampled ended a line, so it is most likely one huge line
+    estimate->averageLength = newlines > 0 ? (double)sampled / newlines : info.size;
+    estimate->lines = info.size / estimate->averageLength;
+
+    requestLineIndex(fileName);
+    // Without the scheduler the index was built on this thread
+    if (indexedLineCount(fileName, &estimate->lines)) estimate->exact = 1;
+    return 1;
+}
+
+/**
+ * @brief Moves past some lines
+ *
+ * @param file The file
+ * @param offset Where to start, at the start of a line
+ * @param count How many lines to move past
+ * @return uint64_t Where the line count lines on starts, the end of the file if it has fewer
+ */
+static uint64_t skipLines(struct StorageFile *file, uint64_t offset, size_t count){
+    char *block = malloc(STORAGE_BUFFER_SIZE);
+    ssize_t got;
+    while (count > 0 && (got = storageRead(file, block, STORAGE_BUFFER_SIZE, offset)) > 0){
+        char *position = block, *end = block + got;
+        while (count > 0 && (position = memchr(position, '\n', end - position)) != NULL){
+            position++;
+            count--;
+        }
+        offset += count > 0 ? (uint64_t)got : (uint64_t)(position - block);
+    }
+    free(block);
+    return offset;
+}
+
+/**
+ * @brief Finds where a line starts using the files index, only the lines since the nearest checkpoint are read
+ *
+ * @param fileName The file
+ * @param lineNumber The line, from 1
+ * @param offset Set to where it starts, the end of the file if it has fewer lines
+ * @return int 1 if ok, 0 if the file has no current index
+ */
+int indexedLineStart(char *fileName, size_t lineNumber, uint64_t *offset){
+    *offset = 0;
+    if (lineNumber <= 1) return 1;
+
+    struct StorageStat current;
+    if (storageStat(fileName, &current) == 0) return 0;
+    size_t remaining = lineNumber - 1;
+    uint64_t checkpoint = 0;
+    pthread_mutex_lock(&lineIndexes.lock);
+    struct LineIndex *index = findLineIndex(fileName, &current);
+    if (index != NULL){
+        size_t nearest = remaining / LINE_INDEX_STEP;
+        if (nearest >= index->checkpointCount) nearest = index->checkpointCount - 1;
+        checkpoint = index->checkpoints[nearest];
+        remaining -= nearest * LINE_INDEX_STEP;
+    }
+    pthread_mutex_unlock(&lineIndexes.lock);
+    if (index == NULL) return 0;
+
+    struct StorageFile *file = storageOpen(fileName, STORAGE_READ);
+    if (file == NULL) return 0;
+    *offset = skipLines(file, checkpoint, remaining);
+    storageClose(file);
+    return 1;
+}
+
+/**
+ * @brief Finds where a line starts, straight away however big the file is. Without a current index
+ * a huge files offset is estimated from its average line length and moved on to the next line start
+ *
+ * @param fileName The file
+ * @param lineNumber The line, from 1
+ * @param exact Set to 1 if the offset is really where that line starts, 0 if it is estimated
+ * @return uint64_t The offset, the end of the file if it has fewer lines
+ */
+uint64_t lineStartOffset(char *fileName, size_t lineNumber, int *exact){
+    uint64_t offset;
+    *exact = 1;
+    if (indexedLineStart(fileName, lineNumber, &offset)) return offset;
+
+    // Estimating a small file indexes it
+    struct LineEstimate estimate;
+    if (estimateFileLines(fileName, &estimate) == 0) return 0;
+    if (estimate.exact && indexedLineStart(fileName, lineNumber, &offset)) return offset;
+
+    *exact = 0;
+    struct StorageFile *file = storageOpen(fileName, STORAGE_READ);
+    if (file == NULL) return 0;
+    uint64_t size = storageSize(file);
+    offset = (lineNumber - 1) * estimate.averageLength;
+    if (offset >= size) offset = size > 0 ? size - 1 : 0;
+    // The estimate lands part way through a line, the next one is shown
+    if (offset > 0) offset = skipLines(file, offset - 1, 1);
+    storageClose(file);
+    return offset;
+}
+
+/**
+ * @brief Waits at a screen showing estimates until either the user presses a key or the exact index is ready
+ *
+ * @param fileName The file being indexed
+ * @param estimate Made exact once the index is ready
+ * @return int 1 if the index is ready (redraw with it), 0 if the user pressed a key (left unread)
+ */
+int waitForLineIndex(char *fileName, struct LineEstimate *estimate){
+    struct pollfd input;
+    input.fd = STDIN_FILENO;
+    input.events = POLLIN;
+
+    int ready = 0;
+    setUserWaiting(1);
+    while (1 == 1){
+        input.revents = 0;
+        if (poll(&input, 1, LINE_INDEX_POLL_MILLISECONDS) > 0 && (input.revents & (POLLIN | POLLHUP))) break;
+        // Only looks for the index, the file isn't read again
+        if (indexedLineCount(fileName, &estimate->lines)){
+            ready = estimateFileLines(fileName, estimate);
+            break;
+        }
+    }
+    setUserWaiting(0);
+    return ready;
+}
@@ -0,0 +1,34 @@
+#ifndef LINE_INDEX_H
+#define LINE_INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Where every this many lines start is remembered, so any line is found by reading at most this many
+#define LINE_INDEX_STEP 4096
+// Files smaller than this are simply counted, bigger ones are estimated while they are indexed in the background
+#define LINE_INDEX_INSTANT_BYTES (16 * 1024 * 1024)
+// Blocks spread over a file read to estimate how long its lines are
+#define LINE_INDEX_SAMPLES 16
+#define LINE_INDEX_SAMPLE_BYTES (64 * 1024)
+// Indexes of the files looked at most recently are kept
+#define LINE_INDEX_CACHE 8
+// How often a screen showing estimates checks whether the index is ready
+#define LINE_INDEX_POLL_MILLISECONDS 100
+
+struct LineEstimate
+{
+    size_t lines;           // Lines ending in a \n, like fileLines
+    int exact;              // 0 while it is estimated from samples
+    double averageLength;   // Bytes per line
+};
+
+size_t indexFileLines(char *fileName);
+int indexedLineCount(char *fileName, size_t *lines);
+int estimateFileLines(char *fileName, struct LineEstimate *estimate);
+int indexedLineStart(char *fileName, size_t lineNumber, uint64_t *offset);
+uint64_t lineStartOffset(char *fileName, size_t lineNumber, int *exact);
+void requestLineIndex(char *fileName);
+int waitForLineIndex(char *fileName, struct LineEstimate *estimate);
+
+#endif
@@ -14,11 +14,96 @@
 #include "interface.h"
 #include "utils.h"
 #include "change_log.h"
+#include "trace.h"
+#include "output.h"
+#include "storage.h"
+#include "line_index.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <unistd.h>
+
+// A file being rewritten into a temp file beside it, which then replaces it
+struct LineRewrite
+{
+    char *tempName;
+    struct StorageFile *source;
+    struct StorageFile *temp;
+    struct StorageLineReader reader;
+};
+
+/**
+ * @brief Prints lines x to y highlighting the zth, reading from an offset
+ * 
+ * @param file The file to print from
+ * @param offset Where to start reading, the start of a line
+ * @param first The number of the line there
+ * @param x The minimum line
+ * @param y The maximum line
+ * @param z The line to highlight
+ * @param estimated 1 if the line numbers are estimated, they are marked with a ~
+ */
+static void printLinesFrom(struct StorageFile *file, uint64_t offset, size_t first, size_t x, size_t y, size_t z, int estimated){
+    struct StorageLineReader reader;
+    openLineReader(&reader, file, offset);
+    const char *line;
+    ssize_t length;
+    size_t lineCount = first - 1;    
+
+    struct OutputBuffer output;
+    openOutput(&output, STDOUT_FILENO);
+    // Nothing after y is shown so there is no need to read it
+    while (lineCount < y && (length = storageReadLine(&reader, &line)) != -1) {
+        lineCount++;
+        if (lineCount >= x){
+            if (estimated) outputString(&output, "~");
+            outputNumber(&output, lineCount, 0);
+            outputString(&output, lineCount == z ? " > " : "  ");
+            outputBytes(&output, line, length);
+        }
+    }
+    closeOutput(&output);
+    closeLineReader(&reader);
+}
+
+/**
+ * @brief Starts rewriting a file, its lines are read from the rewrites reader and written to its temp file
+ *
+ * @param rewrite The rewrite to setup
+ * @param fileName The file to rewrite
+ * @param suffix Added to the name for the temp file
+ * @return int 1 if ok, 0 if either file couldn't be opened
+ */
+static int openRewrite(struct LineRewrite *rewrite, char *fileName, char *suffix){
+    rewrite->tempName = concat(fileName, suffix);
+    rewrite->source = storageOpen(fileName, STORAGE_READ);
+    rewrite->temp = rewrite->source != NULL ? storageOpen(rewrite->tempName, STORAGE_WRITE) : NULL;
+    if (rewrite->temp == NULL){
+        storageClose(rewrite->source);
+        free(rewrite->tempName);
+        return 0;
+    }
+    openLineReader(&rewrite->reader, rewrite->source, 0);
+    return 1;
+}
+
+/**
+ * @brief Finishes a rewrite, the temp file replaces the original in one step unless writing it failed
+ *
+ * @param rewrite The rewrite
+ * @param fileName The file rewritten
+ * @return int 1 if the file was replaced, 0 if it was left as it was
+ */
+static int finishRewrite(struct LineRewrite *rewrite, char *fileName){
+    closeLineReader(&rewrite->reader);
+    storageClose(rewrite->source);
+    int ok = storageClose(rewrite->temp) && storageReplace(rewrite->tempName, fileName);
+    if (ok == 0) storageRemove(rewrite->tempName);
+    free(rewrite->tempName);
+    return ok;
+}
 
 /**
  * @brief Appends a lien to the file once asked
@@ -47,32 +132,34 @@ void appendLine(char *fileName){
 
     printLastNLines(fileName, 15);
 
-    char *input = malloc(256*sizeof(char));
+    char *input = NULL;
+    size_t inputLength = 0;
    
     char *help = "[New Line !n, Exit !c] >";
 
     int lineAdds = 0;
     printLine(help);
-    while (fgets(input, 256, stdin)){
+    while (getline(&input, &inputLength, stdin) != -1){
 
         if (input[0] == '!' && (input[1] == 'c' || input[1] == 'C') && strlen(input) == 3){
             free(input);
-            char number[4];
+            char number[24];
             sprintf(number, "+%d", lineAdds);
             addToChangeLog(fileName, "APPEND", number);
             return;
         }
         lineAdds++;
 
-        input = sanitise(input);
-        internalAppendLine(fileName, input);
+        char *clean = sanitise(input);
+        internalAppendLine(fileName, clean);
+        free(clean);
 
         clearScreen();
         printHeader();
         printLastNLines(fileName, 15);
         printLine(help);
     }
-    
+    free(input);
 }
 
 /**
@@ -113,37 +200,33 @@ void deleteLine(char *fileName, int lineNumber){
     }
     // Delete line, write file contents to itself skipping invalid line
 
-    char *tempName = concat(fileName,".replica.cword.txt");
-
-    FILE *temp, *source;
-    temp = fopen(tempName, "w");
-    source = fopen(fileName, "r");
+    struct LineRewrite rewrite;
+    if (openRewrite(&rewrite, fileName, ".replica.cword.txt") == 0){
+        infoScreen("The file couldn't be rewritten!");
+        return;
+    }
 
-    char *line;
-    size_t len = 0;
+    const char *line;
     size_t lineCount = 0;  
     ssize_t l = 0;
 
-    char *deletedLine;  
+    char *deletedLine = NULL;
 
-    while ((l = getline(&line, &len, source)) != -1) {
+    while ((l = storageReadLine(&rewrite.reader, &line)) != -1) {
         lineCount++;
         if (lineCount == lineNumber) {
-            deletedLine = malloc((l + 1) * sizeof(char));
-            strcpy(deletedLine, line);
+            // Recorded without its \n
+            deletedLine = strndup(line, line[l - 1] == '\n' ? l - 1 : l);
             continue;
         }
 
-        fprintf(temp, "%s", line);
+        storageWrite(rewrite.temp, line, l);
+    }
+    if (finishRewrite(&rewrite, fileName) == 0 || deletedLine == NULL){
+        free(deletedLine);
+        infoScreen("The file couldn't be rewritten!");
+        return;
     }
-    fclose(temp);
-    fclose(source);
-    remove(fileName);
-    rename(tempName, fileName);
-    free(tempName);
-    
-
-    deletedLine[strlen(deletedLine)-1] = '\0';
 
   
     char *ln = intToString(lineNumber);
@@ -189,16 +272,18 @@ void insertLine(char *fileName, int lineNumber){
     printLinesFromXToYHighlightingZ(fileName, min, max, lineNumber);
     printLine("\n[Type !c to cancel?]> ");
 
-    char *input = malloc(sizeof(char) * 256);
-    fgets(input, 256, stdin);
-    if (input[0] == '!' && (input[1] == 'c' || input[1] == 'C') && strlen(input) == 3){
+    char *input = NULL;
+    size_t inputLength = 0;
+    if (getline(&input, &inputLength, stdin) == -1 || (input[0] == '!' && (input[1] == 'c' || input[1] == 'C') && strlen(input) == 3)){
             free(input);
             infoScreen("Line insertion cancelled!");
             return;
     }
 
-    input = sanitise(input);
-    internalInsertLine(fileName, lineNumber, input);
+    char *clean = sanitise(input);
+    free(input);
+    internalInsertLine(fileName, lineNumber, clean);
+    free(clean);
 
     char *ln = intToString(lineNumber);
     addToChangeLog(fileName, "INSERT", ln);
@@ -208,6 +293,109 @@ void insertLine(char *fileName, int lineNumber){
     infoScreen("Line successfully inserted!");
 }
 
+/**
+ * @brief Inserts a block of lines typed, pasted or read from another file in one go,
+ * recorded as a single changelog entry so one rollback removes the whole block
+ * 
+ * @param fileName The file to insert into
+ * @param lineNumber The line number to insert at
+ */
+void insertBlock(char *fileName, int lineNumber){
+    if (fileExists(fileName) == 0){
+        char *m = concat(fileName, " doesn't exist!");
+        infoScreen(m);
+        free(m);
+        return;
+    }
+    if (canRead(fileName) == 0){
+        infoScreen("You don't have permission to read this file!");
+        return;
+    }
+    if (canWrite(fileName) == 0){
+        infoScreen("You don't have permission to write to this file!");
+        return;
+    }
+
+    char *sourceName = getUserLine("Please provide the file to insert from (leave blank to type or paste the lines): ");
+    FILE *block;
+    if (sourceName[0] != '\0'){
+        if (strcmp(sourceName, fileName) == 0 || canRead(sourceName) == 0 || (block = fopen(sourceName, "r")) == NULL){
+            free(sourceName);
+            infoScreen("That file can't be inserted from!");
+            return;
+        }
+    } else {
+        clearScreen();
+        printHeader();
+
+        size_t min, max;
+        calculateMinMax(&min, &max, &lineNumber, fileLines(fileName), 5);
+        printLinesFromXToYHighlightingZ(fileName, min, max, lineNumber);
+        printLine("\n[Type or paste the lines, !c on its own line to finish]>\n");
+
+        // The lines are held aside so a cancelled or empty block leaves the file untouched
+        block = tmpfile();
+        char *input = NULL;
+        size_t inputLength = 0;
+        ssize_t length;
+        while ((length = getline(&input, &inputLength, stdin)) != -1){
+            if (input[0] == '!' && (input[1] == 'c' || input[1] == 'C') && strlen(input) == 3) break;
+            fwrite(input, 1, length, block);
+        }
+        free(input);
+        rewind(block);
+    }
+    free(sourceName);
+
+    size_t inserted = insertBlockFromStream(fileName, lineNumber, block);
+    fclose(block);
+
+    if (inserted == 0){
+        infoScreen("Block insertion cancelled!");
+        return;
+    }
+    char count[24];
+    sprintf(count, "%zu", inserted);
+    char *message = concat3("Block of ", count, " lines successfully inserted!");
+    infoScreen(message);
+    free(message);
+}
+
+/**
+ * @brief Inserts every line of a stream before a line, appending past the end, and records it.
+ * A block is recorded as APPEND k or INSERT n::k, a single line keeps the plain INSERT n. Appending after
+ * a last line without a \n is recorded as APPEND k::joined
+ * 
+ * @param fileName The file to insert into
+ * @param lineNumber The line to insert before
+ * @param block The lines to insert, read to the end
+ * @return size_t How many lines were inserted, nothing is recorded for 0
+ */
+size_t insertBlockFromStream(char *fileName, int lineNumber, FILE *block){
+    if (lineNumber < 1) lineNumber = 1;
+    // A last line without a \n is still a line to insert before
+    size_t totalLines = fileLines(fileName) + lastLineUnterminated(fileName);
+
+    int joined;
+    size_t inserted = internalInsertBlock(fileName, lineNumber, block, &joined);
+    if (inserted == 0) return 0;
+
+    char info[48];
+    if (lineNumber > totalLines){
+        // Rollback also has to take off the \n that ended the old last line
+        sprintf(info, joined ? "%zu::joined" : "%zu", inserted);
+        addToChangeLog(fileName, "APPEND", info);
+    } else {
+        if (inserted == 1){
+            sprintf(info, "%d", lineNumber);
+        } else {
+            sprintf(info, "%d::%zu", lineNumber, inserted);
+        }
+        addToChangeLog(fileName, "INSERT", info);
+    }
+    return inserted;
+}
+
 /**
  * @brief Shows the line of a file and some surrounding context
  * 
@@ -230,16 +418,40 @@ void showLine(char *fileName, int lineNumber){
         return;
     }
 
-    clearScreen();
-    printHeader();
+    struct LineEstimate estimate;
+    if (estimateFileLines(fileName, &estimate) == 0){
+        infoScreen("The file couldn't be read!");
+        return;
+    }
 
-    
-    size_t min, max;
-    calculateMinMax(&min, &max, &lineNumber, fileLines(fileName), 6);
+    // A huge file is shown straight away around where the line should be, then again once it has been indexed
+    while (1 == 1){
+        clearScreen();
+        printHeader();
 
-    //printf("min:%ld max:%ld ln: %d", min, max, lineNumber); Debugging as min was wrong
-    //waitForKey();
-    printLinesFromXToYHighlightingZ(fileName, min, max, lineNumber);
+        size_t min, max;
+        int shownLine = lineNumber;
+        calculateMinMax(&min, &max, &shownLine, estimate.lines, 6);
+
+        //printf("min:%ld max:%ld ln: %d", min, max, lineNumber); Debugging as min was wrong
+        //waitForKey();
+        if (estimate.exact){
+            printLinesFromXToYHighlightingZ(fileName, min, max, shownLine);
+            break;
+        }
+
+        struct StorageFile *file = storageOpen(fileName, STORAGE_READ);
+        if (file == NULL) break;
+        int exact;
+        uint64_t offset = lineStartOffset(fileName, min, &exact);
+        printLinesFrom(file, offset, min, min, max, shownLine, exact == 0);
+        storageClose(file);
+        printLine("\n(Line numbers are estimated until the file has been indexed)\n\nPress ENTER to continue");
+        if (waitForLineIndex(fileName, &estimate) == 0){
+            clearInputBuffer();
+            return;
+        }
+    }
 
     waitForKey();
     return;
@@ -283,25 +495,8 @@ void calculateMinMax(size_t *min, size_t *max, int *lineNumber, size_t totalLine
  * @param n The amount of lines to print
  */
 void printLastNLines(char *fileName, size_t n){
-    int totalLines = fileLines(fileName);
-
-    FILE *file;
-    file = fopen(fileName, "r");
-
-    char *line;
-
-    size_t len = 0;
-
-    size_t lineCount = 0;    
-
-    while (getline(&line, &len, file) != -1) {
-        lineCount++;
-        if ((totalLines-lineCount) <= n){
-            printLine(line);
-        }
-    }
-    fclose(file);
-
+    // Read backward from the end, so only the lines shown are ever read
+    dumpTail(fileName, STDOUT_FILENO, n);
 }
 
 /**
@@ -313,26 +508,22 @@ void printLastNLines(char *fileName, size_t n){
  * @param z The line to highlight
  */
 void printLinesFromXToYHighlightingZ(char *fileName, size_t x, size_t y, size_t z){
-    int totalLines = fileLines(fileName);
-
-
-    FILE *file;
-    file = fopen(fileName, "r");
-
-    char *line;
-    size_t len = 0;
-    size_t lineCount = 0;    
-
-    while (getline(&line, &len, file) != -1) {
-        lineCount++;
-        if (lineCount <= y && lineCount >= x){
-            lineCount == z ? printf("%ld > %s", lineCount, line) : printf("%ld  %s", lineCount, line);
-        }
+    struct StorageFile *file = storageOpen(fileName, STORAGE_READ);
+    if (file == NULL) return;
+
+    // An indexed file is read from the checkpoint before x rather than its start
+    uint64_t offset;
+    size_t first = x;
+    if (indexedLineStart(fileName, x, &offset) == 0){
+        offset = 0;
+        first = 1;
     }
-    fclose(file);
+    printLinesFrom(file, offset, first, x, y, z, 0);
+    storageClose(file);
 }
 
 
+
 /**
  * @brief Shows the line count and read write status to the user
  * 
@@ -372,12 +563,14 @@ void showLineCount(char *fileName){
  * @param line The line to append
  */
 void internalAppendLine(char *fileName, char* line){
-    FILE *append;
-    append = fopen(fileName, "a");
+    uint64_t trace = TRACE_BEGIN();
+    struct StorageFile *append = storageOpen(fileName, STORAGE_APPEND);
+    if (append == NULL) return;
 
-    fprintf(append, "%s", line);
+    storageWriteString(append, line);
         
-    fclose(append);
+    storageClose(append);
+    TRACE_END("internalAppendLine", trace, strlen(line));
 }
 
 /**
@@ -387,25 +580,19 @@ void internalAppendLine(char *fileName, char* line){
  * @return char* The lines content
  */
 char * getLastLineOfFile(char *fileName){
-    int totalLines = fileLines(fileName);
-
-    FILE *file;
-    file = fopen(fileName, "r");
-
-    char *line;
-
-    size_t len = 0;
-
-    size_t lineCount = 0;    
-
-    while (getline(&line, &len, file) != -1) {
-        lineCount++;
-        if ((totalLines-lineCount) == 0){
-            break;
-        }
-    }
-    fclose(file);
-    return line;
+    struct StorageFile *file = storageOpen(fileName, STORAGE_READ);
+    if (file == NULL) return NULL;
+
+    // Only the end of the file is read
+    struct StorageLineReader reader;
+    openLineReader(&reader, file, tailOffset(file, storageSize(file), 1));
+    const char *line;
+    ssize_t length = storageReadLine(&reader, &line);
+    char *lastLine = length == -1 ? strdup("") : strndup(line, length);
+
+    closeLineReader(&reader);
+    storageClose(file);
+    return lastLine;
 }
 
 /**
@@ -415,35 +602,45 @@ char * getLastLineOfFile(char *fileName){
  * @param numberToDelete The amount of lines to delete
  */
 void deleteLastNLinesOfFile(char *fileName, size_t numberToDelete){
+    struct StorageFile *file = storageOpen(fileName, STORAGE_UPDATE);
+    if (file == NULL) return;
+
+    // Only the end of the file is read, then it is cut off where the lines start
+    uint64_t trace = TRACE_BEGIN();
+    uint64_t size = storageSize(file);
+    off_t offset = tailOffset(file, size, numberToDelete);
+    if (storageTruncate(file, offset)) TRACE_END("deleteLastNLinesOfFile", trace, size - offset);
+    storageClose(file);
+}
 
-    size_t totalLines = fileLines(fileName);
-
-    char *tempName = concat(fileName, ".replica.cword.txt");
-
-    FILE *temp, *source;
-    temp = fopen(tempName, "w");
-    source = fopen(fileName, "r");
-
-    char *line;
-    size_t len = 0;
-    size_t lineCount = 0;  
-
-
-    while (getline(&line, &len, source) != -1) {
-        lineCount++;
-        if ((totalLines - lineCount) < numberToDelete) continue;
-
-        fprintf(temp, "%s", line);
-    }
-
-
-
-    fclose(temp);
-    fclose(source);
-    remove(fileName);
-    rename(tempName, fileName);
-    free(tempName);
+/**
+ * @brief Checks whether a file ends part way through a line, which fileLines doesn't count
+ * 
+ * @param fileName The file
+ * @return int 1 if its last byte isn't a \n, 0 if it is or the file is empty
+ */
+int lastLineUnterminated(char *fileName){
+    struct StorageFile *file = storageOpen(fileName, STORAGE_READ);
+    if (file == NULL) return 0;
+    uint64_t size = storageSize(file);
+    char last = '\n';
+    if (size > 0) storageRead(file, &last, 1, size - 1);
+    storageClose(file);
+    return last != '\n';
+}
 
+/**
+ * @brief Takes the \n off the end of a file, the one added when a block was joined onto a last line without one
+ * 
+ * @param fileName The file
+ */
+void removeFinalNewline(char *fileName){
+    struct StorageFile *file = storageOpen(fileName, STORAGE_UPDATE);
+    if (file == NULL) return;
+    uint64_t size = storageSize(file);
+    char last;
+    if (size > 0 && storageRead(file, &last, 1, size - 1) == 1 && last == '\n') storageTruncate(file, size - 1);
+    storageClose(file);
 }
 
 /**
@@ -453,29 +650,33 @@ void deleteLastNLinesOfFile(char *fileName, size_t numberToDelete){
  * @param lineNumber The line to delete
  */
 void internalDeleteLine(char *fileName, int lineNumber){
-    char *tempName = concat(fileName,".replica.cword.txt");
+    internalDeleteLines(fileName, lineNumber, 1);
+}
 
-    FILE *temp, *source;
-    temp = fopen(tempName, "w");
-    source = fopen(fileName, "r");
+/**
+ * @brief Deletes a run of lines in one pass over the file
+ * 
+ * @param fileName The file to delete from
+ * @param lineNumber The first line to delete
+ * @param count How many lines to delete
+ */
+void internalDeleteLines(char *fileName, int lineNumber, size_t count){
+    uint64_t trace = TRACE_BEGIN();
+    struct LineRewrite rewrite;
+    if (openRewrite(&rewrite, fileName, ".replica.cword.txt") == 0) return;
 
-    char *line;
-    size_t len = 0;
+    const char *line;
+    ssize_t length;
     size_t lineCount = 0;  
 
-    char *deletedLine;  
-
-    while (getline(&line, &len, source) != -1) {
+    while ((length = storageReadLine(&rewrite.reader, &line)) != -1) {
         lineCount++;
-        if (lineCount == lineNumber) continue;
+        if (lineCount >= lineNumber && lineCount < lineNumber + count) continue;
 
-        fprintf(temp, "%s", line);
+        storageWrite(rewrite.temp, line, length);
     }
-    fclose(temp);
-    fclose(source);
-    remove(fileName);
-    rename(tempName, fileName);
-    free(tempName);
+    TRACE_END("internalDeleteLines", trace, storageSize(rewrite.temp));
+    finishRewrite(&rewrite, fileName);
 }
 
 /**
@@ -486,30 +687,104 @@ void internalDeleteLine(char *fileName, int lineNumber){
  * @param lineContent The content to insert
  */
 void internalInsertLine(char *fileName, int lineNumber, char *lineContent){
-    char *tempName = concat(fileName,".insert.cword.txt");
-
-    FILE *temp, *source;
-    temp = fopen(tempName, "w");
-    source = fopen(fileName, "r");
+    uint64_t trace = TRACE_BEGIN();
+    struct LineRewrite rewrite;
+    if (openRewrite(&rewrite, fileName, ".insert.cword.txt") == 0) return;
 
-    char *line;
-    size_t len = 0;
+    const char *line;
+    ssize_t length;
     size_t lineCount = 0;    
 
-    while (getline(&line, &len, source) != -1) {
+    while ((length = storageReadLine(&rewrite.reader, &line)) != -1) {
         lineCount++;
         if (lineCount == lineNumber) {
-            fprintf(temp, "%s", lineContent);
+            storageWriteString(rewrite.temp, lineContent);
         }
 
-        fprintf(temp, "%s", line);
+        storageWrite(rewrite.temp, line, length);
     }
 
-    fclose(temp);
-    fclose(source);
-    remove(fileName);
-    rename(tempName, fileName);
-    free(tempName);
+    TRACE_END("internalInsertLine", trace, storageSize(rewrite.temp));
+    finishRewrite(&rewrite, fileName);
+}
+
+/**
+ * @brief Inserts a block of lines before a line in one pass over the file, past the end they are appended.
+ * Each line is sanitised and a last line without a \n is given one
+ * 
+ * @param fileName The file to insert into
+ * @param lineNumber The line to insert before
+ * @param block The lines to insert, read to the end
+ * @param joined Set to 1 if a \n was added to end a last line without one before the block
+ * @return size_t How many lines were inserted
+ */
+size_t internalInsertBlock(char *fileName, int lineNumber, FILE *block, int *joined){
+    uint64_t trace = TRACE_BEGIN();
+    struct LineRewrite rewrite;
+    if (openRewrite(&rewrite, fileName, ".insert.cword.txt") == 0) return 0;
+
+    const char *line;
+    char *blockLine = NULL;
+    size_t len = 0;
+    ssize_t length;
+    size_t lineCount = 0;
+    size_t inserted = 0;
+    int endsWithNewLine = 1;
+    *joined = 0;
+
+    // Lines before the block are copied as they are
+    while (lineCount + 1 < lineNumber && (length = storageReadLine(&rewrite.reader, &line)) != -1) {
+        lineCount++;
+        storageWrite(rewrite.temp, line, length);
+        endsWithNewLine = line[length - 1] == '\n';
+    }
+    while ((length = getline(&blockLine, &len, block)) != -1) {
+        // A file without a final \n would otherwise join its last line to the block, an empty block leaves it be
+        if (endsWithNewLine == 0 && inserted == 0){
+            storageWrite(rewrite.temp, "\n", 1);
+            *joined = 1;
+        }
+        char *clean = sanitise(blockLine);
+        storageWriteString(rewrite.temp, clean);
+        if (length == 0 || blockLine[length - 1] != '\n') storageWrite(rewrite.temp, "\n", 1);
+        free(clean);
+        inserted++;
+    }
+    free(blockLine);
+
+    while ((length = storageReadLine(&rewrite.reader, &line)) != -1) {
+        storageWrite(rewrite.temp, line, length);
+    }
+
+    TRACE_END("internalInsertBlock", trace, storageSize(rewrite.temp));
+    if (finishRewrite(&rewrite, fileName) == 0) return 0;
+    return inserted;
+}
+
+/**
+ * @brief Replaces a line of the file with new content
+ * 
+ * @param fileName The file to edit
+ * @param lineNumber The line to replace
+ * @param lineContent The new content, including its \n
+ */
+void internalReplaceLine(char *fileName, int lineNumber, char *lineContent){
+    uint64_t trace = TRACE_BEGIN();
+    struct LineRewrite rewrite;
+    if (openRewrite(&rewrite, fileName, ".replace.cword.txt") == 0) return;
+
+    const char *line;
+    ssize_t length;
+    size_t lineCount = 0;    
+
+    while ((length = storageReadLine(&rewrite.reader, &line)) != -1) {
+        lineCount++;
+        if (lineCount == lineNumber) storageWriteString(rewrite.temp, lineContent);
+        else storageWrite(rewrite.temp, line, length);
+    }
+
+    TRACE_END("internalReplaceLine", trace, storageSize(rewrite.temp));
+    finishRewrite(&rewrite, fileName);
 }
 
 /**
@@ -520,23 +795,26 @@ void internalInsertLine(char *fileName, int lineNumber, char *lineContent){
  * @return char* The lines content
  */
 char * getLineNOfFile(char *fileName, int lineNumber){
+    struct StorageFile *file = storageOpen(fileName, STORAGE_READ);
+    if (file == NULL) return NULL;
 
-
-    FILE *file;
-    file = fopen(fileName, "r");
-
-    char *line;
-
-    size_t len = 0;
+    struct StorageLineReader reader;
+    openLineReader(&reader, file, 0);
+    const char *line;
+    ssize_t length;
+    char *found = NULL;
 
     size_t lineCount = 0;    
 
-    while (getline(&line, &len, file) != -1) {
+    while ((length = storageReadLine(&reader, &line)) != -1) {
         lineCount++;
         if (lineCount == lineNumber){
+            found = strndup(line, length);
             break;
         }
     }
-    fclose(file);
-    return line;
+    closeLineReader(&reader);
+    storageClose(file);
+    // Past the end the last line is given
+    return found != NULL ? found : getLastLineOfFile(fileName);
 }
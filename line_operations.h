@@ -6,6 +6,8 @@
 void appendLine(char *fileName);
 void deleteLine(char *fileName, int lineNumber);
 void insertLine(char *fileName, int lineNumber);
+void insertBlock(char *fileName, int lineNumber);
+size_t insertBlockFromStream(char *fileName, int lineNumber, FILE *block);
 void showLine(char *fileName, int lineNumber);
 void calculateMinMax(size_t *min, size_t *max, int *lineNumber, size_t totalLines, size_t deviation);
 void printLastNLines(char *fileName, size_t n);
@@ -19,8 +21,13 @@ void internalAppendLine(char *fileName, char *line);
 // Added for ext
 char * getLastLineOfFile(char *fileName);
 void deleteLastNLinesOfFile(char *fileName, size_t numberToDelete);
+void removeFinalNewline(char *fileName);
+int lastLineUnterminated(char *fileName);
 void internalDeleteLine(char *fileName, int lineNumber);
+void internalDeleteLines(char *fileName, int lineNumber, size_t count);
 void internalInsertLine(char *fileName, int lineNumber, char *lineContent);
+size_t internalInsertBlock(char *fileName, int lineNumber, FILE *block, int *joined);
+void internalReplaceLine(char *fileName, int lineNumber, char *lineContent);
 
 // Added for full editor
 char * getLineNOfFile(char *fileName, int lineNumber);
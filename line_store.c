@@ -0,0 +1,234 @@
+/**
+ * @file line_store.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Interned lines for the full editor
+ * Every distinct line is hashed once and kept once, documents hold reference counted ids to them
+ * so memory grows with the number of different lines rather than the number of lines
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#include "line_store.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static struct LineStore shared;
+static int sharedReady = 0;
+
+/**
+ * @brief Hashes a line (FNV-1a 64 bit)
+ *
+ * @param text The line
+ * @param length Its length
+ * @return uint64_t The hash
+ */
+uint64_t hashLineBytes(const char *text, size_t length){
+    uint64_t hash = 14695981039346656037ULL;
+    size_t i;
+    for (i = 0; i < length; i++){
+        hash ^= (unsigned char)text[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/**
+ * @brief Sets up an empty store
+ *
+ * @param store The store
+ */
+void initLineStore(struct LineStore *store){
+    memset(store, 0, sizeof(*store));
+    store->slotCapacity = LINE_STORE_INITIAL_SLOTS;
+    store->slots = calloc(store->slotCapacity, sizeof(uint32_t));
+}
+
+/**
+ * @brief Frees a store and every line in it, any ids still held become invalid
+ *
+ * @param store The store
+ */
+void freeLineStore(struct LineStore *store){
+    size_t i;
+    for (i = 0; i < store->count; i++) free(store->lines[i].text);
+    free(store->lines);
+    free(store->freeIds);
+    free(store->slots);
+    memset(store, 0, sizeof(*store));
+}
+
+/**
+ * @brief Gets the store shared by every open document, so a line open in several files is kept once
+ *
+ * @return struct LineStore* The store
+ */
+struct LineStore * sharedLineStore(){
+    if (sharedReady == 0){
+        initLineStore(&shared);
+        sharedReady = 1;
+    }
+    return &shared;
+}
+
+/**
+ * @brief Doubles the hash table and puts every line back in it
+ *
+ * @param store The store
+ */
+static void growSlots(struct LineStore *store){
+    free(store->slots);
+    store->slotCapacity *= 2;
+    store->slots = calloc(store->slotCapacity, sizeof(uint32_t));
+
+    size_t mask = store->slotCapacity - 1, i;
+    for (i = 0; i < store->count; i++){
+        if (store->lines[i].text == NULL) continue;
+        size_t slot = store->lines[i].hash & mask;
+        while (store->slots[slot] != 0) slot = (slot + 1) & mask;
+        store->slots[slot] = i + 1;
+    }
+}
+
+/**
+ * @brief Gets the id of a line, adding it to the store the first time it is seen.
+ * The caller holds a reference to the id and has to release it
+ *
+ * @param store The store
+ * @param text The line, may contain anything including \n and \0
+ * @param length Its length
+ * @return uint32_t The lines id
+ */
+uint32_t internLine(struct LineStore *store, const char *text, size_t length){
+    uint64_t hash = hashLineBytes(text, length);
+    size_t mask = store->slotCapacity - 1;
+    size_t slot = hash & mask;
+    while (store->slots[slot] != 0){
+        struct StoredLine *line = &store->lines[store->slots[slot] - 1];
+        if (line->hash == hash && line->length == length && memcmp(line->text, text, length) == 0){
+            line->references++;
+            return store->slots[slot] - 1;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    uint32_t id;
+    if (store->freeCount > 0){
+        id = store->freeIds[--store->freeCount];
+    } else {
+        if (store->count == store->capacity){
+            store->capacity = store->capacity == 0 ? 256 : store->capacity * 2;
+            store->lines = realloc(store->lines, store->capacity * sizeof(struct StoredLine));
+        }
+        id = store->count++;
+    }
+
+    struct StoredLine *line = &store->lines[id];
+    // Never NULL, even when empty, as NULL marks a free id
+    line->text = malloc(length + 1);
+    memcpy(line->text, text, length);
+    line->text[length] = '\0';
+    line->length = length;
+    line->references = 1;
+    line->hash = hash;
+    store->slots[slot] = id + 1;
+    store->used++;
+    store->bytes += length;
+
+    // Kept at most half full so probes stay short
+    if (store->used * 2 > store->slotCapacity) growSlots(store);
+    return id;
+}
+
+/**
+ * @brief Takes another reference to a line
+ *
+ * @param store The store
+ * @param id The lines id
+ */
+void retainLine(struct LineStore *store, uint32_t id){
+    store->lines[id].references++;
+}
+
+/**
+ * @brief Drops a reference to a line, the line is freed when nothing refers to it
+ *
+ * @param store The store
+ * @param id The lines id
+ */
+void releaseLine(struct LineStore *store, uint32_t id){
+    struct StoredLine *line = &store->lines[id];
+    if (--line->references > 0) return;
+
+    // Remove it from the table, shifting back the lines probed past it so no tombstones are needed
+    size_t mask = store->slotCapacity - 1;
+    size_t slot = line->hash & mask;
+    while (store->slots[slot] != id + 1) slot = (slot + 1) & mask;
+    size_t hole = slot;
+    slot = (slot + 1) & mask;
+    while (store->slots[slot] != 0){
+        size_t home = store->lines[store->slots[slot] - 1].hash & mask;
+        // Move it if its home isn't between the hole and where it sits
+        if (((slot - home) & mask) >= ((slot - hole) & mask)){
+            store->slots[hole] = store->slots[slot];
+            hole = slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+    store->slots[hole] = 0;
+
+    store->used--;
+    store->bytes -= line->length;
+    free(line->text);
+    line->text = NULL;
+
+    if (store->freeCount == store->freeCapacity){
+        store->freeCapacity = store->freeCapacity == 0 ? 256 : store->freeCapacity * 2;
+        store->freeIds = realloc(store->freeIds, store->freeCapacity * sizeof(uint32_t));
+    }
+    store->freeIds[store->freeCount++] = id;
+}
+
+/**
+ * @brief Gets the text of a line
+ *
+ * @param store The store
+ * @param id The lines id
+ * @param length Set to its length
+ * @return const char* The text, valid until the line is released
+ */
+const char * storedLine(struct LineStore *store, uint32_t id, size_t *length){
+    *length = store->lines[id].length;
+    return store->lines[id].text;
+}
+
+/**
+ * @brief Checks a line against some text without hashing it
+ *
+ * @param store The store
+ * @param id The lines id
+ * @param text The text
+ * @param length Its length
+ * @return int 1 if they match
+ */
+int storedLineEquals(struct LineStore *store, uint32_t id, const char *text, size_t length){
+    struct StoredLine *line = &store->lines[id];
+    return line->length == length && memcmp(line->text, text, length) == 0;
+}
+
+/**
+ * @brief Works out roughly how much memory a store holds
+ *
+ * @param store The store
+ * @return size_t Bytes
+ */
+size_t lineStoreMemory(struct LineStore *store){
+    // Each line also costs an allocation header on top of its text
+    return store->bytes + store->used * 16
+        + store->capacity * sizeof(struct StoredLine)
+        + store->freeCapacity * sizeof(uint32_t)
+        + store->slotCapacity * sizeof(uint32_t);
+}
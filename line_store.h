@@ -0,0 +1,46 @@
+#ifndef LINE_STORE_H
+#define LINE_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define LINE_STORE_INITIAL_SLOTS 1024
+
+// One distinct line, shared by every place it appears
+struct StoredLine
+{
+    char *text;             // NULL when the id is free
+    uint32_t length;
+    uint32_t references;
+    uint64_t hash;
+};
+
+// Hash consed pool of lines, equal lines always get the same id. Not thread safe
+struct LineStore
+{
+    struct StoredLine *lines;   // lines[id]
+    size_t count;               // Ids handed out, free or not
+    size_t capacity;
+    uint32_t *freeIds;
+    size_t freeCount;
+    size_t freeCapacity;
+    uint32_t *slots;            // Open addressed hash table of id + 1, 0 = empty
+    size_t slotCapacity;
+    size_t used;                // Distinct lines held
+    size_t bytes;               // Text bytes held
+};
+
+uint64_t hashLineBytes(const char *text, size_t length);
+
+void initLineStore(struct LineStore *store);
+void freeLineStore(struct LineStore *store);
+struct LineStore * sharedLineStore();
+
+uint32_t internLine(struct LineStore *store, const char *text, size_t length);
+void retainLine(struct LineStore *store, uint32_t id);
+void releaseLine(struct LineStore *store, uint32_t id);
+const char * storedLine(struct LineStore *store, uint32_t id, size_t *length);
+int storedLineEquals(struct LineStore *store, uint32_t id, const char *text, size_t length);
+size_t lineStoreMemory(struct LineStore *store);
+
+#endif
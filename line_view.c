@@ -0,0 +1,287 @@
+/**
+ * @file line_view.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Horizontal scrolling for the full editor
+ * Caches the display width of lines so only the visible columns of a long line are ever drawn
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#define _XOPEN_SOURCE 700
+
+#include "line_view.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <wchar.h>
+
+#include <ncurses.h>
+
+/**
+ * @brief Empties the cache
+ *
+ * @param cache The cache to setup
+ */
+void initLineWidthCache(struct LineWidthCache *cache){
+    memset(cache, 0, sizeof(*cache));
+}
+
+/**
+ * @brief Frees a single measured line
+ *
+ * @param widths The entry to free
+ */
+void freeLineWidths(struct LineWidths *widths){
+    free(widths->checkpointBytes);
+    free(widths->checkpointColumns);
+    memset(widths, 0, sizeof(*widths));
+}
+
+/**
+ * @brief Frees everything held by the cache
+ *
+ * @param cache The cache to free
+ */
+void freeLineWidthCache(struct LineWidthCache *cache){
+    int i;
+    for (i = 0; i < LINE_WIDTH_CACHE_SIZE; i++){
+        freeLineWidths(&cache->entries[i]);
+    }
+}
+
+/**
+ * @brief Forgets every cached line from the given line onwards,
+ * call after an insert/delete as the lines after it have moved
+ *
+ * @param cache The cache
+ * @param fromLine The first line to forget
+ */
+void invalidateLineWidths(struct LineWidthCache *cache, size_t fromLine){
+    int i;
+    for (i = 0; i < LINE_WIDTH_CACHE_SIZE; i++){
+        if (cache->entries[i].lineNumber >= fromLine) freeLineWidths(&cache->entries[i]);
+    }
+}
+
+/**
+ * @brief Gets the width of the character at the start of text
+ *
+ * @param text The text
+ * @param remaining Bytes left in the text
+ * @param column The column the character would be drawn at, needed for tabs
+ * @param bytes Set to the size of the character in bytes
+ * @return int The display width, invalid and control characters count as 1
+ */
+int characterWidth(const char *text, size_t remaining, size_t column, size_t *bytes){
+    unsigned char first = (unsigned char)text[0];
+
+    if (first == '\t'){
+        *bytes = 1;
+        return TAB_WIDTH - (column % TAB_WIDTH);
+    }
+    if (first < 0x80){
+        *bytes = 1;
+        return 1;
+    }
+
+    mbstate_t state;
+    memset(&state, 0, sizeof(state));
+    wchar_t wide;
+    size_t read = mbrtowc(&wide, text, remaining, &state);
+    if (read == (size_t)-1 || read == (size_t)-2 || read == 0){
+        *bytes = 1;
+        return 1;
+    }
+    *bytes = read;
+
+    int width = wcwidth(wide);
+    return width < 0 ? 1 : width;
+}
+
+/**
+ * @brief Measures a line, building its column checkpoints
+ *
+ * @param widths The entry to fill, must be empty
+ * @param line The lines content, without its \n
+ * @param length The lines length in bytes
+ */
+void measureLineWidths(struct LineWidths *widths, const char *line, size_t length){
+    widths->length = length;
+
+    size_t capacity = length / LINE_WIDTH_CHECKPOINT + 1;
+    widths->checkpointBytes = malloc(capacity * sizeof(size_t));
+    widths->checkpointColumns = malloc(capacity * sizeof(size_t));
+
+    size_t byte = 0, column = 0, nextCheckpoint = 0;
+    while (byte < length){
+        if (byte >= nextCheckpoint){
+            if (widths->checkpointCount == capacity){
+                capacity *= 2;
+                widths->checkpointBytes = realloc(widths->checkpointBytes, capacity * sizeof(size_t));
+                widths->checkpointColumns = realloc(widths->checkpointColumns, capacity * sizeof(size_t));
+            }
+            widths->checkpointBytes[widths->checkpointCount] = byte;
+            widths->checkpointColumns[widths->checkpointCount] = column;
+            widths->checkpointCount++;
+            nextCheckpoint = byte + LINE_WIDTH_CHECKPOINT;
+        }
+
+        size_t bytes;
+        column += characterWidth(line + byte, length - byte, column, &bytes);
+        byte += bytes;
+    }
+    widths->width = column;
+}
+
+/**
+ * @brief Gets the cached widths of a line, measuring it if it isn't cached yet
+ *
+ * @param cache The cache
+ * @param lineNumber The lines number, from 1
+ * @param line The lines content, without its \n
+ * @param length The lines length in bytes
+ * @return struct LineWidths* The widths, owned by the cache
+ */
+struct LineWidths * lineWidthsFor(struct LineWidthCache *cache, size_t lineNumber, const char *line, size_t length){
+    struct LineWidths *widths = &cache->entries[lineNumber % LINE_WIDTH_CACHE_SIZE];
+    if (widths->lineNumber == lineNumber && widths->length == length) return widths;
+
+    freeLineWidths(widths);
+    widths->lineNumber = lineNumber;
+    measureLineWidths(widths, line, length);
+    return widths;
+}
+
+/**
+ * @brief Finds the character covering a display column
+ *
+ * @param widths The lines widths
+ * @param line The lines content
+ * @param column The column to find
+ * @param startColumn Set to the column that character starts at
+ * @return size_t The byte offset of that character, the line length if the column is past the end
+ */
+size_t byteAtColumn(struct LineWidths *widths, const char *line, size_t column, size_t *startColumn){
+    if (widths->checkpointCount == 0 || column >= widths->width){
+        *startColumn = widths->width;
+        return widths->length;
+    }
+
+    // Last checkpoint at or before the column
+    size_t low = 0, high = widths->checkpointCount;
+    while (high - low > 1){
+        size_t middle = low + (high - low) / 2;
+        if (widths->checkpointColumns[middle] <= column){
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+
+    size_t byte = widths->checkpointBytes[low];
+    size_t current = widths->checkpointColumns[low];
+    while (byte < widths->length){
+        size_t bytes;
+        int width = characterWidth(line + byte, widths->length - byte, current, &bytes);
+        if (current + width > column) break;
+        current += width;
+        byte += bytes;
+    }
+    *startColumn = current;
+    return byte;
+}
+
+/**
+ * @brief Finds the display column a byte offset starts at
+ *
+ * @param widths The lines widths
+ * @param line The lines content
+ * @param byte The byte offset, should be at a character start
+ * @return size_t The display column
+ */
+size_t columnAtByte(struct LineWidths *widths, const char *line, size_t byte){
+    if (widths->checkpointCount == 0) return 0;
+    if (byte >= widths->length) return widths->width;
+
+    size_t low = 0, high = widths->checkpointCount;
+    while (high - low > 1){
+        size_t middle = low + (high - low) / 2;
+        if (widths->checkpointBytes[middle] <= byte){
+            low = middle;
+        } else {
+            high = middle;
+        }
+    }
+
+    size_t current = widths->checkpointBytes[low];
+    size_t column = widths->checkpointColumns[low];
+    while (current < byte){
+        size_t bytes;
+        column += characterWidth(line + current, widths->length - current, column, &bytes);
+        current += bytes;
+    }
+    return column;
+}
+
+/**
+ * @brief Draws the columns from leftColumn of a line at the cursor, never more than maxColumns wide.
+ * Wide characters cut by either edge are drawn as spaces and a $ marks a line carrying on to the right
+ *
+ * @param widths The lines widths
+ * @param line The lines content
+ * @param leftColumn The first column to show
+ * @param maxColumns The space available on screen
+ * @param classes A highlight class per byte used as the colour pair, NULL for none
+ */
+void renderLineSlice(struct LineWidths *widths, const char *line, size_t leftColumn, size_t maxColumns, const unsigned char *classes){
+    if (maxColumns == 0) return;
+
+    size_t column;
+    size_t byte = byteAtColumn(widths, line, leftColumn, &column);
+    size_t drawn = 0;
+    int cutOff = widths->width > leftColumn + maxColumns;
+    size_t limit = cutOff ? maxColumns - 1 : maxColumns;
+
+    // Character hanging over the left edge
+    if (byte < widths->length && column < leftColumn){
+        size_t bytes;
+        int width = characterWidth(line + byte, widths->length - byte, column, &bytes);
+        size_t visible = column + width - leftColumn;
+        for (; visible > 0 && drawn < limit; visible--, drawn++) addch(' ');
+        column += width;
+        byte += bytes;
+    }
+
+    while (byte < widths->length && drawn < limit){
+        size_t bytes;
+        int width = characterWidth(line + byte, widths->length - byte, column, &bytes);
+        unsigned char first = (unsigned char)line[byte];
+
+        if (drawn + width > limit){
+            for (; drawn < limit; drawn++) addch(' ');
+            break;
+        }
+
+        if (classes != NULL) attrset(COLOR_PAIR(classes[byte]));
+
+        if (first == '\t'){
+            int i;
+            for (i = 0; i < width; i++) addch(' ');
+        } else if (first < 0x20 || first == 0x7f || (first >= 0x80 && bytes == 1)){
+            // Control characters and invalid UTF-8
+            addch('?');
+        } else {
+            addnstr(line + byte, bytes);
+        }
+
+        drawn += width;
+        column += width;
+        byte += bytes;
+    }
+
+    if (classes != NULL) attrset(A_NORMAL);
+    if (cutOff) addch('$');
+}
@@ -0,0 +1,39 @@
+#ifndef LINE_VIEW_H
+#define LINE_VIEW_H
+
+#include <stddef.h>
+
+// Bytes between cached column checkpoints, bounds the walk to find any column
+#define LINE_WIDTH_CHECKPOINT 64
+// Slots in the width cache, plenty for a screen full of lines
+#define LINE_WIDTH_CACHE_SIZE 256
+#define TAB_WIDTH 8
+
+struct LineWidths
+{
+    size_t lineNumber;        // 0 = empty slot
+    size_t length;            // Bytes in the line, catches stale entries
+    size_t width;             // Display columns in the line
+    size_t checkpointCount;
+    size_t *checkpointBytes;  // Byte offset of each checkpoint, always at a character start
+    size_t *checkpointColumns;// Display column each checkpoint starts at
+};
+
+struct LineWidthCache
+{
+    struct LineWidths entries[LINE_WIDTH_CACHE_SIZE];
+};
+
+void initLineWidthCache(struct LineWidthCache *cache);
+void freeLineWidthCache(struct LineWidthCache *cache);
+void measureLineWidths(struct LineWidths *widths, const char *line, size_t length);
+void freeLineWidths(struct LineWidths *widths);
+void invalidateLineWidths(struct LineWidthCache *cache, size_t fromLine);
+struct LineWidths * lineWidthsFor(struct LineWidthCache *cache, size_t lineNumber, const char *line, size_t length);
+
+int characterWidth(const char *text, size_t remaining, size_t column, size_t *bytes);
+size_t byteAtColumn(struct LineWidths *widths, const char *line, size_t column, size_t *startColumn);
+size_t columnAtByte(struct LineWidths *widths, const char *line, size_t byte);
+void renderLineSlice(struct LineWidths *widths, const char *line, size_t leftColumn, size_t maxColumns, const unsigned char *classes);
+
+#endif
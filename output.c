@@ -0,0 +1,334 @@
+/**
+ * @file output.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Bulk output for showing files
+ * Output is gathered into large buffers so showing a file costs a write per megabyte rather than a call per line
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "output.h"
+#include "change_log.h"
+#include "storage.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/**
+ * @brief Writes all of some bytes, carrying on after partial writes and interruptions
+ *
+ * @param fd Where to write
+ * @param bytes The bytes
+ * @param length How many
+ * @return int 1 if ok, 0 if the write failed
+ */
+static int writeAll(int fd, const char *bytes, size_t length){
+    while (length > 0){
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0){
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        bytes += written;
+        length -= written;
+    }
+    return 1;
+}
+
+/**
+ * @brief Starts gathering output for a file descriptor
+ *
+ * @param output The buffer to setup
+ * @param fd Where the output goes
+ */
+void openOutput(struct OutputBuffer *output, int fd){
+    // Anything printed before has to come out first
+    fflush(stdout);
+    output->fd = fd;
+    output->data = malloc(OUTPUT_BUFFER_SIZE);
+    output->length = 0;
+    output->failed = 0;
+}
+
+/**
+ * @brief Writes out everything gathered so far
+ *
+ * @param output The buffer
+ * @return int 1 if ok, 0 if a write has failed
+ */
+int flushOutput(struct OutputBuffer *output){
+    if (output->length > 0 && output->failed == 0 && writeAll(output->fd, output->data, output->length) == 0) output->failed = 1;
+    output->length = 0;
+    return output->failed == 0;
+}
+
+/**
+ * @brief Writes out and frees a buffer
+ *
+ * @param output The buffer
+ * @return int 1 if everything was written, 0 if a write failed
+ */
+int closeOutput(struct OutputBuffer *output){
+    int ok = flushOutput(output);
+    free(output->data);
+    output->data = NULL;
+    return ok;
+}
+
+/**
+ * @brief Adds bytes to the output, anything as big as the buffer is written straight out
+ *
+ * @param output The buffer
+ * @param bytes The bytes
+ * @param length How many
+ */
+void outputBytes(struct OutputBuffer *output, const char *bytes, size_t length){
+    if (output->length + length > OUTPUT_BUFFER_SIZE) flushOutput(output);
+    if (length >= OUTPUT_BUFFER_SIZE){
+        if (output->failed == 0 && writeAll(output->fd, bytes, length) == 0) output->failed = 1;
+        return;
+    }
+    memcpy(output->data + output->length, bytes, length);
+    output->length += length;
+}
+
+/**
+ * @brief Adds a string to the output
+ *
+ * @param output The buffer
+ * @param string The string
+ */
+void outputString(struct OutputBuffer *output, const char *string){
+    outputBytes(output, string, strlen(string));
+}
+
+/**
+ * @brief Adds a number to the output, without going through printf
+ *
+ * @param output The buffer
+ * @param number The number
+ * @param width Spaces are added before it to make it at least this wide
+ */
+void outputNumber(struct OutputBuffer *output, size_t number, size_t width){
+    char digits[24];
+    size_t count = 0;
+    do {
+        digits[sizeof(digits) - 1 - count++] = '0' + number % 10;
+        number /= 10;
+    } while (number > 0);
+    while (count < width && count < sizeof(digits)) digits[sizeof(digits) - 1 - count++] = ' ';
+    outputBytes(output, digits + sizeof(digits) - count, count);
+}
+
+/**
+ * @brief Writes out a block read while dumping, numbering its lines if asked
+ *
+ * @param output Where it goes
+ * @param block The bytes read
+ * @param length How many
+ * @param numberLines 1 to put the line number before every line
+ * @param lineNumber The number of the next line, moved on past the block
+ * @param atLineStart Whether the block starts a line, updated for the next
+ */
+static void dumpBlock(struct OutputBuffer *output, const char *block, size_t length, int numberLines, size_t *lineNumber, int *atLineStart){
+    if (numberLines == 0){
+        // Nothing to add, so the block goes straight out
+        if (flushOutput(output) == 0 || writeAll(output->fd, block, length) == 0) output->failed = 1;
+        return;
+    }
+
+    size_t position = 0;
+    while (position < length){
+        if (*atLineStart){
+            outputNumber(output, (*lineNumber)++, 6);
+            outputBytes(output, "\t", 1);
+        }
+        const char *newline = memchr(block + position, '\n', length - position);
+        size_t end = newline != NULL ? (size_t)(newline - block) + 1 : length;
+        outputBytes(output, block + position, end - position);
+        *atLineStart = newline != NULL;
+        position = end;
+    }
+}
+
+/**
+ * @brief Copies a whole stream out without paging, in large aligned blocks.
+ * Numbering lines is done in the same pass, otherwise each block is written as it was read
+ *
+ * @param stream What to dump
+ * @param fd Where to write it
+ * @param numberLines 1 to put the line number before every line (like cat -n)
+ * @return int 1 if ok, 0 if reading or writing failed
+ */
+int dumpStream(FILE *stream, int fd, int numberLines){
+    uint64_t trace = TRACE_BEGIN();
+    char *block;
+    if (posix_memalign((void **)&block, OUTPUT_BLOCK_ALIGNMENT, OUTPUT_BLOCK_SIZE) != 0) return 0;
+
+    struct OutputBuffer output;
+    openOutput(&output, fd);
+    size_t lineNumber = 1;
+    int atLineStart = 1;
+    uint64_t total = 0;
+
+    size_t got;
+    while (output.failed == 0 && (got = fread(block, 1, OUTPUT_BLOCK_SIZE, stream)) > 0){
+        total += got;
+        dumpBlock(&output, block, got, numberLines, &lineNumber, &atLineStart);
+    }
+
+    int ok = ferror(stream) == 0;
+    if (closeOutput(&output) == 0) ok = 0;
+    free(block);
+    TRACE_END("dumpStream", trace, total);
+    return ok;
+}
+
+/**
+ * @brief Dumps a whole file without paging, for piping into other programs
+ *
+ * @param fileName The file
+ * @param fd Where to write it
+ * @param numberLines 1 to put the line number before every line
+ * @return int 1 if ok, 0 if the file couldn't be read or written out
+ */
+int dumpFile(char *fileName, int fd, int numberLines){
+    struct StorageFile *file = storageOpen(fileName, STORAGE_READ);
+    if (file == NULL) return 0;
+
+    char *block;
+    if (posix_memalign((void **)&block, OUTPUT_BLOCK_ALIGNMENT, OUTPUT_BLOCK_SIZE) != 0){
+        storageClose(file);
+        return 0;
+    }
+
+    uint64_t trace = TRACE_BEGIN();
+    struct OutputBuffer output;
+    openOutput(&output, fd);
+    size_t lineNumber = 1;
+    int atLineStart = 1;
+    uint64_t total = 0;
+
+    ssize_t got;
+    while (output.failed == 0 && (got = storageRead(file, block, OUTPUT_BLOCK_SIZE, total)) > 0){
+        total += got;
+        dumpBlock(&output, block, got, numberLines, &lineNumber, &atLineStart);
+    }
+
+    int ok = got == 0;
+    if (closeOutput(&output) == 0) ok = 0;
+    free(block);
+    storageClose(file);
+    TRACE_END("dumpFile", trace, total);
+    return ok;
+}
+
+/**
+ * @brief Finds where the last lines of a file start by reading blocks backward from the end,
+ * so only the tail is read however big the file is
+ *
+ * @param file The file
+ * @param size How long it is
+ * @param lines How many lines are wanted, a last line without a \n counts as one
+ * @return off_t The offset of the first of them, 0 when the file has fewer
+ */
+off_t tailOffset(struct StorageFile *file, off_t size, size_t lines){
+    if (lines == 0) return size;
+
+    char *block;
+    if (posix_memalign((void **)&block, OUTPUT_BLOCK_ALIGNMENT, TAIL_BLOCK_SIZE) != 0) return 0;
+
+    uint64_t trace = TRACE_BEGIN();
+    off_t end = size, offset = 0;
+    // The \n ending the last line doesn't start another one
+    if (end > 0 && storageRead(file, block, 1, end - 1) == 1 && block[0] == '\n') end--;
+
+    size_t found = 0;
+    while (end > 0){
+        // Blocks are aligned so each read is whole pages
+        off_t start = ((end - 1) / TAIL_BLOCK_SIZE) * TAIL_BLOCK_SIZE;
+        if (storageRead(file, block, end - start, start) != end - start) break;
+
+        char *searchEnd = block + (end - start);
+        char *newline;
+        while ((newline = memrchr(block, '\n', searchEnd - block)) != NULL){
+            if (++found == lines){
+                offset = start + (newline - block) + 1;
+                break;
+            }
+            searchEnd = newline;
+        }
+        if (found == lines) break;
+        end = start;
+    }
+    free(block);
+    TRACE_END("tailOffset", trace, size - offset);
+    return offset;
+}
+
+/**
+ * @brief Writes out a file from an offset to its current end
+ *
+ * @param file The file
+ * @param from Where to start
+ * @param output Where to write it
+ * @return off_t The offset reached, -1 if reading or writing failed
+ */
+off_t dumpFrom(struct StorageFile *file, off_t from, int output){
+    char *block;
+    if (posix_memalign((void **)&block, OUTPUT_BLOCK_ALIGNMENT, OUTPUT_BLOCK_SIZE) != 0) return -1;
+
+    // Anything printed before has to come out first
+    fflush(stdout);
+    ssize_t got;
+    while ((got = storageRead(file, block, OUTPUT_BLOCK_SIZE, from)) > 0){
+        if (writeAll(output, block, got) == 0){
+            got = -1;
+            break;
+        }
+        from += got;
+    }
+    free(block);
+    return got < 0 ? -1 : from;
+}
+
+/**
+ * @brief Writes out the last lines of a file, reading only them
+ *
+ * @param fileName The file
+ * @param fd Where to write them
+ * @param lines How many lines
+ * @return int 1 if ok, 0 if the file couldn't be read or written out
+ */
+int dumpTail(char *fileName, int fd, size_t lines){
+    struct StorageFile *file = storageOpen(fileName, STORAGE_READ);
+    if (file == NULL) return 0;
+    int ok = dumpFrom(file, tailOffset(file, storageSize(file), lines), fd) != -1;
+    storageClose(file);
+    return ok;
+}
+
+/**
+ * @brief Dumps the whole changelog of a file without paging, sealed segments and all
+ *
+ * @param fileName The tracked file
+ * @param fd Where to write it
+ * @param numberLines 1 to put the record number before every record
+ * @return int 1 if ok, 0 if the file has no changelog or it couldn't be written out
+ */
+int dumpChangeLog(char *fileName, int fd, int numberLines){
+    FILE *log = openChangeLogStream(fileName);
+    if (log == NULL) return 0;
+    int ok = dumpStream(log, fd, numberLines);
+    fclose(log);
+    return ok;
+}
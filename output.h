@@ -0,0 +1,41 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Output is gathered up to this much before each write
+#define OUTPUT_BUFFER_SIZE (1024 * 1024)
+// Files are dumped in blocks of this size, aligned for the page cache
+#define OUTPUT_BLOCK_SIZE (1024 * 1024)
+#define OUTPUT_BLOCK_ALIGNMENT 4096
+// The end of a file is read backward in blocks of this size to find its last lines
+#define TAIL_BLOCK_SIZE (64 * 1024)
+
+struct OutputBuffer
+{
+    int fd;
+    char *data;
+    size_t length;
+    int failed;         // Set once a write fails, later output is dropped
+};
+
+void openOutput(struct OutputBuffer *output, int fd);
+int closeOutput(struct OutputBuffer *output);
+int flushOutput(struct OutputBuffer *output);
+void outputBytes(struct OutputBuffer *output, const char *bytes, size_t length);
+void outputString(struct OutputBuffer *output, const char *string);
+void outputNumber(struct OutputBuffer *output, size_t number, size_t width);
+
+int dumpStream(FILE *stream, int fd, int numberLines);
+int dumpFile(char *fileName, int fd, int numberLines);
+int dumpChangeLog(char *fileName, int fd, int numberLines);
+
+struct StorageFile;
+
+off_t tailOffset(struct StorageFile *file, off_t size, size_t lines);
+off_t dumpFrom(struct StorageFile *file, off_t from, int output);
+int dumpTail(char *fileName, int fd, size_t lines);
+
+#endif
@@ -0,0 +1,785 @@
+/**
+ * @file pack.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Packs the sealed changelog segments and snapshots of every tracked file into one file
+ * The pack is only ever appended to and is found through a sorted index that is mapped into memory,
+ * new segments and snapshots are written loose into each files folder until the next repack
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#include "pack.h"
+#include "change_log.h"
+#include "file_operations.h"
+#include "utils.h"
+#include "trace.h"
+
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// An index entry while the index is being rewritten
+struct PackRecord
+{
+    char *name;
+    uint64_t offset;
+    uint64_t length;
+    uint32_t modified;
+    int dropped;            // Left out of the next index, kept in place so the records stay sorted
+};
+
+// A loose segment or snapshot while it is being repacked
+struct LooseMember
+{
+    char *location;
+    char *key;
+    struct stat info;       // As it was when copied
+    uint64_t offset;
+    uint64_t length;
+    int appended;           // 0 if the pack already held it
+    int kept;               // 1 if it was unchanged when the index was swapped, only then is it removed
+};
+
+// Only one repack appends to the pack at a time, without holding the changelog lock
+static pthread_mutex_t repackLock = PTHREAD_MUTEX_INITIALIZER;
+
+// The mapped index, remapped whenever pack.cwi is replaced
+static void *indexMap = NULL;
+static size_t indexSize = 0;
+static ino_t indexInode = 0;
+static int64_t indexMtimeNanos = 0;
+
+/**
+ * @brief Gets the location of a pack
+ * Make sure to free after use!
+ *
+ * @param packNumber The packs number
+ * @return char* The location
+ */
+char * packDataPath(uint32_t packNumber){
+    char name[32];
+    sprintf(name, "pack.%u.cwp", packNumber);
+    return concat(".cword/", name);
+}
+
+/**
+ * @brief Gets the entries of a mapped index
+ *
+ * @param header The index
+ * @return const struct PackIndexEntry* The entries
+ */
+static const struct PackIndexEntry * packEntries(const struct PackIndexHeader *header){
+    return (const struct PackIndexEntry *)(header + 1);
+}
+
+/**
+ * @brief Gets the name of an entry in a mapped index
+ *
+ * @param header The index
+ * @param entry The entry
+ * @return const char* The name, not terminated
+ */
+static const char * packEntryName(const struct PackIndexHeader *header, const struct PackIndexEntry *entry){
+    return (const char *)(packEntries(header) + header->count) + entry->nameOffset;
+}
+
+/**
+ * @brief Maps the pack index, reusing the mapping while the file hasn't been replaced.
+ * Call with the changelog lock held
+ *
+ * @return const struct PackIndexHeader* The index, NULL if there isn't a valid one
+ */
+static const struct PackIndexHeader * currentPackIndex(){
+    struct stat info;
+    int exists = stat(PACK_INDEX_LOCATION, &info) == 0;
+    int64_t mtimeNanos = exists ? (int64_t)info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec : 0;
+    if (indexMap != NULL && exists && info.st_ino == indexInode && mtimeNanos == indexMtimeNanos && (size_t)info.st_size == indexSize){
+        return indexMap;
+    }
+
+    if (indexMap != NULL) munmap(indexMap, indexSize);
+    indexMap = NULL;
+    indexSize = 0;
+    if (exists == 0 || (size_t)info.st_size < sizeof(struct PackIndexHeader)) return NULL;
+
+    int file = open(PACK_INDEX_LOCATION, O_RDONLY);
+    if (file == -1) return NULL;
+    void *map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, file, 0);
+    close(file);
+    if (map == MAP_FAILED) return NULL;
+
+    // Checked once per mapping so lookups can trust every offset
+    const struct PackIndexHeader *header = map;
+    int valid = memcmp(header->magic, PACK_INDEX_MAGIC, 4) == 0 && header->version == PACK_INDEX_VERSION
+        && header->count <= (info.st_size - sizeof(*header)) / sizeof(struct PackIndexEntry);
+    if (valid){
+        size_t namesBytes = info.st_size - sizeof(*header) - header->count * sizeof(struct PackIndexEntry);
+        const struct PackIndexEntry *entries = packEntries(header);
+        uint64_t i;
+        for (i = 0; i < header->count && valid; i++){
+            valid = entries[i].nameOffset <= namesBytes && entries[i].nameLength <= namesBytes - entries[i].nameOffset;
+        }
+    }
+    if (valid == 0){
+        munmap(map, info.st_size);
+        return NULL;
+    }
+
+    indexMap = map;
+    indexSize = info.st_size;
+    indexInode = info.st_ino;
+    indexMtimeNanos = mtimeNanos;
+    return indexMap;
+}
+
+/**
+ * @brief Compares an entries name with a key, the same order as strcmp
+ *
+ * @param header The index
+ * @param entry The entry
+ * @param key The key
+ * @param keyLength Its length
+ * @return int Less than, equal to or more than 0
+ */
+static int compareEntry(const struct PackIndexHeader *header, const struct PackIndexEntry *entry, const char *key, size_t keyLength){
+    size_t shorter = entry->nameLength < keyLength ? entry->nameLength : keyLength;
+    int compared = memcmp(packEntryName(header, entry), key, shorter);
+    if (compared != 0) return compared;
+    return entry->nameLength < keyLength ? -1 : (entry->nameLength > keyLength ? 1 : 0);
+}
+
+/**
+ * @brief Finds the first entry not before a key
+ *
+ * @param header The index
+ * @param key The key
+ * @param keyLength Its length
+ * @return uint64_t The entries position, count if every entry is before it
+ */
+static uint64_t lowerBound(const struct PackIndexHeader *header, const char *key, size_t keyLength){
+    const struct PackIndexEntry *entries = packEntries(header);
+    uint64_t low = 0, high = header->count;
+    while (low < high){
+        uint64_t middle = low + (high - low) / 2;
+        if (compareEntry(header, &entries[middle], key, keyLength) < 0){
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+/**
+ * @brief Looks up a member of a tracked file. Call with the changelog lock held
+ *
+ * @param fileName The tracked file
+ * @param member The members name, e.g. changelog.000001.cwz
+ * @param header Set to the index it was found in
+ * @return const struct PackIndexEntry* The entry, NULL if it isn't packed
+ */
+static const struct PackIndexEntry * findPackedEntry(char *fileName, char *member, const struct PackIndexHeader **header){
+    *header = currentPackIndex();
+    if (*header == NULL) return NULL;
+
+    char *key = concat3(fileName, "/", member);
+    size_t keyLength = strlen(key);
+    uint64_t position = lowerBound(*header, key, keyLength);
+    const struct PackIndexEntry *entry = position < (*header)->count ? &packEntries(*header)[position] : NULL;
+    if (entry != NULL && compareEntry(*header, entry, key, keyLength) != 0) entry = NULL;
+    free(key);
+    return entry;
+}
+
+/**
+ * @brief Checks if a member of a tracked file is in the pack
+ *
+ * @param fileName The tracked file
+ * @param member The members name
+ * @return int 1 if it is
+ */
+int packedMemberExists(char *fileName, char *member){
+    lockChangeLogs();
+    const struct PackIndexHeader *header;
+    int found = findPackedEntry(fileName, member, &header) != NULL;
+    unlockChangeLogs();
+    return found;
+}
+
+/**
+ * @brief Opens a packed segment or snapshot for random access reads, straight from the pack
+ *
+ * @param compressed The handle to fill
+ * @param fileName The tracked file
+ * @param member The members name
+ * @return int 1 if ok, 0 if it isn't packed or is damaged
+ */
+int openPackedCompressedFile(struct CompressedFile *compressed, char *fileName, char *member){
+    lockChangeLogs();
+    const struct PackIndexHeader *header;
+    const struct PackIndexEntry *entry = findPackedEntry(fileName, member, &header);
+    int ok = 0;
+    if (entry != NULL){
+        char *location = packDataPath(header->packNumber);
+        ok = openCompressedRegion(compressed, location, entry->offset, entry->length);
+        free(location);
+    }
+    unlockChangeLogs();
+    return ok;
+}
+
+/**
+ * @brief Copies a packed member back out into a file of its own
+ *
+ * @param fileName The tracked file
+ * @param member The members name
+ * @param destination Where to write it
+ * @return int 1 if ok, 0 if it isn't packed or couldn't be copied
+ */
+int extractPackedMember(char *fileName, char *member, char *destination){
+    lockChangeLogs();
+    const struct PackIndexHeader *header;
+    const struct PackIndexEntry *entry = findPackedEntry(fileName, member, &header);
+    if (entry == NULL){
+        unlockChangeLogs();
+        return 0;
+    }
+
+    char *location = packDataPath(header->packNumber);
+    FILE *pack = fopen(location, "rb");
+    free(location);
+    char *tempName = concat(destination, ".extract.cword.txt");
+    FILE *out = pack != NULL ? fopen(tempName, "wb") : NULL;
+    int ok = out != NULL && fseeko(pack, entry->offset, SEEK_SET) == 0;
+
+    char *buffer = malloc(COMPRESSION_BLOCK_SIZE);
+    uint64_t left = entry->length;
+    while (ok && left > 0){
+        size_t want = left < COMPRESSION_BLOCK_SIZE ? left : COMPRESSION_BLOCK_SIZE;
+        size_t got = fread(buffer, 1, want, pack);
+        ok = got == want && fwrite(buffer, 1, got, out) == got;
+        left -= got;
+    }
+    free(buffer);
+    if (out != NULL && fclose(out) != 0) ok = 0;
+    if (pack != NULL) fclose(pack);
+    if (ok) ok = rename(tempName, destination) == 0;
+    if (ok == 0) remove(tempName);
+    free(tempName);
+    unlockChangeLogs();
+    return ok;
+}
+
+/**
+ * @brief Lists the packed members of a tracked file, the index keeps them next to each other
+ *
+ * @param fileName The tracked file
+ * @param members Set to the members, free with freePackMembers
+ * @return size_t The amount of members
+ */
+size_t listPackedMembers(char *fileName, struct PackMember **members){
+    *members = NULL;
+    lockChangeLogs();
+    const struct PackIndexHeader *header = currentPackIndex();
+    if (header == NULL){
+        unlockChangeLogs();
+        return 0;
+    }
+
+    char *prefix = concat(fileName, "/");
+    size_t prefixLength = strlen(prefix);
+    const struct PackIndexEntry *entries = packEntries(header);
+    size_t count = 0, capacity = 0;
+    uint64_t i;
+    for (i = lowerBound(header, prefix, prefixLength); i < header->count; i++){
+        const char *name = packEntryName(header, &entries[i]);
+        if (entries[i].nameLength < prefixLength || memcmp(name, prefix, prefixLength) != 0) break;
+        // Members of files in a folder of the same name share the prefix
+        if (memchr(name + prefixLength, '/', entries[i].nameLength - prefixLength) != NULL) continue;
+
+        if (count == capacity){
+            capacity = capacity == 0 ? 8 : capacity * 2;
+            *members = realloc(*members, capacity * sizeof(struct PackMember));
+        }
+        struct PackMember *member = &(*members)[count++];
+        member->name = strndup(name + prefixLength, entries[i].nameLength - prefixLength);
+        member->offset = entries[i].offset;
+        member->length = entries[i].length;
+        member->modified = entries[i].modified;
+    }
+    free(prefix);
+    unlockChangeLogs();
+    return count;
+}
+
+/**
+ * @brief Frees a list of packed members
+ *
+ * @param members The list
+ * @param count The amount of members
+ */
+void freePackMembers(struct PackMember *members, size_t count){
+    size_t i;
+    for (i = 0; i < count; i++) free(members[i].name);
+    free(members);
+}
+
+/**
+ * @brief Copies every entry of the index into records that can be changed
+ *
+ * @param records Set to the records, free each name and the array after use
+ * @param packNumber Set to the packs number, 1 if there is no pack yet
+ * @param packBytes Set to the packs indexed size
+ * @return size_t The amount of records
+ */
+static size_t loadPackRecords(struct PackRecord **records, uint32_t *packNumber, uint64_t *packBytes){
+    const struct PackIndexHeader *header = currentPackIndex();
+    *packNumber = header != NULL ? header->packNumber : 1;
+    *packBytes = header != NULL ? header->packBytes : 0;
+    size_t count = header != NULL ? header->count : 0, i;
+    *records = malloc((count + 1) * sizeof(struct PackRecord));
+    for (i = 0; i < count; i++){
+        const struct PackIndexEntry *entry = &packEntries(header)[i];
+        (*records)[i].name = strndup(packEntryName(header, entry), entry->nameLength);
+        (*records)[i].offset = entry->offset;
+        (*records)[i].length = entry->length;
+        (*records)[i].modified = entry->modified;
+        (*records)[i].dropped = 0;
+    }
+    return count;
+}
+
+/**
+ * @brief Frees records
+ *
+ * @param records The records
+ * @param count The amount of records
+ */
+static void freePackRecords(struct PackRecord *records, size_t count){
+    size_t i;
+    for (i = 0; i < count; i++) free(records[i].name);
+    free(records);
+}
+
+/**
+ * @brief Orders records by name
+ *
+ * @param a The first record
+ * @param b The second record
+ * @return int Less than, equal to or more than 0
+ */
+static int compareRecords(const void *a, const void *b){
+    const struct PackRecord *first = a, *second = b;
+    return strcmp(first->name, second->name);
+}
+
+/**
+ * @brief Replaces the index with one holding the given records, readers see the old or the new index, never a mix
+ *
+ * @param records The records, sorted in place. Dropped ones are left out
+ * @param count The amount of records
+ * @param packNumber The pack they refer to
+ * @param packBytes The packs size
+ * @return int 1 if ok, 0 if the index couldn't be written
+ */
+static int writePackIndex(struct PackRecord *records, size_t count, uint32_t packNumber, uint64_t packBytes){
+    qsort(records, count, sizeof(struct PackRecord), compareRecords);
+
+    struct PackIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PACK_INDEX_MAGIC, 4);
+    header.version = PACK_INDEX_VERSION;
+    header.packNumber = packNumber;
+    header.packBytes = packBytes;
+
+    struct PackIndexEntry *entries = calloc(count + 1, sizeof(struct PackIndexEntry));
+    struct PackRecord **kept = malloc((count + 1) * sizeof(struct PackRecord *));
+    uint64_t nameOffset = 0;
+    size_t i, live = 0;
+    for (i = 0; i < count; i++){
+        if (records[i].dropped) continue;
+        kept[live] = &records[i];
+        entries[live].nameOffset = nameOffset;
+        entries[live].nameLength = strlen(records[i].name);
+        entries[live].modified = records[i].modified;
+        entries[live].offset = records[i].offset;
+        entries[live].length = records[i].length;
+        nameOffset += entries[live].nameLength;
+        header.liveBytes += records[i].length;
+        live++;
+    }
+    header.count = live;
+
+    char *tempName = concat(PACK_INDEX_LOCATION, ".tmp");
+    FILE *index = fopen(tempName, "wb");
+    int ok = index != NULL;
+    if (ok){
+        ok = fwrite(&header, sizeof(header), 1, index) == 1
+            && fwrite(entries, sizeof(struct PackIndexEntry), live, index) == live;
+        for (i = 0; i < live && ok; i++){
+            ok = fwrite(kept[i]->name, 1, entries[i].nameLength, index) == entries[i].nameLength;
+        }
+        if (fflush(index) != 0 || fsync(fileno(index)) != 0) ok = 0;
+        if (fclose(index) != 0) ok = 0;
+    }
+    if (ok) ok = rename(tempName, PACK_INDEX_LOCATION) == 0;
+    if (ok == 0) remove(tempName);
+    free(tempName);
+    free(entries);
+    free(kept);
+    return ok;
+}
+
+/**
+ * @brief Drops members of a tracked file from the pack, their space is reclaimed by a later repack
+ *
+ * @param fileName The tracked file
+ * @param members The members names
+ * @param count The amount of members
+ * @return int 1 if ok (including when none were packed), 0 if the index couldn't be written
+ */
+int removePackedMembers(char *fileName, char **members, size_t count){
+    lockChangeLogs();
+    int any = 0;
+    size_t i;
+    const struct PackIndexHeader *header;
+    for (i = 0; i < count && any == 0; i++) any = findPackedEntry(fileName, members[i], &header) != NULL;
+    if (any == 0){
+        unlockChangeLogs();
+        return 1;
+    }
+
+    struct PackRecord *records;
+    uint32_t packNumber;
+    uint64_t packBytes;
+    size_t recordCount = loadPackRecords(&records, &packNumber, &packBytes);
+    for (i = 0; i < count; i++){
+        char *key = concat3(fileName, "/", members[i]);
+        struct PackRecord wanted = {key, 0, 0, 0, 0};
+        struct PackRecord *found = bsearch(&wanted, records, recordCount, sizeof(struct PackRecord), compareRecords);
+        if (found != NULL) found->dropped = 1;
+        free(key);
+    }
+    int ok = writePackIndex(records, recordCount, packNumber, packBytes);
+    freePackRecords(records, recordCount);
+    unlockChangeLogs();
+    return ok;
+}
+
+/**
+ * @brief Checks if a name in a history folder is a sealed segment or a snapshot, the only things packed
+ *
+ * @param name The entry name
+ * @return int 1 if it can be packed
+ */
+int isPackableName(char *name){
+    char *p = name;
+    if (strncmp(p, "changelog.", 10) == 0){
+        for (p += 10; isdigit((unsigned char)*p); p++);
+        return p > name + 10 && strcmp(p, ".cwz") == 0;
+    }
+    for (; isdigit((unsigned char)*p); p++);
+    return p > name && *p == '\0';
+}
+
+/**
+ * @brief Counts the segments and snapshots still loose in the history folders
+ *
+ * @return size_t The amount
+ */
+size_t countLooseMembers(){
+    char **files;
+    size_t fileCount = listTrackedFiles(&files), count = 0, i;
+    for (i = 0; i < fileCount; i++){
+        char *dirLocation = concat(".cword/", files[i]);
+        DIR *dir = opendir(dirLocation);
+        if (dir != NULL){
+            struct dirent *entry;
+            while ((entry = readdir(dir)) != NULL){
+                if (isPackableName(entry->d_name)) count++;
+            }
+            closedir(dir);
+        }
+        free(dirLocation);
+        free(files[i]);
+    }
+    free(files);
+    return count;
+}
+
+/**
+ * @brief Copies bytes from one open file to the end of another
+ *
+ * @param from The file to copy from, read from its current position
+ * @param to The file to write to, written at its current position
+ * @param length How many bytes
+ * @return int 1 if ok, 0 if not
+ */
+static int copyBytes(FILE *from, FILE *to, uint64_t length){
+    char *buffer = malloc(COMPRESSION_BLOCK_SIZE);
+    int ok = 1;
+    while (ok && length > 0){
+        size_t want = length < COMPRESSION_BLOCK_SIZE ? length : COMPRESSION_BLOCK_SIZE;
+        size_t got = fread(buffer, 1, want, from);
+        ok = got == want && fwrite(buffer, 1, got, to) == got;
+        length -= got;
+    }
+    free(buffer);
+    return ok;
+}
+
+/**
+ * @brief Writes the live members into a new pack, dropping the space of removed and replaced ones
+ *
+ * @param records The records, their offsets are updated
+ * @param count The amount of records
+ * @param from The current pack
+ * @param packNumber The new packs number
+ * @param packBytes Set to the new packs size
+ * @return int 1 if ok, 0 if the new pack couldn't be written
+ */
+static int rewritePack(struct PackRecord *records, size_t count, FILE *from, uint32_t packNumber, uint64_t *packBytes){
+    char *location = packDataPath(packNumber);
+    FILE *to = fopen(location, "wb");
+    int ok = to != NULL;
+    uint64_t *offsets = malloc((count + 1) * sizeof(uint64_t));
+    uint64_t position = 0;
+    size_t i;
+    for (i = 0; i < count && ok; i++){
+        if (records[i].dropped) continue;
+        ok = fseeko(from, records[i].offset, SEEK_SET) == 0 && copyBytes(from, to, records[i].length);
+        offsets[i] = position;
+        position += records[i].length;
+    }
+    if (to != NULL){
+        if (fflush(to) != 0 || fsync(fileno(to)) != 0) ok = 0;
+        if (fclose(to) != 0) ok = 0;
+    }
+    // The records only move once the whole new pack is safely written
+    for (i = 0; i < count && ok; i++){
+        if (records[i].dropped == 0) records[i].offset = offsets[i];
+    }
+    if (ok == 0) remove(location);
+    free(offsets);
+    free(location);
+    *packBytes = position;
+    return ok;
+}
+
+/**
+ * @brief Checks that a loose member is still the file that was copied into the pack
+ *
+ * @param member The member
+ * @return int 1 if it is unchanged
+ */
+static int looseMemberUnchanged(struct LooseMember *member){
+    struct stat now;
+    return stat(member->location, &now) == 0 && now.st_ino == member->info.st_ino && now.st_size == member->info.st_size
+        && now.st_mtim.tv_sec == member->info.st_mtim.tv_sec && now.st_mtim.tv_nsec == member->info.st_mtim.tv_nsec;
+}
+
+/**
+ * @brief Copies the live members into a new pack without the changelog lock, then swaps it in. Members
+ * removed while it was copied are left out, anything else changing the index gives up on the new pack
+ *
+ * @param records The live records, sorted by name
+ * @param count The amount of records
+ * @param pack The current pack
+ * @param packNumber The current packs number
+ * @param packBytes Set to the new packs size
+ * @return int 1 if the new pack replaced the old, 0 if not
+ */
+static int replacePack(struct PackRecord *records, size_t count, FILE *pack, uint32_t packNumber, uint64_t *packBytes){
+    uint64_t *offsets = malloc((count + 1) * sizeof(uint64_t));
+    size_t i;
+    for (i = 0; i < count; i++) offsets[i] = records[i].offset;
+    uint64_t newBytes;
+    if (rewritePack(records, count, pack, packNumber + 1, &newBytes) == 0){
+        free(offsets);
+        return 0;
+    }
+
+    lockChangeLogs();
+    struct PackRecord *current;
+    uint32_t currentNumber;
+    uint64_t currentBytes;
+    size_t currentCount = loadPackRecords(&current, &currentNumber, &currentBytes);
+    int ok = currentNumber == packNumber;
+    for (i = 0; i < count; i++) records[i].dropped = 1;
+    for (i = 0; i < currentCount && ok; i++){
+        struct PackRecord *found = bsearch(&current[i], records, count, sizeof(struct PackRecord), compareRecords);
+        ok = found != NULL && offsets[found - records] == current[i].offset;
+        if (ok) found->dropped = 0;
+    }
+    if (ok) ok = writePackIndex(records, count, packNumber + 1, newBytes);
+    char *location = packDataPath(ok ? packNumber : packNumber + 1);
+    remove(location);
+    free(location);
+    unlockChangeLogs();
+
+    freePackRecords(current, currentCount);
+    free(offsets);
+    if (ok) *packBytes = newBytes;
+    return ok;
+}
+
+/**
+ * @brief Moves every loose segment and snapshot into the pack. They are compressed and copied without
+ * the changelog lock, it is only taken to swap the index. Loose copies are only removed once the new
+ * index is in place and only if they weren't changed in the meantime, so a failure part way leaves
+ * everything readable
+ *
+ * @param result Filled with what was packed, may be NULL
+ * @param task The task doing it so it can stop early, may be NULL
+ * @return int 1 if ok, 0 if the pack or index couldn't be written
+ */
+int repackHistory(struct RepackResult *result, struct ScheduledTask *task){
+    uint64_t trace = TRACE_BEGIN();
+    struct RepackResult stats;
+    memset(&stats, 0, sizeof(stats));
+    pthread_mutex_lock(&repackLock);
+
+    lockChangeLogs();
+    struct PackRecord *packed;
+    uint32_t packNumber;
+    uint64_t packBytes;
+    size_t packedCount = loadPackRecords(&packed, &packNumber, &packBytes);
+    char **files;
+    size_t fileCount = listTrackedFiles(&files), i;
+    unlockChangeLogs();
+
+    size_t looseCount = 0, looseCapacity = 16;
+    struct LooseMember *loose = malloc(looseCapacity * sizeof(struct LooseMember));
+
+    char *packLocation = packDataPath(packNumber);
+    FILE *pack = fopen(packLocation, "r+b");
+    if (pack == NULL) pack = fopen(packLocation, "w+b");
+    // Anything past the indexed size is from a repack that never finished
+    int ok = pack != NULL && fseeko(pack, packBytes, SEEK_SET) == 0;
+    uint64_t endBytes = packBytes;
+
+    for (i = 0; i < fileCount; i++){
+        char *dirLocation = concat(".cword/", files[i]);
+        DIR *dir = ok ? opendir(dirLocation) : NULL;
+        struct dirent *entry;
+        while (dir != NULL && ok && (task == NULL || taskCancelled(task) == 0) && (entry = readdir(dir)) != NULL){
+            if (isPackableName(entry->d_name) == 0) continue;
+            char *location = concat3(dirLocation, "/", entry->d_name);
+            struct stat info;
+            if (stat(location, &info) != 0 || !S_ISREG(info.st_mode)){
+                free(location);
+                continue;
+            }
+
+            char *key = concat3(files[i], "/", entry->d_name);
+            struct PackRecord wanted = {key, 0, 0, 0, 0};
+            struct PackRecord *existing = bsearch(&wanted, packed, packedCount, sizeof(struct PackRecord), compareRecords);
+
+            // Snapshots are always packed compressed so they can be read in place
+            char *source = location;
+            char *compressedName = NULL;
+            if (entry->d_name[0] != 'c' && isCompressedFile(location) == 0){
+                compressedName = concat(PACK_INDEX_LOCATION, ".compress.cword.txt");
+                if (compressFile(location, compressedName)) source = compressedName;
+            }
+            struct stat sourceInfo;
+            stat(source, &sourceInfo);
+
+            struct LooseMember member = {location, key, info, endBytes, sourceInfo.st_size, 0};
+            // Unless it is a copy taken back out of the pack it is added to the end
+            if (existing == NULL || existing->length != (uint64_t)sourceInfo.st_size){
+                FILE *from = fopen(source, "rb");
+                ok = from != NULL && copyBytes(from, pack, sourceInfo.st_size);
+                if (from != NULL) fclose(from);
+                member.appended = 1;
+                endBytes += sourceInfo.st_size;
+            }
+            if (compressedName != NULL){
+                remove(compressedName);
+                free(compressedName);
+            }
+
+            if (looseCount == looseCapacity){
+                looseCapacity *= 2;
+                loose = realloc(loose, looseCapacity * sizeof(struct LooseMember));
+            }
+            loose[looseCount++] = member;
+        }
+        if (dir != NULL) closedir(dir);
+        free(dirLocation);
+        free(files[i]);
+    }
+    free(files);
+    freePackRecords(packed, packedCount);
+
+    if (ok && fflush(pack) != 0) ok = 0;
+    if (ok && fsync(fileno(pack)) != 0) ok = 0;
+
+    // The index may have lost members since it was read, so what was copied is added to it as it is now
+    lockChangeLogs();
+    struct PackRecord *records;
+    uint32_t currentNumber;
+    uint64_t currentBytes;
+    size_t count = loadPackRecords(&records, &currentNumber, &currentBytes);
+    size_t oldCount = count, kept = 0;
+    records = realloc(records, (count + looseCount + 1) * sizeof(struct PackRecord));
+    for (i = 0; i < looseCount && ok; i++){
+        // Rewritten or removed since it was copied, it stays loose
+        loose[i].kept = looseMemberUnchanged(&loose[i]);
+        if (loose[i].kept == 0) continue;
+        kept++;
+        if (loose[i].appended == 0) continue;
+
+        struct PackRecord wanted = {loose[i].key, 0, 0, 0, 0};
+        struct PackRecord *existing = bsearch(&wanted, records, oldCount, sizeof(struct PackRecord), compareRecords);
+        if (existing != NULL) existing->dropped = 1;
+        records[count++] = (struct PackRecord) {strdup(loose[i].key), loose[i].offset, loose[i].length, loose[i].info.st_mtime, 0};
+        stats.membersPacked++;
+        stats.bytesPacked += loose[i].length;
+    }
+    if (ok && kept > 0) ok = writePackIndex(records, count, packNumber, endBytes);
+    for (i = 0; i < looseCount; i++){
+        if (ok && loose[i].kept) remove(loose[i].location);
+        free(loose[i].location);
+        free(loose[i].key);
+    }
+    free(loose);
+    if (ok && kept > 0) packBytes = endBytes;
+    // Nothing was ever packed
+    if (packBytes == 0 && count == 0) remove(packLocation);
+    unlockChangeLogs();
+
+    // Once over half the pack is garbage it is cheaper to rewrite it than keep reading around it
+    size_t live = 0;
+    uint64_t liveBytes = 0;
+    for (i = 0; i < count; i++){
+        if (records[i].dropped){
+            free(records[i].name);
+            continue;
+        }
+        liveBytes += records[i].length;
+        records[live++] = records[i];
+    }
+    qsort(records, live, sizeof(struct PackRecord), compareRecords);
+    if (ok && liveBytes * 2 < packBytes && (task == NULL || taskCancelled(task) == 0)){
+        stats.rewritten = replacePack(records, live, pack, packNumber, &packBytes);
+    }
+    if (pack != NULL) fclose(pack);
+    free(packLocation);
+    freePackRecords(records, live);
+
+    pthread_mutex_unlock(&repackLock);
+    if (result != NULL) *result = stats;
+    TRACE_END("repackHistory", trace, stats.bytesPacked);
+    return ok;
+}
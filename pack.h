@@ -0,0 +1,66 @@
+#ifndef PACK_H
+#define PACK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "compression.h"
+#include "scheduler.h"
+
+#define PACK_INDEX_MAGIC "CWPI"
+#define PACK_INDEX_VERSION 1
+#define PACK_INDEX_LOCATION ".cword/pack.cwi"
+// Repacked in the background once there are this many loose segments and snapshots
+#define PACK_LOOSE_THRESHOLD 64
+
+// pack.cwi is this header, the entries sorted by name, then the names
+struct PackIndexHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t packNumber;    // The index covers .cword/pack.<packNumber>.cwp
+    uint32_t reserved;
+    uint64_t count;
+    uint64_t packBytes;     // Size of the pack, anything after this was never indexed
+    uint64_t liveBytes;     // Bytes still referred to, the rest is garbage
+};
+
+struct PackIndexEntry
+{
+    uint64_t nameOffset;    // From the start of the names, "<tracked file>/<member>"
+    uint32_t nameLength;
+    uint32_t modified;      // When the member was packed or last written, for the snapshot grace period
+    uint64_t offset;
+    uint64_t length;
+};
+
+// A segment or snapshot of one tracked file held in the pack
+struct PackMember
+{
+    char *name;
+    uint64_t offset;
+    uint64_t length;
+    time_t modified;
+};
+
+struct RepackResult
+{
+    size_t membersPacked;
+    uint64_t bytesPacked;
+    int rewritten;          // 1 if garbage was dropped by rewriting the pack
+};
+
+char * packDataPath(uint32_t packNumber);
+int packedMemberExists(char *fileName, char *member);
+int openPackedCompressedFile(struct CompressedFile *compressed, char *fileName, char *member);
+int extractPackedMember(char *fileName, char *member, char *destination);
+size_t listPackedMembers(char *fileName, struct PackMember **members);
+void freePackMembers(struct PackMember *members, size_t count);
+int removePackedMembers(char *fileName, char **members, size_t count);
+
+int isPackableName(char *name);
+size_t countLooseMembers();
+int repackHistory(struct RepackResult *result, struct ScheduledTask *task);
+
+#endif
@@ -0,0 +1,401 @@
+/**
+ * @file scheduler.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Runs maintenance work (compaction, indexing, snapshot compression) off the UI thread
+ * Tasks wait in one queue per priority for a small pool of workers, idle tasks only start while the
+ * user is sat at a prompt so they never compete with something the user asked for
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#include "scheduler.h"
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+struct Scheduler
+{
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct ScheduledTask *heads[TASK_PRIORITY_COUNT];
+    struct ScheduledTask *tails[TASK_PRIORITY_COUNT];
+    struct ScheduledTask *running[SCHEDULER_MAX_WORKERS];
+    pthread_t workers[SCHEDULER_MAX_WORKERS];
+    size_t workerCount;
+    int started;
+    int stopping;
+    uint64_t nextId;
+    int userWaiting;
+    uint64_t waitingSince;      // Nanoseconds, CLOCK_MONOTONIC
+};
+
+static struct Scheduler scheduler = { .lock = PTHREAD_MUTEX_INITIALIZER, .nextId = 1 };
+
+/**
+ * @brief Gets the time in nanoseconds from a clock that never goes backwards
+ *
+ * @return uint64_t The time
+ */
+static uint64_t monotonicNanos(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * @brief Runs a task and frees it, without the scheduler lock held
+ *
+ * @param task The task
+ */
+static void runTask(struct ScheduledTask *task){
+    uint64_t trace = TRACE_BEGIN();
+    task->run(task, task->context);
+    TRACE_END(task->name, trace, 0);
+}
+
+/**
+ * @brief Frees a task that is finished or was never run
+ *
+ * @param task The task
+ */
+static void freeTask(struct ScheduledTask *task){
+    if (task->release != NULL) task->release(task->context);
+    free(task->subject);
+    free(task);
+}
+
+/**
+ * @brief Takes the next task that may run now, the scheduler lock must be held
+ *
+ * @param wakeAt Set to when an idle task becomes runnable if that is what is waiting, otherwise 0
+ * @return struct ScheduledTask* The task, NULL if none may run yet
+ */
+static struct ScheduledTask * takeTask(uint64_t *wakeAt){
+    *wakeAt = 0;
+    int priority;
+    for (priority = 0; priority < TASK_PRIORITY_COUNT; priority++){
+        struct ScheduledTask *task = scheduler.heads[priority];
+        if (task == NULL) continue;
+        if (priority == TASK_PRIORITY_IDLE){
+            if (scheduler.userWaiting == 0) return NULL;
+            uint64_t idleAt = scheduler.waitingSince + SCHEDULER_IDLE_MILLISECONDS * 1000000ULL;
+            if (monotonicNanos() < idleAt){
+                *wakeAt = idleAt;
+                return NULL;
+            }
+        }
+        scheduler.heads[priority] = task->next;
+        if (scheduler.heads[priority] == NULL) scheduler.tails[priority] = NULL;
+        task->next = NULL;
+        return task;
+    }
+    return NULL;
+}
+
+/**
+ * @brief The body of every worker, runs tasks until the scheduler stops
+ *
+ * @param arg The workers slot in scheduler.running
+ * @return void* Always NULL
+ */
+static void *schedulerWorker(void *arg){
+    size_t slot = (size_t)arg;
+    pthread_mutex_lock(&scheduler.lock);
+    while (scheduler.stopping == 0){
+        uint64_t wakeAt;
+        struct ScheduledTask *task = takeTask(&wakeAt);
+        if (task == NULL){
+            if (wakeAt == 0){
+                pthread_cond_wait(&scheduler.wake, &scheduler.lock);
+            } else {
+                struct timespec until = { wakeAt / 1000000000ULL, wakeAt % 1000000000ULL };
+                pthread_cond_timedwait(&scheduler.wake, &scheduler.lock, &until);
+            }
+            continue;
+        }
+
+        scheduler.running[slot] = task;
+        pthread_mutex_unlock(&scheduler.lock);
+        runTask(task);
+        pthread_mutex_lock(&scheduler.lock);
+        scheduler.running[slot] = NULL;
+
+        pthread_mutex_unlock(&scheduler.lock);
+        freeTask(task);
+        pthread_mutex_lock(&scheduler.lock);
+    }
+    pthread_mutex_unlock(&scheduler.lock);
+    return NULL;
+}
+
+/**
+ * @brief Starts the worker pool, leaving a processor for the user where there is more than one
+ *
+ */
+void startScheduler(){
+    pthread_mutex_lock(&scheduler.lock);
+    if (scheduler.started){
+        pthread_mutex_unlock(&scheduler.lock);
+        return;
+    }
+
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&scheduler.wake, &attributes);
+    pthread_condattr_destroy(&attributes);
+
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t wanted = processors > 1 ? (size_t)processors - 1 : 1;
+    if (wanted > SCHEDULER_MAX_WORKERS) wanted = SCHEDULER_MAX_WORKERS;
+
+    scheduler.stopping = 0;
+    scheduler.workerCount = 0;
+    for (; scheduler.workerCount < wanted; scheduler.workerCount++){
+        if (pthread_create(&scheduler.workers[scheduler.workerCount], NULL, schedulerWorker, (void *)scheduler.workerCount) != 0) break;
+    }
+    // Without a worker tasks carry on running straight away on whoever schedules them
+    scheduler.started = scheduler.workerCount > 0;
+    if (scheduler.started == 0) pthread_cond_destroy(&scheduler.wake);
+    pthread_mutex_unlock(&scheduler.lock);
+}
+
+/**
+ * @brief Stops the worker pool. Queued tasks are dropped, running ones are asked to cancel and waited for.
+ * Every task is written so stopping part way leaves history readable, anything dropped is picked up next start
+ *
+ */
+void stopScheduler(){
+    pthread_mutex_lock(&scheduler.lock);
+    if (scheduler.started == 0){
+        pthread_mutex_unlock(&scheduler.lock);
+        return;
+    }
+    scheduler.stopping = 1;
+
+    struct ScheduledTask *dropped = NULL;
+    int priority;
+    for (priority = 0; priority < TASK_PRIORITY_COUNT; priority++){
+        while (scheduler.heads[priority] != NULL){
+            struct ScheduledTask *task = scheduler.heads[priority];
+            scheduler.heads[priority] = task->next;
+            task->next = dropped;
+            dropped = task;
+        }
+        scheduler.tails[priority] = NULL;
+    }
+    size_t i;
+    for (i = 0; i < scheduler.workerCount; i++){
+        if (scheduler.running[i] != NULL) __atomic_store_n(&scheduler.running[i]->cancelled, 1, __ATOMIC_RELAXED);
+    }
+    pthread_cond_broadcast(&scheduler.wake);
+    pthread_mutex_unlock(&scheduler.lock);
+
+    while (dropped != NULL){
+        struct ScheduledTask *next = dropped->next;
+        freeTask(dropped);
+        dropped = next;
+    }
+    for (i = 0; i < scheduler.workerCount; i++) pthread_join(scheduler.workers[i], NULL);
+
+    pthread_mutex_lock(&scheduler.lock);
+    pthread_cond_destroy(&scheduler.wake);
+    scheduler.workerCount = 0;
+    scheduler.started = 0;
+    scheduler.stopping = 0;
+    pthread_mutex_unlock(&scheduler.lock);
+}
+
+/**
+ * @brief Queues some work. If the same work (name and subject) is already queued it isn't queued twice,
+ * and if the scheduler isn't running the work is done straight away on this thread
+ *
+ * @param priority A TaskPriority
+ * @param name What the work is, must be a string literal
+ * @param subject What it works on, usually the tracked file, copied
+ * @param run Does the work, should check taskCancelled between steps of anything long
+ * @param context Passed to run, owned by the task from now on
+ * @param release Frees the context once the task is finished or dropped, may be NULL
+ * @return uint64_t The tasks id for cancelling it, 0 if it has already been run
+ */
+uint64_t scheduleTask(int priority, const char *name, char *subject, void (*run)(struct ScheduledTask *task, void *context), void *context, void (*release)(void *context)){
+    struct ScheduledTask *task = calloc(1, sizeof(struct ScheduledTask));
+    task->priority = priority;
+    task->name = name;
+    task->subject = strdup(subject);
+    task->run = run;
+    task->release = release;
+    task->context = context;
+
+    pthread_mutex_lock(&scheduler.lock);
+    if (scheduler.started == 0){
+        pthread_mutex_unlock(&scheduler.lock);
+        runTask(task);
+        freeTask(task);
+        return 0;
+    }
+
+    struct ScheduledTask *queued;
+    for (queued = scheduler.heads[priority]; queued != NULL; queued = queued->next){
+        if (queued->name == name && strcmp(queued->subject, subject) == 0){
+            uint64_t id = queued->id;
+            pthread_mutex_unlock(&scheduler.lock);
+            freeTask(task);
+            return id;
+        }
+    }
+
+    task->id = scheduler.nextId++;
+    if (scheduler.tails[priority] != NULL){
+        scheduler.tails[priority]->next = task;
+    } else {
+        scheduler.heads[priority] = task;
+    }
+    scheduler.tails[priority] = task;
+    uint64_t id = task->id;
+    pthread_cond_signal(&scheduler.wake);
+    pthread_mutex_unlock(&scheduler.lock);
+    return id;
+}
+
+/**
+ * @brief Takes every queued task matching out of the queues, the scheduler lock must be held
+ *
+ * @param id The task to take, 0 for any
+ * @param subject The subject to take, NULL for any
+ * @return struct ScheduledTask* A list of the tasks taken, linked through next
+ */
+static struct ScheduledTask * takeQueued(uint64_t id, char *subject){
+    struct ScheduledTask *taken = NULL;
+    int priority;
+    for (priority = 0; priority < TASK_PRIORITY_COUNT; priority++){
+        struct ScheduledTask **link = &scheduler.heads[priority], *previous = NULL;
+        while (*link != NULL){
+            struct ScheduledTask *task = *link;
+            if ((id == 0 || task->id == id) && (subject == NULL || strcmp(task->subject, subject) == 0)){
+                *link = task->next;
+                task->next = taken;
+                taken = task;
+            } else {
+                previous = task;
+                link = &task->next;
+            }
+        }
+        scheduler.tails[priority] = previous;
+    }
+    return taken;
+}
+
+/**
+ * @brief Marks running tasks matching as cancelled, the scheduler lock must be held
+ *
+ * @param id The task, 0 for any
+ * @param subject The subject, NULL for any
+ * @return size_t How many were marked
+ */
+static size_t cancelRunning(uint64_t id, char *subject){
+    size_t count = 0, i;
+    for (i = 0; i < scheduler.workerCount; i++){
+        struct ScheduledTask *task = scheduler.running[i];
+        if (task == NULL) continue;
+        if ((id == 0 || task->id == id) && (subject == NULL || strcmp(task->subject, subject) == 0)){
+            __atomic_store_n(&task->cancelled, 1, __ATOMIC_RELAXED);
+            count++;
+        }
+    }
+    return count;
+}
+
+/**
+ * @brief Frees a list of tasks taken out of the queues
+ *
+ * @param tasks The list
+ * @return size_t How many there were
+ */
+static size_t dropTasks(struct ScheduledTask *tasks){
+    size_t count = 0;
+    while (tasks != NULL){
+        struct ScheduledTask *next = tasks->next;
+        freeTask(tasks);
+        tasks = next;
+        count++;
+    }
+    return count;
+}
+
+/**
+ * @brief Cancels a task. A queued task is dropped, a running one is asked to stop
+ *
+ * @param id The task
+ * @return int 1 if it was found, 0 if it had already finished
+ */
+int cancelTask(uint64_t id){
+    if (id == 0) return 0;
+    pthread_mutex_lock(&scheduler.lock);
+    struct ScheduledTask *taken = takeQueued(id, NULL);
+    size_t running = cancelRunning(id, NULL);
+    pthread_mutex_unlock(&scheduler.lock);
+    return dropTasks(taken) + running > 0;
+}
+
+/**
+ * @brief Cancels every task working on something, e.g. before its history is removed
+ *
+ * @param subject The subject
+ * @return size_t How many were cancelled
+ */
+size_t cancelTasks(char *subject){
+    pthread_mutex_lock(&scheduler.lock);
+    struct ScheduledTask *taken = takeQueued(0, subject);
+    size_t running = cancelRunning(0, subject);
+    pthread_mutex_unlock(&scheduler.lock);
+    return dropTasks(taken) + running;
+}
+
+/**
+ * @brief Checks if a running task has been asked to stop
+ *
+ * @param task The task
+ * @return int 1 if it should stop
+ */
+int taskCancelled(struct ScheduledTask *task){
+    return __atomic_load_n(&task->cancelled, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Counts the tasks queued or running
+ *
+ * @return size_t How many
+ */
+size_t pendingTasks(){
+    size_t count = 0, i;
+    pthread_mutex_lock(&scheduler.lock);
+    int priority;
+    for (priority = 0; priority < TASK_PRIORITY_COUNT; priority++){
+        struct ScheduledTask *task;
+        for (task = scheduler.heads[priority]; task != NULL; task = task->next) count++;
+    }
+    for (i = 0; i < scheduler.workerCount; i++) count += scheduler.running[i] != NULL;
+    pthread_mutex_unlock(&scheduler.lock);
+    return count;
+}
+
+/**
+ * @brief Tells the scheduler whether the user is sat at a prompt, idle tasks only start while they are
+ *
+ * @param waiting 1 before blocking for input, 0 once it arrives
+ */
+void setUserWaiting(int waiting){
+    pthread_mutex_lock(&scheduler.lock);
+    if (waiting && scheduler.userWaiting == 0) scheduler.waitingSince = monotonicNanos();
+    scheduler.userWaiting = waiting;
+    if (waiting && scheduler.started) pthread_cond_broadcast(&scheduler.wake);
+    pthread_mutex_unlock(&scheduler.lock);
+}
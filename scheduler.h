@@ -0,0 +1,44 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Maintenance never takes more threads than this, whatever the machine
+#define SCHEDULER_MAX_WORKERS 2
+// Idle work only starts once the user has been sat at a prompt this long
+#define SCHEDULER_IDLE_MILLISECONDS 300
+
+enum TaskPriority
+{
+    TASK_PRIORITY_HIGH,     // Run as soon as a worker is free
+    TASK_PRIORITY_NORMAL,
+    TASK_PRIORITY_IDLE,     // Only run while the user is waiting at a prompt
+    TASK_PRIORITY_COUNT
+};
+
+struct ScheduledTask
+{
+    uint64_t id;
+    int priority;
+    const char *name;       // Must be a string literal, also used for tracing
+    char *subject;          // Usually the tracked file, a task with the same name and subject is only queued once
+    void (*run)(struct ScheduledTask *task, void *context);
+    void (*release)(void *context);     // Frees the context, may be NULL
+    void *context;
+    int cancelled;
+    struct ScheduledTask *next;
+};
+
+void startScheduler();
+void stopScheduler();
+
+uint64_t scheduleTask(int priority, const char *name, char *subject, void (*run)(struct ScheduledTask *task, void *context), void *context, void (*release)(void *context));
+int cancelTask(uint64_t id);
+size_t cancelTasks(char *subject);
+int taskCancelled(struct ScheduledTask *task);
+size_t pendingTasks();
+
+void setUserWaiting(int waiting);
+
+#endif
@@ -0,0 +1,457 @@
+/**
+ * @file status.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Finds tracked files changed by other programs, and files CWord doesn't track yet
+ * Stat data is cached in .cword/status.cache so only files that changed on disk are ever read
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#include "status.h"
+#include "bulk_operations.h"
+#include "change_log.h"
+#include "change_log_index.h"
+#include "diff.h"
+#include "file_operations.h"
+#include "interface.h"
+#include "utils.h"
+#include "trace.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define STATUS_CACHE_LOCATION ".cword/status.cache"
+#define HASH_BUFFER_SIZE (256 * 1024)
+
+#define PRIME1 11400714785074694791ULL
+#define PRIME2 14029467366897019727ULL
+#define PRIME3 1609587929392839161ULL
+#define PRIME4 9650029242287828579ULL
+#define PRIME5 2870177450012600261ULL
+
+// A tracked file as it was cached and as it is now
+struct StatusFile
+{
+    char *name;
+    struct StatusCacheEntry cached;
+    int wasCached;
+    struct StatusCacheEntry current;
+    int needsHash;
+    int hashed;
+};
+
+/**
+ * @brief Rotates a 64 bit value left
+ *
+ * @param value The value
+ * @param bits How far
+ * @return uint64_t The rotated value
+ */
+static uint64_t rotateLeft(uint64_t value, int bits){
+    return (value << bits) | (value >> (64 - bits));
+}
+
+/**
+ * @brief Mixes 8 bytes into a lane
+ *
+ * @param lane The lane
+ * @param input The bytes
+ * @return uint64_t The new lane
+ */
+static uint64_t hashRound(uint64_t lane, uint64_t input){
+    lane += input * PRIME2;
+    return rotateLeft(lane, 31) * PRIME1;
+}
+
+/**
+ * @brief Reads 8 unaligned bytes
+ *
+ * @param p Where to read
+ * @return uint64_t The bytes
+ */
+static uint64_t read64(const unsigned char *p){
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/**
+ * @brief Hashes a whole file with four independent lanes over 32 byte stripes (the xxHash64 layout),
+ * the lanes have no dependency on each other so the compiler can keep them in parallel/vector registers
+ *
+ * @param fileName The file
+ * @param ok Set to 0 if the file couldn't be read, may be NULL
+ * @return uint64_t The hash
+ */
+uint64_t hashFileContents(char *fileName, int *ok){
+    if (ok != NULL) *ok = 0;
+    int file = open(fileName, O_RDONLY);
+    if (file == -1) return 0;
+
+    unsigned char *buffer = malloc(HASH_BUFFER_SIZE);
+    uint64_t lanes[4] = {PRIME1 + PRIME2, PRIME2, 0, -PRIME1};
+    uint64_t total = 0;
+    size_t filled = 0;
+    int failed = 0;
+
+    while (1 == 1){
+        ssize_t read = pread(file, buffer + filled, HASH_BUFFER_SIZE - filled, total + filled);
+        if (read < 0){
+            failed = 1;
+            break;
+        }
+        filled += read;
+        if (read > 0 && filled < HASH_BUFFER_SIZE) continue;
+
+        // Every full stripe, only the last chunk ever has a tail left over
+        size_t stripes = filled / 32, i;
+        for (i = 0; i < stripes; i++){
+            const unsigned char *stripe = buffer + i * 32;
+            lanes[0] = hashRound(lanes[0], read64(stripe));
+            lanes[1] = hashRound(lanes[1], read64(stripe + 8));
+            lanes[2] = hashRound(lanes[2], read64(stripe + 16));
+            lanes[3] = hashRound(lanes[3], read64(stripe + 24));
+        }
+        if (read == 0) break;
+        total += filled;
+        filled = 0;
+    }
+    close(file);
+
+    size_t tail = filled % 32, tailStart = filled - tail;
+    total += filled;
+
+    uint64_t hash = total >= 32
+        ? rotateLeft(lanes[0], 1) + rotateLeft(lanes[1], 7) + rotateLeft(lanes[2], 12) + rotateLeft(lanes[3], 18)
+        : PRIME5;
+    int i;
+    for (i = 0; i < 4 && total >= 32; i++) hash = (hash ^ hashRound(0, lanes[i])) * PRIME1 + PRIME4;
+    hash += total;
+
+    const unsigned char *p = buffer + tailStart;
+    for (; tail >= 8; tail -= 8, p += 8) hash = rotateLeft(hash ^ hashRound(0, read64(p)), 27) * PRIME1 + PRIME4;
+    for (; tail > 0; tail--, p++) hash = rotateLeft(hash ^ (*p * PRIME5), 11) * PRIME1;
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+
+    free(buffer);
+    if (ok != NULL) *ok = !failed;
+    return hash;
+}
+
+/**
+ * @brief Orders files by name for the cache and bsearch
+ *
+ * @param a A StatusFile
+ * @param b A StatusFile
+ * @return int Like strcmp
+ */
+static int compareStatusFiles(const void *a, const void *b){
+    return strcmp(((const struct StatusFile *)a)->name, ((const struct StatusFile *)b)->name);
+}
+
+/**
+ * @brief Orders strings for the report
+ *
+ * @param a A char*
+ * @param b A char*
+ * @return int Like strcmp
+ */
+static int compareNames(const void *a, const void *b){
+    return strcmp(*(char * const *)a, *(char * const *)b);
+}
+
+/**
+ * @brief Reads the stat cache
+ *
+ * @param files Set to the cached files sorted by name, make sure to free after use!
+ * @return size_t The number of files, 0 if there is no valid cache
+ */
+static size_t readStatusCache(struct StatusFile **files){
+    *files = NULL;
+    FILE *cache = fopen(STATUS_CACHE_LOCATION, "rb");
+    if (cache == NULL) return 0;
+
+    struct StatusCacheHeader header;
+    if (fread(&header, sizeof(header), 1, cache) != 1 || memcmp(header.magic, STATUS_CACHE_MAGIC, 4) != 0 || header.version != STATUS_CACHE_VERSION){
+        fclose(cache);
+        return 0;
+    }
+
+    *files = calloc(header.count + 1, sizeof(struct StatusFile));
+    size_t count = 0;
+    while (count < header.count){
+        struct StatusFile *file = &(*files)[count];
+        if (fread(&file->cached, sizeof(file->cached), 1, cache) != 1 || file->cached.nameLength > 4096) break;
+        file->name = malloc(file->cached.nameLength + 1);
+        if (fread(file->name, 1, file->cached.nameLength, cache) != file->cached.nameLength){
+            free(file->name);
+            break;
+        }
+        file->name[file->cached.nameLength] = '\0';
+        file->wasCached = 1;
+        count++;
+    }
+    fclose(cache);
+    return count;
+}
+
+/**
+ * @brief Writes the stat cache, replacing the old one in one step
+ *
+ * @param files The files, sorted by name
+ * @param count The number of files
+ */
+static void writeStatusCache(struct StatusFile *files, size_t count){
+    FILE *cache = fopen(STATUS_CACHE_LOCATION ".temp", "wb");
+    if (cache == NULL) return;
+
+    struct StatusCacheHeader header;
+    memcpy(header.magic, STATUS_CACHE_MAGIC, 4);
+    header.version = STATUS_CACHE_VERSION;
+    header.count = count;
+    fwrite(&header, sizeof(header), 1, cache);
+
+    size_t i;
+    for (i = 0; i < count; i++){
+        files[i].current.nameLength = strlen(files[i].name);
+        fwrite(&files[i].current, sizeof(files[i].current), 1, cache);
+        fwrite(files[i].name, 1, files[i].current.nameLength, cache);
+    }
+    if (fclose(cache) == 0) rename(STATUS_CACHE_LOCATION ".temp", STATUS_CACHE_LOCATION);
+}
+
+/**
+ * @brief Hashes one file whose stat data changed
+ *
+ * @param context The StatusFile array
+ * @param job Index into the list of files to hash
+ */
+static void hashJob(void *context, size_t job){
+    struct StatusFile **toHash = context;
+    struct StatusFile *file = toHash[job];
+    int ok;
+    file->current.hash = hashFileContents(file->name, &ok);
+    file->hashed = ok;
+}
+
+/**
+ * @brief Adds a name to a list
+ *
+ * @param list The list
+ * @param count Names in the list
+ * @param name The name, copied
+ */
+static void addName(char ***list, size_t *count, char *name){
+    *list = realloc(*list, (*count + 1) * sizeof(char *));
+    (*list)[(*count)++] = strdup(name);
+}
+
+/**
+ * @brief Finds files in a folder CWord has no history for
+ *
+ * @param dirLocation The folder, . for the working directory
+ * @param report Where to add them
+ */
+static void findUntrackedFiles(char *dirLocation, struct StatusReport *report){
+    DIR *dir = opendir(dirLocation);
+    if (dir == NULL) return;
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL){
+        // Hidden folders hold other tools data, and .cword holds ours
+        if (entry->d_name[0] == '.') continue;
+
+        char *location = strcmp(dirLocation, ".") == 0 ? strdup(entry->d_name) : concat3(dirLocation, "/", entry->d_name);
+        struct stat info;
+        if (lstat(location, &info) != 0){
+            free(location);
+            continue;
+        }
+
+        if (S_ISDIR(info.st_mode)){
+            findUntrackedFiles(location, report);
+        } else if (S_ISREG(info.st_mode) && strstr(location, ".cword.txt") == NULL){
+            char *logLocation = concat3(".cword/", location, "/changelog.txt");
+            if (fileExists(logLocation) == 0) addName(&report->untracked, &report->untrackedCount, location);
+            free(logLocation);
+        }
+        free(location);
+    }
+    closedir(dir);
+}
+
+/**
+ * @brief Compares every tracked file with what CWord last saw of it.
+ * A file only counts as modified if it changed without CWord recording a change
+ *
+ * @param report Filled with the results, free with freeStatusReport
+ * @return int 1 if ok
+ */
+int scanStatus(struct StatusReport *report){
+    uint64_t trace = TRACE_BEGIN();
+    memset(report, 0, sizeof(*report));
+
+    struct StatusFile *cached;
+    size_t cachedCount = readStatusCache(&cached);
+
+    char **tracked;
+    size_t trackedCount = listTrackedFiles(&tracked);
+    struct StatusFile *files = calloc(trackedCount + 1, sizeof(struct StatusFile));
+    struct StatusFile **toHash = malloc((trackedCount + 1) * sizeof(struct StatusFile *));
+    size_t hashCount = 0, i;
+
+    for (i = 0; i < trackedCount; i++){
+        struct StatusFile *file = &files[i];
+        file->name = tracked[i];
+
+        struct StatusFile key;
+        key.name = file->name;
+        struct StatusFile *found = cachedCount > 0 ? bsearch(&key, cached, cachedCount, sizeof(struct StatusFile), compareStatusFiles) : NULL;
+        if (found != NULL){
+            file->cached = found->cached;
+            file->wasCached = 1;
+        }
+
+        changeLogStoredSize(file->name, &file->current.logBytes);
+
+        struct stat info;
+        if (stat(file->name, &info) != 0 || !S_ISREG(info.st_mode)){
+            file->current.present = 0;
+            continue;
+        }
+        file->current.present = 1;
+        file->current.size = info.st_size;
+        file->current.mtimeNanos = (int64_t)info.st_mtim.tv_sec * 1000000000LL + info.st_mtim.tv_nsec;
+        file->current.inode = info.st_ino;
+
+        if (file->wasCached && file->cached.present && file->cached.size == file->current.size
+            && file->cached.mtimeNanos == file->current.mtimeNanos && file->cached.inode == file->current.inode){
+            file->current.hash = file->cached.hash;
+        } else {
+            file->needsHash = 1;
+            toHash[hashCount++] = file;
+        }
+    }
+    free(tracked);
+
+    runInThreadPool(hashCount, hashJob, toHash);
+    report->hashed = hashCount;
+    report->tracked = trackedCount;
+
+    for (i = 0; i < trackedCount; i++){
+        struct StatusFile *file = &files[i];
+
+        if (file->current.present == 0){
+            file->current.baselineHash = file->cached.baselineHash;
+            char *last = lastChangeLogRecord(file->name);
+            if (last == NULL || strstr(last, "||DELETED||") == NULL) addName(&report->deleted, &report->deletedCount, file->name);
+            free(last);
+            continue;
+        }
+        if (file->needsHash && file->hashed == 0){
+            file->current.baselineHash = file->cached.baselineHash;
+            continue;
+        }
+
+        // CWord changed the file itself (or has never seen it), so what is on disk is the new baseline
+        if (file->wasCached == 0 || file->current.logBytes != file->cached.logBytes){
+            file->current.baselineHash = file->current.hash;
+        } else {
+            file->current.baselineHash = file->cached.baselineHash;
+            if (file->current.hash != file->current.baselineHash) addName(&report->modified, &report->modifiedCount, file->name);
+        }
+    }
+
+    qsort(files, trackedCount, sizeof(struct StatusFile), compareStatusFiles);
+    writeStatusCache(files, trackedCount);
+
+    findUntrackedFiles(".", report);
+    if (report->untrackedCount > 1) qsort(report->untracked, report->untrackedCount, sizeof(char *), compareNames);
+
+    for (i = 0; i < trackedCount; i++) free(files[i].name);
+    for (i = 0; i < cachedCount; i++) free(cached[i].name);
+    free(files);
+    free(cached);
+    free(toHash);
+    TRACE_END("scanStatus", trace, 0);
+    return 1;
+}
+
+/**
+ * @brief Frees a status report
+ *
+ * @param report The report
+ */
+void freeStatusReport(struct StatusReport *report){
+    size_t i;
+    for (i = 0; i < report->modifiedCount; i++) free(report->modified[i]);
+    for (i = 0; i < report->deletedCount; i++) free(report->deleted[i]);
+    for (i = 0; i < report->untrackedCount; i++) free(report->untracked[i]);
+    free(report->modified);
+    free(report->deleted);
+    free(report->untracked);
+    memset(report, 0, sizeof(*report));
+}
+
+/**
+ * @brief Writes one section of the status report
+ *
+ * @param output Where to write
+ * @param heading The sections heading
+ * @param names The files
+ * @param count The number of files
+ */
+static void printStatusSection(FILE *output, char *heading, char **names, size_t count){
+    if (count == 0) return;
+    fprintf(output, "%s (%zu):\n", heading, count);
+    size_t i;
+    for (i = 0; i < count; i++) fprintf(output, "    %s\n", names[i]);
+    fprintf(output, "\n");
+}
+
+/**
+ * @brief Shows the user which files changed outside of CWord
+ *
+ */
+void showStatus(){
+    waitScreen("Checking files.\nPlease wait...\n");
+    struct StatusReport report;
+    scanStatus(&report);
+
+    if (report.modifiedCount == 0 && report.deletedCount == 0 && report.untrackedCount == 0){
+        char message[128];
+        sprintf(message, "All %zu tracked files are as CWord left them!", report.tracked);
+        infoScreen(message);
+        freeStatusReport(&report);
+        return;
+    }
+
+    FILE *output = tmpfile();
+    if (output == NULL){
+        freeStatusReport(&report);
+        infoScreen("CWord couldn't create a temporary file!");
+        return;
+    }
+    printStatusSection(output, "Modified outside CWord", report.modified, report.modifiedCount);
+    printStatusSection(output, "Deleted outside CWord", report.deleted, report.deletedCount);
+    printStatusSection(output, "Untracked", report.untracked, report.untrackedCount);
+
+    char title[128];
+    sprintf(title, "Status of %zu tracked files (%zu read from disk):", report.tracked, report.hashed);
+    pageDiff(output, title);
+    fclose(output);
+    freeStatusReport(&report);
+}
@@ -0,0 +1,47 @@
+#ifndef STATUS_H
+#define STATUS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STATUS_CACHE_MAGIC "CWST"
+#define STATUS_CACHE_VERSION 1
+
+struct StatusCacheHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint64_t count;
+};
+
+// Written for every tracked file, followed by nameLength bytes of name
+struct StatusCacheEntry
+{
+    uint64_t size;
+    int64_t mtimeNanos;
+    uint64_t inode;
+    uint64_t logBytes;      // Changelog size when hash became the baseline
+    uint64_t hash;          // Contents as CWord last saw them
+    uint64_t baselineHash;  // Contents after the last change CWord recorded
+    uint32_t nameLength;
+    uint32_t present;       // 0 if the file was missing when scanned
+};
+
+struct StatusReport
+{
+    char **modified;
+    size_t modifiedCount;
+    char **deleted;         // Missing without a DELETED record
+    size_t deletedCount;
+    char **untracked;
+    size_t untrackedCount;
+    size_t tracked;
+    size_t hashed;          // Files whose stat data changed and had to be read
+};
+
+uint64_t hashFileContents(char *fileName, int *ok);
+int scanStatus(struct StatusReport *report);
+void freeStatusReport(struct StatusReport *report);
+void showStatus();
+
+#endif
@@ -0,0 +1,798 @@
+/**
+ * @file storage.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Where file contents are actually kept
+ * File and line operations and the active changelog go through a small interface (open, read a range, write,
+ * append, truncate, replace and stat) so the same code runs on plain POSIX calls, memory mapped reads or files
+ * held entirely in memory. The backend is picked by CWORD_STORAGE. The in memory one is only used by
+ * --benchmark-storage, as the changelog stream and index, compressed segments, packs and the Full Editor
+ * still read and write the disk directly
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "storage.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static struct StorageBackend *activeBackend = NULL;
+static pthread_once_t chooseOnce = PTHREAD_ONCE_INIT;
+
+/**
+ * @brief Picks the backend named by CWORD_STORAGE, POSIX unless it asks for mmap
+ *
+ */
+static void chooseBackend(){
+    activeBackend = &posixStorage;
+    char *name = getenv(STORAGE_BACKEND_VARIABLE);
+    // Files only in memory would be lost on exit, so that backend can't be picked from outside
+    if (name != NULL && strcmp(name, mmapStorage.name) == 0) activeBackend = &mmapStorage;
+}
+
+/**
+ * @brief The backend files are opened with
+ *
+ * @return struct StorageBackend* The backend
+ */
+struct StorageBackend * storageBackend(){
+    pthread_once(&chooseOnce, chooseBackend);
+    return activeBackend;
+}
+
+/**
+ * @brief Switches every later open to another backend, files already open keep theirs
+ *
+ * @param backend The backend to use
+ */
+void setStorageBackend(struct StorageBackend *backend){
+    pthread_once(&chooseOnce, chooseBackend);
+    activeBackend = backend;
+}
+
+/**
+ * @brief Opens a file with the active backend
+ *
+ * @param path The file
+ * @param mode A StorageMode
+ * @return struct StorageFile* The open file, NULL with errno set if it couldn't be opened
+ */
+struct StorageFile * storageOpen(const char *path, int mode){
+    return storageOpenWith(storageBackend(), path, mode);
+}
+
+/**
+ * @brief Opens a file with a particular backend
+ *
+ * @param backend The backend
+ * @param path The file
+ * @param mode A StorageMode
+ * @return struct StorageFile* The open file, NULL with errno set if it couldn't be opened
+ */
+struct StorageFile * storageOpenWith(struct StorageBackend *backend, const char *path, int mode){
+    struct StorageFile *file = calloc(1, sizeof(struct StorageFile));
+    if (file == NULL) return NULL;
+    file->backend = backend;
+    file->mode = mode;
+    if (backend->open(file, path, mode) != 0){
+        int error = errno;
+        free(file);
+        errno = error;
+        return NULL;
+    }
+    return file;
+}
+
+/**
+ * @brief Passes everything written so far to the backend
+ *
+ * @param file The file
+ * @return int 1 if ok, 0 if a write failed
+ */
+static int flushStorage(struct StorageFile *file){
+    size_t done = 0;
+    while (done < file->pendingLength){
+        ssize_t written = file->backend->write(file, file->pending + done, file->pendingLength - done);
+        if (written < 0){
+            if (errno == EINTR) continue;
+            file->failed = 1;
+            break;
+        }
+        done += written;
+    }
+    file->pendingLength = 0;
+    return file->failed == 0;
+}
+
+/**
+ * @brief Reads a range of a file, anything written to it first goes to the backend
+ *
+ * @param file The file
+ * @param buffer Where to put the bytes
+ * @param length How many to read at most
+ * @param offset Where from
+ * @return ssize_t How many were read, 0 at the end, -1 if reading failed
+ */
+ssize_t storageRead(struct StorageFile *file, void *buffer, size_t length, uint64_t offset){
+    if (file->pendingLength > 0) flushStorage(file);
+    ssize_t got;
+    do {
+        got = file->backend->read(file, buffer, length, offset);
+    } while (got < 0 && errno == EINTR);
+    return got;
+}
+
+/**
+ * @brief Writes to the end of a file, small writes are gathered so the backend sees few big ones
+ *
+ * @param file The file
+ * @param bytes What to write
+ * @param length How many bytes
+ * @return int 1 if ok, 0 if writing has failed
+ */
+int storageWrite(struct StorageFile *file, const void *bytes, size_t length){
+    if (file->failed) return 0;
+    if (file->pendingLength + length > STORAGE_BUFFER_SIZE && flushStorage(file) == 0) return 0;
+
+    if (length >= STORAGE_BUFFER_SIZE){
+        const char *next = bytes;
+        while (length > 0){
+            ssize_t written = file->backend->write(file, next, length);
+            if (written < 0){
+                if (errno == EINTR) continue;
+                file->failed = 1;
+                return 0;
+            }
+            next += written;
+            length -= written;
+        }
+        return 1;
+    }
+
+    if (file->pending == NULL && (file->pending = malloc(STORAGE_BUFFER_SIZE)) == NULL){
+        file->failed = 1;
+        return 0;
+    }
+    memcpy(file->pending + file->pendingLength, bytes, length);
+    file->pendingLength += length;
+    return 1;
+}
+
+/**
+ * @brief Writes a string to the end of a file
+ *
+ * @param file The file
+ * @param string What to write
+ * @return int 1 if ok, 0 if writing has failed
+ */
+int storageWriteString(struct StorageFile *file, const char *string){
+    return storageWrite(file, string, strlen(string));
+}
+
+/**
+ * @brief Cuts a file down (or pads it with zeros) to a length
+ *
+ * @param file The file, opened for updating
+ * @param length The new length
+ * @return int 1 if ok, 0 if not
+ */
+int storageTruncate(struct StorageFile *file, uint64_t length){
+    if (file->pendingLength > 0 && flushStorage(file) == 0) return 0;
+    return file->backend->truncate(file, length) == 0;
+}
+
+/**
+ * @brief How long a file is, including anything written to it
+ *
+ * @param file The file
+ * @return uint64_t The length, 0 if it couldn't be found
+ */
+uint64_t storageSize(struct StorageFile *file){
+    uint64_t size = 0;
+    if (file->pendingLength > 0) flushStorage(file);
+    if (file->backend->size(file, &size) != 0) return 0;
+    return size;
+}
+
+/**
+ * @brief Closes a file, anything still gathered is written first
+ *
+ * @param file The file, may be NULL
+ * @return int 1 if every write succeeded, 0 if any failed
+ */
+int storageClose(struct StorageFile *file){
+    if (file == NULL) return 0;
+    int ok = flushStorage(file);
+    if (file->backend->close(file) != 0) ok = 0;
+    free(file->pending);
+    free(file);
+    return ok;
+}
+
+/**
+ * @brief Looks up a files size, modification time and inode
+ *
+ * @param path The file
+ * @param info Filled in
+ * @return int 1 if it exists, 0 if not
+ */
+int storageStat(const char *path, struct StorageStat *info){
+    return storageBackend()->stat(path, info) == 0;
+}
+
+/**
+ * @brief Whether a file exists
+ *
+ * @param path The file
+ * @return int 1 if it does, 0 if not
+ */
+int storageExists(const char *path){
+    struct StorageStat info;
+    return storageStat(path, &info);
+}
+
+/**
+ * @brief Whether a file (or folder) can be read or written
+ *
+ * @param path The file
+ * @param write 1 to check for writing, 0 for reading
+ * @return int 1 if it can, 0 if not
+ */
+int storageAccess(const char *path, int write){
+    return storageBackend()->access(path, write) == 0;
+}
+
+/**
+ * @brief Puts one file in place of another in one step, so readers see all of the old or all of the new
+ *
+ * @param from The new contents
+ * @param to The file they replace
+ * @return int 1 if ok, 0 if not
+ */
+int storageReplace(const char *from, const char *to){
+    return storageBackend()->replace(from, to) == 0;
+}
+
+/**
+ * @brief Removes a file
+ *
+ * @param path The file
+ * @return int 1 if ok, 0 if not
+ */
+int storageRemove(const char *path){
+    return storageBackend()->remove(path) == 0;
+}
+
+/**
+ * @brief Starts reading the lines of a file
+ *
+ * @param reader The reader to setup
+ * @param file The file
+ * @param offset Where the first line starts
+ */
+void openLineReader(struct StorageLineReader *reader, struct StorageFile *file, uint64_t offset){
+    reader->file = file;
+    reader->offset = offset;
+    reader->buffer = NULL;
+    reader->start = 0;
+    reader->length = 0;
+    reader->capacity = 0;
+}
+
+/**
+ * @brief Reads the next line of a file. Backends that can view a file hand out the line where it lies,
+ * others read it in blocks. The line isn't \0 terminated and is only valid until the next is read
+ *
+ * @param reader The reader
+ * @param line Set to the start of the line
+ * @return ssize_t How long the line is including its \n, -1 at the end of the file or if reading failed
+ */
+ssize_t storageReadLine(struct StorageLineReader *reader, const char **line){
+    size_t available;
+    const char *bytes = reader->length == 0 ? reader->file->backend->view(reader->file, reader->offset, &available) : NULL;
+    if (bytes != NULL){
+        if (available == 0) return -1;
+        const char *newline = memchr(bytes, '\n', available);
+        size_t length = newline != NULL ? (size_t)(newline - bytes) + 1 : available;
+        *line = bytes;
+        reader->offset += length;
+        return length;
+    }
+
+    size_t searched = 0;
+    while (1){
+        char *start = reader->buffer + reader->start;
+        char *newline = reader->length > searched ? memchr(start + searched, '\n', reader->length - searched) : NULL;
+        if (newline != NULL){
+            size_t length = (newline - start) + 1;
+            *line = start;
+            reader->start += length;
+            reader->length -= length;
+            reader->offset += length;
+            return length;
+        }
+        searched = reader->length;
+
+        // Whatever is left moves to the front and the rest of the buffer is filled
+        if (reader->start > 0){
+            memmove(reader->buffer, start, reader->length);
+            reader->start = 0;
+        }
+        if (reader->length == reader->capacity){
+            size_t capacity = reader->capacity == 0 ? STORAGE_BUFFER_SIZE : reader->capacity * 2;
+            char *grown = realloc(reader->buffer, capacity);
+            if (grown == NULL) return -1;
+            reader->buffer = grown;
+            reader->capacity = capacity;
+        }
+        ssize_t got = storageRead(reader->file, reader->buffer + reader->length, reader->capacity - reader->length, reader->offset + reader->length);
+        if (got <= 0){
+            // A last line without a \n
+            if (reader->length == 0) return -1;
+            size_t length = reader->length;
+            *line = reader->buffer;
+            reader->length = 0;
+            reader->offset += length;
+            return length;
+        }
+        reader->length += got;
+    }
+}
+
+/**
+ * @brief Frees what a line reader holds, the file stays open
+ *
+ * @param reader The reader
+ */
+void closeLineReader(struct StorageLineReader *reader){
+    free(reader->buffer);
+    reader->buffer = NULL;
+}
+
+
+/*
+ * Buffered POSIX, every call goes straight to the file descriptor
+ */
+
+#define FILE_DESCRIPTOR(file) ((int)(intptr_t)(file)->handle)
+
+/**
+ * @brief Opens a file descriptor with the flags a StorageMode means
+ *
+ * @param path The file
+ * @param mode A StorageMode
+ * @return int The descriptor, -1 if it couldn't be opened
+ */
+static int openDescriptor(const char *path, int mode){
+    int flags = O_RDONLY;
+    if (mode == STORAGE_WRITE) flags = O_WRONLY | O_CREAT | O_TRUNC;
+    else if (mode == STORAGE_APPEND) flags = O_WRONLY | O_CREAT | O_APPEND;
+    else if (mode == STORAGE_UPDATE) flags = O_RDWR | O_APPEND;
+    int fd = open(path, flags | O_CLOEXEC, 0666);
+    if (fd != -1 && mode == STORAGE_READ) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return fd;
+}
+
+static int posixOpen(struct StorageFile *file, const char *path, int mode){
+    int fd = openDescriptor(path, mode);
+    if (fd == -1) return -1;
+    file->handle = (void *)(intptr_t)fd;
+    return 0;
+}
+
+static ssize_t posixRead(struct StorageFile *file, void *buffer, size_t length, uint64_t offset){
+    return pread(FILE_DESCRIPTOR(file), buffer, length, offset);
+}
+
+static const char * posixView(struct StorageFile *file, uint64_t offset, size_t *length){
+    return NULL;
+}
+
+static ssize_t posixWrite(struct StorageFile *file, const void *bytes, size_t length){
+    return write(FILE_DESCRIPTOR(file), bytes, length);
+}
+
+static int posixTruncate(struct StorageFile *file, uint64_t length){
+    return ftruncate(FILE_DESCRIPTOR(file), length);
+}
+
+static int posixSize(struct StorageFile *file, uint64_t *size){
+    struct stat info;
+    if (fstat(FILE_DESCRIPTOR(file), &info) != 0) return -1;
+    *size = info.st_size;
+    return 0;
+}
+
+static int posixClose(struct StorageFile *file){
+    return close(FILE_DESCRIPTOR(file));
+}
+
+static int posixStat(const char *path, struct StorageStat *info){
+    struct stat status;
+    if (stat(path, &status) != 0) return -1;
+    info->size = status.st_size;
+    info->mtimeNanos = (int64_t)status.st_mtim.tv_sec * 1000000000 + status.st_mtim.tv_nsec;
+    info->inode = status.st_ino;
+    return 0;
+}
+
+static int posixAccess(const char *path, int write){
+    return access(path, write ? W_OK : R_OK);
+}
+
+static int posixReplace(const char *from, const char *to){
+    return rename(from, to);
+}
+
+static int posixRemove(const char *path){
+    return remove(path);
+}
+
+struct StorageBackend posixStorage = {
+    "posix", posixOpen, posixRead, posixView, posixWrite, posixTruncate, posixSize, posixClose,
+    posixStat, posixAccess, posixReplace, posixRemove
+};
+
+
+/*
+ * mmap, files opened for reading are mapped so lines are read where they lie, writes are POSIX
+ */
+
+struct MappedFile
+{
+    int fd;
+    char *map;              // NULL when empty or it couldn't be mapped
+    size_t length;
+    int mapped;             // 0 if mapping failed, reads then go to the descriptor
+};
+
+static int mmapOpen(struct StorageFile *file, const char *path, int mode){
+    struct MappedFile *mapped = calloc(1, sizeof(struct MappedFile));
+    if (mapped == NULL) return -1;
+    mapped->fd = openDescriptor(path, mode);
+    if (mapped->fd == -1){
+        free(mapped);
+        return -1;
+    }
+
+    struct stat info;
+    if (mode == STORAGE_READ && fstat(mapped->fd, &info) == 0 && S_ISREG(info.st_mode)){
+        mapped->mapped = 1;
+        if (info.st_size > 0){
+            mapped->map = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, mapped->fd, 0);
+            if (mapped->map == MAP_FAILED){
+                mapped->map = NULL;
+                mapped->mapped = 0;
+            } else {
+                mapped->length = info.st_size;
+                madvise(mapped->map, mapped->length, MADV_SEQUENTIAL);
+            }
+        }
+    }
+    file->handle = mapped;
+    return 0;
+}
+
+static ssize_t mmapRead(struct StorageFile *file, void *buffer, size_t length, uint64_t offset){
+    struct MappedFile *mapped = file->handle;
+    if (mapped->mapped == 0) return pread(mapped->fd, buffer, length, offset);
+    if (offset >= mapped->length) return 0;
+    if (length > mapped->length - offset) length = mapped->length - offset;
+    memcpy(buffer, mapped->map + offset, length);
+    return length;
+}
+
+static const char * mmapView(struct StorageFile *file, uint64_t offset, size_t *length){
+    struct MappedFile *mapped = file->handle;
+    if (mapped->mapped == 0) return NULL;
+    if (offset >= mapped->length){
+        *length = 0;
+        return "";
+    }
+    *length = mapped->length - offset;
+    return mapped->map + offset;
+}
+
+static ssize_t mmapWrite(struct StorageFile *file, const void *bytes, size_t length){
+    return write(((struct MappedFile *)file->handle)->fd, bytes, length);
+}
+
+static int mmapTruncate(struct StorageFile *file, uint64_t length){
+    return ftruncate(((struct MappedFile *)file->handle)->fd, length);
+}
+
+static int mmapSize(struct StorageFile *file, uint64_t *size){
+    struct MappedFile *mapped = file->handle;
+    // A mapped file is read as it was when opened
+    if (mapped->mapped){
+        *size = mapped->length;
+        return 0;
+    }
+    struct stat info;
+    if (fstat(mapped->fd, &info) != 0) return -1;
+    *size = info.st_size;
+    return 0;
+}
+
+static int mmapClose(struct StorageFile *file){
+    struct MappedFile *mapped = file->handle;
+    if (mapped->map != NULL) munmap(mapped->map, mapped->length);
+    int result = close(mapped->fd);
+    free(mapped);
+    return result;
+}
+
+struct StorageBackend mmapStorage = {
+    "mmap", mmapOpen, mmapRead, mmapView, mmapWrite, mmapTruncate, mmapSize, mmapClose,
+    posixStat, posixAccess, posixReplace, posixRemove
+};
+
+
+/*
+ * In memory, files are named buffers that never touch the disk. Folders are still the real ones
+ */
+
+struct MemoryFile
+{
+    char *path;
+    char *data;
+    size_t length;
+    size_t capacity;
+    int64_t mtimeNanos;
+    uint64_t inode;
+    int references;         // Open handles, a removed file is freed once there are none
+    int removed;
+};
+
+static struct
+{
+    pthread_mutex_t lock;
+    struct MemoryFile **files;
+    size_t count;
+    size_t capacity;
+    uint64_t nextInode;
+} memoryFiles = {PTHREAD_MUTEX_INITIALIZER, NULL, 0, 0, 1};
+
+static int64_t memoryClock(){
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @brief Finds a file by name, the lock must be held
+ *
+ * @param path The file
+ * @return size_t Where it is in the table, the count if it isn't there
+ */
+static size_t findMemoryFile(const char *path){
+    size_t i;
+    for (i = 0; i < memoryFiles.count; i++){
+        if (strcmp(memoryFiles.files[i]->path, path) == 0) break;
+    }
+    return i;
+}
+
+/**
+ * @brief Takes a file out of the table, freeing it unless it is still open. The lock must be held
+ *
+ * @param index Where it is in the table
+ */
+static void dropMemoryFile(size_t index){
+    struct MemoryFile *dropped = memoryFiles.files[index];
+    memoryFiles.files[index] = memoryFiles.files[--memoryFiles.count];
+    dropped->removed = 1;
+    if (dropped->references == 0){
+        free(dropped->path);
+        free(dropped->data);
+        free(dropped);
+    }
+}
+
+static int memoryOpen(struct StorageFile *file, const char *path, int mode){
+    pthread_mutex_lock(&memoryFiles.lock);
+    size_t index = findMemoryFile(path);
+    struct MemoryFile *opened = index < memoryFiles.count ? memoryFiles.files[index] : NULL;
+
+    if (opened == NULL){
+        if (mode == STORAGE_READ || mode == STORAGE_UPDATE){
+            pthread_mutex_unlock(&memoryFiles.lock);
+            errno = ENOENT;
+            return -1;
+        }
+        if (memoryFiles.count == memoryFiles.capacity){
+            size_t capacity = memoryFiles.capacity == 0 ? 16 : memoryFiles.capacity * 2;
+            struct MemoryFile **grown = realloc(memoryFiles.files, capacity * sizeof(struct MemoryFile *));
+            if (grown == NULL){
+                pthread_mutex_unlock(&memoryFiles.lock);
+                errno = ENOMEM;
+                return -1;
+            }
+            memoryFiles.files = grown;
+            memoryFiles.capacity = capacity;
+        }
+        opened = calloc(1, sizeof(struct MemoryFile));
+        if (opened == NULL || (opened->path = strdup(path)) == NULL){
+            free(opened);
+            pthread_mutex_unlock(&memoryFiles.lock);
+            errno = ENOMEM;
+            return -1;
+        }
+        opened->inode = memoryFiles.nextInode++;
+        opened->mtimeNanos = memoryClock();
+        memoryFiles.files[memoryFiles.count++] = opened;
+    }
+    if (mode == STORAGE_WRITE){
+        opened->length = 0;
+        opened->mtimeNanos = memoryClock();
+    }
+    opened->references++;
+    pthread_mutex_unlock(&memoryFiles.lock);
+    file->handle = opened;
+    return 0;
+}
+
+static ssize_t memoryRead(struct StorageFile *file, void *buffer, size_t length, uint64_t offset){
+    struct MemoryFile *opened = file->handle;
+    pthread_mutex_lock(&memoryFiles.lock);
+    if (offset >= opened->length) length = 0;
+    else if (length > opened->length - offset) length = opened->length - offset;
+    if (length > 0) memcpy(buffer, opened->data + offset, length);
+    pthread_mutex_unlock(&memoryFiles.lock);
+    return length;
+}
+
+static const char * memoryView(struct StorageFile *file, uint64_t offset, size_t *length){
+    struct MemoryFile *opened = file->handle;
+    // Only valid until the file is next written, which is all a line reader needs
+    pthread_mutex_lock(&memoryFiles.lock);
+    const char *bytes = "";
+    *length = 0;
+    if (offset < opened->length){
+        bytes = opened->data + offset;
+        *length = opened->length - offset;
+    }
+    pthread_mutex_unlock(&memoryFiles.lock);
+    return bytes;
+}
+
+static ssize_t memoryWrite(struct StorageFile *file, const void *bytes, size_t length){
+    struct MemoryFile *opened = file->handle;
+    pthread_mutex_lock(&memoryFiles.lock);
+    if (opened->length + length > opened->capacity){
+        size_t capacity = opened->capacity == 0 ? 4096 : opened->capacity;
+        while (capacity < opened->length + length) capacity *= 2;
+        char *grown = realloc(opened->data, capacity);
+        if (grown == NULL){
+            pthread_mutex_unlock(&memoryFiles.lock);
+            errno = ENOSPC;
+            return -1;
+        }
+        opened->data = grown;
+        opened->capacity = capacity;
+    }
+    memcpy(opened->data + opened->length, bytes, length);
+    opened->length += length;
+    opened->mtimeNanos = memoryClock();
+    pthread_mutex_unlock(&memoryFiles.lock);
+    return length;
+}
+
+static int memoryTruncate(struct StorageFile *file, uint64_t length){
+    struct MemoryFile *opened = file->handle;
+    pthread_mutex_lock(&memoryFiles.lock);
+    if (length > opened->length){
+        char *grown = realloc(opened->data, length);
+        if (grown == NULL){
+            pthread_mutex_unlock(&memoryFiles.lock);
+            errno = ENOSPC;
+            return -1;
+        }
+        memset(grown + opened->length, 0, length - opened->length);
+        opened->data = grown;
+        opened->capacity = length;
+    }
+    opened->length = length;
+    opened->mtimeNanos = memoryClock();
+    pthread_mutex_unlock(&memoryFiles.lock);
+    return 0;
+}
+
+static int memorySize(struct StorageFile *file, uint64_t *size){
+    pthread_mutex_lock(&memoryFiles.lock);
+    *size = ((struct MemoryFile *)file->handle)->length;
+    pthread_mutex_unlock(&memoryFiles.lock);
+    return 0;
+}
+
+static int memoryClose(struct StorageFile *file){
+    struct MemoryFile *opened = file->handle;
+    pthread_mutex_lock(&memoryFiles.lock);
+    if (--opened->references == 0 && opened->removed){
+        free(opened->path);
+        free(opened->data);
+        free(opened);
+    }
+    pthread_mutex_unlock(&memoryFiles.lock);
+    return 0;
+}
+
+static int memoryStat(const char *path, struct StorageStat *info){
+    pthread_mutex_lock(&memoryFiles.lock);
+    size_t index = findMemoryFile(path);
+    int found = index < memoryFiles.count;
+    if (found){
+        info->size = memoryFiles.files[index]->length;
+        info->mtimeNanos = memoryFiles.files[index]->mtimeNanos;
+        info->inode = memoryFiles.files[index]->inode;
+    }
+    pthread_mutex_unlock(&memoryFiles.lock);
+    if (found) return 0;
+
+    // Folders are the real ones
+    struct stat folder;
+    if (stat(path, &folder) == 0 && S_ISDIR(folder.st_mode)) return posixStat(path, info);
+    errno = ENOENT;
+    return -1;
+}
+
+static int memoryAccess(const char *path, int write){
+    struct StorageStat info;
+    if (memoryStat(path, &info) != 0) return -1;
+    // Whether a file can be made in a folder is still up to the real one
+    struct stat folder;
+    if (stat(path, &folder) == 0 && S_ISDIR(folder.st_mode)) return access(path, write ? W_OK : R_OK);
+    return 0;
+}
+
+static int memoryReplace(const char *from, const char *to){
+    pthread_mutex_lock(&memoryFiles.lock);
+    size_t index = findMemoryFile(from);
+    if (index == memoryFiles.count){
+        pthread_mutex_unlock(&memoryFiles.lock);
+        errno = ENOENT;
+        return -1;
+    }
+    char *path = strdup(to);
+    if (path == NULL){
+        pthread_mutex_unlock(&memoryFiles.lock);
+        errno = ENOMEM;
+        return -1;
+    }
+    struct MemoryFile *moved = memoryFiles.files[index];
+    size_t replaced = findMemoryFile(to);
+    if (replaced < memoryFiles.count && memoryFiles.files[replaced] != moved) dropMemoryFile(replaced);
+    free(moved->path);
+    moved->path = path;
+    pthread_mutex_unlock(&memoryFiles.lock);
+    return 0;
+}
+
+static int memoryRemove(const char *path){
+    pthread_mutex_lock(&memoryFiles.lock);
+    size_t index = findMemoryFile(path);
+    int found = index < memoryFiles.count;
+    if (found) dropMemoryFile(index);
+    pthread_mutex_unlock(&memoryFiles.lock);
+    if (found) return 0;
+    errno = ENOENT;
+    return -1;
+}
+
+struct StorageBackend memoryStorage = {
+    "memory", memoryOpen, memoryRead, memoryView, memoryWrite, memoryTruncate, memorySize, memoryClose,
+    memoryStat, memoryAccess, memoryReplace, memoryRemove
+};
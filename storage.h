@@ -0,0 +1,96 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Picks the backend at startup, "posix" (the default) or "mmap"
+#define STORAGE_BACKEND_VARIABLE "CWORD_STORAGE"
+// Writes are gathered up to this much before going to the backend, and lines read this much at a time
+#define STORAGE_BUFFER_SIZE (64 * 1024)
+
+enum StorageMode
+{
+    STORAGE_READ = 0,       // An existing file, read only
+    STORAGE_WRITE,          // Created or emptied, then written from the start
+    STORAGE_APPEND,         // Created if missing, every write goes on the end
+    STORAGE_UPDATE          // An existing file, read, appended to and truncated
+};
+
+struct StorageStat
+{
+    uint64_t size;
+    int64_t mtimeNanos;
+    uint64_t inode;
+};
+
+struct StorageBackend;
+
+struct StorageFile
+{
+    struct StorageBackend *backend;
+    void *handle;           // The backends own state for the file
+    int mode;
+    char *pending;          // Written but not yet passed to the backend
+    size_t pendingLength;
+    int failed;             // Set once a write fails, closing then reports it
+};
+
+// Every backend provides all of these, returning -1/0 on failure with errno set like the POSIX calls
+struct StorageBackend
+{
+    const char *name;
+    int (*open)(struct StorageFile *file, const char *path, int mode);
+    ssize_t (*read)(struct StorageFile *file, void *buffer, size_t length, uint64_t offset);
+    // The bytes from offset to the end without copying them, NULL if the backend can't
+    const char * (*view)(struct StorageFile *file, uint64_t offset, size_t *length);
+    ssize_t (*write)(struct StorageFile *file, const void *bytes, size_t length);
+    int (*truncate)(struct StorageFile *file, uint64_t length);
+    int (*size)(struct StorageFile *file, uint64_t *size);
+    int (*close)(struct StorageFile *file);
+    int (*stat)(const char *path, struct StorageStat *info);
+    int (*access)(const char *path, int write);
+    int (*replace)(const char *from, const char *to);
+    int (*remove)(const char *path);
+};
+
+// Reads a file a line at a time, the lines are only valid until the next is read
+struct StorageLineReader
+{
+    struct StorageFile *file;
+    uint64_t offset;        // Where the next line starts
+    char *buffer;           // Only used when the backend has no view
+    size_t start;
+    size_t length;
+    size_t capacity;
+    uint64_t bufferOffset;
+};
+
+extern struct StorageBackend posixStorage;
+extern struct StorageBackend mmapStorage;
+extern struct StorageBackend memoryStorage;
+
+struct StorageBackend * storageBackend();
+void setStorageBackend(struct StorageBackend *backend);
+
+struct StorageFile * storageOpen(const char *path, int mode);
+struct StorageFile * storageOpenWith(struct StorageBackend *backend, const char *path, int mode);
+ssize_t storageRead(struct StorageFile *file, void *buffer, size_t length, uint64_t offset);
+int storageWrite(struct StorageFile *file, const void *bytes, size_t length);
+int storageWriteString(struct StorageFile *file, const char *string);
+int storageTruncate(struct StorageFile *file, uint64_t length);
+uint64_t storageSize(struct StorageFile *file);
+int storageClose(struct StorageFile *file);
+
+int storageStat(const char *path, struct StorageStat *info);
+int storageExists(const char *path);
+int storageAccess(const char *path, int write);
+int storageReplace(const char *from, const char *to);
+int storageRemove(const char *path);
+
+void openLineReader(struct StorageLineReader *reader, struct StorageFile *file, uint64_t offset);
+ssize_t storageReadLine(struct StorageLineReader *reader, const char **line);
+void closeLineReader(struct StorageLineReader *reader);
+
+#endif
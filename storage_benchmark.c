@@ -0,0 +1,135 @@
+/**
+ * @file storage_benchmark.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Times the file and line operations on every storage backend
+ * The same generated file is written, counted, read, edited and copied on each backend in turn. Only the
+ * internal operations are used so nothing is recorded in a changelog, under the in memory backend the disk
+ * is never touched at all
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#include "storage_benchmark.h"
+#include "storage.h"
+#include "file_operations.h"
+#include "line_operations.h"
+#include "trace.h"
+#include "utils.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BENCHMARK_OPERATIONS 8
+
+static const char *operationNames[BENCHMARK_OPERATIONS] = {
+    "Write", "Count lines", "Read middle line", "Insert line", "Replace line", "Delete line", "Delete last 10", "Copy"
+};
+
+/**
+ * @brief Writes the file every backend is timed on
+ *
+ * @param fileName The file
+ * @param lines How many lines
+ * @return uint64_t The bytes written, 0 if it couldn't be
+ */
+static uint64_t writeBenchmarkFile(char *fileName, size_t lines){
+    struct StorageFile *file = storageOpen(fileName, STORAGE_WRITE);
+    if (file == NULL) return 0;
+    char line[96];
+    uint64_t bytes = 0;
+    size_t i;
+    for (i = 1; i <= lines; i++){
+        // Varying lengths so lines don't all sit at the same place in a block
+        int length = sprintf(line, "Line %zu of the storage benchmark %.*s\n", i, (int)(i % 40), "........................................");
+        storageWrite(file, line, length);
+        bytes += length;
+    }
+    return storageClose(file) ? bytes : 0;
+}
+
+/**
+ * @brief Runs every operation on one backend
+ *
+ * @param backend The backend
+ * @param lines How many lines the file has
+ * @param seconds Filled with how long each operation took
+ * @param bytes Set to the size of the file
+ * @return int 1 if ok, 0 if the file couldn't be written
+ */
+static int benchmarkBackend(struct StorageBackend *backend, size_t lines, double *seconds, uint64_t *bytes){
+    setStorageBackend(backend);
+    char *fileName = concat3("benchmark.", (char *)backend->name, ".cword.txt");
+    char *copyName = concat3("benchmark.", (char *)backend->name, ".copy.cword.txt");
+    int middle = lines / 2 + 1;
+
+    int operation, ok = 1;
+    for (operation = 0; operation < BENCHMARK_OPERATIONS && ok; operation++){
+        uint64_t start = traceClock();
+        switch (operation){
+            case 0:
+                *bytes = writeBenchmarkFile(fileName, lines);
+                ok = *bytes != 0;
+                break;
+            case 1:
+                fileLines(fileName);
+                break;
+            case 2:
+                free(getLineNOfFile(fileName, middle));
+                break;
+            case 3:
+                internalInsertLine(fileName, middle, "An inserted line\n");
+                break;
+            case 4:
+                internalReplaceLine(fileName, middle, "A replaced line\n");
+                break;
+            case 5:
+                internalDeleteLine(fileName, middle);
+                break;
+            case 6:
+                deleteLastNLinesOfFile(fileName, 10);
+                break;
+            case 7:
+                internalCopyFile(fileName, copyName);
+                break;
+        }
+        seconds[operation] = (traceClock() - start) / 1000000000.0;
+    }
+
+    storageRemove(fileName);
+    storageRemove(copyName);
+    free(fileName);
+    free(copyName);
+    return ok;
+}
+
+/**
+ * @brief Times the operations on the POSIX, mmap and in memory backends side by side
+ *
+ * @param lines How many lines the file has
+ * @param out Where to write the table
+ * @return int 1 if ok, 0 if a backend couldn't write the file
+ */
+int benchmarkStorage(size_t lines, FILE *out){
+    struct StorageBackend *backends[3] = {&posixStorage, &mmapStorage, &memoryStorage};
+    struct StorageBackend *previous = storageBackend();
+    double seconds[3][BENCHMARK_OPERATIONS];
+    uint64_t bytes = 0;
+    int i, ok = 1;
+    for (i = 0; i < 3 && ok; i++) ok = benchmarkBackend(backends[i], lines, seconds[i], &bytes);
+    setStorageBackend(previous);
+    if (ok == 0) return 0;
+
+    fprintf(out, "Storage benchmark, %zu lines (%.1fMB)\n\n%-18s", lines, bytes / (1024.0 * 1024.0), "");
+    for (i = 0; i < 3; i++) fprintf(out, "%10s", backends[i]->name);
+    fprintf(out, "\n");
+    int operation;
+    for (operation = 0; operation < BENCHMARK_OPERATIONS; operation++){
+        fprintf(out, "%-18s", operationNames[operation]);
+        for (i = 0; i < 3; i++) fprintf(out, "%9.3fs", seconds[i][operation]);
+        fprintf(out, "\n");
+    }
+    return 1;
+}
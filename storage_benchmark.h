@@ -0,0 +1,12 @@
+#ifndef STORAGE_BENCHMARK_H
+#define STORAGE_BENCHMARK_H
+
+#include <stdio.h>
+#include <stddef.h>
+
+// Lines written to the benchmark file when no count is given
+#define STORAGE_BENCHMARK_LINES 1000000
+
+int benchmarkStorage(size_t lines, FILE *out);
+
+#endif
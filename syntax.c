@@ -0,0 +1,572 @@
+/**
+ * @file syntax.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Syntax highlighting for the full editor
+ * A table driven lexer with the lexer state at the start of every line cached,
+ * so an edit only re-lexes lines until their start state stops changing
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#include "syntax.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include <ncurses.h>
+
+static struct SyntaxLanguage languages[] = {
+    {
+        "C/C++",
+        {".c", ".h", ".cpp", ".hpp", ".cc", ".cxx", ".hh", NULL},
+        "//", "/*", "*/",
+        {"if", "else", "for", "while", "do", "switch", "case", "default", "break", "continue", "return", "goto",
+         "sizeof", "typedef", "struct", "union", "enum", "static", "extern", "const", "volatile", "inline",
+         "register", "class", "public", "private", "protected", "virtual", "template", "typename", "namespace",
+         "using", "new", "delete", "this", "true", "false", "nullptr", "try", "catch", "throw", "operator",
+         "friend", "constexpr", "override", "NULL", NULL},
+        {"int", "long", "short", "char", "float", "double", "void", "unsigned", "signed", "bool", "auto",
+         "size_t", "ssize_t", "off_t", "FILE", "wchar_t", "int8_t", "int16_t", "int32_t", "int64_t",
+         "uint8_t", "uint16_t", "uint32_t", "uint64_t", NULL},
+        SYNTAX_NUMBERS | SYNTAX_STRINGS | SYNTAX_PREPROCESSOR
+    },
+    {
+        "JSON",
+        {".json", NULL},
+        NULL, NULL, NULL,
+        {"true", "false", "null", NULL},
+        {NULL},
+        SYNTAX_NUMBERS | SYNTAX_STRINGS | SYNTAX_OBJECT_KEYS
+    },
+    {
+        "Markdown",
+        {".md", ".markdown", NULL},
+        NULL, NULL, NULL,
+        {NULL},
+        {NULL},
+        SYNTAX_MARKDOWN
+    }
+};
+
+#define LANGUAGE_COUNT (sizeof(languages) / sizeof(languages[0]))
+
+/**
+ * @brief Picks the language to highlight a file with from its extension
+ *
+ * @param fileName The file
+ * @return struct SyntaxLanguage* The language, NULL for plain text
+ */
+struct SyntaxLanguage * syntaxLanguageForFile(char *fileName){
+    char *extension = strrchr(fileName, '.');
+    if (extension == NULL) return NULL;
+
+    size_t i;
+    int j;
+    for (i = 0; i < LANGUAGE_COUNT; i++){
+        for (j = 0; languages[i].extensions[j] != NULL; j++){
+            if (strcasecmp(extension, languages[i].extensions[j]) == 0) return &languages[i];
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Cycles through the languages, plain text coming after the last one
+ *
+ * @param language The current language, NULL for plain text
+ * @return struct SyntaxLanguage* The next language
+ */
+struct SyntaxLanguage * nextSyntaxLanguage(struct SyntaxLanguage *language){
+    if (language == NULL) return &languages[0];
+    size_t next = (language - languages) + 1;
+    return next < LANGUAGE_COUNT ? &languages[next] : NULL;
+}
+
+/**
+ * @brief Checks if a character ends a word
+ *
+ * @param c The character
+ * @return int 1 if it separates words, 0 if not
+ */
+static int isSeparator(int c){
+    return isspace(c) || c == '\0' || strchr(",.()+-/*=~%<>[];{}:!&|^?\"'", c) != NULL;
+}
+
+/**
+ * @brief Checks if text starts with a prefix
+ *
+ * @param line The text
+ * @param length Bytes left in the text
+ * @param prefix The prefix, may be NULL
+ * @return size_t The length of the prefix if it matched, 0 if not
+ */
+static size_t startsWith(const char *line, size_t length, const char *prefix){
+    // Nearly every call fails on the first byte, so that is checked before measuring the prefix
+    if (prefix == NULL || length == 0 || *line != *prefix) return 0;
+    size_t prefixLength = strlen(prefix);
+    if (prefixLength > length || strncmp(line, prefix, prefixLength) != 0) return 0;
+    return prefixLength;
+}
+
+/**
+ * @brief Marks a range of bytes with a class
+ *
+ * @param classes The classes, may be NULL when only the state is wanted
+ * @param from First byte
+ * @param to One past the last byte
+ * @param class The class to mark
+ */
+static void mark(unsigned char *classes, size_t from, size_t to, unsigned char class){
+    if (classes != NULL && to > from) memset(classes + from, class, to - from);
+}
+
+/**
+ * @brief Finds the closing delimiter of an inline Markdown span
+ *
+ * @param line The line
+ * @param length Its length
+ * @param from Where to start looking
+ * @param delimiter The closing delimiter
+ * @return size_t The position of the delimiter, length if it isn't closed
+ */
+static size_t findClosing(const char *line, size_t length, size_t from, const char *delimiter){
+    size_t i;
+    for (i = from; i < length; i++){
+        if (startsWith(line + i, length - i, delimiter)) return i;
+    }
+    return length;
+}
+
+/**
+ * @brief Lexes a Markdown line, only fenced code blocks carry on between lines
+ *
+ * @param state The state at the start of the line
+ * @param line The line
+ * @param length Its length
+ * @param classes Filled with a class per byte, may be NULL
+ * @return unsigned char The state at the start of the next line
+ */
+static unsigned char lexMarkdownLine(unsigned char state, const char *line, size_t length, unsigned char *classes){
+    size_t start = 0;
+    while (start < length && start < 3 && line[start] == ' ') start++;
+
+    if (startsWith(line + start, length - start, "```") || startsWith(line + start, length - start, "~~~")){
+        mark(classes, 0, length, SYNTAX_CODE);
+        return state == SYNTAX_STATE_CODE_FENCE ? SYNTAX_STATE_NORMAL : SYNTAX_STATE_CODE_FENCE;
+    }
+    if (state == SYNTAX_STATE_CODE_FENCE){
+        mark(classes, 0, length, SYNTAX_CODE);
+        return state;
+    }
+    if (classes == NULL) return SYNTAX_STATE_NORMAL;
+
+    if (start < length && line[start] == '#'){
+        mark(classes, 0, length, SYNTAX_HEADING);
+        return SYNTAX_STATE_NORMAL;
+    }
+    if (start < length && line[start] == '>'){
+        mark(classes, 0, length, SYNTAX_COMMENT);
+        return SYNTAX_STATE_NORMAL;
+    }
+
+    // List markers
+    size_t i = start;
+    if (i + 1 < length && strchr("-*+", line[i]) != NULL && line[i + 1] == ' '){
+        mark(classes, i, i + 1, SYNTAX_KEYWORD);
+        i += 2;
+    } else {
+        size_t digits = i;
+        while (digits < length && isdigit((unsigned char)line[digits])) digits++;
+        if (digits > i && digits + 1 < length && line[digits] == '.' && line[digits + 1] == ' '){
+            mark(classes, i, digits + 1, SYNTAX_KEYWORD);
+            i = digits + 2;
+        }
+    }
+
+    while (i < length){
+        char c = line[i];
+        if (c == '`'){
+            size_t end = findClosing(line, length, i + 1, "`");
+            size_t stop = end < length ? end + 1 : length;
+            mark(classes, i, stop, SYNTAX_CODE);
+            i = stop;
+        } else if ((c == '*' || c == '_') && i + 1 < length && line[i + 1] != ' '){
+            const char *delimiter = (i + 1 < length && line[i + 1] == c) ? (c == '*' ? "**" : "__") : (c == '*' ? "*" : "_");
+            size_t open = strlen(delimiter);
+            size_t end = findClosing(line, length, i + open, delimiter);
+            if (end == length){
+                i++;
+                continue;
+            }
+            mark(classes, i, end + open, SYNTAX_EMPHASIS);
+            i = end + open;
+        } else if (c == ']' && i + 1 < length && line[i + 1] == '('){
+            size_t end = findClosing(line, length, i + 2, ")");
+            size_t stop = end < length ? end + 1 : length;
+            mark(classes, i + 1, stop, SYNTAX_STRING);
+            i = stop;
+        } else {
+            i++;
+        }
+    }
+    return SYNTAX_STATE_NORMAL;
+}
+
+/**
+ * @brief Lexes a single line using the rules of the language
+ *
+ * @param language The language, NULL for plain text
+ * @param state The state at the start of the line
+ * @param line The line, without its \n
+ * @param length Its length
+ * @param classes Filled with a class per byte, may be NULL when only the exit state is wanted
+ * @return unsigned char The state at the start of the next line
+ */
+unsigned char lexLine(struct SyntaxLanguage *language, unsigned char state, const char *line, size_t length, unsigned char *classes){
+    mark(classes, 0, length, SYNTAX_NORMAL);
+    if (language == NULL) return SYNTAX_STATE_NORMAL;
+    if (language->flags & SYNTAX_MARKDOWN) return lexMarkdownLine(state, line, length, classes);
+
+    unsigned char defaultClass = SYNTAX_NORMAL;
+    if (state == SYNTAX_STATE_NORMAL && (language->flags & SYNTAX_PREPROCESSOR)){
+        size_t first = 0;
+        while (first < length && isspace((unsigned char)line[first])) first++;
+        if (first < length && line[first] == '#') defaultClass = SYNTAX_PREPROCESSOR_LINE;
+    }
+
+    size_t i = 0, stringStart = 0;
+    char quote = '"';
+    int previousSeparator = 1, continued = 0;
+    unsigned char previousClass = SYNTAX_NORMAL;
+
+    while (i < length){
+        char c = line[i];
+
+        if (state == SYNTAX_STATE_BLOCK_COMMENT){
+            size_t end = startsWith(line + i, length - i, language->blockCommentEnd);
+            if (end){
+                mark(classes, i, i + end, SYNTAX_COMMENT);
+                i += end;
+                state = SYNTAX_STATE_NORMAL;
+                previousSeparator = 1;
+                continue;
+            }
+            mark(classes, i, i + 1, SYNTAX_COMMENT);
+            i++;
+            continue;
+        }
+
+        if (state == SYNTAX_STATE_STRING){
+            mark(classes, i, i + 1, SYNTAX_STRING);
+            if (c == '\\'){
+                if (i + 1 == length) continued = 1;
+                mark(classes, i, i + 2 <= length ? i + 2 : length, SYNTAX_STRING);
+                i += 2;
+                continue;
+            }
+            i++;
+            if (c == quote){
+                state = SYNTAX_STATE_NORMAL;
+                previousSeparator = 1;
+                previousClass = SYNTAX_STRING;
+
+                // A string followed by : is an object key
+                if (language->flags & SYNTAX_OBJECT_KEYS){
+                    size_t next = i;
+                    while (next < length && isspace((unsigned char)line[next])) next++;
+                    if (next < length && line[next] == ':') mark(classes, stringStart, i, SYNTAX_KEYWORD);
+                }
+            }
+            continue;
+        }
+
+        size_t matched = startsWith(line + i, length - i, language->lineComment);
+        if (matched){
+            mark(classes, i, length, SYNTAX_COMMENT);
+            break;
+        }
+        matched = startsWith(line + i, length - i, language->blockCommentStart);
+        if (matched){
+            mark(classes, i, i + matched, SYNTAX_COMMENT);
+            i += matched;
+            state = SYNTAX_STATE_BLOCK_COMMENT;
+            continue;
+        }
+
+        if ((language->flags & SYNTAX_STRINGS) && (c == '"' || c == '\'')){
+            state = SYNTAX_STATE_STRING;
+            quote = c;
+            stringStart = i;
+            mark(classes, i, i + 1, SYNTAX_STRING);
+            i++;
+            continue;
+        }
+
+        // Numbers, keywords and types never change the state carried to the next line
+        if (classes == NULL){
+            i++;
+            continue;
+        }
+
+        if (language->flags & SYNTAX_NUMBERS){
+            int digit = isdigit((unsigned char)c);
+            if ((digit && (previousSeparator || previousClass == SYNTAX_NUMBER))
+                || (previousClass == SYNTAX_NUMBER && (c == '.' || isalnum((unsigned char)c)))){
+                mark(classes, i, i + 1, SYNTAX_NUMBER);
+                previousClass = SYNTAX_NUMBER;
+                previousSeparator = 0;
+                i++;
+                continue;
+            }
+        }
+
+        if (previousSeparator){
+            int found = 0, j;
+            for (j = 0; language->keywords[j] != NULL && found == 0; j++){
+                size_t keyword = startsWith(line + i, length - i, language->keywords[j]);
+                if (keyword && (i + keyword == length || isSeparator((unsigned char)line[i + keyword]))){
+                    mark(classes, i, i + keyword, SYNTAX_KEYWORD);
+                    i += keyword;
+                    found = 1;
+                }
+            }
+            for (j = 0; language->types[j] != NULL && found == 0; j++){
+                size_t type = startsWith(line + i, length - i, language->types[j]);
+                if (type && (i + type == length || isSeparator((unsigned char)line[i + type]))){
+                    mark(classes, i, i + type, SYNTAX_TYPE);
+                    i += type;
+                    found = 1;
+                }
+            }
+            if (found){
+                previousSeparator = 0;
+                previousClass = SYNTAX_KEYWORD;
+                continue;
+            }
+        }
+
+        mark(classes, i, i + 1, defaultClass);
+        previousSeparator = isSeparator((unsigned char)c);
+        previousClass = defaultClass;
+        i++;
+    }
+
+    // Strings only carry on to the next line after a trailing backslash
+    if (state == SYNTAX_STATE_STRING && continued == 0) state = SYNTAX_STATE_NORMAL;
+    return state;
+}
+
+/**
+ * @brief Sets up an empty cache, only the first lines start state is known
+ *
+ * @param cache The cache
+ * @param language The language to highlight with, NULL for plain text
+ */
+void initSyntaxCache(struct SyntaxCache *cache, struct SyntaxLanguage *language){
+    memset(cache, 0, sizeof(*cache));
+    cache->language = language;
+    cache->capacity = 64;
+    cache->entryStates = malloc(cache->capacity);
+    cache->entryStates[0] = SYNTAX_STATE_NORMAL;
+    cache->count = 1;
+    cache->dirty = 1;
+}
+
+/**
+ * @brief Forgets the highlighted lines from the given line onwards
+ *
+ * @param cache The cache
+ * @param fromLine The first line to forget
+ */
+static void forgetHighlights(struct SyntaxCache *cache, size_t fromLine){
+    int i;
+    for (i = 0; i < SYNTAX_LINE_CACHE_SIZE; i++){
+        if (cache->lines[i].lineNumber >= fromLine){
+            free(cache->lines[i].classes);
+            memset(&cache->lines[i], 0, sizeof(cache->lines[i]));
+        }
+    }
+}
+
+/**
+ * @brief Frees everything held by the cache
+ *
+ * @param cache The cache
+ */
+void freeSyntaxCache(struct SyntaxCache *cache){
+    forgetHighlights(cache, 1);
+    free(cache->entryStates);
+    cache->entryStates = NULL;
+    cache->count = cache->capacity = 0;
+}
+
+/**
+ * @brief Switches language, throwing away every cached state
+ *
+ * @param cache The cache
+ * @param language The new language, NULL for plain text
+ */
+void setSyntaxLanguage(struct SyntaxCache *cache, struct SyntaxLanguage *language){
+    freeSyntaxCache(cache);
+    initSyntaxCache(cache, language);
+}
+
+/**
+ * @brief Gives the cache the next line of the file, must be called for lines in order from the top.
+ * Lines before the first dirty line are skipped without lexing, and once a line past every
+ * edit ends in the state already stored for the next line the rest of the stored states are trusted again
+ *
+ * @param cache The cache
+ * @param lineNumber The lines number, from 1
+ * @param line The line, without its \n
+ * @param length Its length
+ */
+void syntaxFeedLine(struct SyntaxCache *cache, size_t lineNumber, const char *line, size_t length){
+    if (cache->language == NULL || lineNumber != cache->dirty || lineNumber > cache->count) return;
+
+    unsigned char exitState = lexLine(cache->language, cache->entryStates[lineNumber - 1], line, length, NULL);
+
+    if (lineNumber < cache->count && lineNumber >= cache->dirtyEnd && cache->entryStates[lineNumber] == exitState){
+        cache->dirty = cache->count;
+        cache->dirtyEnd = 0;
+        return;
+    }
+
+    if (lineNumber == cache->count){
+        if (cache->count == cache->capacity){
+            cache->capacity *= 2;
+            cache->entryStates = realloc(cache->entryStates, cache->capacity);
+        }
+        cache->count++;
+    }
+    cache->entryStates[lineNumber] = exitState;
+    cache->dirty = lineNumber + 1;
+}
+
+/**
+ * @brief Gets the highlight classes of a line, lexing it only if it isn't cached.
+ * The line must have been fed, or come before the first dirty line
+ *
+ * @param cache The cache
+ * @param lineNumber The lines number, from 1
+ * @param line The line, without its \n
+ * @param length Its length
+ * @return const unsigned char* A class per byte, NULL for no highlighting
+ */
+const unsigned char * syntaxHighlightLine(struct SyntaxCache *cache, size_t lineNumber, const char *line, size_t length){
+    if (cache->language == NULL || lineNumber > cache->dirty || lineNumber > cache->count) return NULL;
+
+    unsigned char entryState = cache->entryStates[lineNumber - 1];
+    struct SyntaxLineHighlight *highlight = &cache->lines[lineNumber % SYNTAX_LINE_CACHE_SIZE];
+    if (highlight->lineNumber == lineNumber && highlight->length == length && highlight->entryState == entryState){
+        return highlight->classes;
+    }
+
+    free(highlight->classes);
+    highlight->lineNumber = lineNumber;
+    highlight->length = length;
+    highlight->entryState = entryState;
+    highlight->classes = malloc(length + 1);
+    lexLine(cache->language, entryState, line, length, highlight->classes);
+    return highlight->classes;
+}
+
+/**
+ * @brief Marks a line as edited so it gets re-lexed
+ *
+ * @param cache The cache
+ * @param lineNumber The line
+ */
+static void markEdited(struct SyntaxCache *cache, size_t lineNumber){
+    if (lineNumber < cache->dirty) cache->dirty = lineNumber;
+    if (cache->dirty > cache->count) cache->dirty = cache->count;
+    if (lineNumber > cache->dirtyEnd) cache->dirtyEnd = lineNumber;
+}
+
+/**
+ * @brief Tells the cache lines were inserted
+ *
+ * @param cache The cache
+ * @param lineNumber Where the first new line is
+ * @param amount How many lines were inserted
+ */
+void syntaxLinesInserted(struct SyntaxCache *cache, size_t lineNumber, size_t amount){
+    forgetHighlights(cache, lineNumber);
+    if (lineNumber == 0 || amount == 0) return;
+
+    if (lineNumber <= cache->count){
+        if (cache->count + amount > cache->capacity){
+            while (cache->count + amount > cache->capacity) cache->capacity *= 2;
+            cache->entryStates = realloc(cache->entryStates, cache->capacity);
+        }
+        // The new lines states are placeholders until they are fed
+        memmove(cache->entryStates + lineNumber + amount, cache->entryStates + lineNumber, cache->count - lineNumber);
+        memset(cache->entryStates + lineNumber, cache->entryStates[lineNumber - 1], amount);
+        cache->count += amount;
+    }
+    if (cache->dirtyEnd >= lineNumber) cache->dirtyEnd += amount;
+    markEdited(cache, lineNumber);
+    markEdited(cache, lineNumber + amount - 1);
+}
+
+/**
+ * @brief Tells the cache lines were deleted
+ *
+ * @param cache The cache
+ * @param lineNumber The first deleted line
+ * @param amount How many lines were deleted
+ */
+void syntaxLinesDeleted(struct SyntaxCache *cache, size_t lineNumber, size_t amount){
+    forgetHighlights(cache, lineNumber);
+    if (lineNumber == 0 || amount == 0) return;
+
+    if (lineNumber < cache->count){
+        size_t removed = cache->count - lineNumber < amount ? cache->count - lineNumber : amount;
+        memmove(cache->entryStates + lineNumber, cache->entryStates + lineNumber + removed, cache->count - lineNumber - removed);
+        cache->count -= removed;
+    }
+    if (cache->dirtyEnd >= lineNumber + amount){
+        cache->dirtyEnd -= amount;
+    } else if (cache->dirtyEnd >= lineNumber){
+        cache->dirtyEnd = lineNumber;
+    }
+    markEdited(cache, lineNumber);
+}
+
+/**
+ * @brief Tells the cache a lines content changed
+ *
+ * @param cache The cache
+ * @param lineNumber The line
+ */
+void syntaxLineChanged(struct SyntaxCache *cache, size_t lineNumber){
+    struct SyntaxLineHighlight *highlight = &cache->lines[lineNumber % SYNTAX_LINE_CACHE_SIZE];
+    if (highlight->lineNumber == lineNumber){
+        free(highlight->classes);
+        memset(highlight, 0, sizeof(*highlight));
+    }
+    markEdited(cache, lineNumber);
+}
+
+/**
+ * @brief Sets up a colour pair for every highlight class, does nothing on terminals without colour
+ *
+ */
+void initSyntaxColours(){
+    if (has_colors() == FALSE) return;
+    start_color();
+    use_default_colors();
+    init_pair(SYNTAX_KEYWORD, COLOR_YELLOW, -1);
+    init_pair(SYNTAX_TYPE, COLOR_GREEN, -1);
+    init_pair(SYNTAX_STRING, COLOR_MAGENTA, -1);
+    init_pair(SYNTAX_NUMBER, COLOR_RED, -1);
+    init_pair(SYNTAX_COMMENT, COLOR_CYAN, -1);
+    init_pair(SYNTAX_PREPROCESSOR_LINE, COLOR_BLUE, -1);
+    init_pair(SYNTAX_HEADING, COLOR_YELLOW, -1);
+    init_pair(SYNTAX_CODE, COLOR_GREEN, -1);
+    init_pair(SYNTAX_EMPHASIS, COLOR_MAGENTA, -1);
+}
@@ -0,0 +1,87 @@
+#ifndef SYNTAX_H
+#define SYNTAX_H
+
+#include <stddef.h>
+
+// Slots in the per line highlight cache
+#define SYNTAX_LINE_CACHE_SIZE 256
+
+// Language flags
+#define SYNTAX_NUMBERS (1 << 0)
+#define SYNTAX_STRINGS (1 << 1)
+#define SYNTAX_PREPROCESSOR (1 << 2)
+#define SYNTAX_MARKDOWN (1 << 3)
+#define SYNTAX_OBJECT_KEYS (1 << 4)
+
+// Lexer state at the start of a line
+enum SyntaxState
+{
+    SYNTAX_STATE_NORMAL = 0,
+    SYNTAX_STATE_BLOCK_COMMENT,
+    SYNTAX_STATE_STRING,         // String carried on by a trailing backslash
+    SYNTAX_STATE_CODE_FENCE
+};
+
+// Highlight classes, also used as the ncurses colour pair numbers
+enum SyntaxClass
+{
+    SYNTAX_NORMAL = 0,
+    SYNTAX_KEYWORD,
+    SYNTAX_TYPE,
+    SYNTAX_STRING,
+    SYNTAX_NUMBER,
+    SYNTAX_COMMENT,
+    SYNTAX_PREPROCESSOR_LINE,
+    SYNTAX_HEADING,
+    SYNTAX_CODE,
+    SYNTAX_EMPHASIS,
+    SYNTAX_CLASS_COUNT
+};
+
+struct SyntaxLanguage
+{
+    char *name;
+    char *extensions[8];
+    char *lineComment;
+    char *blockCommentStart;
+    char *blockCommentEnd;
+    char *keywords[48];
+    char *types[32];
+    int flags;
+};
+
+struct SyntaxLineHighlight
+{
+    size_t lineNumber;           // 0 = empty slot
+    size_t length;
+    unsigned char entryState;
+    unsigned char *classes;      // One class per byte
+};
+
+struct SyntaxCache
+{
+    struct SyntaxLanguage *language;
+    unsigned char *entryStates;  // entryStates[n - 1] is the state at the start of line n
+    size_t count;                // Lines with a stored entry state
+    size_t capacity;
+    size_t dirty;                // First line whose exit state hasn't been checked, lines before it are trusted
+    size_t dirtyEnd;             // Last line edited since the states were last trusted
+    struct SyntaxLineHighlight lines[SYNTAX_LINE_CACHE_SIZE];
+};
+
+struct SyntaxLanguage * syntaxLanguageForFile(char *fileName);
+struct SyntaxLanguage * nextSyntaxLanguage(struct SyntaxLanguage *language);
+unsigned char lexLine(struct SyntaxLanguage *language, unsigned char state, const char *line, size_t length, unsigned char *classes);
+
+void initSyntaxCache(struct SyntaxCache *cache, struct SyntaxLanguage *language);
+void freeSyntaxCache(struct SyntaxCache *cache);
+void setSyntaxLanguage(struct SyntaxCache *cache, struct SyntaxLanguage *language);
+void syntaxFeedLine(struct SyntaxCache *cache, size_t lineNumber, const char *line, size_t length);
+const unsigned char * syntaxHighlightLine(struct SyntaxCache *cache, size_t lineNumber, const char *line, size_t length);
+void syntaxLinesInserted(struct SyntaxCache *cache, size_t lineNumber, size_t amount);
+void syntaxLinesDeleted(struct SyntaxCache *cache, size_t lineNumber, size_t amount);
+void syntaxLineChanged(struct SyntaxCache *cache, size_t lineNumber);
+
+void initSyntaxColours();
+
+#endif
@@ -0,0 +1,154 @@
+/**
+ * @file trace.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Opt in tracing of where the time goes, written out as Chrome trace JSON on exit
+ * Every thread records into its own ring buffer so recording never takes a lock
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "trace.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+int tracingEnabled = 0;
+
+static char *traceFileName = NULL;
+static pthread_mutex_t ringsLock = PTHREAD_MUTEX_INITIALIZER;
+static struct TraceRing *allRings = NULL;
+static struct TraceRing *freeRings = NULL;
+static pthread_key_t ringKey;
+static __thread struct TraceRing *threadRing = NULL;
+static __thread pid_t threadId = 0;
+
+/**
+ * @brief Hands a finished threads ring to the next thread, its events are kept
+ *
+ * @param ring The ring
+ */
+static void retireRing(void *ring){
+    pthread_mutex_lock(&ringsLock);
+    ((struct TraceRing *)ring)->nextFree = freeRings;
+    freeRings = ring;
+    pthread_mutex_unlock(&ringsLock);
+}
+
+/**
+ * @brief Gets the calling threads ring, only the first event of a thread takes the lock
+ *
+ * @return struct TraceRing* The ring, NULL if one couldn't be allocated
+ */
+static struct TraceRing * ringForThread(){
+    if (threadRing != NULL) return threadRing;
+
+    pthread_mutex_lock(&ringsLock);
+    struct TraceRing *ring = freeRings;
+    if (ring != NULL){
+        freeRings = ring->nextFree;
+    } else {
+        ring = calloc(1, sizeof(struct TraceRing));
+        if (ring != NULL){
+            ring->next = allRings;
+            allRings = ring;
+        }
+    }
+    pthread_mutex_unlock(&ringsLock);
+
+    if (ring != NULL) pthread_setspecific(ringKey, ring);
+    threadRing = ring;
+    threadId = syscall(SYS_gettid);
+    return ring;
+}
+
+/**
+ * @brief Turns tracing on if CWORD_TRACE is set, the trace is written when the program exits
+ *
+ * @return int 1 if tracing, 0 if not
+ */
+int initTracing(){
+    char *fileName = getenv(TRACE_ENVIRONMENT_VARIABLE);
+    if (fileName == NULL || fileName[0] == '\0') return 0;
+    if (pthread_key_create(&ringKey, retireRing) != 0) return 0;
+
+    traceFileName = strdup(fileName);
+    tracingEnabled = 1;
+    atexit(writeTrace);
+    return 1;
+}
+
+/**
+ * @brief Gets the time used by trace events
+ *
+ * @return uint64_t Nanoseconds, never 0
+ */
+uint64_t traceClock(){
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec + 1;
+}
+
+/**
+ * @brief Records a finished scope, use TRACE_END rather than calling this directly
+ *
+ * @param name The scopes name, must be a string literal
+ * @param start When the scope started, from TRACE_BEGIN
+ * @param bytes The bytes the scope read or wrote, 0 if that doesn't apply
+ */
+void traceRecord(const char *name, uint64_t start, uint64_t bytes){
+    if (tracingEnabled == 0) return;
+    struct TraceRing *ring = ringForThread();
+    if (ring == NULL) return;
+
+    struct TraceEvent *event = &ring->events[ring->written % TRACE_RING_EVENTS];
+    event->name = name;
+    event->start = start;
+    event->duration = traceClock() - start;
+    event->bytes = bytes;
+    event->thread = threadId;
+    __atomic_store_n(&ring->written, ring->written + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Writes every ring out as Chrome trace JSON, registered with atexit by initTracing
+ *
+ */
+void writeTrace(){
+    if (tracingEnabled == 0) return;
+    // Threads still running stop recording, an event they are halfway through writing may be dropped
+    tracingEnabled = 0;
+
+    FILE *out = fopen(traceFileName, "w");
+    if (out == NULL) return;
+
+    fprintf(out, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(out, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"CWord\"}}", getpid());
+
+    pthread_mutex_lock(&ringsLock);
+    struct TraceRing *ring;
+    for (ring = allRings; ring != NULL; ring = ring->next){
+        uint64_t written = __atomic_load_n(&ring->written, __ATOMIC_ACQUIRE);
+        uint64_t first = written > TRACE_RING_EVENTS ? written - TRACE_RING_EVENTS : 0;
+        uint64_t i;
+        for (i = first; i < written; i++){
+            struct TraceEvent *event = &ring->events[i % TRACE_RING_EVENTS];
+            // Chrome traces are in microseconds, the fraction keeps the nanoseconds
+            fprintf(out, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"bytes\":%llu}}",
+                event->name, getpid(), event->thread, event->start / 1000.0, event->duration / 1000.0, (unsigned long long)event->bytes);
+        }
+    }
+    pthread_mutex_unlock(&ringsLock);
+
+    fprintf(out, "\n]}\n");
+    fclose(out);
+}
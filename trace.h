@@ -0,0 +1,40 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <sys/types.h>
+
+// Set to a file name to record a Chrome trace of the session, open it in chrome://tracing or ui.perfetto.dev
+#define TRACE_ENVIRONMENT_VARIABLE "CWORD_TRACE"
+// Events kept per thread, the oldest are overwritten once full
+#define TRACE_RING_EVENTS 16384
+
+struct TraceEvent
+{
+    const char *name;       // Must be a string literal, only the pointer is kept
+    uint64_t start;         // Nanoseconds, CLOCK_MONOTONIC
+    uint64_t duration;
+    uint64_t bytes;
+    pid_t thread;
+};
+
+struct TraceRing
+{
+    struct TraceEvent events[TRACE_RING_EVENTS];
+    uint64_t written;       // Events ever written, the newest is at (written - 1) % TRACE_RING_EVENTS
+    struct TraceRing *next;
+    struct TraceRing *nextFree;
+};
+
+extern int tracingEnabled;
+
+int initTracing();
+void writeTrace();
+uint64_t traceClock();
+void traceRecord(const char *name, uint64_t start, uint64_t bytes);
+
+// Starts a scope, 0 when tracing is off so TRACE_END skips everything, including working out bytes
+#define TRACE_BEGIN() (tracingEnabled ? traceClock() : 0)
+#define TRACE_END(name, start, bytes) do { if ((start) != 0) traceRecord((name), (start), (bytes)); } while (0)
+
+#endif
@@ -0,0 +1,829 @@
+/**
+ * @file transform.c
+ * @author Noah Hollowell (Noah.Hollowell@warwick.ac.uk)
+ * @brief Sort, unique and reverse the lines of a whole file
+ * Sorting holds a bounded amount of the file in memory, sorting blocks of it in parallel into runs
+ * that are merged back together. The file before is kept as a snapshot so the whole transform is one
+ * TRANSFORM record that can be rolled back
+ * @version 0.1
+ * @date 2020-12-13
+ *
+ * @copyright Copyright (c) 2020
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include "transform.h"
+#include "bulk_operations.h"
+#include "file_operations.h"
+#include "interface.h"
+#include "utils.h"
+#include "change_log.h"
+#include "compression.h"
+#include "output.h"
+#include "trace.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// Lines are read and written through buffers this big
+#define TRANSFORM_IO_BUFFER_SIZE (1024 * 1024)
+// The smallest block of lines sorted at once, whatever the budget
+#define TRANSFORM_MIN_CHUNK_SIZE (64 * 1024)
+// Chunks are filled this much at a time, so little is read past where one ends
+#define TRANSFORM_READ_SIZE (64 * 1024)
+
+struct SortLine
+{
+    const char *text;       // Including its \n
+    size_t length;
+    size_t keyOffset;
+    size_t keyLength;
+    double number;          // Only worked out for numeric sorts
+};
+
+// A block of whole lines, each ending in \n
+struct SortChunk
+{
+    char *data;
+    size_t length;
+    size_t capacity;
+};
+
+// Writes lines out, dropping repeats when asked to
+struct LineWriter
+{
+    FILE *file;
+    int unique;
+    char *last;
+    size_t lastLength;
+    size_t lastCapacity;
+    int hasLast;
+    size_t written;
+};
+
+// Shared by the workers sorting one batch of chunks into runs
+struct RunJobs
+{
+    struct TransformOptions *options;
+    struct SortChunk *chunks;
+    char **runNames;
+    FILE *output;           // Set when the whole file is one chunk, it is sorted straight into the output
+    size_t *read;
+    size_t *written;
+    int *failed;
+};
+
+// The next line of one run being merged
+struct RunReader
+{
+    FILE *file;
+    char *line;
+    size_t capacity;
+    struct SortLine current;
+};
+
+/**
+ * @brief Gets how many bytes of lines a sort may hold in memory, from CWORD_SORT_MB if set
+ *
+ * @return size_t The budget in bytes
+ */
+size_t transformBudget(){
+    char *setting = getenv(TRANSFORM_BUDGET_VARIABLE);
+    long megabytes = setting != NULL ? strtol(setting, NULL, 10) : 0;
+    if (megabytes <= 0) megabytes = TRANSFORM_DEFAULT_BUDGET_MB;
+    return (size_t)megabytes * 1024 * 1024;
+}
+
+/**
+ * @brief Finds the key of a line to sort by, and its number for numeric sorts
+ *
+ * @param options How the lines are sorted
+ * @param text The line, ending in \n
+ * @param length Its length including the \n
+ * @param line Where to describe it
+ */
+static void describeLine(struct TransformOptions *options, const char *text, size_t length, struct SortLine *line){
+    line->text = text;
+    line->length = length;
+    size_t end = length > 0 && text[length - 1] == '\n' ? length - 1 : length;
+    size_t start = 0, stop = end;
+
+    if (options->field > 0 && options->separator == '\0'){
+        size_t field = 0, position = 0;
+        while (field < options->field && position < end){
+            while (position < end && isblank((unsigned char)text[position])) position++;
+            start = position;
+            while (position < end && !isblank((unsigned char)text[position])) position++;
+            field++;
+        }
+        stop = position;
+        // Lines with fewer fields have an empty key
+        if (field < options->field || start == end) start = stop = end;
+    } else if (options->field > 0){
+        size_t field = 1;
+        while (field < options->field && start < end){
+            const char *next = memchr(text + start, options->separator, end - start);
+            start = next != NULL ? (size_t)(next - text) + 1 : end;
+            field++;
+        }
+        if (field < options->field) start = end;
+        const char *next = memchr(text + start, options->separator, end - start);
+        stop = next != NULL ? (size_t)(next - text) : end;
+    }
+    line->keyOffset = start;
+    line->keyLength = stop - start;
+
+    line->number = 0;
+    if (options->numeric){
+        // Copied out so the number can't run on into the next field
+        char number[64];
+        size_t numberLength = line->keyLength < sizeof(number) - 1 ? line->keyLength : sizeof(number) - 1;
+        memcpy(number, text + start, numberLength);
+        number[numberLength] = '\0';
+        line->number = strtod(number, NULL);
+        // Keys that aren't numbers sort as 0, like sort -n
+        if (line->number != line->number) line->number = 0;
+    }
+}
+
+/**
+ * @brief Compares bytes the way memcmp would, a prefix sorting first
+ *
+ * @return int <0, 0 or >0
+ */
+static int compareBytes(const char *a, size_t aLength, const char *b, size_t bLength){
+    int order = memcmp(a, b, aLength < bLength ? aLength : bLength);
+    if (order != 0) return order;
+    return aLength < bLength ? -1 : aLength > bLength;
+}
+
+/**
+ * @brief Orders two lines by their keys, ties fall back to the whole line so equal lines end up together
+ *
+ * @param a The first line
+ * @param b The second line
+ * @param options How the lines are sorted
+ * @return int <0 if a comes first, 0 if they are the same, >0 if b comes first
+ */
+static int compareLines(const struct SortLine *a, const struct SortLine *b, const struct TransformOptions *options){
+    int order = 0;
+    if (options->numeric && a->number != b->number) order = a->number < b->number ? -1 : 1;
+    if (order == 0 && options->numeric == 0) order = compareBytes(a->text + a->keyOffset, a->keyLength, b->text + b->keyOffset, b->keyLength);
+    if (order == 0 && (options->field > 0 || options->numeric)){
+        order = compareBytes(a->text, a->length - 1, b->text, b->length - 1);
+    }
+    return options->descending ? -order : order;
+}
+
+/**
+ * @brief compareLines for qsort_r
+ */
+static int compareSortLines(const void *a, const void *b, void *options){
+    return compareLines(a, b, options);
+}
+
+/**
+ * @brief Writes a line, unless lines are unique and it is the same as the one written before
+ *
+ * @param writer The writer
+ * @param text The line including its \n
+ * @param length Its length
+ */
+static void writeLine(struct LineWriter *writer, const char *text, size_t length){
+    if (writer->unique){
+        if (writer->hasLast && writer->lastLength == length && memcmp(writer->last, text, length) == 0) return;
+        if (length > writer->lastCapacity){
+            writer->lastCapacity = length * 2;
+            writer->last = realloc(writer->last, writer->lastCapacity);
+        }
+        memcpy(writer->last, text, length);
+        writer->lastLength = length;
+        writer->hasLast = 1;
+    }
+    fwrite(text, 1, length, writer->file);
+    writer->written++;
+}
+
+/**
+ * @brief Fills a chunk with whole lines from the source, stopping once its bytes and the SortLine each
+ * of its lines will need reach the limit. The bytes after that are carried over to the next chunk.
+ * A last line without a \n is given one
+ *
+ * @param source The file being sorted
+ * @param chunk The chunk to fill
+ * @param carry The bytes carried over, replaced by the ones left this time
+ * @param limit The most memory the chunk and its lines may take
+ * @param endOfFile Set once the source has been read to the end
+ */
+static void fillChunk(FILE *source, struct SortChunk *chunk, struct SortChunk *carry, size_t limit, int *endOfFile){
+    if (carry->length + 1 > chunk->capacity){
+        chunk->capacity = (carry->length + 1) * 2;
+        chunk->data = realloc(chunk->data, chunk->capacity);
+    }
+    memcpy(chunk->data, carry->data, carry->length);
+    chunk->length = carry->length;
+    carry->length = 0;
+
+    size_t scanned = 0, lines = 0, end = 0;
+    while (1 == 1){
+        // Lines are counted as they arrive, the chunk ends at the first taking it over the limit
+        char *newline;
+        while (end == 0 && (newline = memchr(chunk->data + scanned, '\n', chunk->length - scanned)) != NULL){
+            scanned = (newline - chunk->data) + 1;
+            lines++;
+            if (scanned + lines * sizeof(struct SortLine) >= limit) end = scanned;
+        }
+        if (end != 0) break;
+        scanned = chunk->length;
+
+        if (*endOfFile){
+            if (chunk->length > 0 && chunk->data[chunk->length - 1] != '\n'){
+                if (chunk->length == chunk->capacity){
+                    chunk->capacity++;
+                    chunk->data = realloc(chunk->data, chunk->capacity);
+                }
+                chunk->data[chunk->length++] = '\n';
+            }
+            return;
+        }
+        if (chunk->length == chunk->capacity){
+            // A single line longer than the chunk, it has to fit somehow
+            chunk->capacity *= 2;
+            chunk->data = realloc(chunk->data, chunk->capacity);
+        }
+        size_t wanted = chunk->capacity - chunk->length;
+        if (wanted > TRANSFORM_READ_SIZE) wanted = TRANSFORM_READ_SIZE;
+        size_t read = fread(chunk->data + chunk->length, 1, wanted, source);
+        chunk->length += read;
+        if (read < wanted) *endOfFile = 1;
+    }
+
+    if (chunk->length - end > carry->capacity){
+        carry->capacity = chunk->length - end;
+        carry->data = realloc(carry->data, carry->capacity);
+    }
+    memcpy(carry->data, chunk->data + end, chunk->length - end);
+    carry->length = chunk->length - end;
+    chunk->length = end;
+}
+
+/**
+ * @brief Sorts the lines of a chunk and writes them out
+ *
+ * @param options How the lines are sorted
+ * @param chunk The lines
+ * @param output Where to write them
+ * @param written Set to how many lines were written
+ * @return size_t How many lines the chunk had
+ */
+static size_t sortChunk(struct TransformOptions *options, struct SortChunk *chunk, FILE *output, size_t *written){
+    // Every line ends in \n, so the index is sized exactly rather than grown
+    size_t count = 0, capacity = 0, position = 0;
+    char *newline;
+    while ((newline = memchr(chunk->data + position, '\n', chunk->length - position)) != NULL){
+        position = (newline - chunk->data) + 1;
+        capacity++;
+    }
+    if (position < chunk->length) capacity++;
+    struct SortLine *lines = malloc((capacity > 0 ? capacity : 1) * sizeof(struct SortLine));
+
+    position = 0;
+    while (position < chunk->length){
+        newline = memchr(chunk->data + position, '\n', chunk->length - position);
+        size_t end = newline != NULL ? (size_t)(newline - chunk->data) + 1 : chunk->length;
+        describeLine(options, chunk->data + position, end - position, &lines[count++]);
+        position = end;
+    }
+
+    qsort_r(lines, count, sizeof(struct SortLine), compareSortLines, options);
+
+    struct LineWriter writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.file = output;
+    writer.unique = options->unique;
+    size_t i;
+    for (i = 0; i < count; i++) writeLine(&writer, lines[i].text, lines[i].length);
+    *written = writer.written;
+    free(writer.last);
+    free(lines);
+    return count;
+}
+
+/**
+ * @brief Sorts one chunk into its run, run on the thread pool
+ *
+ * @param context The RunJobs
+ * @param job The chunk
+ */
+static void sortRunJob(void *context, size_t job){
+    struct RunJobs *jobs = context;
+    uint64_t trace = TRACE_BEGIN();
+    FILE *run = jobs->output != NULL ? jobs->output : fopen(jobs->runNames[job], "w");
+    if (run == NULL){
+        jobs->failed[job] = 1;
+        return;
+    }
+    if (jobs->output == NULL) setvbuf(run, NULL, _IOFBF, TRANSFORM_IO_BUFFER_SIZE);
+
+    jobs->read[job] = sortChunk(jobs->options, &jobs->chunks[job], run, &jobs->written[job]);
+    if (ferror(run)) jobs->failed[job] = 1;
+    if (jobs->output == NULL && fclose(run) != 0) jobs->failed[job] = 1;
+    TRACE_END("sortRun", trace, jobs->chunks[job].length);
+}
+
+/**
+ * @brief Reads the next line of a run being merged
+ *
+ * @param reader The run
+ * @param options How the lines are sorted
+ * @return int 1 if there was a line, 0 at the end of the run
+ */
+static int nextRunLine(struct RunReader *reader, struct TransformOptions *options){
+    ssize_t length = getline(&reader->line, &reader->capacity, reader->file);
+    if (length <= 0) return 0;
+    describeLine(options, reader->line, length, &reader->current);
+    return 1;
+}
+
+/**
+ * @brief Checks if one run's line should come out of the merge before another's,
+ * the earlier run winning ties so equal keys keep their order
+ *
+ * @return int 1 if run a comes first
+ */
+static int runBefore(struct RunReader *readers, size_t a, size_t b, struct TransformOptions *options){
+    int order = compareLines(&readers[a].current, &readers[b].current, options);
+    return order < 0 || (order == 0 && a < b);
+}
+
+/**
+ * @brief Moves a run down the heap until both below it come after it
+ *
+ * @param heap Run numbers, the run with the first line on top
+ * @param count How many runs are on the heap
+ * @param position Where the run to move is
+ */
+static void siftDown(size_t *heap, size_t count, size_t position, struct RunReader *readers, struct TransformOptions *options){
+    while (1 == 1){
+        size_t first = position, left = position * 2 + 1, right = left + 1;
+        if (left < count && runBefore(readers, heap[left], heap[first], options)) first = left;
+        if (right < count && runBefore(readers, heap[right], heap[first], options)) first = right;
+        if (first == position) return;
+        size_t swap = heap[first];
+        heap[first] = heap[position];
+        heap[position] = swap;
+        position = first;
+    }
+}
+
+/**
+ * @brief Merges sorted runs into one sorted output, a k-way merge through a heap of the runs
+ *
+ * @param names The runs
+ * @param count How many, at most TRANSFORM_MAX_MERGE_RUNS
+ * @param output Where to write the merged lines
+ * @param options How the lines are sorted
+ * @return size_t How many lines were written, (size_t)-1 if a run couldn't be read
+ */
+static size_t mergeRuns(char **names, size_t count, FILE *output, struct TransformOptions *options){
+    uint64_t trace = TRACE_BEGIN();
+    struct RunReader *readers = calloc(count, sizeof(struct RunReader));
+    size_t *heap = malloc(count * sizeof(size_t));
+
+    // The budget is shared between the runs read at once
+    size_t bufferSize = options->budget / (count + 1);
+    if (bufferSize > TRANSFORM_IO_BUFFER_SIZE) bufferSize = TRANSFORM_IO_BUFFER_SIZE;
+    if (bufferSize < 16 * 1024) bufferSize = 16 * 1024;
+
+    int ok = 1;
+    size_t heapCount = 0, i;
+    for (i = 0; i < count; i++){
+        readers[i].file = fopen(names[i], "r");
+        if (readers[i].file == NULL){
+            ok = 0;
+            continue;
+        }
+        setvbuf(readers[i].file, NULL, _IOFBF, bufferSize);
+        if (nextRunLine(&readers[i], options)) heap[heapCount++] = i;
+    }
+    for (i = heapCount; i-- > 0;) siftDown(heap, heapCount, i, readers, options);
+
+    struct LineWriter writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.file = output;
+    writer.unique = options->unique;
+    while (ok && heapCount > 0){
+        struct RunReader *top = &readers[heap[0]];
+        writeLine(&writer, top->current.text, top->current.length);
+        if (nextRunLine(top, options) == 0) heap[0] = heap[--heapCount];
+        siftDown(heap, heapCount, 0, readers, options);
+    }
+
+    for (i = 0; i < count; i++){
+        if (readers[i].file != NULL){
+            if (ferror(readers[i].file)) ok = 0;
+            fclose(readers[i].file);
+        }
+        free(readers[i].line);
+    }
+    free(writer.last);
+    free(readers);
+    free(heap);
+    TRACE_END("mergeRuns", trace, writer.written);
+    return ok ? writer.written : (size_t)-1;
+}
+
+/**
+ * @brief Sorts a file of any size within the memory budget. Blocks of it are sorted in parallel
+ * into runs beside the file, which are then merged, in several passes if there are many of them
+ *
+ * @param fileName The file being sorted, the runs are named after it
+ * @param source The file
+ * @param output Where the sorted lines go
+ * @param options How to sort
+ * @param result Filled with how many lines were read, written and spilled runs
+ * @return int 1 if ok, 0 if reading or writing failed
+ */
+static int sortFile(char *fileName, FILE *source, FILE *output, struct TransformOptions *options, struct TransformResult *result){
+    long processors = sysconf(_SC_NPROCESSORS_ONLN);
+    size_t parallel = processors > 0 ? (size_t)processors : 1;
+    if (parallel > TRANSFORM_MAX_PARALLEL_RUNS) parallel = TRANSFORM_MAX_PARALLEL_RUNS;
+    // Each chunk's buffer takes half its part of the budget, its lines and their SortLines together
+    // are kept within the other half by fillChunk
+    size_t share = options->budget / parallel / 2;
+    if (share < TRANSFORM_MIN_CHUNK_SIZE) share = TRANSFORM_MIN_CHUNK_SIZE;
+
+    struct SortChunk *chunks = calloc(parallel, sizeof(struct SortChunk));
+    struct SortChunk carry;
+    memset(&carry, 0, sizeof(carry));
+    size_t read[TRANSFORM_MAX_PARALLEL_RUNS], written[TRANSFORM_MAX_PARALLEL_RUNS];
+    int failed[TRANSFORM_MAX_PARALLEL_RUNS];
+    size_t i;
+    for (i = 0; i < parallel; i++){
+        chunks[i].capacity = share;
+        chunks[i].data = malloc(share);
+    }
+
+    size_t runCount = 0, runCapacity = 16, runNumber = 0;
+    char **runNames = malloc(runCapacity * sizeof(char *));
+    int ok = 1, endOfFile = 0;
+
+    while (ok && (endOfFile == 0 || carry.length > 0)){
+        size_t filled = 0;
+        while (filled < parallel && (endOfFile == 0 || carry.length > 0)){
+            fillChunk(source, &chunks[filled], &carry, share, &endOfFile);
+            if (chunks[filled].length > 0) filled++;
+        }
+        if (ferror(source)) ok = 0;
+        if (filled == 0 || ok == 0) break;
+
+        struct RunJobs jobs;
+        jobs.options = options;
+        jobs.chunks = chunks;
+        jobs.read = read;
+        jobs.written = written;
+        jobs.failed = failed;
+        memset(failed, 0, sizeof(failed));
+        memset(read, 0, sizeof(read));
+
+        // It all fit in memory at once, so no runs are needed
+        if (runCount == 0 && endOfFile && carry.length == 0 && filled == 1){
+            jobs.output = output;
+            jobs.runNames = NULL;
+            sortRunJob(&jobs, 0);
+            result->linesRead += read[0];
+            result->linesWritten = written[0];
+            ok = failed[0] == 0;
+            break;
+        }
+
+        while (runCount + filled > runCapacity){
+            runCapacity *= 2;
+            runNames = realloc(runNames, runCapacity * sizeof(char *));
+        }
+        for (i = 0; i < filled; i++){
+            char number[32];
+            sprintf(number, ".run.%zu.cword.txt", runNumber++);
+            runNames[runCount + i] = concat(fileName, number);
+        }
+        jobs.output = NULL;
+        jobs.runNames = runNames + runCount;
+        runCount += filled;
+        runInThreadPool(filled, sortRunJob, &jobs);
+        for (i = 0; i < filled; i++){
+            result->linesRead += read[i];
+            if (failed[i]) ok = 0;
+        }
+    }
+
+    // The chunks aren't needed any more, the merge gets the memory instead
+    for (i = 0; i < parallel; i++) free(chunks[i].data);
+    free(chunks);
+    free(carry.data);
+    result->runs = runCount;
+
+    // Too many runs to read at once are merged down into fewer, longer ones first
+    while (ok && runCount > TRANSFORM_MAX_MERGE_RUNS){
+        size_t mergedCount = 0;
+        for (i = 0; ok && i < runCount; i += TRANSFORM_MAX_MERGE_RUNS){
+            size_t group = runCount - i < TRANSFORM_MAX_MERGE_RUNS ? runCount - i : TRANSFORM_MAX_MERGE_RUNS;
+            char number[32];
+            sprintf(number, ".run.%zu.cword.txt", runNumber++);
+            char *mergedName = concat(fileName, number);
+            FILE *merged = fopen(mergedName, "w");
+            ok = merged != NULL;
+            if (ok){
+                setvbuf(merged, NULL, _IOFBF, TRANSFORM_IO_BUFFER_SIZE);
+                if (mergeRuns(runNames + i, group, merged, options) == (size_t)-1) ok = 0;
+                if (fclose(merged) != 0) ok = 0;
+            }
+            size_t j;
+            for (j = i; j < i + group; j++){
+                remove(runNames[j]);
+                free(runNames[j]);
+            }
+            // Every merged group goes before any not merged yet, so the array is reused in place
+            runNames[mergedCount++] = mergedName;
+        }
+        // Groups that were never reached still have to be cleaned up
+        for (; i < runCount; i++){
+            runNames[mergedCount++] = runNames[i];
+        }
+        runCount = mergedCount;
+    }
+
+    if (ok && runCount > 0){
+        size_t written = mergeRuns(runNames, runCount, output, options);
+        if (written == (size_t)-1) ok = 0;
+        else result->linesWritten = written;
+    }
+
+    for (i = 0; i < runCount; i++){
+        remove(runNames[i]);
+        free(runNames[i]);
+    }
+    free(runNames);
+    return ok;
+}
+
+/**
+ * @brief Drops lines repeating the line before them, reading a line at a time
+ *
+ * @param source The file
+ * @param output Where the remaining lines go
+ * @param result Filled with how many lines were read and written
+ * @return int 1 if ok, 0 if reading failed
+ */
+static int uniqueFile(FILE *source, FILE *output, struct TransformResult *result){
+    struct LineWriter writer;
+    memset(&writer, 0, sizeof(writer));
+    writer.file = output;
+    writer.unique = 1;
+
+    char *line = NULL;
+    size_t len = 0;
+    ssize_t length;
+    while ((length = getline(&line, &len, source)) != -1){
+        // A last line without a \n still matches the same line with one
+        if (line[length - 1] != '\n'){
+            line = realloc(line, length + 2);
+            line[length++] = '\n';
+        }
+        result->linesRead++;
+        writeLine(&writer, line, length);
+    }
+    result->linesWritten = writer.written;
+    free(line);
+    free(writer.last);
+    return ferror(source) == 0;
+}
+
+/**
+ * @brief Writes the lines of a file last first, reading it backward in blocks so only a block
+ * (or a line, if longer) is held at once
+ *
+ * @param source The file
+ * @param output Where the lines go
+ * @param result Filled with how many lines were read and written
+ * @return int 1 if ok, 0 if reading failed
+ */
+static int reverseFile(FILE *source, FILE *output, struct TransformResult *result){
+    int fd = fileno(source);
+    struct stat info;
+    if (fstat(fd, &info) != 0) return 0;
+
+    // data holds the block just read followed by the start of the line it ends in
+    size_t capacity = TAIL_BLOCK_SIZE * 2, length = 0;
+    char *data = malloc(capacity);
+    off_t end = info.st_size;
+    int ok = 1;
+
+    while (ok){
+        off_t start = end > TAIL_BLOCK_SIZE ? end - TAIL_BLOCK_SIZE : 0;
+        size_t blockLength = end - start;
+        if (length + blockLength > capacity){
+            capacity = (length + blockLength) * 2;
+            data = realloc(data, capacity);
+        }
+        memmove(data + blockLength, data, length);
+        if (pread(fd, data, blockLength, start) != (ssize_t)blockLength){
+            ok = 0;
+            break;
+        }
+        length += blockLength;
+        end = start;
+
+        // Each line starts after the \n before it, the \n a line ends in is never searched for
+        while (length > 0){
+            char *previous = length > 1 ? memrchr(data, '\n', length - 1) : NULL;
+            if (previous == NULL && start > 0) break;
+            size_t lineStart = previous != NULL ? (size_t)(previous - data) + 1 : 0;
+            fwrite(data + lineStart, 1, length - lineStart, output);
+            if (data[length - 1] != '\n') fputc('\n', output);
+            result->linesRead++;
+            length = lineStart;
+        }
+        if (start == 0) break;
+    }
+    result->linesWritten = result->linesRead;
+    free(data);
+    return ok;
+}
+
+/**
+ * @brief Gets the name a transform is recorded under
+ *
+ * @param options The transform
+ * @return char* The name
+ */
+static char * transformName(struct TransformOptions *options){
+    if (options->kind == TRANSFORM_UNIQUE) return "UNIQUE";
+    if (options->kind == TRANSFORM_REVERSE) return "REVERSE";
+    return options->unique ? "SORT-UNIQUE" : "SORT";
+}
+
+/**
+ * @brief Sorts, uniques or reverses the lines of a file, rewriting it in one go.
+ * The file before is kept as a snapshot and recorded as a single TRANSFORM so one rollback undoes it
+ *
+ * @param fileName The file
+ * @param options What to do
+ * @param result Filled with what was done, may be NULL
+ * @return int 1 if ok, 0 if the file couldn't be read or rewritten
+ */
+int transformFile(char *fileName, struct TransformOptions *options, struct TransformResult *result){
+    uint64_t trace = TRACE_BEGIN();
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    struct TransformResult counts;
+    memset(&counts, 0, sizeof(counts));
+    if (options->budget == 0) options->budget = transformBudget();
+
+    FILE *source = fopen(fileName, "r");
+    char *outputName = concat(fileName, ".transform.cword.txt");
+    FILE *output = source != NULL ? fopen(outputName, "w") : NULL;
+    int ok = output != NULL;
+
+    if (ok){
+        setvbuf(source, NULL, _IOFBF, TRANSFORM_IO_BUFFER_SIZE);
+        setvbuf(output, NULL, _IOFBF, TRANSFORM_IO_BUFFER_SIZE);
+        if (options->kind == TRANSFORM_SORT){
+            ok = sortFile(fileName, source, output, options, &counts);
+        } else if (options->kind == TRANSFORM_UNIQUE){
+            ok = uniqueFile(source, output, &counts);
+        } else {
+            ok = reverseFile(source, output, &counts);
+        }
+    }
+    if (source != NULL) fclose(source);
+    if (output != NULL && fclose(output) != 0) ok = 0;
+
+    if (ok){
+        // The whole file is kept so a single rollback puts every line back where it was
+        char *dirLocation = concat(".cword/", fileName);
+        dirExists(dirLocation);
+        free(dirLocation);
+        char *hash = storeSnapshot(fileName, fileName);
+        ok = hash != NULL && rename(outputName, fileName) == 0;
+        if (ok){
+            char *info = concat3(transformName(options), "::", hash);
+            addToChangeLog(fileName, "TRANSFORM", info);
+            free(info);
+        }
+        free(hash);
+    }
+    remove(outputName);
+    free(outputName);
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    counts.seconds = (finished.tv_sec - started.tv_sec) + (finished.tv_nsec - started.tv_nsec) / 1e9;
+    if (result != NULL) *result = counts;
+    TRACE_END("transformFile", trace, counts.linesRead);
+    return ok;
+}
+
+/**
+ * @brief Puts back the file a TRANSFORM record kept a snapshot of
+ *
+ * @param fileName The tracked file, its history holds the snapshot
+ * @param hash The snapshot named in the record
+ * @param target Where to restore it, the tracked file or a copy of it
+ * @return int 1 if ok, 0 if the snapshot couldn't be read
+ */
+int undoTransform(char *fileName, char *hash, char *target){
+    char *snapshot = changeLogSnapshotPath(fileName, hash);
+    if (snapshot == NULL) return 0;
+
+    char *tempName = concat(target, ".transform.cword.txt");
+    int ok = 1;
+    if (isCompressedFile(snapshot)){
+        ok = decompressFile(snapshot, tempName);
+    } else {
+        internalCopyFile(snapshot, tempName);
+        ok = fileExists(tempName);
+    }
+    free(snapshot);
+
+    if (ok) ok = rename(tempName, target) == 0;
+    remove(tempName);
+    free(tempName);
+    return ok;
+}
+
+/**
+ * @brief Asks how to transform the lines of a file and does it
+ *
+ * @param fileName The file
+ */
+void transformLines(char *fileName){
+    if (fileExists(fileName) == 0){
+        char *m = concat(fileName, " doesn't exist!");
+        infoScreen(m);
+        free(m);
+        return;
+    }
+    if (canRead(fileName) == 0 || canWrite(fileName) == 0){
+        infoScreen("You don't have permission to edit this file!");
+        return;
+    }
+
+    struct TransformOptions options;
+    memset(&options, 0, sizeof(options));
+    char *kind = getUserLine("Sort, unique (drop repeated lines) or reverse the lines? (s/u/r): ");
+    if (tolower(kind[0]) == 'u'){
+        options.kind = TRANSFORM_UNIQUE;
+    } else if (tolower(kind[0]) == 'r'){
+        options.kind = TRANSFORM_REVERSE;
+    } else if (tolower(kind[0]) == 's'){
+        options.kind = TRANSFORM_SORT;
+    } else {
+        free(kind);
+        infoScreen("Nothing has been changed.");
+        return;
+    }
+    free(kind);
+
+    if (options.kind == TRANSFORM_SORT){
+        char *field = getUserLine("Field to sort by, from 1 (blank for the whole line): ");
+        options.field = strtoul(field, NULL, 10);
+        free(field);
+        if (options.field > 0){
+            char *separator = getUserLine("Character between fields (blank for spaces and tabs): ");
+            options.separator = separator[0];
+            free(separator);
+        }
+        char *answer = getUserLine("Sort numerically? (y/N): ");
+        options.numeric = tolower(answer[0]) == 'y';
+        free(answer);
+        answer = getUserLine("Largest first? (y/N): ");
+        options.descending = tolower(answer[0]) == 'y';
+        free(answer);
+        answer = getUserLine("Drop repeated lines as well? (y/N): ");
+        options.unique = tolower(answer[0]) == 'y';
+        free(answer);
+    }
+
+    waitScreen("Transforming.\nPlease wait...\n");
+    struct TransformResult result;
+    if (transformFile(fileName, &options, &result) == 0){
+        infoScreen("The file couldn't be rewritten!\nNothing has been changed.");
+        return;
+    }
+
+    char message[200];
+    if (result.runs > 0){
+        sprintf(message, "Wrote %zu of %zu lines in %.2f seconds, sorted in %zu runs.\nThey can be put back with a single rollback.", result.linesWritten, result.linesRead, result.seconds, result.runs);
+    } else {
+        sprintf(message, "Wrote %zu of %zu lines in %.2f seconds.\nThey can be put back with a single rollback.", result.linesWritten, result.linesRead, result.seconds);
+    }
+    infoScreen(message);
+}
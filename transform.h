@@ -0,0 +1,45 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include <stddef.h>
+
+// Bytes of lines a sort holds in memory at once, unless CWORD_SORT_MB says otherwise
+#define TRANSFORM_DEFAULT_BUDGET_MB 64
+#define TRANSFORM_BUDGET_VARIABLE "CWORD_SORT_MB"
+// Most runs sorted at the same time
+#define TRANSFORM_MAX_PARALLEL_RUNS 8
+// Most runs merged at once, more are merged down in several passes
+#define TRANSFORM_MAX_MERGE_RUNS 64
+
+enum TransformKind
+{
+    TRANSFORM_SORT = 0,
+    TRANSFORM_UNIQUE,       // Drops lines repeating the one before, like uniq
+    TRANSFORM_REVERSE       // Last line first, like tac
+};
+
+struct TransformOptions
+{
+    enum TransformKind kind;
+    int numeric;            // Sort by the number the key starts with, like sort -n
+    int descending;
+    size_t field;           // Sort by this field, from 1, 0 for the whole line
+    char separator;         // Between fields, \0 for runs of blanks
+    int unique;             // Sort only, drop repeated lines too
+    size_t budget;          // Bytes of lines held in memory at once
+};
+
+struct TransformResult
+{
+    size_t linesRead;
+    size_t linesWritten;
+    size_t runs;            // Sorted runs spilled to disk, 0 if it all fit in memory
+    double seconds;
+};
+
+size_t transformBudget();
+int transformFile(char *fileName, struct TransformOptions *options, struct TransformResult *result);
+int undoTransform(char *fileName, char *hash, char *target);
+void transformLines(char *fileName);
+
+#endif
@@ -16,7 +16,6 @@
 #include <stdio.h>
 #include <math.h>
 #include <errno.h>
-#include <dirent.h>
 #include <sys/stat.h>
 
 
@@ -112,7 +111,8 @@ char * hashString(unsigned char *str){
         hash = ((hash << 5) + hash) + c; /* hash * 33 + c */
     }
 
-    char *string = malloc(strlen(str));
+    // Room for any unsigned long
+    char *string = malloc(21);
     sprintf(string, "%lu", hash);
     return string;
 }
@@ -171,7 +171,10 @@ char* replaceWord(const char* s, const char* oldW, const char* newW)
  * @return char* The sanitised string
  */
 char * sanitise(const char *string){
-    return replaceWord(replaceWord(string, "::", ""), "||", "");
+    char *withoutColons = replaceWord(string, "::", "");
+    char *result = replaceWord(withoutColons, "||", "");
+    free(withoutColons);
+    return result;
 }
 
 /**
@@ -182,14 +185,10 @@ char * sanitise(const char *string){
  * @return int 1 if exists/created 0 for problem (permission)
  */
 int dirExists(char *dirPath){
-    DIR *dir = opendir(dirPath);
+    // Trying mkdir first costs one call and no descriptor, every changelog write comes through here
+    if (mkdir(dirPath, 0770) == 0) return 1;
+    if (errno != EEXIST) return 0;
 
-    if (dir){
-        return 1;
-    } else if (ENOENT == errno) {
-        mkdir(dirPath, 0770);
-        return 1;
-    } else {
-        return 0;
-    }
+    struct stat info;
+    return stat(dirPath, &info) == 0 && S_ISDIR(info.st_mode);
 }
\ No newline at end of file
@@ -15,6 +15,10 @@
 #include "utils.h"
 #include "interface.h"
 #include "change_log.h"
+#include "change_log_index.h"
+#include "compression.h"
+#include "find_replace.h"
+#include "transform.h"
 
 #include <stddef.h>
 #include <stdlib.h>
@@ -30,15 +34,19 @@ void rollback(char *fileName){
 
     char *location = concat3(".cword/", fileName, "/changelog.txt");
 
+    lockChangeLogs();
+
     if (fileExists(location) == 0){
+        unlockChangeLogs();
         free(location);
         infoScreen("That file doesn't have any changelog history!");
         return;
     }
 
-    char *lastLine = getLastLineOfFile(location);
+    char *lastLine = lastChangeLogRecord(fileName);
 
-    if (strcmp(lastLine, "") == 0){
+    if (lastLine == NULL || strcmp(lastLine, "") == 0){
+        unlockChangeLogs();
         infoScreen("There is nothing to rollback!");
         return;
     }
@@ -50,32 +58,92 @@ void rollback(char *fileName){
 
     
 
+    // Each rollback gives back its message, shown once the lock is released as the user may sit at it for a while
+    char *message = NULL;
+    int ok = 1;
     if (fileExists(fileName) == 1){
         if (strcmp(operation, "APPEND") == 0){
-            rollbackAppend(fileName, stringToInt(strtok(NULL, "||")));
+            // A block joined onto a last line without a \n is recorded as count::joined
+            char *together = strtok(NULL, "||");
+            char *count = strtok(together, "::");
+            char *joined = strtok(NULL, "::\n");
+            message = rollbackAppend(fileName, stringToInt(count), joined != NULL && strcmp(joined, "joined") == 0);
         } else if (strcmp(operation, "INSERT") == 0){
-            rollbackInsert(fileName, stringToInt(strtok(NULL, "||")));
+            // A block is recorded as n::count, a single line as just n
+            char *together = strtok(NULL, "||");
+            char *lineNumber = strtok(together, "::");
+            char *count = strtok(NULL, "::");
+            message = rollbackInsert(fileName, stringToInt(lineNumber), count != NULL ? stringToInt(count) : 1);
         } else if (strcmp(operation, "DELETE") == 0){
             char *together, *lineNumber, *lineContent;
             together = strtok(NULL, "||");
             lineNumber = strtok(together, "::");
             lineContent = strtok(NULL, "::");
 
-            rollbackDelete(fileName, stringToInt(lineNumber), lineContent);
+            message = rollbackDelete(fileName, stringToInt(lineNumber), lineContent);
+        } else if (strcmp(operation, "REPLACE") == 0){
+            // The old content may itself contain :, so only split on the first ::
+            char *together = strtok(NULL, "\n");
+            while (together != NULL && *together == '|') together++;
+            char *separator = together != NULL ? strstr(together, "::") : NULL;
+            if (separator == NULL){
+                unlockChangeLogs();
+                free(lastLine);
+                free(location);
+                infoScreen("The last REPLACE record couldn't be read!");
+                return;
+            }
+            *separator = '\0';
+
+            message = rollbackReplace(fileName, stringToInt(together), separator + 2);
+        } else if (strcmp(operation, "SUBSTITUTE") == 0){
+            char *together = strtok(NULL, "||");
+            char *count = strtok(together, "::");
+            char *hash = strtok(NULL, "::");
+            if (hash == NULL){
+                unlockChangeLogs();
+                free(lastLine);
+                free(location);
+                infoScreen("The last SUBSTITUTE record couldn't be read!");
+                return;
+            }
+            hash[strcspn(hash, "\n")] = '\0';
+
+            message = rollbackSubstitute(fileName, stringToInt(count), hash, &ok);
+        } else if (strcmp(operation, "TRANSFORM") == 0){
+            char *together = strtok(NULL, "||");
+            char *kind = strtok(together, "::");
+            char *hash = strtok(NULL, "::");
+            if (hash == NULL){
+                unlockChangeLogs();
+                free(lastLine);
+                free(location);
+                infoScreen("The last TRANSFORM record couldn't be read!");
+                return;
+            }
+            hash[strcspn(hash, "\n")] = '\0';
+
+            message = rollbackTransform(fileName, kind, hash, &ok);
         } else if (strcmp(operation, "CREATED") == 0){
-            rollbackCreated(fileName);
+            message = rollbackCreated(fileName);
         } 
     } else {
         if (strcmp(operation, "DELETED") == 0){
-            rollbackDeleted(fileName, strtok(NULL, "||"));
+            message = rollbackDeleted(fileName, strtok(NULL, "||"));
         } else {
+            unlockChangeLogs();
             infoScreen("The file you are trying to rollback has been deleted!");
             return;
         }
     }
     
     
-    deleteLastNLinesOfFile(location, 1);
+    // A rollback that couldn't be done keeps its record
+    if (ok) popChangeLogRecord(fileName);
+    unlockChangeLogs();
+    if (message != NULL) infoScreen(message);
+    free(message);
+    free(lastLine);
     free(location);
 }
 
@@ -84,30 +152,40 @@ void rollback(char *fileName){
  * 
  * @param fileName File to rollbakc
  * @param numberOfLines Amount of lines to rollback
+ * @param joined 1 if a \n was added to the line before them, which is taken off again
+ * @return char* The message to show, make sure to free after use!
  */
-void rollbackAppend(char *fileName, size_t numberOfLines){
+char * rollbackAppend(char *fileName, size_t numberOfLines, int joined){
     deleteLastNLinesOfFile(fileName, numberOfLines);
+    if (joined) removeFinalNewline(fileName);
 
     char *ln = intToString(numberOfLines);
     char *message = concat3("APPEND Operation Rolledback\nLast ", ln, " were deleted");
     free(ln);
-    infoScreen(message);
-    free(message);
+    return message;
 }
 
 /**
  * @brief Rolls back the insert operation
  * 
  * @param fileName File to rollback
- * @param lineNumber The line to rollback
+ * @param lineNumber The first line to rollback
+ * @param numberOfLines How many lines were inserted
+ * @return char* The message to show, make sure to free after use!
  */
-void rollbackInsert(char *fileName, size_t lineNumber){
-    internalDeleteLine(fileName, lineNumber);
+char * rollbackInsert(char *fileName, size_t lineNumber, size_t numberOfLines){
+    internalDeleteLines(fileName, lineNumber, numberOfLines);
     char *ln = intToString(lineNumber);
-    char *message = concat3("INSERT Operation Rolledback\nLine ", ln, " was deleted");
+    char *message;
+    if (numberOfLines == 1){
+        message = concat3("INSERT Operation Rolledback\nLine ", ln, " was deleted");
+    } else {
+        char count[24];
+        sprintf(count, "%zu", numberOfLines);
+        message = concat4("INSERT Operation Rolledback\n", count, " lines were deleted from line ", ln);
+    }
     free(ln);
-    infoScreen(message);
-    free(message);
+    return message;
 }
 
 /**
@@ -116,65 +194,207 @@ void rollbackInsert(char *fileName, size_t lineNumber){
  * @param fileName The file to rollback
  * @param lineNumber The line number to rollbak
  * @param line The line content to rollback
+ * @return char* The message to show, make sure to free after use!
  */
-void rollbackDelete(char *fileName, size_t lineNumber, char *line){
+char * rollbackDelete(char *fileName, size_t lineNumber, char *line){
     internalInsertLine(fileName, lineNumber, line);
     char *ln = intToString(lineNumber);
     char *message = concat3("DELETE Operation Rolledback\nLine ", ln, " was inserted");
     free(ln);
-    infoScreen(message);
-    free(message);
+    return message;
+}
+
+/**
+ * @brief Rolls back the replace operation
+ * 
+ * @param fileName The file to rollback
+ * @param lineNumber The line number that was replaced
+ * @param line The lines content before it was replaced
+ * @return char* The message to show, make sure to free after use!
+ */
+char * rollbackReplace(char *fileName, size_t lineNumber, char *line){
+    char *content = concat(line, "\n");
+    internalReplaceLine(fileName, lineNumber, content);
+    free(content);
+    char *ln = intToString(lineNumber);
+    char *message = concat3("REPLACE Operation Rolledback\nLine ", ln, " was restored");
+    free(ln);
+    return message;
+}
+
+/**
+ * @brief Rolls back a find and replace, the replaced lines are put back from its snapshot
+ * 
+ * @param fileName The file to rollback
+ * @param numberOfLines How many lines were changed
+ * @param hash The snapshot holding their original content
+ * @param ok Set to 0 if the snapshot couldn't be read (the record is kept)
+ * @return char* The message to show, make sure to free after use!
+ */
+char * rollbackSubstitute(char *fileName, size_t numberOfLines, char *hash, int *ok){
+    *ok = undoSubstitute(fileName, hash, fileName);
+    if (*ok == 0) return strdup("The replaced lines couldn't be read back!\nThe file hasn't been changed.");
+    char *ln = intToString(numberOfLines);
+    char *message = concat3("SUBSTITUTE Operation Rolledback\n", ln, " lines were restored");
+    free(ln);
+    return message;
+}
+
+/**
+ * @brief Rolls back a sort, unique or reverse by putting back the file from before it
+ * 
+ * @param fileName The file to rollback
+ * @param kind What was done to the lines
+ * @param hash The snapshot of the file before
+ * @param ok Set to 0 if the snapshot couldn't be read (the file is left as it is and the record is kept)
+ * @return char* The message to show, make sure to free after use!
+ */
+char * rollbackTransform(char *fileName, char *kind, char *hash, int *ok){
+    *ok = undoTransform(fileName, hash, fileName);
+    if (*ok == 0) return strdup("The file from before couldn't be read back!\nThe file hasn't been changed.");
+    return concat3("TRANSFORM Operation Rolledback\nThe lines are back as they were before the ", kind, "");
 }
 
 /**
  * @brief Rolls back the created operation
  * 
  * @param fileName The file to rollback
+ * @return char* The message to show, make sure to free after use!
  */
-void rollbackCreated(char *fileName){
+char * rollbackCreated(char *fileName){
     remove(fileName);
-    infoScreen("CREATED Operation Rolledback\nThe file was deleted");
+    return strdup("CREATED Operation Rolledback\nThe file was deleted");
 }
 
 /**
  * @brief Rolls back the deleted operation
+ * The snapshot is left for compaction to collect as copies of the file may share it
  * 
  * @param fileName The file to rollback
  * @param timeHash The hash of the time relating to the rolledback file
+ * @return char* The message to show, make sure to free after use!
  */
-void rollbackDeleted(char *fileName, char *timeHash){
-    char *location = concat4(".cword/", fileName, "/", timeHash);
-    location[strlen(location)-1] = '\0';
-    internalCopyFile(location, fileName);
-    infoScreen("DELETED Operation Rolledback\nThe file was created");
-    remove(location);
+char * rollbackDeleted(char *fileName, char *timeHash){
+    timeHash[strcspn(timeHash, "\n")] = '\0';
+    char *location = changeLogSnapshotPath(fileName, timeHash);
+    if (location == NULL){
+        return strdup("The snapshot of that file couldn't be found!\nIt couldn't be restored.");
+    }
+    // Snapshots made before compression was added are plain copies
+    if (isCompressedFile(location)){
+        if (decompressFile(location, fileName) == 0){
+            free(location);
+            return strdup("The snapshot of that file is damaged!\nIt couldn't be restored.");
+        }
+    } else {
+        internalCopyFile(location, fileName);
+    }
     free(location);
+    return strdup("DELETED Operation Rolledback\nThe file was created");
 }
 
 /**
- * @brief Saves a copy of the deleted file for rolling back
+ * @brief Saves a copy of the deleted file for rolling back, deleting the same contents
+ * again reuses the copy saved the first time
  * 
  * @param fileName The file to copy
- * @return char* The hashed time string
+ * @return char* The snapshots name, NULL if it couldn't be saved
  */
 char * saveDeletedFileForVersionControl(char *fileName){
-    time_t now;
-    time(&now);
-    struct tm *time = localtime(&now);
-    char stringTime[20];
-    sprintf(stringTime, "%02d:%02d:%02d %02d/%02d/%d", time->tm_hour, time->tm_min, time->tm_sec, time->tm_mday, time->tm_mon + 1, time->tm_year + 1900);
+    return storeSnapshot(fileName, fileName);
+}
 
-    char *hash = hashString(stringTime);
+/**
+ * @brief Rebuilds an earlier version of a file by undoing its newest changes on a copy,
+ * the file itself and its changelog are left as they are
+ * 
+ * @param fileName The tracked file
+ * @param steps How many changes to undo
+ * @param destination Where to write the earlier version, removed if the file didn't exist then
+ * @return int 1 if ok, 0 if the file has fewer changes than that
+ */
+int reconstructVersion(char *fileName, size_t steps, char *destination){
+    struct ChangeLogView view;
+    if (openChangeLogView(&view, fileName, OPERATION_ANY) == 0) return 0;
+    if (steps > view.count){
+        closeChangeLogView(&view);
+        return 0;
+    }
 
-    char *location = concat4(".cword/", fileName, "/", hash);
+    remove(destination);
+    if (fileExists(fileName)) internalCopyFile(fileName, destination);
 
-    char *toDir = concat(".cword/", fileName);
-    dirExists(toDir);
-    free(toDir);
-    internalCopyFile(fileName, location);
+    size_t i;
+    for (i = 0; i < steps; i++){
+        struct ChangeLogIndexEntry entry;
+        char *record = readChangeLogViewEntry(&view, view.count - 1 - i, &entry) ? readChangeLogViewRecord(&view, &entry) : NULL;
+        if (record == NULL){
+            closeChangeLogView(&view);
+            return 0;
+        }
 
-    free(location);
-    
+        char *info = strstr(record, "||");
+        info = info != NULL ? strstr(info + 2, "||") : NULL;
+        if (info == NULL){
+            free(record);
+            continue;
+        }
+        info += 2;
+        info[strcspn(info, "\n")] = '\0';
+
+        // Line numbers and contents are split on the first ::, like rollback
+        char *separator = strstr(info, "::");
+        if (separator != NULL) *separator = '\0';
+
+        switch (entry.operation){
+            case OPERATION_APPEND:
+                deleteLastNLinesOfFile(destination, stringToInt(info));
+                if (separator != NULL && strcmp(separator + 2, "joined") == 0) removeFinalNewline(destination);
+                break;
+
+            case OPERATION_INSERT:
+                internalDeleteLines(destination, stringToInt(info), separator != NULL ? stringToInt(separator + 2) : 1);
+                break;
+
+            case OPERATION_DELETE:
+            case OPERATION_REPLACE:
+                if (separator != NULL){
+                    char *content = concat(separator + 2, "\n");
+                    if (entry.operation == OPERATION_DELETE){
+                        internalInsertLine(destination, stringToInt(info), content);
+                    } else {
+                        internalReplaceLine(destination, stringToInt(info), content);
+                    }
+                    free(content);
+                }
+                break;
 
-    return hash;
-}
\ No newline at end of file
+            case OPERATION_SUBSTITUTE:
+                if (separator != NULL) undoSubstitute(fileName, separator + 2, destination);
+                break;
+
+            case OPERATION_TRANSFORM:
+                if (separator != NULL) undoTransform(fileName, separator + 2, destination);
+                break;
+
+            case OPERATION_CREATED:
+                remove(destination);
+                break;
+
+            case OPERATION_DELETED:
+                {
+                    char *snapshot = changeLogSnapshotPath(fileName, info);
+                    if (snapshot != NULL && isCompressedFile(snapshot)){
+                        decompressFile(snapshot, destination);
+                    } else if (snapshot != NULL){
+                        internalCopyFile(snapshot, destination);
+                    }
+                    free(snapshot);
+                    break;
+                }
+        }
+        free(record);
+    }
+    closeChangeLogView(&view);
+    return 1;
+}
@@ -5,12 +5,16 @@
 
 void rollback(char *fileName);
 
-void rollbackAppend(char *fileName, size_t numberOfLines);
-void rollbackInsert(char *fileName, size_t lineNumber);
-void rollbackDelete(char *fileName, size_t lineNumber, char *line);
-void rollbackCreated(char *fileName);
-void rollbackDeleted(char *fileName, char *timeHash);
+char * rollbackAppend(char *fileName, size_t numberOfLines, int joined);
+char * rollbackInsert(char *fileName, size_t lineNumber, size_t numberOfLines);
+char * rollbackDelete(char *fileName, size_t lineNumber, char *line);
+char * rollbackReplace(char *fileName, size_t lineNumber, char *line);
+char * rollbackSubstitute(char *fileName, size_t numberOfLines, char *hash, int *ok);
+char * rollbackTransform(char *fileName, char *kind, char *hash, int *ok);
+char * rollbackCreated(char *fileName);
+char * rollbackDeleted(char *fileName, char *timeHash);
 char * saveDeletedFileForVersionControl(char *fileName);
+int reconstructVersion(char *fileName, size_t steps, char *destination);
 
 
 #endif
\ No newline at end of file